@@ -0,0 +1,30 @@
+#ifndef _BLOB_UPLOAD_H
+#define _BLOB_UPLOAD_H
+
+#include <globals.h>
+
+#define BLOB_UPLOAD_FILENAME      "/upload.tmp"
+#define BLOB_UPLOAD_META_FILENAME "/upload.json"
+#define BLOB_UPLOAD_TARGET_LEN    20
+#define BLOB_UPLOAD_MAX_SIZE      65536
+// every chunk starts with its offset and the CRC32 of its data, both big endian
+#define BLOB_UPLOAD_CHUNK_HEADER  8
+
+/**
+ * Receives a blob in chunks and streams it to a temporary file on LittleFS. The transfer survives
+ * disconnects and reboots: starting an upload with the same target, size and hash resumes at the
+ * number of bytes already written. The SHA-256 of the whole blob is verified before it's moved in place.
+ */
+namespace BlobUpload {
+  boolean parseChunk(const uint8_t* chunk, size_t length, uint32_t* offset, const uint8_t** data, size_t* dataLength);
+  boolean begin(const char* target, uint32_t size, const char* sha256);
+  boolean writeChunk(const uint8_t* chunk, size_t length);
+  boolean finish(const char* filename);
+  void abort();
+  boolean isActive();
+  const char* getTarget();
+  uint32_t getOffset();
+  uint32_t getSize();
+}
+
+#endif
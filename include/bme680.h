@@ -7,6 +7,8 @@
 #include <messageSupport.h>
 #include <Wire.h>
 #include <model.h>
+#include <filters.h>
+#include <cadence.h>
 #include <EEPROM.h>
 #include "bsec.h"
 
@@ -22,6 +24,13 @@ private:
   Bsec* bme680;
   Model* model;
   updateMessageCallback_t updateMessageCallback;
+  Filters::TemperatureFilter temperatureFilter;
+  Filters::HumidityFilter humidityFilter;
+  Filters::PressureFilter pressureFilter;
+  Filters::GasFilter iaqFilter;
+  Filters::GasFilter staticIaqFilter;
+  Filters::GasFilter co2EquivalentFilter;
+  Filters::GasFilter breathVocFilter;
 
   static void bme680Loop(void* pvParameters);
 
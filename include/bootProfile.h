@@ -0,0 +1,19 @@
+#ifndef _BOOT_PROFILE_H
+#define _BOOT_PROFILE_H
+
+#include <globals.h>
+#include <ArduinoJson.h>
+
+#define BOOT_PROFILE_MAX_PHASES 16
+
+/**
+ * Records when each boot phase finished, in milliseconds since power-on. Phases are identified by
+ * string literals and only their first completion is kept, so mark() can be called from hot paths.
+ */
+namespace BootProfile {
+  void mark(const char* phase);
+  uint32_t get(const char* phase);  // 0 if the phase isn't done (yet)
+  void toJson(JsonObject obj);
+}
+
+#endif
@@ -0,0 +1,25 @@
+#ifndef _CADENCE_H
+#define _CADENCE_H
+
+#include <globals.h>
+#include <model.h>
+
+/**
+ * Adaptive measurement cadence: tracks how fast CO2, PM2.5 and IAQ change and tells the sensor drivers
+ * how often to measure. Any value changing faster than its fast rate switches to CADENCE_FAST at once,
+ * the cadence steps down one level after CADENCE_STABLE_TIME in which no value asked for it. The drivers
+ * add their raw readings before filtering, so a ramp shows without the delay of the filters, and apply
+ * the level with their next reading. Only called from the sensors task.
+ */
+namespace Cadence {
+  typedef enum : uint8_t {
+    CADENCE_FAST,     // SCD4x periodic 5 s, SPS30 every minute
+    CADENCE_NORMAL,   // SCD4x low power periodic 30 s
+    CADENCE_SLOW      // SCD41 single shot, SPS30 every 5 minutes
+  } CadenceLevel;
+
+  void addReading(SensorSource source, MeasurementId id, float value);
+  CadenceLevel getLevel();
+}
+
+#endif
@@ -7,6 +7,9 @@
 #define OTA_URL               "https://otahost/co2monitor/firmware.json"
 #define OTA_APP               "co2monitor"
 //#define OTA_POLL
+// nodes wait up to this long before checking for an update, so they don't all hit the OTA host at once
+#define OTA_MAX_START_DELAY   300   // seconds
+#define OTA_HTTP_TIMEOUT    10000   // milliseconds
 
 #if CONFIG_IDF_TARGET_ESP32
 
@@ -30,18 +33,61 @@
 #define SCD30_I2C_CLK 50000UL   // SCD30 recommendation of 50kHz
 
 static const char* CONFIG_FILENAME = "/config.json";
+// the JSON export is written here first and then renamed over CONFIG_FILENAME
+static const char* TEMP_CONFIG_FILENAME = "/config.json.tmp";
+// present once config.json has been imported into the binary config store
+static const char* CONFIG_IMPORTED_FILENAME = "/config.imported";
 static const char* MQTT_ROOT_CA_FILENAME = "/mqtt_root_ca.pem";
 static const char* MQTT_CLIENT_CERT_FILENAME = "/mqtt_client_cert.pem";
 static const char* MQTT_CLIENT_KEY_FILENAME = "/mqtt_client_key.pem";
 static const char* TEMP_MQTT_ROOT_CA_FILENAME = "/temp_mqtt_root_ca.pem";
 static const char* ROOT_CA_FILENAME = "/root_ca.pem";
+// if present, firmware pushed over MQTT has to be signed with the matching private key
+static const char* OTA_PUBLIC_KEY_FILENAME = "/ota_public_key.pem";
 
-#define MQTT_QUEUE_LENGTH      25
+// capacity and scheduler weight of the MQTT outbound lanes
+#define MQTT_CONTROL_QUEUE_LENGTH    5
+#define MQTT_STATUS_QUEUE_LENGTH    10
+#define MQTT_TELEMETRY_QUEUE_LENGTH 10
+#define MQTT_CONTROL_WEIGHT          1
+#define MQTT_STATUS_WEIGHT           1
+#define MQTT_TELEMETRY_WEIGHT        4
+// downlink commands waiting for the command task, each holds a pooled payload buffer
+#define MQTT_COMMAND_QUEUE_LENGTH    4
 
 #define PWM_CHANNEL_LEDS        0
+// LED self-tests wait for WiFi, but not longer than this
+#define SELF_TEST_MAX_WAIT  10000   // milliseconds
+// the self-tests show red, yellow and green for SELF_TEST_STEP_TIME each
+#define SELF_TEST_STEPS         3
+#define SELF_TEST_STEP_TIME   500   // milliseconds
+
+// Configuration changes are written behind: once no further change came in for CONFIG_SAVE_DELAY,
+// but no later than CONFIG_SAVE_MAX_DELAY after the first unsaved change.
+#define CONFIG_SAVE_DELAY      2000   // milliseconds
+#define CONFIG_SAVE_MAX_DELAY 10000   // milliseconds
+
+// A sensor's reading is fused with those of other sensors measuring the same value until it is this old
+#define SENSOR_READING_TIMEOUT 300000   // milliseconds
+// readings over which the difference between sensors is averaged for drift detection
+#define SENSOR_DRIFT_SMOOTHING      8
+
+// every measurement is published at least this often, even if it didn't move past its deadband
+#define TELEMETRY_HEARTBEAT 300000   // milliseconds
+
+// Sensors measure less often while the room is stable, see Cadence. A rate of change is taken over at
+// least CADENCE_RATE_WINDOW, the cadence steps down one level after CADENCE_STABLE_TIME without change.
+// The rate of a sensor that stopped reporting is ignored after CADENCE_RATE_EXPIRY.
+#define CADENCE_RATE_WINDOW          60000   // milliseconds
+#define CADENCE_RATE_EXPIRY         180000   // milliseconds
+#define CADENCE_STABLE_TIME         600000   // milliseconds
+#define SCD4X_SINGLE_SHOT_INTERVAL     300   // seconds, what the SCD41 ASC assumes in single shot mode
+#define SPS30_INTERVAL_FAST             60   // seconds
+#define SPS30_INTERVAL_NORMAL          120   // seconds
+#define SPS30_INTERVAL_SLOW            300   // seconds
 
 // ----------------------------  Config struct ------------------------------------- 
-#define CONFIG_SIZE 1280
+#define CONFIG_SIZE 1536
 
 #define MQTT_USERNAME_LEN 20
 #define MQTT_PASSWORD_LEN 20
@@ -50,6 +96,9 @@ static const char* ROOT_CA_FILENAME = "/root_ca.pem";
 #define SSID_LEN 32
 #define WIFI_PASSWORD_LEN 64
 
+// Bump when changing the Config struct, stored images of an older schema are then migrated from the JSON export.
+#define CONFIG_SCHEMA_VERSION 2
+
 struct Config {
   uint16_t deviceId;
   char mqttTopic[MQTT_TOPIC_LEN + 1];
@@ -58,6 +107,7 @@ struct Config {
   char mqttHost[MQTT_HOSTNAME_LEN + 1];
   bool mqttUseTls;
   bool mqttInsecure;
+  bool mqttV5;
   uint16_t mqttServerPort;
   uint16_t altitude;
   uint16_t co2GreenThreshold;
@@ -94,6 +144,8 @@ struct Config {
   uint8_t hub75Clk;
   uint8_t hub75Lat;
   uint8_t hub75Oe;
+  uint8_t sensorFusion;
+  uint8_t preferredSensor;
 };
 
 #endif
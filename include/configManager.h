@@ -4,16 +4,67 @@
 #include <Arduino.h>
 #include <config.h>
 #include <configParameter.h>
-#include <vector>
 
 extern Config config;
 
+// Parameter ids are looked up through a perfect hash: CONFIG_HASH_SEED is chosen so that every id has
+// its own slot, see configTable.cpp.
+#define CONFIG_HASH_SEED 24405
+#define CONFIG_HASH_BITS    7
+#define CONFIG_HASH_SLOTS (1 << CONFIG_HASH_BITS)
+
+// iterable view of the constexpr parameter table
+struct ConfigParameterTable {
+  const ConfigParameter* parameters;
+  uint8_t count;
+  const ConfigParameter* begin() const { return parameters; }
+  const ConfigParameter* end() const { return parameters + count; }
+};
+
+/**
+ * Changes staged against a copy of the configuration. The staged values are validated while parsing and
+ * only copied over the live configuration by commitConfigTransaction(), so a rejected change set leaves
+ * the configuration untouched. changed has bit i set for every entry of the parameter table that differs.
+ */
+struct ConfigTransaction {
+  Config staged;
+  uint64_t changed;
+  const char* rejected;   // id of the value that failed validation
+
+  uint8_t changeCount() const { return __builtin_popcountll(changed); }
+  uint8_t flags() const;  // CONFIG_* flags of all changed parameters
+  bool mqttConnectionChanged() const { return flags() & CONFIG_MQTT_CONNECTION; }
+};
+
+// Flash writes of the configuration, see saveConfiguration()
+struct ConfigPersistenceStats {
+  uint32_t requested;     // calls to saveConfiguration()
+  uint32_t writes;        // images written to flash
+  uint32_t unchanged;     // writes skipped since the configuration was already stored
+  uint32_t failures;
+  uint32_t lastWriteTime; // milliseconds
+  uint32_t maxWriteTime;  // milliseconds
+};
+
+extern TaskHandle_t configSaveTask;
+
 void setupConfigManager();
 void getDefaultConfiguration(Config& config);
 boolean loadConfiguration(Config& config);
 boolean saveConfiguration(const Config config);
+boolean flushConfiguration();
+ConfigPersistenceStats getConfigPersistenceStats();
+void logConfigPersistence();
+boolean importConfiguration(Config& config);
+boolean exportConfiguration(const Config config);
 void logConfiguration(const Config config);
 void printFile();
-std::vector<ConfigParameterBase<Config>*> getConfigParameters();
+ConfigParameterTable getConfigParameters();
+const ConfigParameter* findConfigParameter(const char* id);
+void beginConfigTransaction(ConfigTransaction& transaction);
+boolean stageConfigJson(ConfigTransaction& transaction, JsonObjectConst values);
+boolean stageConfigValue(ConfigTransaction& transaction, const ConfigParameter& configParameter, const char* str);
+void commitConfigTransaction(const ConfigTransaction& transaction);
+void configChangesToJson(const ConfigTransaction& transaction, JsonObject changes);
 
 #endif
\ No newline at end of file
@@ -4,149 +4,114 @@
 #include <globals.h>
 #include <config.h>
 #include <ArduinoJson.h>
-
-template <typename C>
-class ConfigParameterBase {
-public:
-  virtual uint8_t getMaxStrLen(void) = 0;
-  virtual const char* getId() = 0;
-  virtual const char* getLabel() = 0;
-  virtual void print(const C config, char* str) = 0;
-  virtual bool save(C& config, const char* str) = 0;
-  virtual bool isNumber() = 0;
-  virtual bool isBoolean() = 0;
-  virtual void getMinimum(char* str) = 0;
-  virtual void getMaximum(char* str) = 0;
-  virtual void setToDefault(C& config) = 0;
-  virtual String toString(const C config) = 0;
-  virtual void toJson(const C config, DynamicJsonDocument* doc) = 0;
-  virtual bool fromJson(C& config, DynamicJsonDocument* doc, bool useDefaultIfNotPresent) = 0;
-  virtual bool isRebootRequiredOnChange() = 0;
-  virtual bool isEnum() = 0;
-  virtual const char** getEnumLabels(void) = 0;
-  virtual u_int16_t getValueOrdinal(const C config) = 0;
-};
-
-template <typename C, typename T>
-class ConfigParameter :public ConfigParameterBase<C> {
-public:
-  ConfigParameter(const char* id, const char* label, T C::* valuePtr, uint8_t maxStrLen, bool rebootRequiredOnChange = false);
-  virtual ~ConfigParameter() = default;
-  uint8_t getMaxStrLen(void) override;
-  const char* getId() override;
-  const char* getLabel() override;
-  bool isNumber() override;
-  bool isBoolean() override;
-  T* getValuePtr();
-  void getMinimum(char* str) override;
-  void getMaximum(char* str) override;
-  String toString(const C config) override;
-  bool isRebootRequiredOnChange() override;
-  bool isEnum() override;
-  const char** getEnumLabels(void) override;
-
-protected:
+#include <stddef.h>
+
+typedef enum : uint8_t {
+  CONFIG_PARAMETER_UINT8,
+  CONFIG_PARAMETER_UINT16,
+  CONFIG_PARAMETER_BOOLEAN,
+  CONFIG_PARAMETER_CHAR_ARRAY,
+  CONFIG_PARAMETER_ENUM     // uint8_t sized enum with labels
+} ConfigParameterType;
+
+// ConfigParameter::flags
+#define CONFIG_MQTT_CONNECTION  0x02   // changes how the MQTT connection is made, needs to be tested first
+#define CONFIG_SECRET           0x04   // never published or logged
+
+typedef enum : uint8_t {
+  CONFIG_VALUE_INVALID,
+  CONFIG_VALUE_UNCHANGED,
+  CONFIG_VALUE_CHANGED
+} ConfigValueResult;
+
+/**
+ * Describes one field of the Config struct by its offset. The parameter table is constexpr and lives in
+ * flash, the accessors dispatch on the type instead of going through virtual calls.
+ */
+struct ConfigParameter {
   const char* id;
   const char* label;
-  T C::* valuePtr;
+  uint16_t offset;
+  ConfigParameterType type;
   uint8_t maxStrLen;
-  bool rebootRequiredOnChange;
+  uint16_t minValue;
+  uint16_t maxValue;
+  uint16_t defaultValue;
+  const char* defaultString;
+  const char* const* enumLabels;
+  uint8_t flags;
+
+  const char* getId() const { return id; }
+  const char* getLabel() const { return label; }
+  uint8_t getMaxStrLen() const { return maxStrLen; }
+  bool isNumber() const { return type == CONFIG_PARAMETER_UINT8 || type == CONFIG_PARAMETER_UINT16; }
+  bool isBoolean() const { return type == CONFIG_PARAMETER_BOOLEAN; }
+  bool isEnum() const { return type == CONFIG_PARAMETER_ENUM; }
+  bool isMqttConnection() const { return flags & CONFIG_MQTT_CONNECTION; }
+  bool isSecret() const { return flags & CONFIG_SECRET; }
+  const char* const* getEnumLabels() const { return enumLabels; }
+
+  void getMinimum(char* str) const;
+  void getMaximum(char* str) const;
+  void print(const Config& config, char* str) const;
+  String toString(const Config& config) const;
+  bool save(Config& config, const char* str) const;
+  void setToDefault(Config& config) const;
+  void toJson(const Config& config, JsonDocument* doc) const;
+  void toJson(const Config& config, JsonObject object) const;
+  bool fromJson(Config& config, JsonDocument* doc, bool useDefaultIfNotPresent) const;
+  ConfigValueResult fromJson(Config& config, JsonVariantConst value) const;
+  bool equals(const Config& a, const Config& b) const;
+  uint16_t getValueOrdinal(const Config& config) const;
+
+private:
+  uint16_t getValue(const Config& config) const;
+  void setValue(Config& config, uint16_t value) const;
+  char* getString(Config& config) const;
+  bool setString(Config& config, const char* str) const;
+
+  template <typename TObject>
+  void writeJson(const Config& config, TObject& object) const {
+    switch (type) {
+    case CONFIG_PARAMETER_BOOLEAN:
+      object[id] = (bool)getValue(config);
+      break;
+    case CONFIG_PARAMETER_CHAR_ARRAY:
+      object[id] = (char*)&config + offset;
+      break;
+    default:
+      object[id] = getValue(config);
+    }
+  }
 };
 
-template <typename C, typename T>
-class NumberConfigParameter :public ConfigParameter<C, T> {
-public:
-  NumberConfigParameter(const char* id, const char* label, T C::* valuePtr, T defaultValue, uint8_t maxStrLen, T min, T max, bool rebootRequiredOnChange = false);
-  ~NumberConfigParameter();
-  bool isNumber() override;
-  void getMinimum(char* str) override;
-  void getMaximum(char* str) override;
-  void setToDefault(C& config) override;
-  void toJson(const C config, DynamicJsonDocument* doc) override;
-  bool fromJson(C& config, DynamicJsonDocument* doc, bool useDefaultIfNotPresent = false) override;
-  u_int16_t getValueOrdinal(const C config) override;
-
-protected:
-  T defaultValue;
-  T minValue;
-  T maxValue;
-};
+constexpr ConfigParameter uint8Parameter(const char* id, const char* label, uint16_t offset, uint8_t defaultValue, uint8_t min = 0, uint8_t max = 255, uint8_t flags = 0) {
+  return { id, label, offset, CONFIG_PARAMETER_UINT8, 4, min, max, defaultValue, nullptr, nullptr, flags };
+}
 
-template <typename C>
-class Uint8ConfigParameter :public NumberConfigParameter<C, uint8_t> {
-public:
-  Uint8ConfigParameter(const char* id, const char* label, uint8_t C::* valuePtr, uint8_t defaultValue, uint8_t min = 0, uint8_t max = 255, bool rebootRequiredOnChange = false);
-  Uint8ConfigParameter(const char* id, const char* label, uint8_t C::* valuePtr, uint8_t defaultValue, bool rebootRequiredOnChange);
-  ~Uint8ConfigParameter();
-  void print(const C config, char* str) override;
-  bool save(C& config, const char* str) override;
-};
+constexpr ConfigParameter uint16Parameter(const char* id, const char* label, uint16_t offset, uint16_t defaultValue, uint16_t min = 0, uint16_t max = 65535, uint8_t flags = 0) {
+  return { id, label, offset, CONFIG_PARAMETER_UINT16, 6, min, max, defaultValue, nullptr, nullptr, flags };
+}
 
-template <typename C>
-class Uint16ConfigParameter :public NumberConfigParameter<C, uint16_t> {
-public:
-  Uint16ConfigParameter(const char* id, const char* label, uint16_t C::* valuePtr, uint16_t defaultValue, uint16_t min = 0, uint16_t max = 65535, bool rebootRequiredOnChange = false);
-  Uint16ConfigParameter(const char* id, const char* label, uint16_t C::* valuePtr, uint16_t defaultValue, bool rebootRequiredOnChange);
-  ~Uint16ConfigParameter();
-  void print(const C config, char* str) override;
-  bool save(C& config, const char* str) override;
-};
+constexpr ConfigParameter booleanParameter(const char* id, const char* label, uint16_t offset, bool defaultValue, uint8_t flags = 0) {
+  return { id, label, offset, CONFIG_PARAMETER_BOOLEAN, 6, 0, 1, defaultValue, nullptr, nullptr, flags };
+}
 
-template <typename C>
-class BooleanConfigParameter :public ConfigParameter<C, bool> {
-public:
-  BooleanConfigParameter(const char* id, const char* label, bool C::* valuePtr, bool defaultValue, bool rebootRequiredOnChange = false);
-  ~BooleanConfigParameter();
-  void print(const C config, char* str) override;
-  bool isBoolean() override;
-  void setToDefault(C& config) override;
-  void toJson(const C config, DynamicJsonDocument* doc) override;
-  bool fromJson(C& config, DynamicJsonDocument* doc, bool useDefaultIfNotPresent = false) override;
-  u_int16_t getValueOrdinal(const C config) override;
-  bool save(C& config, const char* str) override;
-
-protected:
-  bool defaultValue;
-};
+constexpr ConfigParameter charArrayParameter(const char* id, const char* label, uint16_t offset, const char* defaultValue, uint8_t maxLen, uint8_t flags = 0) {
+  return { id, label, offset, CONFIG_PARAMETER_CHAR_ARRAY, maxLen, 0, 0, 0, defaultValue, nullptr, flags };
+}
 
-template <typename C>
-class CharArrayConfigParameter :public ConfigParameter<C, char> {
-public:
-  CharArrayConfigParameter(const char* id, const char* label, char C::* valuePtr, const char* defaultValue, uint8_t maxLen, bool rebootRequiredOnChange = false);
-  ~CharArrayConfigParameter();
-  void print(const C config, char* str) override;
-  void setToDefault(C& config) override;
-  void toJson(const C config, DynamicJsonDocument* doc) override;
-  bool fromJson(C& config, DynamicJsonDocument* doc, bool useDefaultIfNotPresent = false) override;
-  u_int16_t getValueOrdinal(const C config) override;
-  bool save(C& config, const char* str) override;
-
-protected:
-  const char* defaultValue;
-};
+constexpr ConfigParameter enumParameter(const char* id, const char* label, uint16_t offset, uint8_t defaultValue, const char* const* enumLabels, uint8_t min, uint8_t max, uint8_t maxLabelLen, uint8_t flags = 0) {
+  return { id, label, offset, CONFIG_PARAMETER_ENUM, maxLabelLen, min, max, defaultValue, nullptr, enumLabels, flags };
+}
 
-/*
-template<typename E>
-using enumToString_t = const char* (*)(E value);
-
-template<typename E>
-using stringToEnum_t = E(*)(const char*);
-*/
-
-template <typename C, typename B, typename E>
-class EnumConfigParameter :public NumberConfigParameter<C, B> {
-public:
-  EnumConfigParameter(const char* id, const char* label, E C::* valuePtr, E defaultValue, const char* enumLabels[], E min, E max, bool rebootRequiredOnChange = false);
-  ~EnumConfigParameter();
-  void print(const C config, char* str) override;
-  const char** getEnumLabels(void) override;
-  bool isEnum() override;
-  bool isNumber() override;
-  u_int16_t getValueOrdinal(const C config) override;
-  bool save(C& config, const char* str) override;
-
-protected:
-  const char** enumLabels;
-};
+// FNV-1a, the seed makes the slots of the parameter ids collision free (see configManager.cpp)
+constexpr uint32_t configIdHash(const char* id, uint32_t hash) {
+  return *id ? configIdHash(id + 1, (hash ^ (uint8_t)*id) * 16777619u) : hash;
+}
+
+constexpr uint8_t configIdSlot(const char* id, uint32_t seed, uint8_t bits) {
+  return (uint8_t)((configIdHash(id, 2166136261u ^ seed) * 0x9E3779B1u) >> (32 - bits));
+}
 
-#endif
\ No newline at end of file
+#endif
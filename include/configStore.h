@@ -0,0 +1,21 @@
+#ifndef _CONFIG_STORE_H
+#define _CONFIG_STORE_H
+
+#include <globals.h>
+#include <config.h>
+
+#define CONFIG_STORE_NAMESPACE "config"
+#define CONFIG_STORE_MAGIC     0x43464731  // "CFG1"
+
+/**
+ * Keeps the configuration as a binary image in two alternating NVS slots. Each image carries the schema
+ * version, a generation counter and a CRC. Loading picks the valid image with the highest generation,
+ * saving overwrites the other slot, so a power loss during a save leaves the previous image intact.
+ */
+namespace ConfigStore {
+  boolean load(Config& config);
+  boolean save(const Config& config);
+  uint32_t getGeneration();
+}
+
+#endif
@@ -0,0 +1,35 @@
+#ifndef _EVENT_BUS_H
+#define _EVENT_BUS_H
+
+#include <globals.h>
+#include <model.h>
+
+#define EVENT_BUS_MAX_SUBSCRIBERS 6
+
+/**
+ * Delivers model events to subscribers running in their own tasks, so publishing only costs a mailbox
+ * update per subscriber. A subscriber that's still busy gets superseded events coalesced into one: the
+ * masks are or-ed, oldStatus is kept from the first and newStatus taken from the last event. Handlers
+ * read the values themselves with Model::getSnapshot(), so no reading is lost by coalescing.
+ * Subscribers are registered during setup, before the first event is published.
+ */
+namespace EventBus {
+  typedef void (*handler_t)(MeasurementMask mask, TrafficLightStatus oldStatus, TrafficLightStatus newStatus);
+
+  struct SubscriberStats {
+    const char* name;
+    uint32_t published;      // events posted to the subscriber
+    uint32_t delivered;      // handler calls, published - delivered were coalesced
+    uint32_t lastLatency;    // milliseconds from the oldest pending event to the handler call
+    uint32_t maxLatency;
+    uint32_t maxHandlerTime; // milliseconds
+    TaskHandle_t task;
+  };
+
+  boolean subscribe(const char* name, handler_t handler, uint32_t stackSize, UBaseType_t priority, BaseType_t core);
+  void publish(MeasurementMask mask, TrafficLightStatus oldStatus, TrafficLightStatus newStatus);
+  uint8_t getStats(SubscriberStats* stats, uint8_t maxCount);
+  void logStats();
+}
+
+#endif
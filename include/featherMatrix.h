@@ -13,7 +13,8 @@ public:
   FeatherMatrix(Model* model, uint8_t dataPin, uint8_t clockPin);
   ~FeatherMatrix();
 
-  void update(uint16_t, TrafficLightStatus oldStatus, TrafficLightStatus newStatus);
+  void update(MeasurementMask mask, TrafficLightStatus oldStatus, TrafficLightStatus newStatus);
+  void selfTest(uint8_t step);
 
 private:
   void timer();
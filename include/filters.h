@@ -0,0 +1,187 @@
+#ifndef _FILTERS_H
+#define _FILTERS_H
+
+#include <Arduino.h>
+
+/**
+ * Filter stages for raw sensor readings, composed at compile time with Pipeline<...>. Every stage has
+ * fixed-size state and no heap, apply() takes one sample with the millis() it was taken at and returns
+ * the filtered value. NaN passes through without touching the state. Parameters that aren't counts or
+ * seconds are in tenths of the unit of the measurement, since C++11 doesn't allow float template
+ * parameters. Windows and rates are bounded in time, so a sensor measuring less often isn't filtered
+ * over a longer stretch of time.
+ */
+namespace Filters {
+
+  // Sorts a copy of the first count values of window, count is small enough for an insertion sort
+  template <uint8_t N>
+  float median(const float* window, uint8_t count) {
+    float sorted[N];
+    for (uint8_t i = 0; i < count; i++) {
+      uint8_t j = i;
+      for (; j > 0 && sorted[j - 1] > window[i]; j--) sorted[j] = sorted[j - 1];
+      sorted[j] = window[i];
+    }
+    return (count & 1) ? sorted[count / 2] : (sorted[count / 2 - 1] + sorted[count / 2]) / 2;
+  }
+
+  // Ring buffer of the last N samples and their times
+  template <uint8_t N>
+  class Window {
+  public:
+    void add(float x, uint32_t now) {
+      samples[next] = x;
+      times[next] = now;
+      next = (next + 1) % N;
+      if (count < N) count++;
+    }
+    // copies the samples taken at most span milliseconds before now to recent and returns their number
+    uint8_t recent(uint32_t now, uint32_t span, float* recent) const {
+      uint8_t found = 0;
+      for (uint8_t i = 0; i < count; i++) {
+        if (now - times[i] <= span) recent[found++] = samples[i];
+      }
+      return found;
+    }
+    void reset() { count = next = 0; }
+    float samples[N];
+    uint32_t times[N];
+    uint8_t count = 0;
+    uint8_t next = 0;
+  };
+
+  // Median of the last N samples within SPAN seconds, removes single spikes at the cost of (N - 1) / 2
+  // samples delay. Samples further apart than SPAN pass unchanged.
+  template <uint8_t N, uint16_t SPAN>
+  class Median {
+  public:
+    float apply(float x, uint32_t now) {
+      if (isnan(x)) return x;
+      window.add(x, now);
+      float recent[N];
+      uint8_t count = window.recent(now, SPAN * 1000ul, recent);
+      return median<N>(recent, count);
+    }
+    void reset() { window.reset(); }
+  private:
+    Window<N> window;
+  };
+
+  // Hampel identifier: replaces a sample by the median of the last N if it's more than K / 10 scaled
+  // median absolute deviations, and at least FLOOR / 10, away from it. Other samples pass unchanged,
+  // as do all samples while there are fewer than N within SPAN seconds. Without the floor a window of
+  // equal samples would hold back any change until it makes up the median.
+  template <uint8_t N, uint8_t K, uint16_t FLOOR, uint16_t SPAN>
+  class Hampel {
+  public:
+    float apply(float x, uint32_t now) {
+      if (isnan(x)) return x;
+      window.add(x, now);
+      float recent[N];
+      if (window.recent(now, SPAN * 1000ul, recent) < N) return x;
+      float center = median<N>(recent, N);
+      float deviations[N];
+      for (uint8_t i = 0; i < N; i++) deviations[i] = fabsf(recent[i] - center);
+      // 1.4826 scales the MAD to the standard deviation of normally distributed samples
+      float limit = max(1.4826f * median<N>(deviations, N) * K / 10, FLOOR / 10.0f);
+      return fabsf(x - center) > limit ? center : x;
+    }
+    void reset() { window.reset(); }
+  private:
+    Window<N> window;
+  };
+
+  // Exponentially weighted moving average with a time constant of TAU seconds, the weight of a sample
+  // grows with the time since the previous one
+  template <uint16_t TAU>
+  class Ewma {
+  public:
+    float apply(float x, uint32_t now) {
+      if (isnan(x)) return x;
+      value = initialised ? value + (x - value) * (1 - expf(-(float)(now - last) / (TAU * 1000ul))) : x;
+      last = now;
+      initialised = true;
+      return value;
+    }
+    void reset() { initialised = false; }
+  private:
+    float value;
+    uint32_t last;
+    bool initialised = false;
+  };
+
+  // Follows the samples by at most MAX_RATE / 10 per minute
+  template <uint16_t MAX_RATE>
+  class SlewRate {
+  public:
+    float apply(float x, uint32_t now) {
+      if (isnan(x)) return x;
+      if (initialised) {
+        float step = MAX_RATE / 10.0f * (now - last) / 60000;
+        value += constrain(x - value, -step, step);
+      } else {
+        value = x;
+      }
+      last = now;
+      initialised = true;
+      return value;
+    }
+    void reset() { initialised = false; }
+  private:
+    float value;
+    uint32_t last;
+    bool initialised = false;
+  };
+
+  // Holds the output until a sample differs from it by at least BAND / 10
+  template <uint16_t BAND>
+  class Deadband {
+  public:
+    float apply(float x, uint32_t now) {
+      if (isnan(x)) return x;
+      if (!initialised || fabsf(x - value) >= BAND / 10.0f) value = x;
+      initialised = true;
+      return value;
+    }
+    void reset() { initialised = false; }
+  private:
+    float value;
+    bool initialised = false;
+  };
+
+  // Applies the stages from left to right
+  template <typename... Stages>
+  class Pipeline;
+
+  template <>
+  class Pipeline<> {
+  public:
+    float apply(float x, uint32_t now) { return x; }
+    void reset() {}
+  };
+
+  template <typename Stage, typename... Stages>
+  class Pipeline<Stage, Stages...> {
+  public:
+    float apply(float x) { return apply(x, millis()); }
+    float apply(float x, uint32_t now) { return rest.apply(stage.apply(x, now), now); }
+    void reset() {
+      stage.reset();
+      rest.reset();
+    }
+  private:
+    Stage stage;
+    Pipeline<Stages...> rest;
+  };
+
+  // Filters per measurement, applied by the sensor drivers before the model update. The CO2 and particle
+  // windows cover the fast cadence only, at slower cadences every sample counts.
+  typedef Pipeline<Hampel<5, 30, 300, 90>, Ewma<7>, Deadband<50>> Co2Filter;   // spikes over 30 ppm, 5 ppm
+  typedef Pipeline<Median<3, 60>, SlewRate<60>, Deadband<1>> TemperatureFilter; // 6 °C per minute, 0.1 °C
+  typedef Pipeline<Median<3, 60>, SlewRate<600>, Deadband<2>> HumidityFilter;   // 60 % per minute, 0.2 %
+  typedef Pipeline<Median<3, 60>, Deadband<5>> PressureFilter;                  // 0.5 hPa
+  typedef Pipeline<Hampel<5, 30, 50, 300>, Ewma<90>> ParticleFilter;            // spikes over 5 #/cm³ or µg/m³
+  typedef Pipeline<Median<3, 60>> GasFilter;                                    // BSEC smooths its outputs itself
+}
+
+#endif
@@ -14,4 +14,18 @@
   }
 #endif
 
+// Held while the output drivers are updated or replaced, see main.cpp
+extern SemaphoreHandle_t outputsMutex;
+
+/**
+ * Ticker callback of an output driver. The esp_timer task doesn't wait for the outputs, a tick is skipped
+ * while they are locked, so a driver can't be used while it's being replaced and freed.
+ */
+template <typename T, void (T::*timer)()>
+void outputTimer(T* instance) {
+  if (xSemaphoreTake(outputsMutex, 0) != pdTRUE) return;
+  (instance->*timer)();
+  xSemaphoreGive(outputsMutex);
+}
+
 #endif
\ No newline at end of file
@@ -15,7 +15,7 @@ public:
   HUB75(Model* _model);
   ~HUB75();
 
-  void update(uint16_t mask, TrafficLightStatus oldStatus, TrafficLightStatus newStatus);
+  void update(MeasurementMask mask, TrafficLightStatus oldStatus, TrafficLightStatus newStatus);
   void stopDMA();
 
 private:
@@ -5,6 +5,9 @@
 
 #define I2C_MUTEX_DEF_WAIT pdMS_TO_TICKS(5000)
 
+#define I2C_PREFERENCES_NAMESPACE "i2c"
+#define I2C_DEVICE_MAP_KEY "deviceMap"
+
 namespace I2C {
 #define SSD1306_I2C_ADR 0x3C
 #define SCD30_I2C_ADR 0x61
@@ -13,6 +16,8 @@ namespace I2C {
 #define BME680_I2C_ADR 0x76
 
   void initI2C();
+  uint8_t rescan();
+  uint8_t getDeviceMap();
 
   boolean takeMutex(TickType_t blockTime);
   void giveMutex();
@@ -2,24 +2,10 @@
 #define _MODEL_H
 
 #include <Arduino.h>
+#include <ArduinoJson.h>
 
 const float NaN = sqrt(-1);
 
-typedef enum {
-  M_NONE = 0,
-  M_CO2 = 1 << 0,
-  M_TEMPERATURE = 1 << 1,
-  M_HUMIDITY = 1 << 2,
-  M_PRESSURE = 1 << 3,
-  M_IAQ = 1 << 4,
-  M_PM0_5 = 1 << 5,
-  M_PM1_0 = 1 << 6,
-  M_PM2_5 = 1 << 7,
-  M_PM4 = 1 << 8,
-  M_PM10 = 1 << 9,
-  M_CONFIG_CHANGED = 1 << 10
-} Measurement;
-
 typedef enum {
   OFF = 0,
   GREEN,
@@ -28,7 +14,119 @@ typedef enum {
   DARK_RED
 } TrafficLightStatus;
 
-typedef void (*modelUpdatedEvt_t)(uint16_t mask, TrafficLightStatus oldStatus, TrafficLightStatus newStatus);
+// Sensors reporting into the model, in the order of their default priority
+typedef enum : uint8_t {
+  SOURCE_SCD30,
+  SOURCE_SCD40,
+  SOURCE_BME680,
+  SOURCE_SPS30,
+  SOURCE_COUNT
+} SensorSource;
+
+// Config::sensorFusion, how the readings of sensors measuring the same value are combined
+typedef enum : uint8_t {
+  FUSION_PRIORITY,  // the preferred sensor, the others only while it has no current reading
+  FUSION_MEAN,      // mean weighted by sensor accuracy
+  FUSION_MEDIAN     // median, the mean of the middle two for an even number of sensors
+} FusionMode;
+
+/**
+ * All measurements of the model:
+ *   X(NAME, field, type, JSON key, unit, decimals, maxSpread, delta, deltaPercent, flags)
+ * Everything else, the ModelSnapshot fields, the MEASUREMENT_* ids, the M_* mask bits and the descriptor
+ * table the JSON encoder iterates, is generated from this list, so a new channel is a single line here.
+ * maxSpread is how far sensors measuring the same value may disagree before they count as drifting,
+ * 0 disables the check. A value is only published again once it changed by delta or by deltaPercent of
+ * the last published value, whichever is larger, or when TELEMETRY_HEARTBEAT has passed.
+ */
+#define MODEL_MEASUREMENTS(X) \
+  X(CO2,             co2,            uint16_t,  "co2",            "ppm",    0,         100,        10,     2,            MEASUREMENT_ZERO_IS_NONE) \
+  X(TEMPERATURE,     temperature,    float,     "temperature",    "°C",     1,         1.5,        0.2,    0,            0) \
+  X(HUMIDITY,        humidity,       float,     "humidity",       "%",      1,         5,          1,      0,            0) \
+  X(PRESSURE,        pressure,       uint16_t,  "pressure",       "hPa",    0,         3,          1,      0,            MEASUREMENT_ZERO_IS_NONE) \
+  X(IAQ,             iaq,            uint16_t,  "iaq",            "",       0,         0,          5,      5,            MEASUREMENT_ZERO_IS_NONE) \
+  X(PM0_5,           pm0_5,          uint16_t,  "pm0.5",          "#/cm³",  0,         0,          1,      10,           0) \
+  X(PM1_0,           pm1,            uint16_t,  "pm1",            "#/cm³",  0,         0,          1,      10,           0) \
+  X(PM2_5,           pm2_5,          uint16_t,  "pm2.5",          "#/cm³",  0,         0,          1,      10,           0) \
+  X(PM4,             pm4,            uint16_t,  "pm4",            "#/cm³",  0,         0,          1,      10,           0) \
+  X(PM10,            pm10,           uint16_t,  "pm10",           "#/cm³",  0,         0,          1,      10,           0) \
+  X(MASS_PM1_0,      massPm1,        float,     "massPm1",        "µg/m³",  1,         0,          0.5,    10,           0) \
+  X(MASS_PM2_5,      massPm2_5,      float,     "massPm2.5",      "µg/m³",  1,         0,          0.5,    10,           0) \
+  X(MASS_PM4,        massPm4,        float,     "massPm4",        "µg/m³",  1,         0,          0.5,    10,           0) \
+  X(MASS_PM10,       massPm10,       float,     "massPm10",       "µg/m³",  1,         0,          0.5,    10,           0) \
+  X(PARTICLE_SIZE,   particleSize,   float,     "particleSize",   "µm",     2,         0,          0.05,   5,            0) \
+  X(STATIC_IAQ,      staticIaq,      uint16_t,  "staticIaq",      "",       0,         0,          5,      5,            MEASUREMENT_ZERO_IS_NONE) \
+  X(CO2_EQUIVALENT,  co2Equivalent,  uint16_t,  "co2Equivalent",  "ppm",    0,         0,          10,     2,            MEASUREMENT_ZERO_IS_NONE) \
+  X(BREATH_VOC,      breathVoc,      float,     "breathVoc",      "ppm",    2,         0,          0.05,   10,           0)
+
+// MeasurementDescriptor::flags
+#define MEASUREMENT_ZERO_IS_NONE 0x01   // 0 means there's no reading, floats use NaN for that
+
+typedef enum : uint8_t {
+#define X(name, field, type, key, unit, decimals, maxSpread, delta, deltaPercent, flags) MEASUREMENT_##name,
+  MODEL_MEASUREMENTS(X)
+#undef X
+  MEASUREMENT_COUNT
+} MeasurementId;
+
+// Bit i is set for MeasurementId i, the top bit signals a configuration change
+typedef uint32_t MeasurementMask;
+
+static_assert(MEASUREMENT_COUNT < 31, "MeasurementMask is too small");
+
+const MeasurementMask M_NONE = 0;
+#define X(name, field, type, key, unit, decimals, maxSpread, delta, deltaPercent, flags) const MeasurementMask M_##name = 1ul << MEASUREMENT_##name;
+MODEL_MEASUREMENTS(X)
+#undef X
+const MeasurementMask M_ALL_MEASUREMENTS = (1ul << MEASUREMENT_COUNT) - 1;
+const MeasurementMask M_CONFIG_CHANGED = 1ul << 31;
+
+// Consistent copy of all measurements, taken by Model::getSnapshot()
+struct ModelSnapshot {
+  uint32_t sequence;    // number of updates so far
+  uint32_t timestamp;   // millis() of the last update
+  TrafficLightStatus status;
+  MeasurementMask drifting;  // measurements whose sensors disagree by more than maxSpread
+#define X(name, field, type, key, unit, decimals, maxSpread, delta, deltaPercent, flags) type field;
+  MODEL_MEASUREMENTS(X)
+#undef X
+};
+
+typedef enum : uint8_t {
+  MEASUREMENT_UINT16,
+  MEASUREMENT_FLOAT
+} MeasurementType;
+
+template <typename T> struct MeasurementTypeOf;
+template <> struct MeasurementTypeOf<uint16_t> { static constexpr MeasurementType value = MEASUREMENT_UINT16; };
+template <> struct MeasurementTypeOf<float> { static constexpr MeasurementType value = MEASUREMENT_FLOAT; };
+
+// Describes one ModelSnapshot field by its offset, like ConfigParameter does for Config
+struct MeasurementDescriptor {
+  const char* key;
+  const char* unit;
+  uint8_t offset;
+  MeasurementType type;
+  uint8_t decimals;
+  float maxSpread;
+  float delta;
+  uint8_t deltaPercent;
+  uint8_t flags;
+
+  uint8_t size() const { return type == MEASUREMENT_FLOAT ? sizeof(float) : sizeof(uint16_t); }
+  bool hasValue(const ModelSnapshot& snapshot) const;
+  float getValue(const ModelSnapshot& snapshot) const;
+  void setValue(ModelSnapshot& snapshot, float value) const;
+  void toJson(const ModelSnapshot& snapshot, JsonObject object) const;
+};
+
+extern const MeasurementDescriptor measurementDescriptors[MEASUREMENT_COUNT];
+extern const char* const sensorSourceNames[SOURCE_COUNT];
+
+// Adds the measurements in mask that have a value to object
+void measurementsToJson(const ModelSnapshot& snapshot, MeasurementMask mask, JsonObject object);
+
+typedef void (*modelUpdatedEvt_t)(MeasurementMask mask, TrafficLightStatus oldStatus, TrafficLightStatus newStatus);
 
 class Model {
 public:
@@ -37,39 +135,42 @@ public:
   ~Model();
 
   uint16_t getCo2();
-  float getTemperature();
-  float getHumidity();
   uint16_t getPressure();
-  uint16_t getIAQ();
-  uint16_t getPM0_5();
-  uint16_t getPM1();
-  uint16_t getPM2_5();
-  uint16_t getPM4();
-  uint16_t getPM10();
+  float getValue(MeasurementId id);
 
   TrafficLightStatus getStatus();
+  ModelSnapshot getSnapshot();
 
-  void updateModel(uint16_t _co2);
-  void updateModel(uint16_t co2, float temperature, float humidity);
-  void updateModel(float temperature, float humidity, uint16_t pressure, uint16_t iaq);
-  void updateModel(uint16_t pm0_5, uint16_t pm1, uint16_t pm2_5, uint16_t pm4, uint16_t pm10);
+  /**
+   * Stores the measurements in mask from values as the readings of source and fuses them with the current
+   * readings of other sources of the same measurements. Readings that are missing aren't reported as updated.
+   */
+  void updateModel(SensorSource source, const ModelSnapshot& values, MeasurementMask mask);
   void configurationChanged();
 
 private:
 
-  TrafficLightStatus status;
-  float temperature;
-  float humidity;
-  uint16_t co2;
-  uint16_t pressure;
-  uint16_t iaq;
-  uint16_t pm0_5;
-  uint16_t pm1;
-  uint16_t pm2_5;
-  uint16_t pm4;
-  uint16_t pm10;
+  /**
+   * Seqlock: writers make sequence odd while they change data, readers copy data without locking and
+   * retry if sequence was odd or changed meanwhile. Writers fuse into a copy while holding updateMutex,
+   * writeMux is only held while the copy is published.
+   */
+  ModelSnapshot data;
+  volatile uint32_t sequence;
+  // latest reading of every source, drift is the moving average of its difference to the other sources
+  struct SourceReading {
+    float value;
+    uint32_t time;    // millis() of the reading
+    float drift;
+    bool valid;
+  };
+  SourceReading readings[SOURCE_COUNT][MEASUREMENT_COUNT];
+  portMUX_TYPE writeMux;
+  SemaphoreHandle_t updateMutex;
   modelUpdatedEvt_t modelUpdatedEvt;
-  void updateStatus();
+  void publish(ModelSnapshot& next);
+  void updateStatus(ModelSnapshot& next);
+  void fuse(ModelSnapshot& next, MeasurementId id, SensorSource source, uint32_t now);
 
 };
 
@@ -4,6 +4,7 @@
 #include <globals.h>
 #include <ArduinoJson.h>
 #include <messageSupport.h>
+#include <esp_event.h>
 
 // If you issue really large certs (e.g. long CN, extra options) this value may need to be
 // increased, but 1600 is plenty for a typical CN and standard option openSSL issued cert.
@@ -12,6 +13,27 @@
 // Use larger of cert or config for MQTT buffer size.
 #define MQTT_BUFFER_SIZE MQTT_CERT_SIZE > CONFIG_SIZE ? MQTT_CERT_SIZE : CONFIG_SIZE
 
+// QoS used for uplink messages and downlink subscriptions. QoS1 messages are kept in the
+// client's in-flight window until acknowledged and retransmitted after a reconnect.
+#define MQTT_QOS 1
+
+// Reconnect backoff: a random delay between 0 and min(MAX, BASE * 2^attempt) milliseconds
+#define MQTT_RECONNECT_BASE_DELAY  1000
+#define MQTT_RECONNECT_MAX_DELAY  60000
+
+// MQTT 5 only: sensor readings older than this are discarded by the broker instead of being delivered
+#define MQTT_TELEMETRY_EXPIRY 300    // seconds
+
+#define MQTT_TOPIC_BUFFER_LEN (MQTT_TOPIC_LEN + 24)
+
+// Longest downlink command name (topic suffix after .../down/)
+#define MQTT_COMMAND_NAME_LEN 32
+// Capacity of the JSON reply to a command: cmd, success and a few details
+#define MQTT_REPLY_SIZE (JSON_OBJECT_SIZE(6) + MQTT_COMMAND_NAME_LEN + 1)
+
+// Number of PEM files (root ca, client key, client cert and a ca under test) kept in RAM
+#define MQTT_PEM_CACHE_SIZE 4
+
 
 namespace mqtt {
   typedef void (*calibrateCo2SensorCallback_t)(uint16_t);
@@ -36,10 +58,16 @@ namespace mqtt {
   void publishSensors(DynamicJsonDocument* _payload);
   void publishConfiguration();
   void publishStatusMsg(const char* statusMessage);
+  void logQueueStatistics();
+  void eventHandler(void* event_handler_arg, esp_event_base_t event_base, int32_t event_id, void* event_data);
 
   void mqttLoop(void* pvParameters);
+  void commandLoop(void* pvParameters);
+  // downlink commands are queued from the start but only executed once the sensors and outputs are set up
+  void enableCommands();
 
   extern TaskHandle_t mqttTask;
+  extern TaskHandle_t commandTask;
 }
 
 #endif
\ No newline at end of file
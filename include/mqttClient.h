@@ -0,0 +1,174 @@
+#ifndef _MQTT_CLIENT_H
+#define _MQTT_CLIENT_H
+
+#include <globals.h>
+#include <Client.h>
+#include <Print.h>
+
+// Maximum number of unacknowledged QoS1 messages kept for retransmission.
+#define MQTT_MAX_INFLIGHT           8
+#define MQTT_DEFAULT_KEEPALIVE     15    // seconds
+#define MQTT_DEFAULT_BUFFER_SIZE  256
+#define MQTT_CONNACK_TIMEOUT     5000    // milliseconds
+#define MQTT_PINGRESP_TIMEOUT   10000    // milliseconds
+
+#define MQTT_PROTOCOL_V311           4
+#define MQTT_PROTOCOL_V5             5
+// MQTT 5 only: number of topics that can be registered for topic aliases
+#define MQTT_MAX_TOPIC_ALIASES       4
+// MQTT 5 only: how long the broker keeps a persistent session after the connection is lost
+#define MQTT_SESSION_EXPIRY      86400    // seconds
+
+// connection states, numerically compatible with PubSubClient
+#define MQTT_CONNECTION_TIMEOUT     -4
+#define MQTT_CONNECTION_LOST        -3
+#define MQTT_CONNECT_FAILED         -2
+#define MQTT_DISCONNECTED           -1
+#define MQTT_CONNECTED               0
+#define MQTT_CONNECT_BAD_PROTOCOL    1
+#define MQTT_CONNECT_BAD_CLIENT_ID   2
+#define MQTT_CONNECT_UNAVAILABLE     3
+#define MQTT_CONNECT_BAD_CREDENTIALS 4
+#define MQTT_CONNECT_UNAUTHORIZED    5
+
+// MQTT 5 publish properties, ignored when connected using 3.1.1
+struct MqttUserProperty {
+  const char* key;
+  const char* value;
+};
+
+struct MqttPublishProperties {
+  uint32_t messageExpiry;    // seconds, 0 to never expire
+  const MqttUserProperty* userProperties;
+  uint8_t userPropertyCount;
+};
+
+/**
+ * Minimal MQTT 3.1.1 client supporting QoS0/QoS1 publishes with an in-flight window,
+ * persistent sessions (cleanSession=false) with retransmission of unacknowledged
+ * messages after reconnect, and non-blocking processing of incoming packets.
+ * Payloads can be streamed with beginPublish()/write()/endPublish(), e.g. straight from serializeJson().
+ * With MQTT 5 registered topics are replaced by topic aliases once the broker knows them, publishes
+ * may carry message expiry and user properties, and reason codes are available via getReasonCode().
+ */
+class MqttClient : public Print {
+public:
+  typedef void (*callback_t)(char* topic, byte* payload, unsigned int length);
+
+  MqttClient(Client& client);
+  ~MqttClient();
+
+  void setServer(const char* host, uint16_t port);
+  void setCallback(callback_t callback);
+  boolean setBufferSize(uint16_t size);
+  void setKeepAlive(uint16_t keepAliveSeconds);
+  void setCleanSession(boolean cleanSession);
+  void setProtocolVersion(uint8_t version);
+  uint8_t getProtocolVersion();
+  boolean addTopicAlias(const char* topic);
+
+  boolean connect(const char* id, const char* user, const char* pass);
+  boolean connect(const char* id, const char* user, const char* pass, const char* willTopic, uint8_t willQos, boolean willRetain, const char* willMessage);
+  void disconnect();
+  boolean connected();
+  int state();
+
+  boolean publish(const char* topic, const char* payload, uint8_t qos = 0, boolean retained = false);
+  boolean publish(const char* topic, const uint8_t* payload, size_t length, uint8_t qos = 0, boolean retained = false);
+  boolean beginPublish(const char* topic, size_t length, uint8_t qos = 0, boolean retained = false, const MqttPublishProperties* properties = nullptr);
+  virtual size_t write(uint8_t b);
+  virtual size_t write(const uint8_t* data, size_t length);
+  boolean endPublish();
+  using Print::write;
+  boolean subscribe(const char* topic, uint8_t qos = 0);
+
+  boolean canPublish(uint8_t qos);
+  uint8_t getInFlight();
+  uint32_t getAcknowledged();
+  uint32_t getRetransmitted();
+  uint32_t getRejected();
+  uint8_t getReasonCode();
+
+  boolean loop();
+
+private:
+  struct InFlightMessage {
+    uint16_t packetId;
+    uint8_t* packet;
+    size_t length;
+    uint8_t headerLength;
+    uint8_t topicAlias;   // 0 if the packet carries no topic alias property
+  };
+
+  Client* client;
+  const char* host;
+  uint16_t port;
+  callback_t callback;
+  uint16_t keepAlive;
+  boolean cleanSession;
+  uint8_t protocolVersion;
+  int connectionState;
+  uint8_t reasonCode;
+
+  // limits announced by the broker in CONNACK (MQTT 5)
+  uint16_t serverReceiveMaximum;
+  uint16_t serverTopicAliasMaximum;
+
+  // topicAliases[i] is sent as alias i + 1
+  char* topicAliases[MQTT_MAX_TOPIC_ALIASES];
+  boolean topicAliasEstablished[MQTT_MAX_TOPIC_ALIASES];
+
+  uint8_t* buffer;
+  uint16_t bufferSize;
+
+  // incoming packet parser state
+  uint8_t rxHeader;
+  uint32_t rxRemaining;
+  uint32_t rxLength;
+  uint32_t rxPosition;
+  uint8_t rxLengthShift;
+  uint8_t rxStage;
+  boolean rxDiscard;
+
+  uint16_t nextPacketId;
+  InFlightMessage inFlight[MQTT_MAX_INFLIGHT];
+  uint8_t inFlightCount;
+  uint32_t acknowledged;
+  uint32_t retransmitted;
+  uint32_t rejected;
+
+  uint32_t lastOutActivity;
+  uint32_t lastInActivity;
+  boolean pingOutstanding;
+
+  // publish in progress between beginPublish() and endPublish(), streamPacket is only used for QoS1
+  boolean streamActive;
+  boolean streamFailed;
+  uint8_t* streamPacket;
+  uint16_t streamPacketId;
+  uint8_t streamHeaderLength;
+  uint8_t streamTopicAlias;
+  size_t streamLength;
+  size_t streamPosition;
+  size_t streamRemaining;
+
+  uint16_t getNextPacketId();
+  boolean writePacket(const uint8_t* packet, size_t length);
+  boolean writeControl(uint8_t header, uint16_t packetId, boolean withId);
+  boolean sendInFlight(InFlightMessage* msg);
+  boolean dropTopicAlias(InFlightMessage* msg);
+  uint8_t findTopicAlias(const char* topic);
+  boolean readByte(uint8_t* result, uint32_t timeout);
+  boolean readPacket(uint32_t timeout);
+  boolean parseConnackProperties(const uint8_t* properties, uint32_t length);
+  boolean processIncoming();
+  void handlePacket();
+  void discardPacket();
+  void retransmit();
+  void releaseInFlight(uint16_t packetId, uint8_t reason);
+  void clearInFlight();
+  void resetParser();
+  void connectionLost();
+};
+
+#endif
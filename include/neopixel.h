@@ -13,8 +13,9 @@ public:
   Neopixel(Model* model, uint8_t pin, uint8_t numPixel);
   ~Neopixel();
 
-  void update(uint16_t mask, TrafficLightStatus oldStatus, TrafficLightStatus newStatus);
+  void update(MeasurementMask mask, TrafficLightStatus oldStatus, TrafficLightStatus newStatus);
   void off();
+  void selfTest(uint8_t step);
 
 private:
   void fill(uint32_t c);
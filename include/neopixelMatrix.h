@@ -13,7 +13,7 @@ public:
   NeopixelMatrix(Model* model, uint8_t pin, uint8_t columns, uint8_t rows, uint8_t layout);
   ~NeopixelMatrix();
 
-  void update(uint16_t mask, TrafficLightStatus oldStatus, TrafficLightStatus newStatus);
+  void update(MeasurementMask mask, TrafficLightStatus oldStatus, TrafficLightStatus newStatus);
   TaskHandle_t start(const char* name, uint32_t stackSize, UBaseType_t priority, BaseType_t core);
   void stop();
 
@@ -59,6 +59,7 @@ private:
 
   QueueHandle_t updateQueue;
   TaskHandle_t displayTask;
+  volatile bool stopRequested;
 
   uint16_t GREEN;
   uint16_t YELLOW;
@@ -3,15 +3,28 @@
 
 #include <globals.h>
 #include <messageSupport.h>
+#include <otaDecoder.h>
+
+// longest accepted firmware signature (DER encoded ECDSA or RSA up to 4096 bits)
+#define OTA_MAX_SIGNATURE_LEN 512
 
 typedef void (*preUpdateCallback_t)(void);
+// undoes preUpdateCallback_t when an update over MQTT is aborted or fails
+typedef void (*updateFailedCallback_t)(void);
 
 namespace OTA {
-  void setupOta(preUpdateCallback_t preUpdateCallback, setPriorityMessageCallback_t _setPriorityMessageCallback, clearPriorityMessageCallback_t _clearPriorityMessageCallback);
+  void setupOta(preUpdateCallback_t preUpdateCallback, updateFailedCallback_t updateFailedCallback, setPriorityMessageCallback_t _setPriorityMessageCallback, clearPriorityMessageCallback_t _clearPriorityMessageCallback);
   void checkForUpdate();
   extern TaskHandle_t otaTask;
   void otaLoop(void* pvParameters);
   void forceUpdate(char* url);
+
+  boolean beginMqttUpdate(uint32_t size, const char* sha256, const char* signature, uint8_t encoding = OTA_ENCODING_RAW);
+  boolean writeMqttUpdate(const uint8_t* chunk, size_t length);
+  boolean endMqttUpdate();
+  void abortMqttUpdate();
+  uint32_t getMqttUpdateOffset();
+  uint32_t getMqttUpdateSize();
 }
 
 #endif
\ No newline at end of file
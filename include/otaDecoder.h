@@ -0,0 +1,64 @@
+#ifndef _OTA_DECODER_H
+#define _OTA_DECODER_H
+
+#include <globals.h>
+#include <esp_partition.h>
+
+#define OTA_ENCODING_RAW       0
+#define OTA_ENCODING_DEFLATE   1
+#define OTA_ENCODING_DELTA     2
+
+// delta header: magic, version, size and SHA-256 of the firmware the delta was made against
+#define OTA_DELTA_MAGIC        "CO2D"
+#define OTA_DELTA_VERSION      1
+#define OTA_DELTA_HEADER_SIZE  41
+#define OTA_COPY_BUFFER_SIZE   1024
+
+typedef boolean(*otaWriteCallback_t)(const uint8_t* data, size_t length);
+
+struct tinfl_decompressor_tag;
+
+/**
+ * Turns a transferred firmware stream back into the image to flash, passing the output to the write
+ * callback as it is produced. Deflate streams (zlib format) are inflated on the fly using the ROM's tinfl.
+ * Delta streams are inflated as well and then applied against the running partition: a sequence of
+ * copy (offset and length in the running firmware) and insert (literal bytes) operations.
+ */
+class OtaDecoder {
+public:
+  OtaDecoder(uint8_t encoding, otaWriteCallback_t writeCallback);
+  ~OtaDecoder();
+  boolean begin();
+  boolean write(const uint8_t* data, size_t length);
+  boolean end();
+  uint32_t getOutputSize();
+
+private:
+  uint8_t encoding;
+  otaWriteCallback_t writeCallback;
+  uint32_t outputSize;
+
+  tinfl_decompressor_tag* inflator;
+  uint8_t* dictionary;
+  size_t dictionaryOffset;
+  boolean inflateDone;
+
+  const esp_partition_t* source;
+  uint32_t sourceSize;
+  uint8_t* copyBuffer;
+  uint8_t deltaStage;
+  uint8_t header[OTA_DELTA_HEADER_SIZE];
+  uint8_t headerLength;
+  uint8_t op;
+  uint8_t args[8];
+  uint8_t argsLength;
+  uint32_t insertRemaining;
+
+  boolean inflate(const uint8_t* data, size_t length);
+  boolean applyDelta(const uint8_t* data, size_t length);
+  boolean verifySource();
+  boolean copyFromSource(uint32_t offset, uint32_t length);
+  boolean output(const uint8_t* data, size_t length);
+};
+
+#endif
@@ -7,6 +7,8 @@
 #include <messageSupport.h>
 #include <Wire.h>
 #include <model.h>
+#include <filters.h>
+#include <cadence.h>
 #include <Adafruit_SCD30.h>
 
 class SCD30 {
@@ -26,6 +28,9 @@ private:
   Model* model;
   Adafruit_SCD30* scd30;
   updateMessageCallback_t updateMessageCallback;
+  Filters::Co2Filter co2Filter;
+  Filters::TemperatureFilter temperatureFilter;
+  Filters::HumidityFilter humidityFilter;
   boolean initialised = false;
   uint16_t lastAmbientPressure = 0x0000;
 
@@ -7,6 +7,8 @@
 #include <messageSupport.h>
 #include <Wire.h>
 #include <model.h>
+#include <filters.h>
+#include <cadence.h>
 #include <SensirionI2CScd4x.h>
 
 class SCD40 {
@@ -23,12 +25,29 @@ public:
   boolean setAmbientPressure(uint16_t ambientPressureInHpa);
 
 private:
+  // measurement modes, picked by the cadence level
+  typedef enum : uint8_t {
+    SCD4X_PERIODIC,       // every 5 s
+    SCD4X_LOW_POWER,      // every 30 s
+    SCD4X_SINGLE_SHOT     // idle between single shots, SCD41 only
+  } Scd4xMode;
+
   Model* model;
   SensirionI2CScd4x* scd40;
+  TwoWire* wire;
   updateMessageCallback_t updateMessageCallback;
+  Filters::Co2Filter co2Filter;
+  Filters::TemperatureFilter temperatureFilter;
+  Filters::HumidityFilter humidityFilter;
   uint16_t lastAmbientPressure = 0x0000;
+  Scd4xMode mode = SCD4X_PERIODIC;
+  boolean singleShotSupported = true;
+  boolean singleShotPending = false;
 
   boolean checkError(uint16_t error, char const* msg);
+  uint16_t startMeasurement();
+  void applyCadence();
+  boolean triggerSingleShot();
   static void scd40Loop(void* pvParameters);
 };
 
@@ -7,6 +7,8 @@
 #include <messageSupport.h>
 #include <Wire.h>
 #include <model.h>
+#include <filters.h>
+#include <cadence.h>
 #include <sps30.h>
 
 class SPS_30 {
@@ -26,6 +28,10 @@ private:
   Model* model;
   SPS30* sps30;
   updateMessageCallback_t updateMessageCallback;
+  Filters::ParticleFilter countFilters[5];
+  Filters::ParticleFilter massFilters[4];
+  Filters::ParticleFilter sizeFilter;
+  uint32_t interval = SPS30_INTERVAL_FAST;
 
   boolean checkError(uint16_t error, char const* msg);
   static void sps30Loop(void* pvParameters);
@@ -0,0 +1,28 @@
+#ifndef _TELEMETRY_H
+#define _TELEMETRY_H
+
+#include <globals.h>
+#include <model.h>
+
+/**
+ * Send-on-delta for the sensor messages: a measurement is only published when it moved past its deadband
+ * (delta and deltaPercent in MODEL_MEASUREMENTS) since it was last published, its drift state changed, or
+ * it wasn't published for TELEMETRY_HEARTBEAT. Only called from the telemetry event subscriber.
+ */
+namespace Telemetry {
+  struct TelemetryStats {
+    uint32_t sent;              // sensor messages published
+    uint32_t suppressed;        // model updates without anything worth publishing
+    uint32_t valuesSent;
+    uint32_t valuesSuppressed;
+  };
+
+  // Returns the measurements of mask to publish and records them as published
+  MeasurementMask select(const ModelSnapshot& snapshot, MeasurementMask mask);
+  // Forgets what was published when a sensor message is dropped, so the next one carries every measurement
+  void invalidate();
+  TelemetryStats getStats();
+  void logStats();
+}
+
+#endif
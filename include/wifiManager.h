@@ -5,7 +5,7 @@
 #include <config.h>
 #include <messageSupport.h>
 #include <ESPAsyncWebServer.h>
-#include <configParameter.h>
+#include <configManager.h>
 #include <model.h>
 
 
@@ -14,7 +14,7 @@ namespace WifiManager {
 
   typedef void (*configChangedCallback_t)();
 
-  void setupWifiManager(const char* appName, std::vector<ConfigParameterBase<Config>*> configParameterVector, bool keepCaptivePortalActive, bool captivePortalActiveWhenNotConnected,
+  void setupWifiManager(const char* appName, ConfigParameterTable configParameters, bool keepCaptivePortalActive, bool captivePortalActiveWhenNotConnected,
     updateMessageCallback_t updateMessageCallback, setPriorityMessageCallback_t setPriorityMessageCallback, clearPriorityMessageCallback_t clearPriorityMessageCallback,
     configChangedCallback_t configChangedCallback);
   void resetSettings();
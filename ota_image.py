@@ -0,0 +1,132 @@
+#!/usr/bin/env python3
+"""Prepares firmware images for OTA over MQTT.
+
+  ota_image.py deflate firmware.bin firmware.bin.z
+  ota_image.py delta old.bin new.bin update.delta
+  ota_image.py apply old.bin update.delta new.bin
+
+deflate compresses an image (zlib format). delta creates a compressed patch against the firmware
+currently running on the node, apply reverses it to check a patch before sending it. Both print the
+otaBegin message to use for the resulting file.
+"""
+
+import hashlib
+import json
+import struct
+import sys
+import zlib
+
+DELTA_MAGIC = b"CO2D"
+DELTA_VERSION = 1
+KEY_LENGTH = 16
+KEY_STEP = 4
+MIN_COPY = 32
+
+
+def index_source(source):
+    index = {}
+    for offset in range(0, len(source) - KEY_LENGTH + 1, KEY_STEP):
+        index.setdefault(source[offset:offset + KEY_LENGTH], offset)
+    return index
+
+
+def make_delta(source, target):
+    index = index_source(source)
+    ops = [DELTA_MAGIC, struct.pack(">BI", DELTA_VERSION, len(source)), hashlib.sha256(source).digest()]
+    literal = bytearray()
+
+    def flush_literal():
+        if literal:
+            ops.append(b"I" + struct.pack(">I", len(literal)) + bytes(literal))
+            literal.clear()
+
+    position = 0
+    while position < len(target):
+        offset = index.get(target[position:position + KEY_LENGTH])
+        length = 0
+        if offset is not None:
+            while (position + length < len(target) and offset + length < len(source)
+                   and target[position + length] == source[offset + length]):
+                length += 1
+        if length >= MIN_COPY:
+            flush_literal()
+            ops.append(b"C" + struct.pack(">II", offset, length))
+            position += length
+        else:
+            literal.append(target[position])
+            position += 1
+    flush_literal()
+    ops.append(b"E")
+    return zlib.compress(b"".join(ops), 9)
+
+
+def apply_delta(source, delta):
+    data = zlib.decompress(delta)
+    if data[:4] != DELTA_MAGIC or data[4] != DELTA_VERSION:
+        raise ValueError("not a delta of a supported version")
+    size = struct.unpack(">I", data[5:9])[0]
+    if size != len(source) or hashlib.sha256(source).digest() != data[9:41]:
+        raise ValueError("delta was made against a different firmware")
+    target = bytearray()
+    position = 41
+    while True:
+        op = data[position:position + 1]
+        position += 1
+        if op == b"C":
+            offset, length = struct.unpack(">II", data[position:position + 8])
+            position += 8
+            if offset + length > len(source):
+                raise ValueError("copy beyond source firmware")
+            target += source[offset:offset + length]
+        elif op == b"I":
+            length = struct.unpack(">I", data[position:position + 4])[0]
+            position += 4
+            target += data[position:position + length]
+            position += length
+        elif op == b"E":
+            if position != len(data):
+                raise ValueError("trailing data after delta")
+            return bytes(target)
+        else:
+            raise ValueError("unknown delta operation")
+
+
+def ota_begin(stream, encoding):
+    return json.dumps({"size": len(stream), "sha256": hashlib.sha256(stream).hexdigest(), "encoding": encoding})
+
+
+def read(filename):
+    with open(filename, "rb") as f:
+        return f.read()
+
+
+def write(filename, data):
+    with open(filename, "wb") as f:
+        f.write(data)
+
+
+def main(args):
+    if len(args) == 3 and args[0] == "deflate":
+        image = read(args[1])
+        stream = zlib.compress(image, 9)
+        write(args[2], stream)
+        print(f"{len(image)} -> {len(stream)} bytes", file=sys.stderr)
+        print(ota_begin(stream, "deflate"))
+    elif len(args) == 4 and args[0] == "delta":
+        source, target = read(args[1]), read(args[2])
+        stream = make_delta(source, target)
+        if apply_delta(source, stream) != target:
+            raise RuntimeError("delta doesn't reproduce the new image")
+        write(args[3], stream)
+        print(f"{len(target)} -> {len(stream)} bytes", file=sys.stderr)
+        print(ota_begin(stream, "delta"))
+    elif len(args) == 4 and args[0] == "apply":
+        write(args[3], apply_delta(read(args[1]), read(args[2])))
+    else:
+        print(__doc__, file=sys.stderr)
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv[1:]))
@@ -0,0 +1,202 @@
+#include <blobUpload.h>
+#include <ArduinoJson.h>
+#include <LittleFS.h>
+#include <mbedtls/sha256.h>
+#include <rom/crc.h>
+
+// Local logging tag
+static const char TAG[] = __FILE__;
+
+namespace BlobUpload {
+  File file;
+  char target[BLOB_UPLOAD_TARGET_LEN + 1];
+  char sha256[65];
+  uint32_t size = 0;
+  uint32_t offset = 0;
+  boolean active = false;
+
+  uint32_t readUint32(const uint8_t* buf) {
+    return ((uint32_t)buf[0] << 24) | ((uint32_t)buf[1] << 16) | ((uint32_t)buf[2] << 8) | buf[3];
+  }
+
+  // Splits a chunk into offset and data, returns false if it's too short or the CRC doesn't match.
+  boolean parseChunk(const uint8_t* chunk, size_t length, uint32_t* chunkOffset, const uint8_t** data, size_t* dataLength) {
+    if (length < BLOB_UPLOAD_CHUNK_HEADER) return false;
+    *chunkOffset = readUint32(chunk);
+    *data = chunk + BLOB_UPLOAD_CHUNK_HEADER;
+    *dataLength = length - BLOB_UPLOAD_CHUNK_HEADER;
+    if (crc32_le(0, *data, *dataLength) != readUint32(chunk + 4)) {
+      ESP_LOGW(TAG, "CRC mismatch in chunk at %u", *chunkOffset);
+      return false;
+    }
+    return true;
+  }
+
+  boolean saveMeta() {
+    File f = LittleFS.open(BLOB_UPLOAD_META_FILENAME, FILE_WRITE);
+    if (!f) return false;
+    StaticJsonDocument<JSON_OBJECT_SIZE(3)> doc;
+    doc["target"] = (const char*)target;
+    doc["size"] = size;
+    doc["sha256"] = (const char*)sha256;
+    boolean written = serializeJson(doc, f) > 0;
+    f.close();
+    return written;
+  }
+
+  // Returns true if an interrupted upload of the same blob was left on the file system.
+  boolean matchesMeta(const char* _target, uint32_t _size, const char* _sha256) {
+    if (!LittleFS.exists(BLOB_UPLOAD_FILENAME)) return false;
+    File f = LittleFS.open(BLOB_UPLOAD_META_FILENAME, FILE_READ);
+    if (!f) return false;
+    StaticJsonDocument<JSON_OBJECT_SIZE(3) + 128> doc;
+    DeserializationError error = deserializeJson(doc, f);
+    f.close();
+    if (error) return false;
+    return strcmp(doc["target"] | "", _target) == 0 && doc["size"] == _size && strcasecmp(doc["sha256"] | "", _sha256) == 0;
+  }
+
+  boolean begin(const char* _target, uint32_t _size, const char* _sha256) {
+    if (strlen(_target) > BLOB_UPLOAD_TARGET_LEN || strlen(_sha256) != 64 || _size == 0 || _size > BLOB_UPLOAD_MAX_SIZE) {
+      ESP_LOGW(TAG, "Invalid upload parameters");
+      return false;
+    }
+    if (active && strcmp(target, _target) == 0 && size == _size && strcasecmp(sha256, _sha256) == 0) {
+      ESP_LOGI(TAG, "Resuming upload of %s at %u/%u", target, offset, size);
+      return true;
+    }
+    if (file) file.close();
+    active = false;
+    offset = 0;
+    if (matchesMeta(_target, _size, _sha256)) {
+      file = LittleFS.open(BLOB_UPLOAD_FILENAME, FILE_APPEND);
+      if (file && file.size() <= _size) offset = file.size();
+    }
+    if (!file || offset == 0) {
+      if (file) file.close();
+      if (LittleFS.totalBytes() - LittleFS.usedBytes() < _size) {
+        ESP_LOGW(TAG, "Not enough space for %u bytes", _size);
+        return false;
+      }
+      file = LittleFS.open(BLOB_UPLOAD_FILENAME, FILE_WRITE);
+      offset = 0;
+    }
+    if (!file) {
+      ESP_LOGW(TAG, "Failed to open %s", BLOB_UPLOAD_FILENAME);
+      return false;
+    }
+    strcpy(target, _target);
+    for (uint8_t i = 0; i < 64; i++) sha256[i] = tolower(_sha256[i]);
+    sha256[64] = 0x00;
+    size = _size;
+    if (offset == 0 && !saveMeta()) {
+      ESP_LOGW(TAG, "Failed to write %s", BLOB_UPLOAD_META_FILENAME);
+      abort();
+      return false;
+    }
+    active = true;
+    ESP_LOGI(TAG, "Upload of %s (%u bytes) starting at %u", target, size, offset);
+    return true;
+  }
+
+  /**
+   * Appends a chunk (header followed by data). Chunks already received, e.g. redelivered after a
+   * reconnect, are acknowledged without being written again, chunks beyond the current offset are rejected.
+   */
+  boolean writeChunk(const uint8_t* chunk, size_t length) {
+    uint32_t chunkOffset;
+    const uint8_t* data;
+    size_t dataLength;
+    if (!active || !parseChunk(chunk, length, &chunkOffset, &data, &dataLength)) return false;
+    if (chunkOffset + dataLength <= offset) return true;
+    if (chunkOffset > offset) {
+      ESP_LOGW(TAG, "Chunk at %u, expected %u", chunkOffset, offset);
+      return false;
+    }
+    // skip the part of an overlapping chunk we already have
+    data += offset - chunkOffset;
+    dataLength -= offset - chunkOffset;
+    if (offset + dataLength > size) {
+      ESP_LOGW(TAG, "Chunk exceeds announced size");
+      return false;
+    }
+    if (file.write(data, dataLength) != dataLength) {
+      ESP_LOGW(TAG, "Failed to write chunk at %u", offset);
+      return false;
+    }
+    // make sure the file size reflects what has been acknowledged in case of a reboot
+    file.flush();
+    offset += dataLength;
+    return true;
+  }
+
+  boolean verify() {
+    File f = LittleFS.open(BLOB_UPLOAD_FILENAME, FILE_READ);
+    if (!f) return false;
+    uint8_t buf[256];
+    uint8_t hash[32];
+    mbedtls_sha256_context ctx;
+    mbedtls_sha256_init(&ctx);
+    mbedtls_sha256_starts_ret(&ctx, 0);
+    size_t n;
+    while ((n = f.read(buf, sizeof(buf))) > 0) mbedtls_sha256_update_ret(&ctx, buf, n);
+    f.close();
+    mbedtls_sha256_finish_ret(&ctx, hash);
+    mbedtls_sha256_free(&ctx);
+    char hex[65];
+    for (uint8_t i = 0; i < 32; i++) sprintf(hex + 2 * i, "%02x", hash[i]);
+    return strcmp(hex, sha256) == 0;
+  }
+
+  // Verifies the completed upload and moves it to filename, replacing any existing file.
+  boolean finish(const char* filename) {
+    if (!active || offset != size) {
+      ESP_LOGW(TAG, "Upload incomplete (%u/%u)", offset, size);
+      return false;
+    }
+    file.close();
+    if (!verify()) {
+      ESP_LOGW(TAG, "SHA-256 mismatch, discarding upload");
+      abort();
+      return false;
+    }
+    if (LittleFS.exists(filename) && !LittleFS.remove(filename)) {
+      ESP_LOGE(TAG, "Failed to remove %s", filename);
+      abort();
+      return false;
+    }
+    if (!LittleFS.rename(BLOB_UPLOAD_FILENAME, filename)) {
+      ESP_LOGE(TAG, "Failed to move upload to %s", filename);
+      abort();
+      return false;
+    }
+    LittleFS.remove(BLOB_UPLOAD_META_FILENAME);
+    active = false;
+    ESP_LOGI(TAG, "Upload of %s complete", target);
+    return true;
+  }
+
+  void abort() {
+    if (file) file.close();
+    LittleFS.remove(BLOB_UPLOAD_FILENAME);
+    LittleFS.remove(BLOB_UPLOAD_META_FILENAME);
+    active = false;
+    offset = 0;
+  }
+
+  boolean isActive() {
+    return active;
+  }
+
+  const char* getTarget() {
+    return target;
+  }
+
+  uint32_t getOffset() {
+    return offset;
+  }
+
+  uint32_t getSize() {
+    return size;
+  }
+}
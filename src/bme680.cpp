@@ -14,12 +14,30 @@ const uint8_t bsec_config_iaq[] = {
 #include "config/generic_33v_3s_4d/bsec_iaq.txt"
 };
 
+// BSEC stays at the low power rate, the ultra low power rate would need the 300 s config and a state handover
+const float SAMPLE_RATE = BSEC_SAMPLE_RATE_LP;
+
 #define STATE_SAVE_PERIOD	UINT32_C(360 * 60 * 1000) // 360 minutes - 4 times a day
 
 uint8_t bsecState[BSEC_MAX_STATE_BLOB_SIZE] = { 0 };
 uint16_t stateUpdateCounter = 0;
 
-const float SAMPLE_RATE = BSEC_SAMPLE_RATE_LP;
+bsec_virtual_sensor_t sensorList[9] = {
+  BSEC_OUTPUT_IAQ,
+  BSEC_OUTPUT_STATIC_IAQ,
+  BSEC_OUTPUT_CO2_EQUIVALENT,
+  BSEC_OUTPUT_BREATH_VOC_EQUIVALENT,
+  BSEC_OUTPUT_RAW_PRESSURE,
+  BSEC_OUTPUT_SENSOR_HEAT_COMPENSATED_TEMPERATURE,
+  BSEC_OUTPUT_SENSOR_HEAT_COMPENSATED_HUMIDITY,
+  BSEC_OUTPUT_STABILIZATION_STATUS,
+  BSEC_OUTPUT_RUN_IN_STATUS,
+  //  BSEC_OUTPUT_RAW_TEMPERATURE,
+  //  BSEC_OUTPUT_RAW_HUMIDITY,
+  //  BSEC_OUTPUT_RAW_GAS,
+  //  BSEC_OUTPUT_COMPENSATED_GAS,
+  //  BSEC_OUTPUT_GAS_PERCENTAGE,
+};
 
 void BME680::loadState(void) {
   if (EEPROM.read(0) == BSEC_MAX_STATE_BLOB_SIZE) {
@@ -113,24 +131,7 @@ BME680::BME680(TwoWire* wire, Model* _model, updateMessageCallback_t _updateMess
 
   loadState();
 
-  bsec_virtual_sensor_t sensorList[6] = {
-    BSEC_OUTPUT_IAQ,
-    BSEC_OUTPUT_RAW_PRESSURE,
-    BSEC_OUTPUT_SENSOR_HEAT_COMPENSATED_TEMPERATURE,
-    BSEC_OUTPUT_SENSOR_HEAT_COMPENSATED_HUMIDITY,
-    BSEC_OUTPUT_STABILIZATION_STATUS,
-    BSEC_OUTPUT_RUN_IN_STATUS,
-    //  BSEC_OUTPUT_RAW_TEMPERATURE,
-    //  BSEC_OUTPUT_RAW_HUMIDITY,
-    //  BSEC_OUTPUT_RAW_GAS,
-    //  BSEC_OUTPUT_STATIC_IAQ,  // <--
-    //  BSEC_OUTPUT_CO2_EQUIVALENT,
-    //  BSEC_OUTPUT_BREATH_VOC_EQUIVALENT,
-    //  BSEC_OUTPUT_COMPENSATED_GAS,
-    //  BSEC_OUTPUT_GAS_PERCENTAGE,
-  };
-
-  bme680->updateSubscription(sensorList, 6, SAMPLE_RATE);
+  bme680->updateSubscription(sensorList, 9, SAMPLE_RATE);
   checkIaqSensorStatus();
 
   I2C::giveMutex();
@@ -169,11 +170,29 @@ boolean BME680::readBme680() {
     updateMessageCallback("");
 #endif
 
-    if (bme680->runInStatus && bme680->iaqAccuracy >= 3) {
-      model->updateModel(bme680->temperature, bme680->humidity, (uint16_t)(bme680->pressure / 100), (uint16_t)(bme680->iaq));
+    ModelSnapshot values;
+    values.temperature = temperatureFilter.apply(bme680->temperature);
+    values.humidity = humidityFilter.apply(bme680->humidity);
+    values.pressure = (uint16_t)(pressureFilter.apply(bme680->pressure / 100) + 0.5f);
+    // the gas based outputs are meaningless until BSEC is calibrated, 0/NaN clears them in the model
+    boolean calibrated = bme680->runInStatus && bme680->iaqAccuracy >= 3;
+    if (calibrated) {
+      Cadence::addReading(SOURCE_BME680, MEASUREMENT_IAQ, bme680->iaq);
+      values.iaq = (uint16_t)(iaqFilter.apply(bme680->iaq) + 0.5f);
+      values.staticIaq = (uint16_t)(staticIaqFilter.apply(bme680->staticIaq) + 0.5f);
+      values.co2Equivalent = (uint16_t)(co2EquivalentFilter.apply(bme680->co2Equivalent) + 0.5f);
+      values.breathVoc = breathVocFilter.apply(bme680->breathVocEquivalent);
     } else {
-      model->updateModel(bme680->temperature, bme680->humidity, (uint16_t)(bme680->pressure / 100), 0);
+      iaqFilter.reset();
+      staticIaqFilter.reset();
+      co2EquivalentFilter.reset();
+      breathVocFilter.reset();
+      values.iaq = 0;
+      values.staticIaq = 0;
+      values.co2Equivalent = 0;
+      values.breathVoc = NaN;
     }
+    model->updateModel(SOURCE_BME680, values, M_TEMPERATURE | M_HUMIDITY | M_PRESSURE | M_IAQ | M_STATIC_IAQ | M_CO2_EQUIVALENT | M_BREATH_VOC);
 
     updateState();
   } else {
@@ -0,0 +1,50 @@
+#include <bootProfile.h>
+#include <esp_timer.h>
+
+// Local logging tag
+static const char TAG[] = __FILE__;
+
+namespace BootProfile {
+  struct Phase {
+    const char* name;
+    uint32_t doneAt;
+  };
+
+  Phase phases[BOOT_PROFILE_MAX_PHASES];
+  uint8_t phaseCount = 0;
+  portMUX_TYPE phasesMux = portMUX_INITIALIZER_UNLOCKED;
+
+  void mark(const char* phase) {
+    uint32_t now = (uint32_t)(esp_timer_get_time() / 1000);
+    boolean added = false;
+    portENTER_CRITICAL(&phasesMux);
+    boolean known = false;
+    for (uint8_t i = 0; i < phaseCount; i++) {
+      if (phases[i].name == phase) known = true;
+    }
+    if (!known && phaseCount < BOOT_PROFILE_MAX_PHASES) {
+      phases[phaseCount++] = { phase, now };
+      added = true;
+    }
+    portEXIT_CRITICAL(&phasesMux);
+    if (added) ESP_LOGI(TAG, "Boot phase %s done after %u ms", phase, now);
+  }
+
+  uint32_t get(const char* phase) {
+    portENTER_CRITICAL(&phasesMux);
+    uint8_t count = phaseCount;
+    portEXIT_CRITICAL(&phasesMux);
+    for (uint8_t i = 0; i < count; i++) {
+      if (strcmp(phases[i].name, phase) == 0) return phases[i].doneAt;
+    }
+    return 0;
+  }
+
+  void toJson(JsonObject obj) {
+    portENTER_CRITICAL(&phasesMux);
+    uint8_t count = phaseCount;
+    portEXIT_CRITICAL(&phasesMux);
+    // entries are never changed once added
+    for (uint8_t i = 0; i < count; i++) obj[phases[i].name] = phases[i].doneAt;
+  }
+}
@@ -0,0 +1,92 @@
+#include <cadence.h>
+#include <config.h>
+
+// Local logging tag
+static const char TAG[] = __FILE__;
+
+namespace Cadence {
+  // rates of change per minute at or above which a measurement asks for CADENCE_FAST or CADENCE_NORMAL
+  struct Trend {
+    MeasurementId id;
+    float fastRate;
+    float slowRate;
+  };
+
+  const Trend trends[] = {
+    { MEASUREMENT_CO2,        20, 8 },   // ppm, one person in a small room is around 10 ppm per minute
+    { MEASUREMENT_MASS_PM2_5,  5, 1 },   // µg/m³
+    { MEASUREMENT_IAQ,        10, 3 },
+  };
+  const uint8_t TREND_COUNT = sizeof(trends) / sizeof(trends[0]);
+
+  // value and time the rate of every trend is taken from per sensor, as sensors of the same measurement
+  // differ by their offsets
+  boolean referenced[SOURCE_COUNT][TREND_COUNT] = {};
+  float references[SOURCE_COUNT][TREND_COUNT];
+  uint32_t referenceTimes[SOURCE_COUNT][TREND_COUNT];
+  float rates[SOURCE_COUNT][TREND_COUNT] = {};
+  // direction of a jump by fastRate within the rate window, it only counts once the next reading confirms it
+  int8_t jumps[SOURCE_COUNT][TREND_COUNT] = {};
+
+  volatile CadenceLevel level = CADENCE_FAST;
+  uint32_t levelConfirmed = 0;   // millis() when the readings last asked for level or faster
+
+  const char* const levelNames[] = { "fast", "normal", "slow" };
+
+  void updateLevel(uint32_t now) {
+    CadenceLevel wanted = CADENCE_SLOW;
+    for (uint8_t s = 0; s < SOURCE_COUNT; s++) {
+      for (uint8_t i = 0; i < TREND_COUNT; i++) {
+        if (!referenced[s][i] || now - referenceTimes[s][i] >= CADENCE_RATE_EXPIRY) continue;
+        if (rates[s][i] >= trends[i].fastRate) {
+          wanted = CADENCE_FAST;
+        } else if (rates[s][i] >= trends[i].slowRate && wanted == CADENCE_SLOW) {
+          wanted = CADENCE_NORMAL;
+        }
+      }
+    }
+
+    if (wanted <= level) {
+      if (wanted < level) ESP_LOGI(TAG, "Cadence %s -> %s", levelNames[level], levelNames[wanted]);
+      level = wanted;
+      levelConfirmed = now;
+    } else if (now - levelConfirmed >= CADENCE_STABLE_TIME) {
+      CadenceLevel slower = (CadenceLevel)(level + 1);
+      ESP_LOGI(TAG, "Cadence %s -> %s", levelNames[level], levelNames[slower]);
+      level = slower;
+      levelConfirmed = now;
+    }
+  }
+
+  void addReading(SensorSource source, MeasurementId id, float value) {
+    uint8_t i = 0;
+    while (i < TREND_COUNT && trends[i].id != id) i++;
+    if (i == TREND_COUNT || isnan(value)) return;
+
+    uint32_t now = millis();
+    if (!referenced[source][i]) {
+      referenced[source][i] = true;
+      references[source][i] = value;
+      referenceTimes[source][i] = now;
+    } else {
+      // short intervals make noise look like a trend, only a jump by fastRate that two readings in a row
+      // agree on counts before the window is over
+      float change = fabsf(value - references[source][i]);
+      uint32_t elapsed = now - referenceTimes[source][i];
+      int8_t jump = change < trends[i].fastRate ? 0 : value > references[source][i] ? 1 : -1;
+      boolean confirmed = jump != 0 && jump == jumps[source][i];
+      jumps[source][i] = jump;
+      if (elapsed >= CADENCE_RATE_WINDOW || confirmed) {
+        rates[source][i] = change * 60000 / max(elapsed, (uint32_t)CADENCE_RATE_WINDOW);
+        references[source][i] = value;
+        referenceTimes[source][i] = now;
+        jumps[source][i] = 0;
+      }
+    }
+    updateLevel(now);
+  }
+
+  CadenceLevel getLevel() {
+    return level;
+  }
+}
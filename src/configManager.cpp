@@ -1,4 +1,5 @@
 #include <configManager.h>
+#include <configStore.h>
 
 #include <FS.h>
 #include <LittleFS.h>
@@ -7,8 +8,6 @@
 // Local logging tag
 static const char TAG[] = __FILE__;
 
-Config config;
-
 // Allocate a temporary JsonDocument
 // Don't forget to change the capacity to match your requirements.
 // Use arduinojson.org/v6/assistant to compute the capacity.
@@ -21,6 +20,7 @@ Config config;
   "mqttHost": "1234567891123456789212345678931",
   "mqttUseTls": false,
   "mqttInsecure": false,
+  "mqttV5": false,
   "mqttServerPort": 65535,
   "altitude": 12345,
   "co2GreenThreshold": 0,
@@ -60,56 +60,20 @@ Config config;
 }
 */
 
-#define DEFAULT_DEVICE_ID                  0
-#define DEFAULT_MQTT_TOPIC      "co2monitor"
-#define DEFAULT_MQTT_HOST        "127.0.0.1"
-#define DEFAULT_MQTT_PORT               1883
-#define DEFAULT_MQTT_USERNAME   "co2monitor"
-#define DEFAULT_MQTT_PASSWORD   "co2monitor"
-#define DEFAULT_MQTT_USE_TLS           false
-#define DEFAULT_MQTT_INSECURE          false
-#define DEFAULT_ALTITUDE                   5
-#define DEFAULT_CO2_GREEN_THRESHOLD        0
-#define DEFAULT_CO2_YELLOW_THRESHOLD     700
-#define DEFAULT_CO2_RED_THRESHOLD        900
-#define DEFAULT_CO2_DARK_RED_THRESHOLD  1200
-#define DEFAULT_IAQ_GREEN_THRESHOLD        0
-#define DEFAULT_IAQ_YELLOW_THRESHOLD     100
-#define DEFAULT_IAQ_RED_THRESHOLD        200
-#define DEFAULT_IAQ_DARK_RED_THRESHOLD   300
-#define DEFAULT_BRIGHTNESS               255
-#define DEFAULT_SSD1306_ROWS              64
-//27
-#define DEFAULT_GREEN_LED                 0
-#define DEFAULT_YELLOW_LED                26
-#define DEFAULT_RED_LED                   25
-// 16
-#define DEFAULT_NEOPIXEL_DATA              0
-#define DEFAULT_NEOPIXEL_NUMBER            3
-// 14
-#define DEFAULT_NEOPIXEL_MATRIX_DATA       0
-// 27
-#define DEFAULT_FEATHER_MATRIX_DATA        0
-#define DEFAULT_FEATHER_MATRIX_CLK        13
-#define DEFAULT_MATRIX_COLUMNS            12
-#define DEFAULT_MATRIX_ROWS                5
-#define DEFAULT_MATRIX_LAYOUT              0
-// 15
-#define DEFAULT_HUB75_R1                   0
-#define DEFAULT_HUB75_G1                   2
-#define DEFAULT_HUB75_B1                   4
-#define DEFAULT_HUB75_R2                  16
-#define DEFAULT_HUB75_G2                  12
-#define DEFAULT_HUB75_B2                  17
-#define DEFAULT_HUB75_CH_A                 5
-#define DEFAULT_HUB75_CH_B                18
-#define DEFAULT_HUB75_CH_C                19
-#define DEFAULT_HUB75_CH_D                14
-#define DEFAULT_HUB75_CLK                 27
-#define DEFAULT_HUB75_LAT                 26
-#define DEFAULT_HUB75_OE                  25
+// Write-behind state. pendingMutex guards the pending copy and its timestamps, writeMutex serializes
+// the flash writes of the save task and flushConfiguration().
+TaskHandle_t configSaveTask = nullptr;
+SemaphoreHandle_t pendingMutex;
+SemaphoreHandle_t writeMutex;
+Config pendingConfig;
+bool pending = false;
+uint32_t firstUnsavedChange;
+uint32_t lastChange;
+Config persistedConfig;
+bool persistedValid = false;
+ConfigPersistenceStats persistenceStats = {};
 
-std::vector<ConfigParameterBase<Config>*> configParameterVector;
+void configSaveLoop(void* pvParameters);
 
 void setupConfigManager() {
   if (!LittleFS.begin(true)) {
@@ -119,69 +83,47 @@ void setupConfigManager() {
       ESP_LOGW(TAG, "LittleFS failed second time!");
     }
   }
-  //  configParameterVector.clear();
-  configParameterVector.push_back(new Uint16ConfigParameter<Config>("deviceId", "Device ID", &Config::deviceId, DEFAULT_DEVICE_ID));
-  configParameterVector.push_back(new CharArrayConfigParameter<Config>("mqttTopic", "MQTT topic", (char Config::*) & Config::mqttTopic, DEFAULT_MQTT_TOPIC, MQTT_TOPIC_LEN));
-  configParameterVector.push_back(new CharArrayConfigParameter<Config>("mqttUsername", "MQTT username", (char Config::*) & Config::mqttUsername, DEFAULT_MQTT_USERNAME, MQTT_USERNAME_LEN));
-  configParameterVector.push_back(new CharArrayConfigParameter<Config>("mqttPassword", "MQTT password", (char Config::*) & Config::mqttPassword, DEFAULT_MQTT_PASSWORD, MQTT_PASSWORD_LEN));
-  configParameterVector.push_back(new CharArrayConfigParameter<Config>("mqttHost", "MQTT host", (char Config::*) & Config::mqttHost, DEFAULT_MQTT_HOST, MQTT_HOSTNAME_LEN));
-  configParameterVector.push_back(new Uint16ConfigParameter<Config>("mqttServerPort", "MQTT port", &Config::mqttServerPort, DEFAULT_MQTT_PORT));
-  configParameterVector.push_back(new BooleanConfigParameter<Config>("mqttUseTls", "MQTT use TLS", &Config::mqttUseTls, DEFAULT_MQTT_USE_TLS));
-  configParameterVector.push_back(new BooleanConfigParameter<Config>("mqttInsecure", "MQTT ignore certificate errors", &Config::mqttInsecure, DEFAULT_MQTT_INSECURE));
-  configParameterVector.push_back(new Uint16ConfigParameter<Config>("altitude", "Altitude", &Config::altitude, DEFAULT_ALTITUDE, 0, 8000));
-  configParameterVector.push_back(new Uint16ConfigParameter<Config>("co2GreenThreshold", "CO2 Green threshold ", &Config::co2GreenThreshold, DEFAULT_CO2_GREEN_THRESHOLD));
-  configParameterVector.push_back(new Uint16ConfigParameter<Config>("co2YellowThreshold", "CO2 Yellow threshold ", &Config::co2YellowThreshold, DEFAULT_CO2_YELLOW_THRESHOLD));
-  configParameterVector.push_back(new Uint16ConfigParameter<Config>("co2RedThreshold", "CO2 Red threshold", &Config::co2RedThreshold, DEFAULT_CO2_RED_THRESHOLD));
-  configParameterVector.push_back(new Uint16ConfigParameter<Config>("co2DarkRedThreshold", "CO2 Dark red threshold", &Config::co2DarkRedThreshold, DEFAULT_CO2_DARK_RED_THRESHOLD));
-  configParameterVector.push_back(new Uint16ConfigParameter<Config>("iaqGreenThreshold", "IAQ Green threshold ", &Config::iaqGreenThreshold, DEFAULT_IAQ_GREEN_THRESHOLD));
-  configParameterVector.push_back(new Uint16ConfigParameter<Config>("iaqYellowThreshold", "IAQ Yellow threshold ", &Config::iaqYellowThreshold, DEFAULT_IAQ_YELLOW_THRESHOLD));
-  configParameterVector.push_back(new Uint16ConfigParameter<Config>("iaqRedThreshold", "IAQ Red threshold", &Config::iaqRedThreshold, DEFAULT_IAQ_RED_THRESHOLD));
-  configParameterVector.push_back(new Uint16ConfigParameter<Config>("iaqDarkRedThreshold", "IAQ Dark red threshold", &Config::iaqDarkRedThreshold, DEFAULT_IAQ_DARK_RED_THRESHOLD));
-  configParameterVector.push_back(new Uint8ConfigParameter<Config>("brightness", "LED brightness pwm", &Config::brightness, DEFAULT_BRIGHTNESS));
-  configParameterVector.push_back(new Uint8ConfigParameter<Config>("ssd1306Rows", "SSD1306 rows", &Config::ssd1306Rows, DEFAULT_SSD1306_ROWS, 32, 64, true));
-  configParameterVector.push_back(new Uint8ConfigParameter<Config>("greenLed", "Green Led pin", &Config::greenLed, DEFAULT_GREEN_LED, true));
-  configParameterVector.push_back(new Uint8ConfigParameter<Config>("yellowLed", "Yellow Led pin", &Config::yellowLed, DEFAULT_YELLOW_LED, true));
-  configParameterVector.push_back(new Uint8ConfigParameter<Config>("redLed", "Red Led pin", &Config::redLed, DEFAULT_RED_LED, true));
-  configParameterVector.push_back(new Uint8ConfigParameter<Config>("neopixelData", "Neopixel data pin", &Config::neopixelData, DEFAULT_NEOPIXEL_DATA, true));
-  configParameterVector.push_back(new Uint8ConfigParameter<Config>("neopixelNumber", "Number of Neopixels", &Config::neopixelNumber, DEFAULT_NEOPIXEL_NUMBER, true));
-  configParameterVector.push_back(new Uint8ConfigParameter<Config>("neopixelMatrixData", "Neopixel matrix data pin", &Config::neopixelMatrixData, DEFAULT_NEOPIXEL_MATRIX_DATA, true));
-  configParameterVector.push_back(new Uint8ConfigParameter<Config>("featherMatrixData", "Feather matrix data pin", &Config::featherMatrixData, DEFAULT_FEATHER_MATRIX_DATA, true));
-  configParameterVector.push_back(new Uint8ConfigParameter<Config>("featherMatrixClock", "Feather matrix clock pin", &Config::featherMatrixClock, DEFAULT_FEATHER_MATRIX_CLK, true));
-  configParameterVector.push_back(new Uint8ConfigParameter<Config>("matrixColumns", "Matrix columns", &Config::matrixColumns, DEFAULT_MATRIX_COLUMNS, true));
-  configParameterVector.push_back(new Uint8ConfigParameter<Config>("matrixRows", "Matrix rows", &Config::matrixRows, DEFAULT_MATRIX_ROWS, true));
-  configParameterVector.push_back(new Uint8ConfigParameter<Config>("matrixLayout", "Matrix layout", &Config::matrixLayout, DEFAULT_MATRIX_LAYOUT, true));
-  configParameterVector.push_back(new Uint8ConfigParameter<Config>("hub75R1", "Hub75 R1 pin", &Config::hub75R1, DEFAULT_HUB75_R1, true));
-  configParameterVector.push_back(new Uint8ConfigParameter<Config>("hub75G1", "Hub75 G1 pin", &Config::hub75G1, DEFAULT_HUB75_G1, true));
-  configParameterVector.push_back(new Uint8ConfigParameter<Config>("hub75B1", "Hub75 B1 pin", &Config::hub75B1, DEFAULT_HUB75_B1, true));
-  configParameterVector.push_back(new Uint8ConfigParameter<Config>("hub75R2", "Hub75 R2 pin", &Config::hub75R2, DEFAULT_HUB75_R2, true));
-  configParameterVector.push_back(new Uint8ConfigParameter<Config>("hub75G2", "Hub75 G2 pin", &Config::hub75G2, DEFAULT_HUB75_G2, true));
-  configParameterVector.push_back(new Uint8ConfigParameter<Config>("hub75B2", "Hub75 B2 pin", &Config::hub75B2, DEFAULT_HUB75_B2, true));
-  configParameterVector.push_back(new Uint8ConfigParameter<Config>("hub75ChA", "Hub75 Channel A pin", &Config::hub75ChA, DEFAULT_HUB75_CH_A, true));
-  configParameterVector.push_back(new Uint8ConfigParameter<Config>("hub75ChB", "Hub75 Channel B pin", &Config::hub75ChB, DEFAULT_HUB75_CH_B, true));
-  configParameterVector.push_back(new Uint8ConfigParameter<Config>("hub75ChC", "Hub75 Channel C pin", &Config::hub75ChC, DEFAULT_HUB75_CH_C, true));
-  configParameterVector.push_back(new Uint8ConfigParameter<Config>("hub75ChD", "Hub75 Channel D pin", &Config::hub75ChD, DEFAULT_HUB75_CH_D, true));
-  configParameterVector.push_back(new Uint8ConfigParameter<Config>("hub75Clk", "Hub75 Clk pin", &Config::hub75Clk, DEFAULT_HUB75_CLK, true));
-  configParameterVector.push_back(new Uint8ConfigParameter<Config>("hub75Lat", "Hub75 Lat pin", &Config::hub75Lat, DEFAULT_HUB75_LAT, true));
-  configParameterVector.push_back(new Uint8ConfigParameter<Config>("hub75Oe", "Hub75 Oe pin", &Config::hub75Oe, DEFAULT_HUB75_OE, true));
-}
-
-std::vector<ConfigParameterBase<Config>*> getConfigParameters() {
-  return configParameterVector;
+  pendingMutex = xSemaphoreCreateMutex();
+  writeMutex = xSemaphoreCreateMutex();
+  xTaskCreatePinnedToCore(configSaveLoop,  // task function
+    "configSaveLoop",   // name of task
+    4096,               // stack size of task
+    (void*)1,           // parameter of the task
+    1,                  // priority of the task
+    &configSaveTask,    // task handle
+    1);                 // CPU core
 }
 
-void getDefaultConfiguration(Config& _config) {
-  for (ConfigParameterBase<Config>* configParameter : configParameterVector) {
-    configParameter->setToDefault(_config);
+boolean importAndStore(Config& _config) {
+  if (!importConfiguration(_config)) return false;
+  if (ConfigStore::save(_config)) {
+    persistedConfig = _config;
+    persistedValid = true;
   }
+  File marker = LittleFS.open(CONFIG_IMPORTED_FILENAME, FILE_WRITE);
+  marker.close();
+  return true;
 }
 
-void logConfiguration(const Config _config) {
-  for (ConfigParameterBase<Config>* configParameter : configParameterVector) {
-    ESP_LOGD(TAG, "%s: %s", configParameter->getId(), configParameter->toString(_config).c_str());
+/**
+ * Reads the binary image from NVS. The JSON file is imported instead if it was uploaded with a new file
+ * system image (no import marker), or if there's no valid binary image, e.g. after a schema change.
+ */
+boolean loadConfiguration(Config& _config) {
+  if (!LittleFS.exists(CONFIG_IMPORTED_FILENAME) && LittleFS.exists(CONFIG_FILENAME)) {
+    ESP_LOGI(TAG, "Importing new %s", CONFIG_FILENAME);
+    if (importAndStore(_config)) return true;
   }
+  if (ConfigStore::load(_config)) {
+    persistedConfig = _config;
+    persistedValid = true;
+    return true;
+  }
+  ESP_LOGI(TAG, "No valid binary config, importing %s", CONFIG_FILENAME);
+  return importAndStore(_config);
 }
 
-boolean loadConfiguration(Config& _config) {
+boolean importConfiguration(Config& _config) {
   File file = LittleFS.open(CONFIG_FILENAME, FILE_READ);
   if (!file) {
     ESP_LOGW(TAG, "Could not open config file");
@@ -197,46 +139,143 @@ boolean loadConfiguration(Config& _config) {
   if (error) {
     ESP_LOGW(TAG, "Failed to parse config file: %s", error.f_str());
     file.close();
+    delete doc;
     return false;
   }
 
-  for (ConfigParameterBase<Config>* configParameter : configParameterVector) {
-    configParameter->fromJson(_config, doc, true);
+  for (const ConfigParameter& configParameter : getConfigParameters()) {
+    configParameter.fromJson(_config, doc, true);
   }
 
   file.close();
+  delete doc;
   return true;
 }
 
-boolean saveConfiguration(const Config _config) {
-  ESP_LOGD(TAG, "###################### saveConfiguration");
+// The binary image is the configuration used on boot, the JSON file follows as an export.
+boolean writeConfiguration(const Config& _config) {
+  if (persistedValid && memcmp(&persistedConfig, &_config, sizeof(Config)) == 0) {
+    persistenceStats.unchanged++;
+    return true;
+  }
+  ESP_LOGD(TAG, "###################### writeConfiguration");
   logConfiguration(_config);
-  // Delete existing file, otherwise the configuration is appended to the file
-  if (LittleFS.exists(CONFIG_FILENAME)) {
-    LittleFS.remove(CONFIG_FILENAME);
+  uint32_t start = millis();
+  if (!ConfigStore::save(_config)) {
+    persistenceStats.failures++;
+    persistedValid = false;
+    return false;
+  }
+  exportConfiguration(_config);
+  persistenceStats.lastWriteTime = millis() - start;
+  persistenceStats.maxWriteTime = max(persistenceStats.maxWriteTime, persistenceStats.lastWriteTime);
+  persistenceStats.writes++;
+  persistedConfig = _config;
+  persistedValid = true;
+  return true;
+}
+
+/**
+ * Hands the configuration to the save task and returns straight away. Rapid successive changes, e.g. a
+ * portal save followed by setConfig, are coalesced into a single flash write. Use flushConfiguration()
+ * before rebooting. Only called after setupConfigManager(), which creates the task and its mutexes.
+ */
+boolean saveConfiguration(const Config _config) {
+  xSemaphoreTake(pendingMutex, portMAX_DELAY);
+  if (!pending) firstUnsavedChange = millis();
+  lastChange = millis();
+  pendingConfig = _config;
+  pending = true;
+  persistenceStats.requested++;
+  xSemaphoreGive(pendingMutex);
+  xTaskNotifyGive(configSaveTask);
+  return true;
+}
+
+// Writes a pending configuration now, returns false if writing it failed. A failed write stays pending and
+// is retried by the save task after CONFIG_SAVE_DELAY, unless a newer change replaced it meanwhile.
+boolean flushConfiguration() {
+  xSemaphoreTake(writeMutex, portMAX_DELAY);
+  xSemaphoreTake(pendingMutex, portMAX_DELAY);
+  bool hasPending = pending;
+  Config snapshot;
+  if (hasPending) snapshot = pendingConfig;
+  pending = false;
+  xSemaphoreGive(pendingMutex);
+  boolean success = !hasPending || writeConfiguration(snapshot);
+  if (!success) {
+    xSemaphoreTake(pendingMutex, portMAX_DELAY);
+    if (!pending) {
+      pendingConfig = snapshot;
+      pending = true;
+      firstUnsavedChange = lastChange = millis();
+    }
+    xSemaphoreGive(pendingMutex);
   }
+  xSemaphoreGive(writeMutex);
+  return success;
+}
+
+void configSaveLoop(void* pvParameters) {
+  _ASSERT((uint32_t)pvParameters == 1);
+  while (1) {
+    TickType_t wait = portMAX_DELAY;
+    xSemaphoreTake(pendingMutex, portMAX_DELAY);
+    if (pending) {
+      uint32_t quiet = millis() - lastChange;
+      uint32_t age = millis() - firstUnsavedChange;
+      if (quiet >= CONFIG_SAVE_DELAY || age >= CONFIG_SAVE_MAX_DELAY) {
+        wait = 0;
+      } else {
+        wait = pdMS_TO_TICKS(min(CONFIG_SAVE_DELAY - quiet, CONFIG_SAVE_MAX_DELAY - age));
+      }
+    }
+    xSemaphoreGive(pendingMutex);
+    if (wait == 0) {
+      if (!flushConfiguration()) ESP_LOGW(TAG, "Failed to save configuration");
+    } else {
+      ulTaskNotifyTake(pdTRUE, wait);
+    }
+  }
+  vTaskDelete(NULL);
+}
+
+ConfigPersistenceStats getConfigPersistenceStats() {
+  return persistenceStats;
+}
 
-  // Open file for writing
-  File file = LittleFS.open(CONFIG_FILENAME, FILE_WRITE);
+void logConfigPersistence() {
+  ESP_LOGI(TAG, "Config saves requested %u, flash writes %u, unchanged %u, failed %u, write time last %u ms, max %u ms",
+    persistenceStats.requested, persistenceStats.writes, persistenceStats.unchanged, persistenceStats.failures,
+    persistenceStats.lastWriteTime, persistenceStats.maxWriteTime);
+}
+
+// Writes a temporary file and renames it over the export, so there's always a complete config.json.
+boolean exportConfiguration(const Config _config) {
+  File file = LittleFS.open(TEMP_CONFIG_FILENAME, FILE_WRITE);
   if (!file) {
     ESP_LOGW(TAG, "Could not create config file for writing");
     return false;
   }
 
   DynamicJsonDocument* doc = new DynamicJsonDocument(CONFIG_SIZE);
-  for (ConfigParameterBase<Config>* configParameter : configParameterVector) {
-    configParameter->toJson(_config, doc);
+  for (const ConfigParameter& configParameter : getConfigParameters()) {
+    configParameter.toJson(_config, doc);
   }
 
   // Serialize JSON to file
-  if (serializeJson(*doc, file) == 0) {
+  size_t written = serializeJson(*doc, file);
+  delete doc;
+  file.close();
+  if (written == 0) {
     ESP_LOGW(TAG, "Failed to write to file");
-    file.close();
+    LittleFS.remove(TEMP_CONFIG_FILENAME);
+    return false;
+  }
+  if (!LittleFS.rename(TEMP_CONFIG_FILENAME, CONFIG_FILENAME)) {
+    ESP_LOGW(TAG, "Failed to replace config file");
     return false;
   }
-
-  // Close the file
-  file.close();
   ESP_LOGD(TAG, "Stored configuration successfully");
   return true;
 }
@@ -3,359 +3,173 @@
 // Local logging tag
 static const char TAG[] = __FILE__;
 
-// -------------------- generic -------------------
-template <typename C, typename T>
-ConfigParameter<C, T>::ConfigParameter(const char* _id, const char* _label, T C::* _valuePtr, uint8_t _maxStrLen, bool _rebootRequiredOnChange) {
-  this->id = _id;
-  this->label = _label;
-  this->valuePtr = _valuePtr;
-  this->maxStrLen = _maxStrLen;
-  this->rebootRequiredOnChange = _rebootRequiredOnChange;
-}
-
-template <typename C, typename T>
-uint8_t ConfigParameter<C, T>::getMaxStrLen(void) {
-  return this->maxStrLen;
+uint16_t ConfigParameter::getValue(const Config& config) const {
+  const uint8_t* field = (const uint8_t*)&config + offset;
+  if (type == CONFIG_PARAMETER_UINT16) return *(const uint16_t*)field;
+  if (type == CONFIG_PARAMETER_BOOLEAN) return *(const bool*)field;
+  return *field;
+}
+
+void ConfigParameter::setValue(Config& config, uint16_t value) const {
+  uint8_t* field = (uint8_t*)&config + offset;
+  if (type == CONFIG_PARAMETER_UINT16) {
+    *(uint16_t*)field = value;
+  } else if (type == CONFIG_PARAMETER_BOOLEAN) {
+    *(bool*)field = value != 0;
+  } else {
+    *field = (uint8_t)value;
+  }
 }
 
-template <typename C, typename T>
-const char* ConfigParameter<C, T>::getId() {
-  return this->id;
+char* ConfigParameter::getString(Config& config) const {
+  return (char*)&config + offset;
 }
 
-template <typename C, typename T>
-const char* ConfigParameter<C, T>::getLabel() {
-  return this->label;
+// Copies at most maxStrLen - 1 characters, returns false if the value didn't change.
+bool ConfigParameter::setString(Config& config, const char* str) const {
+  char* field = getString(config);
+  if (strcmp(field, str) == 0) return false;
+  size_t len = min(strlen(str), (size_t)(maxStrLen - 1));
+  strncpy(field, str, len);
+  field[len] = 0x00;
+  return true;
 }
 
-template <typename C, typename T>
-bool ConfigParameter<C, T>::isNumber() {
-  return false;
+void ConfigParameter::getMinimum(char* str) const {
+  if (isNumber() || isEnum()) {
+    snprintf(str, 6, "%d", minValue);
+  } else {
+    str[0] = 0;
+  }
 }
 
-template <typename C, typename T>
-bool ConfigParameter<C, T>::isBoolean() {
-  return false;
+void ConfigParameter::getMaximum(char* str) const {
+  if (isNumber() || isEnum()) {
+    snprintf(str, 6, "%d", maxValue);
+  } else {
+    str[0] = 0;
+  }
 }
 
-template <typename C, typename T>
-T* ConfigParameter<C, T>::getValuePtr() {
-  return this->valuePtr;
+void ConfigParameter::print(const Config& config, char* str) const {
+  switch (type) {
+  case CONFIG_PARAMETER_BOOLEAN:
+    sprintf(str, "%s", getValue(config) ? "true" : "false");
+    break;
+  case CONFIG_PARAMETER_CHAR_ARRAY:
+    sprintf(str, "%s", (const char*)&config + offset);
+    break;
+  case CONFIG_PARAMETER_ENUM:
+    sprintf(str, "%s", enumLabels[getValue(config)]);
+    break;
+  default:
+    sprintf(str, "%u", getValue(config));
+  }
 }
 
-template <typename C, typename T>
-void ConfigParameter<C, T>::getMinimum(char* str) { str[0] = 0; }
-
-template <typename C, typename T>
-void ConfigParameter<C, T>::getMaximum(char* str) { str[0] = 0; }
-
-template <typename C, typename T>
-String ConfigParameter<C, T>::toString(const C config) {
-  char buffer[this->getMaxStrLen()] = { 0 };
-  this->print(config, buffer);
+String ConfigParameter::toString(const Config& config) const {
+  char buffer[maxStrLen + 1];
+  buffer[0] = 0x00;
+  print(config, buffer);
   return String(buffer);
 }
 
-template <typename C, typename T>
-bool ConfigParameter<C, T>::isRebootRequiredOnChange() {
-  return this->rebootRequiredOnChange;
-}
-
-template <typename C, typename T>
-bool ConfigParameter<C, T>::isEnum() {
-  return false;
-}
-
-template <typename C, typename T>
-const char** ConfigParameter<C, T>::getEnumLabels(void) { return nullptr; };
-
-
-// -------------------- number -------------------
-template <typename C, typename T>
-NumberConfigParameter<C, T>::NumberConfigParameter(const char* _id, const char* _label, T C::* _valuePtr, T _defaultValue, uint8_t _maxStrLen, T _min, T _max, bool _rebootRequiredOnChange) :
-  ConfigParameter<C, T>(_id, _label, _valuePtr, _maxStrLen, _rebootRequiredOnChange) {
-  this->minValue = _min;
-  this->maxValue = _max;
-  _ASSERT(_min <= _defaultValue);
-  _ASSERT(_defaultValue <= _max);
-  this->defaultValue = _defaultValue;
-}
-
-template <typename C, typename T>
-NumberConfigParameter<C, T>::~NumberConfigParameter() {};
-
-template <typename C, typename T>
-bool NumberConfigParameter<C, T>::isNumber() {
-  return true;
-}
-
-template <typename C, typename T>
-void NumberConfigParameter<C, T>::getMinimum(char* str) {
-  snprintf(str, 6, "%d", this->minValue);
-}
-
-template <typename C, typename T>
-void NumberConfigParameter<C, T>::getMaximum(char* str) {
-  snprintf(str, 6, "%d", this->maxValue);
-}
-
-template <typename C, typename T>
-void NumberConfigParameter<C, T>::setToDefault(C& config) {
-  config.*(this->valuePtr) = this->defaultValue;
-}
-
-template <typename C, typename T>
-void NumberConfigParameter<C, T>::toJson(const C config, DynamicJsonDocument* doc) {
-  (*doc)[this->getId()] = config.*(this->valuePtr);
-};
-
-template <typename C, typename T>
-bool NumberConfigParameter<C, T>::fromJson(C& config, DynamicJsonDocument* doc, bool useDefaultIfNotPresent) {
-  if ((*doc).containsKey(this->getId()) && (*doc)[(const char*)this->getId()].is<T>()) {
-    T value = (*doc)[(const char*)this->getId()].as<T>();
-    if (value < this->minValue || value > this->maxValue) {
-      ESP_LOGI(TAG, "Ignoring JSON value %d for %s outside range [%i,%i]", value, this->getId(), this->minValue, this->maxValue);
+// Parses a value from the web portal, returns true if it changed.
+bool ConfigParameter::save(Config& config, const char* str) const {
+  uint16_t value;
+  switch (type) {
+  case CONFIG_PARAMETER_CHAR_ARRAY:
+    return setString(config, str);
+  case CONFIG_PARAMETER_BOOLEAN:
+    value = strcmp("true", str) == 0 || strcmp("on", str) == 0;
+    break;
+  case CONFIG_PARAMETER_ENUM:
+    for (uint16_t i = minValue; i <= maxValue; i++) {
+      if (strcmp(enumLabels[i], str) == 0) {
+        if (getValue(config) == i) return false;
+        setValue(config, i);
+        return true;
+      }
+    }
+    // fall through - the portal sends the ordinal
+  default:
+    value = type == CONFIG_PARAMETER_UINT16 ? (uint16_t)atoi(str) : (uint8_t)atoi(str);
+    if (value < minValue || value > maxValue) {
+      ESP_LOGI(TAG, "Ignoring parsed value %d outside range [%u,%u]", value, minValue, maxValue);
       return false;
     }
-    config.*(this->valuePtr) = value;
-    return true;
-  } else if (useDefaultIfNotPresent) {
-    this->setToDefault(config);
-    return true;
   }
-  return false;
-};
-
-template <typename C, typename T>
-u_int16_t NumberConfigParameter<C, T>::getValueOrdinal(const C config) {
-  return config.*(this->valuePtr) - minValue;
-};
-
-// -------------------- uint8_t -------------------
-template <typename C>
-Uint8ConfigParameter<C>::Uint8ConfigParameter(const char* _id, const char* _label, uint8_t C::* _valuePtr, uint8_t _defaultValue, uint8_t _min, uint8_t _max, bool _rebootRequiredOnChange) :
-  NumberConfigParameter<C, uint8_t>(_id, _label, _valuePtr, _defaultValue, 4, _min, _max, _rebootRequiredOnChange) {}
-
-template <typename C>
-Uint8ConfigParameter<C>::Uint8ConfigParameter(const char* _id, const char* _label, uint8_t C::* _valuePtr, uint8_t _defaultValue, bool _rebootRequiredOnChange) :
-  NumberConfigParameter<C, uint8_t>(_id, _label, _valuePtr, _defaultValue, 4, 0, 255, _rebootRequiredOnChange) {}
-
-template <typename C>
-Uint8ConfigParameter<C>::~Uint8ConfigParameter() {};
-
-template <typename C>
-void Uint8ConfigParameter<C>::print(const C config, char* str) {
-  sprintf(str, "%u", config.*(this->valuePtr));
-}
-
-template <typename C>
-bool Uint8ConfigParameter<C>::save(C& config, const char* str) {
-  uint8_t value = (uint8_t)atoi(str);
-  if (config.*(this->valuePtr) == value) return false;
-  if (value < this->minValue || value > this->maxValue) {
-    ESP_LOGI(TAG, "Ignoring parsed value %d outside range [%u,%u]", value, this->minValue, this->maxValue);
-    return false;
-  }
-  config.*(this->valuePtr) = value;
+  if (getValue(config) == value) return false;
+  setValue(config, value);
   return true;
 }
 
-// -------------------- uint16_t -------------------
-template <typename C>
-Uint16ConfigParameter<C>::Uint16ConfigParameter(const char* _id, const char* _label, uint16_t C::* _valuePtr, uint16_t _defaultValue, uint16_t _min, uint16_t _max, bool _rebootRequiredOnChange) :
-  NumberConfigParameter<C, uint16_t>(_id, _label, _valuePtr, _defaultValue, 6, _min, _max, _rebootRequiredOnChange) {}
-
-template <typename C>
-Uint16ConfigParameter<C>::Uint16ConfigParameter(const char* _id, const char* _label, uint16_t C::* _valuePtr, uint16_t _defaultValue, bool _rebootRequiredOnChange) :
-  NumberConfigParameter<C, uint16_t>(_id, _label, _valuePtr, _defaultValue, 6, 0, 65535, _rebootRequiredOnChange) {}
-
-template <typename C>
-Uint16ConfigParameter<C>::~Uint16ConfigParameter() {}
-
-template <typename C>
-void Uint16ConfigParameter<C>::print(const C config, char* str) {
-  sprintf(str, "%u", config.*(this->valuePtr));
-}
-
-template <typename C>
-bool Uint16ConfigParameter<C>::save(C& config, const char* str) {
-  uint16_t value = (uint16_t)atoi(str);
-  if (config.*(this->valuePtr) == value) return false;
-  if (value < this->minValue || value > this->maxValue) {
-    ESP_LOGI(TAG, "Ignoring parsed value %d outside range [%u,%u]", value, this->minValue, this->maxValue);
-    return false;
+void ConfigParameter::setToDefault(Config& config) const {
+  if (type == CONFIG_PARAMETER_CHAR_ARRAY) {
+    setString(config, defaultString);
+  } else {
+    setValue(config, defaultValue);
   }
-  config.*(this->valuePtr) = value;
-  return true;
-}
-
-// -------------------- bool -------------------
-template <typename C>
-BooleanConfigParameter<C>::BooleanConfigParameter(const char* _id, const char* _label, bool C::* _valuePtr, bool _defaultValue, bool _rebootRequiredOnChange)
-  :ConfigParameter<C, bool>(_id, _label, _valuePtr, 6, _rebootRequiredOnChange) {
-  this->defaultValue = _defaultValue;
-}
-
-template <typename C>
-BooleanConfigParameter<C>::~BooleanConfigParameter() {}
-
-template <typename C>
-bool BooleanConfigParameter<C>::isBoolean() {
-  return true;
-}
-
-template <typename C>
-void BooleanConfigParameter<C>::print(const C config, char* str) {
-  sprintf(str, "%s", config.*(this->valuePtr) ? "true" : "false");
 }
 
-template <typename C>
-bool BooleanConfigParameter<C>::save(C& config, const char* str) {
-  bool value = strcmp("true", str) == 0 || strcmp("on", str) == 0;
-  if (config.*(this->valuePtr) == value) return false;
-  config.*(this->valuePtr) = value;
-  return true;
+void ConfigParameter::toJson(const Config& config, JsonDocument* doc) const {
+  writeJson(config, *doc);
 }
 
-template <typename C>
-void BooleanConfigParameter<C>::setToDefault(C& config) {
-  config.*(this->valuePtr) = this->defaultValue;
+void ConfigParameter::toJson(const Config& config, JsonObject object) const {
+  writeJson(config, object);
 }
 
-template <typename C>
-void BooleanConfigParameter<C>::toJson(const C config, DynamicJsonDocument* doc) {
-  (*doc)[this->getId()] = config.*(this->valuePtr);
-};
-
-template <typename C>
-bool BooleanConfigParameter<C>::fromJson(C& config, DynamicJsonDocument* doc, bool useDefaultIfNotPresent) {
-  if ((*doc).containsKey(this->getId()) && (*doc)[(const char*)this->getId()].is<bool>()) {
-    config.*(this->valuePtr) = (*doc)[(const char*)this->getId()].as<bool>();
-    return true;
-  } else if (useDefaultIfNotPresent) {
-    this->setToDefault(config);
+// Returns true if the value was present and valid (or defaulted), not whether it changed.
+bool ConfigParameter::fromJson(Config& config, JsonDocument* doc, bool useDefaultIfNotPresent) const {
+  JsonVariantConst value = (*doc)[id];
+  if (!value.isNull() && fromJson(config, value) != CONFIG_VALUE_INVALID) return true;
+  if (useDefaultIfNotPresent) {
+    setToDefault(config);
     return true;
   }
   return false;
-};
-
-template <typename C>
-u_int16_t BooleanConfigParameter<C>::getValueOrdinal(const C config) {
-  return config.*(this->valuePtr);
-};
-
-// -------------------- char* -------------------
-template <typename C>
-CharArrayConfigParameter<C>::CharArrayConfigParameter(const char* _id, const char* _label, char C::* _valuePtr, const char* _defaultValue, uint8_t _maxLen, bool _rebootRequiredOnChange)
-  :ConfigParameter<C, char>(_id, _label, _valuePtr, _maxLen, _rebootRequiredOnChange) {
-  _ASSERT(strlen(_defaultValue) <= _maxLen);
-  this->defaultValue = _defaultValue;
-}
-template <typename C>
-CharArrayConfigParameter<C>::~CharArrayConfigParameter() {}
-
-template <typename C>
-void CharArrayConfigParameter<C>::print(const C config, char* str) {
-  sprintf(str, "%s", (char*)&(config.*(this->valuePtr)));
-}
-
-template <typename C>
-bool CharArrayConfigParameter<C>::save(C& config, const char* str) {
-  bool isSame = strcmp((char*)&(config.*(this->valuePtr)), str) == 0;
-  if (isSame) return false;
-  strncpy((char*)&(config.*(this->valuePtr)), str, min(strlen(str), (size_t)(this->maxStrLen - 1)));
-  ((char*)&(config.*(this->valuePtr)))[min(strlen(str), (size_t)(this->maxStrLen - 1))] = 0x00;
-  return true;
 }
 
-template <typename C>
-void CharArrayConfigParameter<C>::setToDefault(C& config) {
-  this->save(config, defaultValue);
-}
-
-template <typename C>
-void CharArrayConfigParameter<C>::toJson(const C config, DynamicJsonDocument* doc) {
-  (*doc)[this->getId()] = (char*)&(config.*(this->valuePtr));
-};
-
-template <typename C>
-bool CharArrayConfigParameter<C>::fromJson(C& config, DynamicJsonDocument* doc, bool useDefaultIfNotPresent) {
-  if ((*doc).containsKey(this->getId()) && (*doc)[(const char*)this->getId()].is<const char*>()) {
-    const char* fromJson = (*doc)[(const char*)this->getId()].as<const char*>();
-    strncpy((char*)&(config.*(this->valuePtr)), fromJson, min(strlen(fromJson), (size_t)(this->maxStrLen - 1)));
-    ((char*)&(config.*(this->valuePtr)))[min(strlen(fromJson), (size_t)(this->maxStrLen - 1))] = 0x00;
-    return true;
-  } else if (useDefaultIfNotPresent) {
-    this->setToDefault(config);
-    return true;
+ConfigValueResult ConfigParameter::fromJson(Config& config, JsonVariantConst value) const {
+  bool valid;
+  switch (type) {
+  case CONFIG_PARAMETER_BOOLEAN:
+    valid = value.is<bool>();
+    break;
+  case CONFIG_PARAMETER_CHAR_ARRAY:
+    valid = value.is<const char*>();
+    break;
+  case CONFIG_PARAMETER_UINT16:
+    valid = value.is<uint16_t>();
+    break;
+  default:
+    valid = value.is<uint8_t>();
   }
-  return false;
-};
-
-template <typename C>
-u_int16_t CharArrayConfigParameter<C>::getValueOrdinal(const C config) {
-  _ASSERT(false);
-};
-
-// -------------------- enum -------------------
-
-template <typename C, typename B, typename E>
-EnumConfigParameter<C, B, E>::EnumConfigParameter(const char* _id, const char* _label, E C::* _valuePtr, E _defaultValue, const char* _enumLabels[], E _min, E _max, bool _rebootRequiredOnChange) :
-  NumberConfigParameter<C, B>(_id, _label, (B C::*)_valuePtr, (B)_defaultValue, 0, (B)_min, (B)_max, _rebootRequiredOnChange) {
-  size_t maxLen = 0;
-  for (B i = _min; i < _max;i++) {
-    maxLen = max(maxLen, strlen(_enumLabels[i]));
+  if (!valid) {
+    ESP_LOGI(TAG, "Ignoring JSON value of wrong type for %s", id);
+    return CONFIG_VALUE_INVALID;
   }
-  this->maxStrLen = (uint8_t)maxLen;
-  this->enumLabels = _enumLabels;
-}
-
-template <typename C, typename B, typename E>
-EnumConfigParameter<C, B, E>::~EnumConfigParameter() {};
-
-template <typename C, typename B, typename E>
-void EnumConfigParameter<C, B, E>::print(const C config, char* str) {
-  sprintf(str, "%s", this->enumLabels[(B)(config.*(this->valuePtr))]);
-}
-
-template <typename C, typename B, typename E>
-bool EnumConfigParameter<C, B, E>::save(C& config, const char* str) {
-  for (B i = (B)this->minValue; i <= (B)this->maxValue; i++) {
-    ESP_LOGD(TAG, "%u %s ? %s", i, this->enumLabels[i], strcmp(this->enumLabels[i], str) == 0 ? "true" : "false");
-    if (strcmp(this->enumLabels[i], str) == 0) {
-      if (config.*(this->valuePtr) == (E)i) return false;
-      config.*(this->valuePtr) = (E)i;
-      return true;
-    }
+  if (type == CONFIG_PARAMETER_CHAR_ARRAY) {
+    return setString(config, value.as<const char*>()) ? CONFIG_VALUE_CHANGED : CONFIG_VALUE_UNCHANGED;
   }
-  uint16_t value = (uint16_t)atoi(str);
-  if (value < this->minValue || value > this->maxValue) {
-    ESP_LOGI(TAG, "Ignoring parsed value %d outside range [%u,%u]", value, this->minValue, this->maxValue);
-    return false;
+  uint16_t number = type == CONFIG_PARAMETER_BOOLEAN ? value.as<bool>() : value.as<uint16_t>();
+  if (number < minValue || number > maxValue) {
+    ESP_LOGI(TAG, "Ignoring JSON value %d for %s outside range [%i,%i]", number, id, minValue, maxValue);
+    return CONFIG_VALUE_INVALID;
   }
-  if (config.*(this->valuePtr) == value) return false;
-  config.*(this->valuePtr) = value;
-  return true;
+  if (getValue(config) == number) return CONFIG_VALUE_UNCHANGED;
+  setValue(config, number);
+  return CONFIG_VALUE_CHANGED;
 }
 
-template <typename C, typename B, typename E>
-bool EnumConfigParameter<C, B, E>::isEnum() {
-  return true;
+bool ConfigParameter::equals(const Config& a, const Config& b) const {
+  if (type == CONFIG_PARAMETER_CHAR_ARRAY) {
+    return strcmp((const char*)&a + offset, (const char*)&b + offset) == 0;
+  }
+  return getValue(a) == getValue(b);
 }
 
-template <typename C, typename B, typename E>
-bool EnumConfigParameter<C, B, E>::isNumber() {
-  return false;
+uint16_t ConfigParameter::getValueOrdinal(const Config& config) const {
+  return getValue(config) - minValue;
 }
-
-template <typename C, typename B, typename E>
-const char** EnumConfigParameter<C, B, E>::getEnumLabels(void) {
-  return this->enumLabels;
-};
-
-template <typename C, typename B, typename E>
-u_int16_t EnumConfigParameter<C, B, E>::getValueOrdinal(const C config) {
-  return (B)(config.*(this->valuePtr)) - (B)(this->minValue);
-};
-
-#include <configParameter.tpp>
\ No newline at end of file
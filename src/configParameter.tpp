@@ -1,6 +0,0 @@
-// -------------------- template instantiations -------------------
-
-template class Uint8ConfigParameter<Config>;
-template class Uint16ConfigParameter<Config>;
-template class BooleanConfigParameter<Config>;
-template class CharArrayConfigParameter<Config>;
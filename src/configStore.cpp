@@ -0,0 +1,94 @@
+#include <configStore.h>
+#include <Preferences.h>
+#include <rom/crc.h>
+
+// Local logging tag
+static const char TAG[] = __FILE__;
+
+namespace ConfigStore {
+  struct ConfigImage {
+    uint32_t magic;
+    uint16_t schemaVersion;
+    uint16_t size;
+    uint32_t generation;
+    uint32_t crc;         // over generation and config
+    Config config;
+  };
+
+  const char* slotKeys[] = { "slotA", "slotB" };
+
+  int8_t currentSlot = -1;
+  uint32_t generation = 0;
+
+  uint32_t imageCrc(const ConfigImage* image) {
+    uint32_t crc = crc32_le(0, (const uint8_t*)&image->generation, sizeof(image->generation));
+    return crc32_le(crc, (const uint8_t*)&image->config, sizeof(image->config));
+  }
+
+  boolean readSlot(Preferences& preferences, uint8_t slot, ConfigImage* image) {
+    if (preferences.getBytes(slotKeys[slot], image, sizeof(ConfigImage)) != sizeof(ConfigImage)) return false;
+    if (image->magic != CONFIG_STORE_MAGIC) return false;
+    if (image->schemaVersion != CONFIG_SCHEMA_VERSION || image->size != sizeof(Config)) {
+      ESP_LOGI(TAG, "Config slot %u has schema %u, expected %u", slot, image->schemaVersion, CONFIG_SCHEMA_VERSION);
+      return false;
+    }
+    if (image->crc != imageCrc(image)) {
+      ESP_LOGW(TAG, "Config slot %u CRC mismatch", slot);
+      return false;
+    }
+    return true;
+  }
+
+  boolean load(Config& _config) {
+    Preferences preferences;
+    if (!preferences.begin(CONFIG_STORE_NAMESPACE, true)) return false;
+    ConfigImage* image = (ConfigImage*)malloc(sizeof(ConfigImage));
+    if (!image) {
+      preferences.end();
+      return false;
+    }
+    currentSlot = -1;
+    for (uint8_t slot = 0; slot < 2; slot++) {
+      if (!readSlot(preferences, slot, image)) continue;
+      if (currentSlot < 0 || image->generation > generation) {
+        currentSlot = slot;
+        generation = image->generation;
+        memcpy(&_config, &image->config, sizeof(Config));
+      }
+    }
+    free(image);
+    preferences.end();
+    if (currentSlot < 0) return false;
+    ESP_LOGD(TAG, "Loaded config generation %u from slot %u", generation, currentSlot);
+    return true;
+  }
+
+  boolean save(const Config& _config) {
+    ConfigImage* image = (ConfigImage*)calloc(1, sizeof(ConfigImage));
+    if (!image) return false;
+    image->magic = CONFIG_STORE_MAGIC;
+    image->schemaVersion = CONFIG_SCHEMA_VERSION;
+    image->size = sizeof(Config);
+    image->generation = generation + 1;
+    memcpy(&image->config, &_config, sizeof(Config));
+    image->crc = imageCrc(image);
+    uint8_t slot = currentSlot == 0 ? 1 : 0;
+    Preferences preferences;
+    boolean success = preferences.begin(CONFIG_STORE_NAMESPACE, false)
+      && preferences.putBytes(slotKeys[slot], image, sizeof(ConfigImage)) == sizeof(ConfigImage);
+    preferences.end();
+    if (success) {
+      currentSlot = slot;
+      generation = image->generation;
+      ESP_LOGD(TAG, "Saved config generation %u to slot %u", generation, slot);
+    } else {
+      ESP_LOGW(TAG, "Could not write config slot %u", slot);
+    }
+    free(image);
+    return success;
+  }
+
+  uint32_t getGeneration() {
+    return generation;
+  }
+}
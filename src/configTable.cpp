@@ -0,0 +1,246 @@
+#include <configManager.h>
+#include <model.h>
+#include <stddef.h>
+
+// Local logging tag
+static const char TAG[] = __FILE__;
+
+// The live configuration and its parameter table. Loading and saving it is up to configManager.cpp, this
+// part has no file system or NVS access and is built for the native tests as well.
+Config config;
+
+#define DEFAULT_DEVICE_ID                  0
+#define DEFAULT_MQTT_TOPIC      "co2monitor"
+#define DEFAULT_MQTT_HOST        "127.0.0.1"
+#define DEFAULT_MQTT_PORT               1883
+#define DEFAULT_MQTT_USERNAME   "co2monitor"
+#define DEFAULT_MQTT_PASSWORD   "co2monitor"
+#define DEFAULT_MQTT_USE_TLS           false
+#define DEFAULT_MQTT_INSECURE          false
+#define DEFAULT_MQTT_V5                false
+#define DEFAULT_ALTITUDE                   5
+#define DEFAULT_CO2_GREEN_THRESHOLD        0
+#define DEFAULT_CO2_YELLOW_THRESHOLD     700
+#define DEFAULT_CO2_RED_THRESHOLD        900
+#define DEFAULT_CO2_DARK_RED_THRESHOLD  1200
+#define DEFAULT_IAQ_GREEN_THRESHOLD        0
+#define DEFAULT_IAQ_YELLOW_THRESHOLD     100
+#define DEFAULT_IAQ_RED_THRESHOLD        200
+#define DEFAULT_IAQ_DARK_RED_THRESHOLD   300
+#define DEFAULT_BRIGHTNESS               255
+#define DEFAULT_SSD1306_ROWS              64
+//27
+#define DEFAULT_GREEN_LED                 0
+#define DEFAULT_YELLOW_LED                26
+#define DEFAULT_RED_LED                   25
+// 16
+#define DEFAULT_NEOPIXEL_DATA              0
+#define DEFAULT_NEOPIXEL_NUMBER            3
+// 14
+#define DEFAULT_NEOPIXEL_MATRIX_DATA       0
+// 27
+#define DEFAULT_FEATHER_MATRIX_DATA        0
+#define DEFAULT_FEATHER_MATRIX_CLK        13
+#define DEFAULT_MATRIX_COLUMNS            12
+#define DEFAULT_MATRIX_ROWS                5
+#define DEFAULT_MATRIX_LAYOUT              0
+// 15
+#define DEFAULT_HUB75_R1                   0
+#define DEFAULT_HUB75_G1                   2
+#define DEFAULT_HUB75_B1                   4
+#define DEFAULT_HUB75_R2                  16
+#define DEFAULT_HUB75_G2                  12
+#define DEFAULT_HUB75_B2                  17
+#define DEFAULT_HUB75_CH_A                 5
+#define DEFAULT_HUB75_CH_B                18
+#define DEFAULT_HUB75_CH_C                19
+#define DEFAULT_HUB75_CH_D                14
+#define DEFAULT_HUB75_CLK                 27
+#define DEFAULT_HUB75_LAT                 26
+#define DEFAULT_HUB75_OE                  25
+#define DEFAULT_SENSOR_FUSION             FUSION_PRIORITY
+#define DEFAULT_PREFERRED_SENSOR          SOURCE_SCD30
+
+constexpr const char* fusionModeLabels[] = { "priority", "mean", "median" };
+
+constexpr ConfigParameter configParameters[] = {
+  uint16Parameter("deviceId", "Device ID", offsetof(Config, deviceId), DEFAULT_DEVICE_ID, 0, 65535, CONFIG_MQTT_CONNECTION),
+  charArrayParameter("mqttTopic", "MQTT topic", offsetof(Config, mqttTopic), DEFAULT_MQTT_TOPIC, MQTT_TOPIC_LEN, CONFIG_MQTT_CONNECTION),
+  charArrayParameter("mqttUsername", "MQTT username", offsetof(Config, mqttUsername), DEFAULT_MQTT_USERNAME, MQTT_USERNAME_LEN, CONFIG_MQTT_CONNECTION),
+  charArrayParameter("mqttPassword", "MQTT password", offsetof(Config, mqttPassword), DEFAULT_MQTT_PASSWORD, MQTT_PASSWORD_LEN, CONFIG_MQTT_CONNECTION | CONFIG_SECRET),
+  charArrayParameter("mqttHost", "MQTT host", offsetof(Config, mqttHost), DEFAULT_MQTT_HOST, MQTT_HOSTNAME_LEN, CONFIG_MQTT_CONNECTION),
+  uint16Parameter("mqttServerPort", "MQTT port", offsetof(Config, mqttServerPort), DEFAULT_MQTT_PORT, 0, 65535, CONFIG_MQTT_CONNECTION),
+  booleanParameter("mqttUseTls", "MQTT use TLS", offsetof(Config, mqttUseTls), DEFAULT_MQTT_USE_TLS, CONFIG_MQTT_CONNECTION),
+  booleanParameter("mqttInsecure", "MQTT ignore certificate errors", offsetof(Config, mqttInsecure), DEFAULT_MQTT_INSECURE, CONFIG_MQTT_CONNECTION),
+  booleanParameter("mqttV5", "MQTT use protocol version 5", offsetof(Config, mqttV5), DEFAULT_MQTT_V5, CONFIG_MQTT_CONNECTION),
+  uint16Parameter("altitude", "Altitude", offsetof(Config, altitude), DEFAULT_ALTITUDE, 0, 8000),
+  uint16Parameter("co2GreenThreshold", "CO2 Green threshold ", offsetof(Config, co2GreenThreshold), DEFAULT_CO2_GREEN_THRESHOLD),
+  uint16Parameter("co2YellowThreshold", "CO2 Yellow threshold ", offsetof(Config, co2YellowThreshold), DEFAULT_CO2_YELLOW_THRESHOLD),
+  uint16Parameter("co2RedThreshold", "CO2 Red threshold", offsetof(Config, co2RedThreshold), DEFAULT_CO2_RED_THRESHOLD),
+  uint16Parameter("co2DarkRedThreshold", "CO2 Dark red threshold", offsetof(Config, co2DarkRedThreshold), DEFAULT_CO2_DARK_RED_THRESHOLD),
+  uint16Parameter("iaqGreenThreshold", "IAQ Green threshold ", offsetof(Config, iaqGreenThreshold), DEFAULT_IAQ_GREEN_THRESHOLD),
+  uint16Parameter("iaqYellowThreshold", "IAQ Yellow threshold ", offsetof(Config, iaqYellowThreshold), DEFAULT_IAQ_YELLOW_THRESHOLD),
+  uint16Parameter("iaqRedThreshold", "IAQ Red threshold", offsetof(Config, iaqRedThreshold), DEFAULT_IAQ_RED_THRESHOLD),
+  uint16Parameter("iaqDarkRedThreshold", "IAQ Dark red threshold", offsetof(Config, iaqDarkRedThreshold), DEFAULT_IAQ_DARK_RED_THRESHOLD),
+  uint8Parameter("brightness", "LED brightness pwm", offsetof(Config, brightness), DEFAULT_BRIGHTNESS),
+  uint8Parameter("ssd1306Rows", "SSD1306 rows", offsetof(Config, ssd1306Rows), DEFAULT_SSD1306_ROWS, 32, 64),
+  uint8Parameter("greenLed", "Green Led pin", offsetof(Config, greenLed), DEFAULT_GREEN_LED),
+  uint8Parameter("yellowLed", "Yellow Led pin", offsetof(Config, yellowLed), DEFAULT_YELLOW_LED),
+  uint8Parameter("redLed", "Red Led pin", offsetof(Config, redLed), DEFAULT_RED_LED),
+  uint8Parameter("neopixelData", "Neopixel data pin", offsetof(Config, neopixelData), DEFAULT_NEOPIXEL_DATA),
+  uint8Parameter("neopixelNumber", "Number of Neopixels", offsetof(Config, neopixelNumber), DEFAULT_NEOPIXEL_NUMBER),
+  uint8Parameter("neopixelMatrixData", "Neopixel matrix data pin", offsetof(Config, neopixelMatrixData), DEFAULT_NEOPIXEL_MATRIX_DATA),
+  uint8Parameter("featherMatrixData", "Feather matrix data pin", offsetof(Config, featherMatrixData), DEFAULT_FEATHER_MATRIX_DATA),
+  uint8Parameter("featherMatrixClock", "Feather matrix clock pin", offsetof(Config, featherMatrixClock), DEFAULT_FEATHER_MATRIX_CLK),
+  uint8Parameter("matrixColumns", "Matrix columns", offsetof(Config, matrixColumns), DEFAULT_MATRIX_COLUMNS),
+  uint8Parameter("matrixRows", "Matrix rows", offsetof(Config, matrixRows), DEFAULT_MATRIX_ROWS),
+  uint8Parameter("matrixLayout", "Matrix layout", offsetof(Config, matrixLayout), DEFAULT_MATRIX_LAYOUT),
+  uint8Parameter("hub75R1", "Hub75 R1 pin", offsetof(Config, hub75R1), DEFAULT_HUB75_R1),
+  uint8Parameter("hub75G1", "Hub75 G1 pin", offsetof(Config, hub75G1), DEFAULT_HUB75_G1),
+  uint8Parameter("hub75B1", "Hub75 B1 pin", offsetof(Config, hub75B1), DEFAULT_HUB75_B1),
+  uint8Parameter("hub75R2", "Hub75 R2 pin", offsetof(Config, hub75R2), DEFAULT_HUB75_R2),
+  uint8Parameter("hub75G2", "Hub75 G2 pin", offsetof(Config, hub75G2), DEFAULT_HUB75_G2),
+  uint8Parameter("hub75B2", "Hub75 B2 pin", offsetof(Config, hub75B2), DEFAULT_HUB75_B2),
+  uint8Parameter("hub75ChA", "Hub75 Channel A pin", offsetof(Config, hub75ChA), DEFAULT_HUB75_CH_A),
+  uint8Parameter("hub75ChB", "Hub75 Channel B pin", offsetof(Config, hub75ChB), DEFAULT_HUB75_CH_B),
+  uint8Parameter("hub75ChC", "Hub75 Channel C pin", offsetof(Config, hub75ChC), DEFAULT_HUB75_CH_C),
+  uint8Parameter("hub75ChD", "Hub75 Channel D pin", offsetof(Config, hub75ChD), DEFAULT_HUB75_CH_D),
+  uint8Parameter("hub75Clk", "Hub75 Clk pin", offsetof(Config, hub75Clk), DEFAULT_HUB75_CLK),
+  uint8Parameter("hub75Lat", "Hub75 Lat pin", offsetof(Config, hub75Lat), DEFAULT_HUB75_LAT),
+  uint8Parameter("hub75Oe", "Hub75 Oe pin", offsetof(Config, hub75Oe), DEFAULT_HUB75_OE),
+  enumParameter("sensorFusion", "Sensor fusion", offsetof(Config, sensorFusion), DEFAULT_SENSOR_FUSION, fusionModeLabels, FUSION_PRIORITY, FUSION_MEDIAN, 8),
+  enumParameter("preferredSensor", "Preferred sensor", offsetof(Config, preferredSensor), DEFAULT_PREFERRED_SENSOR, sensorSourceNames, SOURCE_SCD30, SOURCE_BME680, 6)
+};
+
+constexpr uint8_t CONFIG_PARAMETER_COUNT = sizeof(configParameters) / sizeof(configParameters[0]);
+
+constexpr bool slotTaken(uint8_t slot, uint8_t count) {
+  return count > 0 && (configIdSlot(configParameters[count - 1].id, CONFIG_HASH_SEED, CONFIG_HASH_BITS) == slot || slotTaken(slot, count - 1));
+}
+
+constexpr bool isPerfectHash(uint8_t count) {
+  return count == 0 || (!slotTaken(configIdSlot(configParameters[count - 1].id, CONFIG_HASH_SEED, CONFIG_HASH_BITS), count - 1) && isPerfectHash(count - 1));
+}
+
+constexpr bool hasValidDefaults(uint8_t count) {
+  return count == 0 || ((configParameters[count - 1].type == CONFIG_PARAMETER_CHAR_ARRAY
+    || (configParameters[count - 1].minValue <= configParameters[count - 1].defaultValue && configParameters[count - 1].defaultValue <= configParameters[count - 1].maxValue))
+    && hasValidDefaults(count - 1));
+}
+
+// If isPerfectHash fails after adding a parameter, try other values of CONFIG_HASH_SEED until it passes.
+static_assert(CONFIG_PARAMETER_COUNT <= CONFIG_HASH_SLOTS, "More config parameters than hash slots");
+static_assert(CONFIG_PARAMETER_COUNT <= 64, "More config parameters than bits in ConfigTransaction::changed");
+static_assert(isPerfectHash(CONFIG_PARAMETER_COUNT), "Config parameter ids collide, pick another CONFIG_HASH_SEED");
+static_assert(hasValidDefaults(CONFIG_PARAMETER_COUNT), "Config parameter default outside its range");
+
+// index into configParameters by hash slot, -1 for unused slots
+int8_t parameterBySlot[CONFIG_HASH_SLOTS];
+
+boolean indexParameterSlots() {
+  memset(parameterBySlot, -1, sizeof(parameterBySlot));
+  for (uint8_t i = 0; i < CONFIG_PARAMETER_COUNT; i++) {
+    parameterBySlot[configIdSlot(configParameters[i].id, CONFIG_HASH_SEED, CONFIG_HASH_BITS)] = i;
+  }
+  return true;
+}
+
+// filled during static initialisation, so parameters can be looked up before setupConfigManager()
+const boolean parameterSlotsIndexed = indexParameterSlots();
+
+ConfigParameterTable getConfigParameters() {
+  return { configParameters, CONFIG_PARAMETER_COUNT };
+}
+
+const ConfigParameter* findConfigParameter(const char* id) {
+  int8_t index = parameterBySlot[configIdSlot(id, CONFIG_HASH_SEED, CONFIG_HASH_BITS)];
+  if (index < 0 || strcmp(configParameters[index].id, id) != 0) return nullptr;
+  return &configParameters[index];
+}
+
+uint8_t ConfigTransaction::flags() const {
+  uint8_t result = 0;
+  for (uint8_t i = 0; i < CONFIG_PARAMETER_COUNT; i++) {
+    if (changed & (1ULL << i)) result |= configParameters[i].flags;
+  }
+  return result;
+}
+
+void beginConfigTransaction(ConfigTransaction& transaction) {
+  transaction.staged = config;
+  transaction.changed = 0;
+  transaction.rejected = nullptr;
+}
+
+// Compares against the live configuration, so setting a value back to what it was drops the change.
+void trackChange(ConfigTransaction& transaction, const ConfigParameter& configParameter) {
+  uint64_t bit = 1ULL << (&configParameter - configParameters);
+  if (configParameter.equals(config, transaction.staged)) {
+    transaction.changed &= ~bit;
+  } else {
+    transaction.changed |= bit;
+  }
+}
+
+/**
+ * Stages every known key of values, looking each one up by its id instead of scanning the table for
+ * every parameter. Unknown keys are ignored, an invalid value rejects the whole transaction.
+ */
+boolean stageConfigJson(ConfigTransaction& transaction, JsonObjectConst values) {
+  for (JsonPairConst kv : values) {
+    const ConfigParameter* configParameter = findConfigParameter(kv.key().c_str());
+    if (!configParameter) continue;
+    ConfigValueResult result = configParameter->fromJson(transaction.staged, kv.value());
+    if (result == CONFIG_VALUE_INVALID) {
+      transaction.rejected = configParameter->getId();
+      return false;
+    }
+    if (result == CONFIG_VALUE_CHANGED) trackChange(transaction, *configParameter);
+  }
+  return true;
+}
+
+// Stages a value from the web portal, invalid values are ignored like before.
+boolean stageConfigValue(ConfigTransaction& transaction, const ConfigParameter& configParameter, const char* str) {
+  if (!configParameter.save(transaction.staged, str)) return false;
+  trackChange(transaction, configParameter);
+  return true;
+}
+
+void commitConfigTransaction(const ConfigTransaction& transaction) {
+  for (uint8_t i = 0; i < CONFIG_PARAMETER_COUNT; i++) {
+    if (!(transaction.changed & (1ULL << i))) continue;
+    const ConfigParameter& configParameter = configParameters[i];
+    if (configParameter.isSecret()) {
+      ESP_LOGI(TAG, "Config %s changed", configParameter.getId());
+    } else {
+      ESP_LOGI(TAG, "Config %s changed from %s to %s", configParameter.getId(),
+        configParameter.toString(config).c_str(), configParameter.toString(transaction.staged).c_str());
+    }
+  }
+  config = transaction.staged;
+}
+
+// New values of the changed parameters, secrets are only listed as changed.
+void configChangesToJson(const ConfigTransaction& transaction, JsonObject changes) {
+  for (uint8_t i = 0; i < CONFIG_PARAMETER_COUNT; i++) {
+    if (!(transaction.changed & (1ULL << i))) continue;
+    if (configParameters[i].isSecret()) {
+      changes[configParameters[i].getId()] = true;
+    } else {
+      configParameters[i].toJson(transaction.staged, changes);
+    }
+  }
+}
+
+void getDefaultConfiguration(Config& _config) {
+  for (const ConfigParameter& configParameter : configParameters) {
+    configParameter.setToDefault(_config);
+  }
+}
+
+void logConfiguration(const Config _config) {
+  for (const ConfigParameter& configParameter : configParameters) {
+    ESP_LOGD(TAG, "%s: %s", configParameter.getId(), configParameter.toString(_config).c_str());
+  }
+}
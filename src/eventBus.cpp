@@ -0,0 +1,114 @@
+#include <eventBus.h>
+
+// Local logging tag
+static const char TAG[] = __FILE__;
+
+namespace EventBus {
+  // latest-value mailbox of a subscriber, guarded by mux
+  struct Subscriber {
+    handler_t handler;
+    portMUX_TYPE mux;
+    boolean pending;
+    MeasurementMask mask;
+    TrafficLightStatus oldStatus;
+    TrafficLightStatus newStatus;
+    uint32_t pendingSince;
+    SubscriberStats stats;
+  };
+
+  Subscriber subscribers[EVENT_BUS_MAX_SUBSCRIBERS];
+  volatile uint8_t subscriberCount = 0;
+
+  void subscriberLoop(void* pvParameters) {
+    Subscriber* subscriber = (Subscriber*)pvParameters;
+    while (1) {
+      ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+      portENTER_CRITICAL(&subscriber->mux);
+      boolean pending = subscriber->pending;
+      MeasurementMask mask = subscriber->mask;
+      TrafficLightStatus oldStatus = subscriber->oldStatus;
+      TrafficLightStatus newStatus = subscriber->newStatus;
+      uint32_t pendingSince = subscriber->pendingSince;
+      subscriber->pending = false;
+      subscriber->mask = M_NONE;
+      portEXIT_CRITICAL(&subscriber->mux);
+      if (!pending) continue;
+
+      uint32_t start = millis();
+      subscriber->handler(mask, oldStatus, newStatus);
+      uint32_t handlerTime = millis() - start;
+
+      portENTER_CRITICAL(&subscriber->mux);
+      SubscriberStats& stats = subscriber->stats;
+      stats.delivered++;
+      stats.lastLatency = start - pendingSince;
+      if (stats.lastLatency > stats.maxLatency) stats.maxLatency = stats.lastLatency;
+      if (handlerTime > stats.maxHandlerTime) stats.maxHandlerTime = handlerTime;
+      portEXIT_CRITICAL(&subscriber->mux);
+    }
+  }
+
+  boolean subscribe(const char* name, handler_t handler, uint32_t stackSize, UBaseType_t priority, BaseType_t core) {
+    if (subscriberCount >= EVENT_BUS_MAX_SUBSCRIBERS) {
+      ESP_LOGE(TAG, "Too many subscribers, %s not added", name);
+      return false;
+    }
+    Subscriber* subscriber = &subscribers[subscriberCount];
+    *subscriber = {};
+    subscriber->handler = handler;
+    subscriber->mux = portMUX_INITIALIZER_UNLOCKED;
+    subscriber->stats.name = name;
+    if (xTaskCreatePinnedToCore(
+      subscriberLoop,            // task function
+      name,                      // name of task
+      stackSize,                 // stack size of task
+      subscriber,                // parameter of the task
+      priority,                  // priority of the task
+      &subscriber->stats.task,   // task handle
+      core) != pdPASS) {         // CPU core
+      ESP_LOGE(TAG, "Could not start subscriber %s", name);
+      return false;
+    }
+    subscriberCount++;
+    return true;
+  }
+
+  void publish(MeasurementMask mask, TrafficLightStatus oldStatus, TrafficLightStatus newStatus) {
+    uint32_t now = millis();
+    for (uint8_t i = 0; i < subscriberCount; i++) {
+      Subscriber* subscriber = &subscribers[i];
+      portENTER_CRITICAL(&subscriber->mux);
+      if (!subscriber->pending) {
+        subscriber->pending = true;
+        subscriber->oldStatus = oldStatus;
+        subscriber->pendingSince = now;
+      }
+      subscriber->mask |= mask;
+      subscriber->newStatus = newStatus;
+      subscriber->stats.published++;
+      portEXIT_CRITICAL(&subscriber->mux);
+      xTaskNotifyGive(subscriber->stats.task);
+    }
+  }
+
+  uint8_t getStats(SubscriberStats* stats, uint8_t maxCount) {
+    uint8_t count = subscriberCount;
+    if (count > maxCount) count = maxCount;
+    for (uint8_t i = 0; i < count; i++) {
+      portENTER_CRITICAL(&subscribers[i].mux);
+      stats[i] = subscribers[i].stats;
+      portEXIT_CRITICAL(&subscribers[i].mux);
+    }
+    return count;
+  }
+
+  void logStats() {
+    SubscriberStats stats[EVENT_BUS_MAX_SUBSCRIBERS];
+    uint8_t count = getStats(stats, EVENT_BUS_MAX_SUBSCRIBERS);
+    for (uint8_t i = 0; i < count; i++) {
+      ESP_LOGI(TAG, "%s %u bytes left | events %u, delivered %u, coalesced %u | latency last %u ms, max %u ms | handler max %u ms",
+        stats[i].name, uxTaskGetStackHighWaterMark(stats[i].task), stats[i].published, stats[i].delivered,
+        stats[i].published - stats[i].delivered, stats[i].lastLatency, stats[i].maxLatency, stats[i].maxHandlerTime);
+    }
+  }
+}
@@ -34,25 +34,34 @@ FeatherMatrix::FeatherMatrix(Model* _model, uint8_t dataPin, uint8_t clockPin) {
   matrix->setFont(&TomThumb);
   matrix->setTextWrap(false);
   matrix->setBrightness(BRIGHTNESS);
-
-  for (byte i = 0; i < 3; i++) {
-    matrix->fillScreen(matrix->Color(255 * (i == 0 ? 1 : 0), 255 * (i == 1 ? 1 : 0), 255 * (i == 2 ? 1 : 0)));
-    matrix->show();
-    vTaskDelay(pdMS_TO_TICKS(500));
-  }
-  matrix->fillScreen(0);
-  matrix->show();
+  scrollWidth = 0;
 
   cyclicTimer = new Ticker();
-  cyclicTimer->attach(0.5, +[](FeatherMatrix* instance) { instance->timer(); }, this);
+  cyclicTimer->attach(0.5, outputTimer<FeatherMatrix, &FeatherMatrix::timer>, this);
 }
 
 FeatherMatrix::~FeatherMatrix() {
-  if (this->matrix) delete matrix;
   if (cyclicTimer) delete cyclicTimer;
+  if (this->matrix) {
+    matrix->fillScreen(0);
+    matrix->show();
+    delete matrix;
+  }
 };
 
-void FeatherMatrix::update(uint16_t mask, TrafficLightStatus oldStatus, TrafficLightStatus newStatus) {
+// Shows red, green and blue for steps 0 to 2, scrolling is paused until step SELF_TEST_STEPS.
+void FeatherMatrix::selfTest(uint8_t step) {
+  if (step == 0) cyclicTimer->detach();
+  if (step < SELF_TEST_STEPS) {
+    matrix->fillScreen(matrix->Color(255 * (step == 0 ? 1 : 0), 255 * (step == 1 ? 1 : 0), 255 * (step == 2 ? 1 : 0)));
+    matrix->show();
+  } else {
+    cyclicTimer->attach(0.5, outputTimer<FeatherMatrix, &FeatherMatrix::timer>, this);
+  }
+}
+
+void FeatherMatrix::update(MeasurementMask mask, TrafficLightStatus oldStatus, TrafficLightStatus newStatus) {
+  ModelSnapshot snapshot = model->getSnapshot();
   if (newStatus == GREEN) {
     matrix->setTextColor(matrix->Color(0, 255, 0));
   } else if (newStatus == YELLOW) {
@@ -65,10 +74,10 @@ void FeatherMatrix::update(uint16_t mask, TrafficLightStatus oldStatus, TrafficL
   matrix->fillScreen(0);
   matrix->setCursor(0, 5);
   scrollPosition = 0;
-  if (model->getCo2() == 0) {
+  if (snapshot.co2 == 0) {
     strcpy(txt, "---");
   } else {
-    sprintf(txt, "%u", model->getCo2());
+    sprintf(txt, "%u", snapshot.co2);
   }
 
   int16_t x1, y1 = 0;
@@ -2,6 +2,9 @@
 #include <mqtt.h>
 #include <ota.h>
 #include <wifiManager.h>
+#include <configManager.h>
+#include <eventBus.h>
+#include <telemetry.h>
 
 // Local logging tag
 static const char TAG[] = __FILE__;
@@ -15,6 +18,8 @@ namespace housekeeping {
       ESP.getMaxAllocHeap(), uxTaskGetStackHighWaterMark(NULL));
     ESP_LOGI(TAG, "MqttLoop %u bytes left | Taskstate = %d | core = %u",
       uxTaskGetStackHighWaterMark(mqtt::mqttTask), eTaskGetState(mqtt::mqttTask), xTaskGetAffinity(mqtt::mqttTask));
+    ESP_LOGI(TAG, "CommandLoop %u bytes left | Taskstate = %d | core = %u",
+      uxTaskGetStackHighWaterMark(mqtt::commandTask), eTaskGetState(mqtt::commandTask), xTaskGetAffinity(mqtt::commandTask));
     ESP_LOGI(TAG, "OtaLoop %u bytes left | Taskstate = %d | core = %u",
       uxTaskGetStackHighWaterMark(OTA::otaTask), eTaskGetState(OTA::otaTask), xTaskGetAffinity(OTA::otaTask));
     ESP_LOGI(TAG, "WifiLoop %u bytes left | Taskstate = %d | core = %u",
@@ -27,6 +32,12 @@ namespace housekeeping {
       ESP_LOGI(TAG, "NeopixelMatrixLoop %u bytes left | Taskstate = %d | core = %u",
         uxTaskGetStackHighWaterMark(neopixelMatrixTask), eTaskGetState(neopixelMatrixTask), xTaskGetAffinity(neopixelMatrixTask));
     }
+    ESP_LOGI(TAG, "ConfigSaveLoop %u bytes left | Taskstate = %d | core = %u",
+      uxTaskGetStackHighWaterMark(configSaveTask), eTaskGetState(configSaveTask), xTaskGetAffinity(configSaveTask));
+    EventBus::logStats();
+    Telemetry::logStats();
+    mqtt::logQueueStatistics();
+    logConfigPersistence();
     if (ESP.getMinFreeHeap() <= 2048) {
       ESP_LOGW(TAG,
         "Memory full, counter cleared (heap low water mark = %u Bytes / "
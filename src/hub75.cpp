@@ -31,22 +31,28 @@ HUB75::HUB75(Model* _model) {
   //  this);
 
   // https://stackoverflow.com/questions/60985496/arduino-esp8266-esp32-ticker-callback-class-member-function
-  cyclicTimer->attach(0.3, +[](HUB75* instance) { instance->timer(); }, this);
+  cyclicTimer->attach(0.3, outputTimer<HUB75, &HUB75::timer>, this);
   this->toggle = false;
   ESP_LOGD(TAG, "HUB75 initialised");
 }
 
 HUB75::~HUB75() {
-  if (this->matrix) delete matrix;
+  if (this->cyclicTimer) delete cyclicTimer;
+  if (this->matrix) {
+    matrix->clearScreen();
+    matrix->stopDMAoutput();
+    delete matrix;
+  }
 }
 
 void HUB75::stopDMA() {
   if (this->matrix) matrix->stopDMAoutput();
 }
 
-void HUB75::update(uint16_t mask, TrafficLightStatus oldStatus, TrafficLightStatus newStatus) {
+void HUB75::update(MeasurementMask mask, TrafficLightStatus oldStatus, TrafficLightStatus newStatus) {
+  ModelSnapshot snapshot = model->getSnapshot();
   if (mask & M_CONFIG_CHANGED) matrix->setBrightness8(config.brightness);
-  //  ESP_LOGD(TAG, "HUB75 update: %i => %i, co2: %u, mask:%x", oldStatus, newStatus, model->getCo2(), mask);
+  //  ESP_LOGD(TAG, "HUB75 update: %i => %i, co2: %u, mask:%x", oldStatus, newStatus, snapshot.co2, mask);
   if (oldStatus != newStatus) {
     // only redraw smiley on status change
     matrix->fillRect(0, 0, 32, 32, 0);
@@ -64,20 +70,20 @@ void HUB75::update(uint16_t mask, TrafficLightStatus oldStatus, TrafficLightStat
     // clear co2 reading and message
     matrix->fillRect(0, 33, 32, 16, 0);
     // show co2 reading
-    if (model->getCo2() > 9999) {
+    if (snapshot.co2 > 9999) {
       matrix->drawBitmap(0, 35, digits[9], 8, 10, matrix->color565(255, 255, 255));
       matrix->drawBitmap(8, 35, digits[9], 8, 10, matrix->color565(255, 255, 255));
       matrix->drawBitmap(16, 35, digits[9], 8, 10, matrix->color565(255, 255, 255));
       matrix->drawBitmap(24, 35, digits[9], 8, 10, matrix->color565(255, 255, 255));
     } else {
-      if (model->getCo2() > 999)
-        matrix->drawBitmap(0, 35, digits[(uint16_t)(model->getCo2() / 1000) % 10], 8, 10, matrix->color565(255, 255, 255));
-      if (model->getCo2() > 99)
-        matrix->drawBitmap(8, 35, digits[(uint16_t)(model->getCo2() / 100) % 10], 8, 10, matrix->color565(255, 255, 255));
-      if (model->getCo2() > 9)
-        matrix->drawBitmap(16, 35, digits[(uint16_t)(model->getCo2() / 10) % 10], 8, 10, matrix->color565(255, 255, 255));
-      if (model->getCo2() > 0)
-        matrix->drawBitmap(24, 35, digits[model->getCo2() % 10], 8, 10, matrix->color565(255, 255, 255));
+      if (snapshot.co2 > 999)
+        matrix->drawBitmap(0, 35, digits[(uint16_t)(snapshot.co2 / 1000) % 10], 8, 10, matrix->color565(255, 255, 255));
+      if (snapshot.co2 > 99)
+        matrix->drawBitmap(8, 35, digits[(uint16_t)(snapshot.co2 / 100) % 10], 8, 10, matrix->color565(255, 255, 255));
+      if (snapshot.co2 > 9)
+        matrix->drawBitmap(16, 35, digits[(uint16_t)(snapshot.co2 / 10) % 10], 8, 10, matrix->color565(255, 255, 255));
+      if (snapshot.co2 > 0)
+        matrix->drawBitmap(24, 35, digits[snapshot.co2 % 10], 8, 10, matrix->color565(255, 255, 255));
     }
   }
 }
@@ -2,6 +2,7 @@
 #include <i2c.h>
 #include <Wire.h>
 #include <config.h>
+#include <Preferences.h>
 
 // Local logging tag
 static const char TAG[] = __FILE__;
@@ -50,49 +51,113 @@ namespace I2C {
     xSemaphoreGive(i2cMutex);
   }
 
-  void initI2C() {
-    if (i2cMutex == NULL) {
-      ESP_LOGE(TAG, "Could not create I2C Mutex");
-      delay(1000);
-      esp_restart();
-    }
-    if (!takeMutex(portMAX_DELAY)) {
-      return;
+  // Detected devices are kept in NVS as a bit map in the order of this table.
+  struct KnownDevice {
+    uint8_t address;
+    const char* name;
+    boolean* detected;
+  };
+
+  const KnownDevice knownDevices[] = {
+    { SSD1306_I2C_ADR, "SSD1306 display", &lcdDetected },
+    { SCD30_I2C_ADR, "SDC30", &scd30Detected },
+    { SCD40_I2C_ADR, "SDC40", &scd40Detected },
+    { SPS30_I2C_ADR, "SPS30", &sps30Detected },
+    { BME680_I2C_ADR, "BME680", &bme680Detected }
+  };
+  const uint8_t KNOWN_DEVICE_COUNT = sizeof(knownDevices) / sizeof(knownDevices[0]);
+
+  uint8_t deviceMap = 0;
+
+  // Both expect the mutex to be held and the bus to run at SCD30_I2C_CLK.
+  uint8_t probeKnownDevices() {
+    uint8_t map = 0;
+    for (uint8_t i = 0; i < KNOWN_DEVICE_COUNT; i++) {
+      Wire.beginTransmission(knownDevices[i].address);
+      if (Wire.endTransmission() == 0) map |= bit(i);
     }
-    Wire.setClock(SCD30_I2C_CLK);
+    return map;
+  }
+
+  uint8_t scanBus() {
     byte err, addr;
     uint8_t nDevices = 0;
+    uint8_t map = 0;
     for (addr = 1; addr < 127; addr++) {
       Wire.beginTransmission(addr);
       err = Wire.endTransmission();
       if (err == 0) {
         nDevices++;
-        if (addr == SSD1306_I2C_ADR) {
-          lcdDetected = true;
-          ESP_LOGD(TAG, "SSD1306 display found");
-        } else if (addr == SCD30_I2C_ADR) {
-          scd30Detected = true;
-          ESP_LOGD(TAG, "SDC30 found");
-        } else if (addr == SCD40_I2C_ADR) {
-          scd40Detected = true;
-          ESP_LOGD(TAG, "SDC40 found");
-        } else if (addr == SPS30_I2C_ADR) {
-          sps30Detected = true;
-          ESP_LOGD(TAG, "SPS30 found");
-        } else if (addr == BME680_I2C_ADR) {
-          bme680Detected = true;
-          ESP_LOGD(TAG, "BME680 found");
-        } else {
-          ESP_LOGI(TAG, "I2C device found at address %x !", addr);
+        boolean known = false;
+        for (uint8_t i = 0; i < KNOWN_DEVICE_COUNT; i++) {
+          if (addr == knownDevices[i].address) {
+            map |= bit(i);
+            known = true;
+          }
         }
+        if (!known) ESP_LOGI(TAG, "I2C device found at address %x !", addr);
       } else if (err == 4) {
         ESP_LOGW(TAG, "Unknow error at address %x !", addr);
       }
     }
     if (nDevices == 0)
       ESP_LOGD(TAG, "No I2C devices found");
+    return map;
+  }
+
+  void storeDeviceMap(uint8_t map) {
+    Preferences preferences;
+    if (!preferences.begin(I2C_PREFERENCES_NAMESPACE, false)) return;
+    preferences.putUChar(I2C_DEVICE_MAP_KEY, map);
+    preferences.end();
+  }
+
+  /**
+   * Only probes the addresses of the supported devices and compares the result to the device map
+   * stored on the last boot. The full scan only runs if there's no stored map or it doesn't match.
+   */
+  void initI2C() {
+    if (i2cMutex == NULL) {
+      ESP_LOGE(TAG, "Could not create I2C Mutex");
+      delay(1000);
+      esp_restart();
+    }
+    if (!takeMutex(portMAX_DELAY)) {
+      return;
+    }
+    Wire.setClock(SCD30_I2C_CLK);
+    uint8_t map = probeKnownDevices();
+    Preferences preferences;
+    boolean cached = preferences.begin(I2C_PREFERENCES_NAMESPACE, true) && preferences.isKey(I2C_DEVICE_MAP_KEY)
+      && preferences.getUChar(I2C_DEVICE_MAP_KEY) == map;
+    preferences.end();
+    if (!cached) {
+      ESP_LOGI(TAG, "I2C device map changed, scanning bus");
+      map = scanBus();
+      storeDeviceMap(map);
+    }
     Wire.setClock(I2C_CLK);
     giveMutex();
+    deviceMap = map;
+    for (uint8_t i = 0; i < KNOWN_DEVICE_COUNT; i++) {
+      *knownDevices[i].detected = (map & bit(i)) != 0;
+      if (map & bit(i)) ESP_LOGD(TAG, "%s found", knownDevices[i].name);
+    }
   }
 
+  // Full scan on demand, the result is stored and used from the next boot.
+  uint8_t rescan() {
+    if (!takeMutex(I2C_MUTEX_DEF_WAIT)) return deviceMap;
+    Wire.setClock(SCD30_I2C_CLK);
+    uint8_t map = scanBus();
+    Wire.setClock(I2C_CLK);
+    giveMutex();
+    storeDeviceMap(map);
+    if (map != deviceMap) ESP_LOGI(TAG, "I2C device map changed from 0x%02x to 0x%02x", deviceMap, map);
+    return map;
+  }
+
+  uint8_t getDeviceMap() {
+    return deviceMap;
+  }
 }
\ No newline at end of file
@@ -48,7 +48,13 @@ LCD::LCD(TwoWire* _wire, Model* _model) {
 }
 
 LCD::~LCD() {
-  if (this->display) delete display;
+  if (!this->display) return;
+  if (I2C::takeMutex(portMAX_DELAY)) {
+    this->display->clearDisplay();
+    this->display->display();
+    I2C::giveMutex();
+  }
+  delete display;
 };
 
 void LCD::updateMessage(char const* msg) {
@@ -83,11 +89,12 @@ void LCD::clearPriorityMessage() {
   I2C::giveMutex();
 }
 
-void LCD::update(uint16_t mask, TrafficLightStatus oldStatus, TrafficLightStatus newStatus) {
+void LCD::update(MeasurementMask mask, TrafficLightStatus oldStatus, TrafficLightStatus newStatus) {
   if (!I2C::takeMutex(I2C_MUTEX_DEF_WAIT)) return;
 
+  ModelSnapshot snapshot = model->getSnapshot();
   // see if only CO2 sensor is present
-  if ((I2C::scd30Present() || I2C::scd40Present()) && (!I2C::bme680Present() || model->getIAQ() == 0) && !I2C::sps30Present()) {
+  if ((I2C::scd30Present() || I2C::scd40Present()) && (!I2C::bme680Present() || snapshot.iaq == 0) && !I2C::sps30Present()) {
     // 8-24 vs 12-40
     this->display->writeFillRect(4, line1_y, 120, line_height * 3, BLACK);
     this->display->setTextSize(1);
@@ -99,10 +106,10 @@ void LCD::update(uint16_t mask, TrafficLightStatus oldStatus, TrafficLightStatus
       this->display->setCursor(4, 46);
     }
 
-    if (model->getCo2() == 0) {
+    if (snapshot.co2 == 0) {
       this->display->print("----");
     } else {
-      this->display->printf("%4u", model->getCo2());
+      this->display->printf("%4u", snapshot.co2);
     }
     if (config.ssd1306Rows == 32) {
       this->display->setFont(FONT_9);
@@ -118,10 +125,10 @@ void LCD::update(uint16_t mask, TrafficLightStatus oldStatus, TrafficLightStatus
       this->display->setFont(config.ssd1306Rows == 32 ? NULL : FONT_9);
       this->display->setTextSize(1);
       this->display->setCursor(0, line1_y + (config.ssd1306Rows == 32 ? 0 : (line_height - 4)));
-      if (model->getCo2() == 0) {
+      if (snapshot.co2 == 0) {
         this->display->print("CO2: ----");
       } else {
-        this->display->printf("CO2: %4u", model->getCo2());
+        this->display->printf("CO2: %4u", snapshot.co2);
       }
       this->display->setFont(NULL);
       this->display->setCursor(this->display->getCursorX() + 3, this->display->getCursorY());
@@ -132,10 +139,10 @@ void LCD::update(uint16_t mask, TrafficLightStatus oldStatus, TrafficLightStatus
       this->display->setFont(config.ssd1306Rows == 32 ? NULL : FONT_9);
       this->display->setTextSize(1);
       this->display->setCursor(0, line2_y + (config.ssd1306Rows == 32 ? 0 : (line_height - 4)));
-      if (model->getIAQ() == 0) {
+      if (snapshot.iaq == 0) {
         this->display->print("IAQ: ----");
       } else {
-        this->display->printf("IAQ: %4u", model->getIAQ());
+        this->display->printf("IAQ: %4u", snapshot.iaq);
       }
     }
     if (mask & M_PM2_5) {
@@ -143,10 +150,10 @@ void LCD::update(uint16_t mask, TrafficLightStatus oldStatus, TrafficLightStatus
       this->display->setFont(config.ssd1306Rows == 32 ? NULL : FONT_9);
       this->display->setTextSize(1);
       this->display->setCursor(0, line3_y + (config.ssd1306Rows == 32 ? 0 : (line_height - 4)));
-      if (model->getPM10() == 0) {
+      if (snapshot.pm10 == 0) {
         this->display->print("PM2.5: ----");
       } else {
-        this->display->printf("PM2.5: %4u", model->getPM2_5());
+        this->display->printf("PM2.5: %4u", snapshot.pm2_5);
       }
     }
   }
@@ -155,7 +162,7 @@ void LCD::update(uint16_t mask, TrafficLightStatus oldStatus, TrafficLightStatus
   this->display->setFont(NULL);
   this->display->setTextSize(1);
   this->display->setCursor(0, temp_hum_y);
-  this->display->printf("temp: %3.1f  hum: %2.0f%%", model->getTemperature(), model->getHumidity());
+  this->display->printf("temp: %3.1f  hum: %2.0f%%", snapshot.temperature, snapshot.humidity);
 
   this->display->display();
   I2C::giveMutex();
@@ -27,6 +27,9 @@
 #include <bme680.h>
 #include <wifiManager.h>
 #include <ota.h>
+#include <bootProfile.h>
+#include <eventBus.h>
+#include <telemetry.h>
 
 // Local logging tag
 static const char TAG[] = __FILE__;
@@ -45,6 +48,7 @@ BME680* bme680;
 TaskHandle_t sensorsTask;
 TaskHandle_t wifiManagerTask;
 TaskHandle_t neopixelMatrixTask;
+TaskHandle_t selfTestTask;
 
 bool hasLEDs = false;
 bool hasNeoPixel = false;
@@ -52,6 +56,17 @@ bool hasFeatherMatrix = false;
 bool hasNeopixelMatrix = false;
 bool hasHub75 = false;
 
+// Output drivers are replaced by the loop task when their settings change, on the core setup() created
+// them on. outputsMutex keeps model events, messages and the drivers' timers (see outputTimer()) away from a
+// driver while it's being replaced.
+SemaphoreHandle_t outputsMutex;
+Config outputConfig;   // settings the current output drivers were created with
+volatile bool reconfigureOutputsPending = false;
+volatile uint32_t configChangedTime = 0;
+
+// everything an output shows, to redraw it from scratch
+const MeasurementMask M_REDRAW = M_ALL_MEASUREMENTS | M_CONFIG_CHANGED;
+
 const uint32_t debounceDelay = 50;
 volatile uint32_t lastBtnDebounceTime = 0;
 volatile uint8_t buttonState = 0;
@@ -64,74 +79,224 @@ void ICACHE_RAM_ATTR buttonHandler() {
 }
 
 void prepareOta() {
+  xSemaphoreTake(outputsMutex, portMAX_DELAY);
   if (hasHub75 && hub75) hub75->stopDMA();
   if (hasNeopixelMatrix && neopixelMatrix) {
     hasNeopixelMatrix = false;
     neopixelMatrix->stop();
   }
+  xSemaphoreGive(outputsMutex);
 }
 
 void updateMessage(char const* msg) {
+  xSemaphoreTake(outputsMutex, portMAX_DELAY);
   if (lcd) {
     lcd->updateMessage(msg);
   }
+  xSemaphoreGive(outputsMutex);
 }
 
 void setPriorityMessage(char const* msg) {
+  xSemaphoreTake(outputsMutex, portMAX_DELAY);
   if (lcd) {
     lcd->setPriorityMessage(msg);
   }
+  xSemaphoreGive(outputsMutex);
 }
 
 void clearPriorityMessage() {
+  xSemaphoreTake(outputsMutex, portMAX_DELAY);
   if (lcd) {
     lcd->clearPriorityMessage();
   }
+  xSemaphoreGive(outputsMutex);
 }
 
-void modelUpdatedEvt(uint16_t mask, TrafficLightStatus oldStatus, TrafficLightStatus newStatus) {
+void updateOutputs(MeasurementMask mask, TrafficLightStatus oldStatus, TrafficLightStatus newStatus) {
   if (lcd) lcd->update(mask, oldStatus, newStatus);
   if (hasLEDs && trafficLight) trafficLight->update(mask, oldStatus, newStatus);
   if (hasNeoPixel && neopixel) neopixel->update(mask, oldStatus, newStatus);
   if (hasFeatherMatrix && featherMatrix) featherMatrix->update(mask, oldStatus, newStatus);
   if (hasNeopixelMatrix && neopixelMatrix) neopixelMatrix->update(mask, oldStatus, newStatus);
   if (hasHub75 && hub75) hub75->update(mask, oldStatus, newStatus);
-  if ((mask & M_PRESSURE) && I2C::scd40Present() && scd40) scd40->setAmbientPressure(model->getPressure());
-  if ((mask & M_PRESSURE) && I2C::scd30Present() && scd30) scd30->setAmbientPressure(model->getPressure());
-  if ((mask & ~M_CONFIG_CHANGED) != M_NONE) {
-    char buf[8];
-    DynamicJsonDocument* doc = new DynamicJsonDocument(512);
-    if (mask & M_CO2) (*doc)["co2"] = model->getCo2();
-    if (mask & M_TEMPERATURE) {
-      sprintf(buf, "%.1f", model->getTemperature());
-      (*doc)["temperature"] = buf;
-    }
-    if (mask & M_HUMIDITY) {
-      sprintf(buf, "%.1f", model->getHumidity());
-      (*doc)["humidity"] = buf;
-    }
-    if (mask & M_PRESSURE) (*doc)["pressure"] = model->getPressure();
-    if (mask & M_IAQ) (*doc)["iaq"] = model->getIAQ();
-    if (mask & M_PM0_5) (*doc)["pm0.5"] = model->getPM0_5();
-    if (mask & M_PM1_0) (*doc)["pm1"] = model->getPM1();
-    if (mask & M_PM2_5) (*doc)["pm2.5"] = model->getPM2_5();
-    if (mask & M_PM4) (*doc)["pm4"] = model->getPM4();
-    if (mask & M_PM10) (*doc)["pm10"] = model->getPM10();
-    mqtt::publishSensors(doc);
+}
+
+// Runs the cosmetic LED self-tests once networking is up, so they don't hold back the first reading.
+// The outputs are only locked per step, so messages from the sensor tasks aren't held up by the test.
+void selfTestLoop(void* pvParameters) {
+  uint32_t start = millis();
+  while (!WiFi.isConnected() && millis() - start < SELF_TEST_MAX_WAIT) vTaskDelay(pdMS_TO_TICKS(100));
+  for (uint8_t step = 0; step <= SELF_TEST_STEPS; step++) {
+    if (step > 0) vTaskDelay(pdMS_TO_TICKS(SELF_TEST_STEP_TIME));
+    xSemaphoreTake(outputsMutex, portMAX_DELAY);
+    if (hasLEDs && trafficLight) trafficLight->selfTest(step);
+    if (hasNeoPixel && neopixel) neopixel->selfTest(step);
+    if (hasFeatherMatrix && featherMatrix) featherMatrix->selfTest(step);
+    if (step == SELF_TEST_STEPS) updateOutputs(M_REDRAW, OFF, model->getStatus());
+    xSemaphoreGive(outputsMutex);
+  }
+  BootProfile::mark("selfTest");
+  vTaskDelete(NULL);
+}
+
+void createTrafficLight() {
+  hasLEDs = (config.greenLed != 0 && config.yellowLed != 0 && config.redLed != 0);
+  if (hasLEDs) trafficLight = new TrafficLight(model, config.redLed, config.yellowLed, config.greenLed);
+}
+
+void createNeopixel() {
+  hasNeoPixel = (config.neopixelData != 0 && config.neopixelNumber != 0);
+  if (hasNeoPixel) neopixel = new Neopixel(model, config.neopixelData, config.neopixelNumber);
+}
+
+void createFeatherMatrix() {
+  hasFeatherMatrix = (config.featherMatrixClock != 0 && config.featherMatrixData != 0);
+  if (hasFeatherMatrix) featherMatrix = new FeatherMatrix(model, config.featherMatrixData, config.featherMatrixClock);
+}
+
+void createNeopixelMatrix() {
+  hasNeopixelMatrix = (config.neopixelMatrixData != 0 && config.matrixColumns != 0 && config.matrixRows != 0);
+  if (!hasNeopixelMatrix) return;
+  neopixelMatrix = new NeopixelMatrix(model, config.neopixelMatrixData, config.matrixColumns, config.matrixRows, config.matrixLayout);
+  neopixelMatrixTask = neopixelMatrix->start(
+    "neopixelMatrixLoop",  // name of task
+    4096,                  // stack size of task
+    3,                     // priority of the task
+    1);                    // CPU core
+}
+
+void createHub75() {
+  hasHub75 = (config.hub75B1 != 0 && config.hub75B2 != 0 && config.hub75ChA != 0 && config.hub75ChB != 0 && config.hub75ChC != 0 && config.hub75ChD != 0
+    && config.hub75Clk != 0 && config.hub75G1 != 0 && config.hub75G2 != 0 && config.hub75Lat != 0 && config.hub75Oe != 0 && config.hub75R1 != 0 && config.hub75R2 != 0);
+  if (hasHub75) hub75 = new HUB75(model);
+}
+
+void createOutputs() {
+  xSemaphoreTake(outputsMutex, portMAX_DELAY);
+  outputConfig = config;
+  if (I2C::lcdPresent()) lcd = new LCD(&Wire, model);
+  createTrafficLight();
+  createNeopixel();
+  createFeatherMatrix();
+  createNeopixelMatrix();
+  createHub75();
+  xSemaphoreGive(outputsMutex);
+}
+
+// Replaces the drivers whose settings changed and redraws all outputs, returns the number of replaced drivers.
+uint8_t reconfigureOutputs() {
+  uint8_t replaced = 0;
+  xSemaphoreTake(outputsMutex, portMAX_DELAY);
+  if (I2C::lcdPresent() && config.ssd1306Rows != outputConfig.ssd1306Rows) {
+    delete lcd;
+    lcd = new LCD(&Wire, model);
+    replaced++;
+  }
+  if (config.greenLed != outputConfig.greenLed || config.yellowLed != outputConfig.yellowLed || config.redLed != outputConfig.redLed) {
+    hasLEDs = false;
+    delete trafficLight;
+    trafficLight = nullptr;
+    createTrafficLight();
+    replaced++;
+  }
+  if (config.neopixelData != outputConfig.neopixelData || config.neopixelNumber != outputConfig.neopixelNumber) {
+    hasNeoPixel = false;
+    delete neopixel;
+    neopixel = nullptr;
+    createNeopixel();
+    replaced++;
+  }
+  if (config.featherMatrixData != outputConfig.featherMatrixData || config.featherMatrixClock != outputConfig.featherMatrixClock) {
+    hasFeatherMatrix = false;
+    delete featherMatrix;
+    featherMatrix = nullptr;
+    createFeatherMatrix();
+    replaced++;
   }
+  if (config.neopixelMatrixData != outputConfig.neopixelMatrixData || config.matrixColumns != outputConfig.matrixColumns
+    || config.matrixRows != outputConfig.matrixRows || config.matrixLayout != outputConfig.matrixLayout) {
+    hasNeopixelMatrix = false;
+    neopixelMatrixTask = NULL;
+    delete neopixelMatrix;
+    neopixelMatrix = nullptr;
+    createNeopixelMatrix();
+    replaced++;
+  }
+  // the HUB75 pins are consecutive in Config
+  if (memcmp(&config.hub75R1, &outputConfig.hub75R1, offsetof(Config, hub75Oe) - offsetof(Config, hub75R1) + 1) != 0) {
+    hasHub75 = false;
+    delete hub75;
+    hub75 = nullptr;
+    createHub75();
+    replaced++;
+  }
+  outputConfig = config;
+  if (replaced > 0) updateOutputs(M_REDRAW, OFF, model->getStatus());
+  xSemaphoreGive(outputsMutex);
+  return replaced;
+}
+
+// Brings back the displays stopped by prepareOta() after an update over MQTT was aborted or failed
+void restoreAfterOta() {
+  xSemaphoreTake(outputsMutex, portMAX_DELAY);
+  if (hub75) {
+    hasHub75 = false;
+    delete hub75;
+    hub75 = nullptr;
+    createHub75();
+  }
+  if (neopixelMatrix) {
+    neopixelMatrixTask = NULL;
+    delete neopixelMatrix;
+    neopixelMatrix = nullptr;
+    createNeopixelMatrix();
+  }
+  updateOutputs(M_REDRAW, OFF, model->getStatus());
+  xSemaphoreGive(outputsMutex);
+}
+
+// Model events are delivered by the event bus, each of these runs in its own subscriber task.
+void outputsEvt(MeasurementMask mask, TrafficLightStatus oldStatus, TrafficLightStatus newStatus) {
+  xSemaphoreTake(outputsMutex, portMAX_DELAY);
+  updateOutputs(mask, oldStatus, newStatus);
+  xSemaphoreGive(outputsMutex);
+}
+
+void pressureCompensationEvt(MeasurementMask mask, TrafficLightStatus oldStatus, TrafficLightStatus newStatus) {
+  if (!(mask & M_PRESSURE)) return;
+  uint16_t pressure = model->getPressure();
+  if (I2C::scd40Present() && scd40) scd40->setAmbientPressure(pressure);
+  if (I2C::scd30Present() && scd30) scd30->setAmbientPressure(pressure);
 }
 
+void telemetryEvt(MeasurementMask mask, TrafficLightStatus oldStatus, TrafficLightStatus newStatus) {
+  if ((mask & M_ALL_MEASUREMENTS) == M_NONE) return;
+  ModelSnapshot snapshot = model->getSnapshot();
+  MeasurementMask changed = Telemetry::select(snapshot, mask & M_ALL_MEASUREMENTS);
+  if (changed == M_NONE) return;
+  DynamicJsonDocument* doc = new DynamicJsonDocument(1024);
+  measurementsToJson(snapshot, changed, doc->to<JsonObject>());
+  if (doc->size() == 0) {
+    delete doc;
+    return;
+  }
+  mqtt::publishSensors(doc);
+  BootProfile::mark("firstReading");
+}
+
+// Called from the MQTT command and WiFi manager tasks, the outputs are updated by the loop task.
 void configChanged() {
-  model->configurationChanged();
+  configChangedTime = millis();
+  reconfigureOutputsPending = true;
 }
 
 void calibrateCo2SensorCallback(uint16_t co2Reference) {
   ESP_LOGI(TAG, "Starting calibration");
-  if (lcd) lcd->setPriorityMessage("Starting calibration");
+  setPriorityMessage("Starting calibration");
   if (I2C::scd30Present() && scd30) scd30->calibrateScd30ToReference(co2Reference);
   if (I2C::scd40Present() && scd40) scd40->calibrateScd40ToReference(co2Reference);
   vTaskDelay(pdMS_TO_TICKS(200));
-  if (lcd) lcd->clearPriorityMessage();
+  clearPriorityMessage();
 }
 
 void setTemperatureOffsetCallback(float temperatureOffset) {
@@ -201,8 +366,10 @@ void setup() {
   esp_log_set_vprintf(logging::logger);
   esp_log_level_set("*", ESP_LOG_VERBOSE);
   ESP_LOGI(TAG, "CO2 Monitor v%s. Built from %s @ %s", APP_VERSION, SRC_REVISION, BUILD_TIMESTAMP);
+  BootProfile::mark("serial");
 
-  model = new Model(modelUpdatedEvt);
+  outputsMutex = xSemaphoreCreateMutex();
+  model = new Model(EventBus::publish);
 
   logCoreInfo();
 
@@ -211,6 +378,7 @@ void setup() {
   ESP_ERROR_CHECK(esp_event_loop_create_default());
   ESP_ERROR_CHECK(esp_event_handler_instance_register(WIFI_EVENT, ESP_EVENT_ANY_ID, WifiManager::eventHandler, NULL, NULL));
   ESP_ERROR_CHECK(esp_event_handler_instance_register(IP_EVENT, IP_EVENT_STA_GOT_IP, WifiManager::eventHandler, NULL, NULL));
+  ESP_ERROR_CHECK(esp_event_handler_instance_register(IP_EVENT, IP_EVENT_STA_GOT_IP, mqtt::eventHandler, NULL, NULL));
 
   setupConfigManager();
   if (!loadConfiguration(config)) {
@@ -218,33 +386,13 @@ void setup() {
     saveConfiguration(config);
   }
   logConfiguration(config);
+  BootProfile::mark("config");
 
   WifiManager::setupWifiManager("CO2-Monitor", getConfigParameters(), false, true,
     updateMessage, setPriorityMessage, clearPriorityMessage, configChanged);
+  BootProfile::mark("wifi");
 
-  hasLEDs = (config.greenLed != 0 && config.yellowLed != 0 && config.redLed != 0);
-  hasNeoPixel = (config.neopixelData != 0 && config.neopixelNumber != 0);
-  hasFeatherMatrix = (config.featherMatrixClock != 0 && config.featherMatrixData != 0);
-  hasNeopixelMatrix = (config.neopixelMatrixData != 0 && config.matrixColumns != 0 && config.matrixRows != 0);
-  hasHub75 = (config.hub75B1 != 0 && config.hub75B2 != 0 && config.hub75ChA != 0 && config.hub75ChB != 0 && config.hub75ChC != 0 && config.hub75ChD != 0
-    && config.hub75Clk != 0 && config.hub75G1 != 0 && config.hub75G2 != 0 && config.hub75Lat != 0 && config.hub75Oe != 0 && config.hub75R1 != 0 && config.hub75R2 != 0);
-
-  Wire.begin((int)SDA_PIN, (int)SCL_PIN, (uint32_t)I2C_CLK);
-
-  I2C::initI2C();
-
-  if (I2C::scd30Present()) scd30 = new SCD30(&Wire, model, updateMessage);
-  if (I2C::scd40Present()) scd40 = new SCD40(&Wire, model, updateMessage);
-  if (I2C::sps30Present()) sps30 = new SPS_30(&Wire, model, updateMessage);
-  if (I2C::bme680Present()) bme680 = new BME680(&Wire, model, updateMessage);
-  if (I2C::lcdPresent()) lcd = new LCD(&Wire, model);
-
-  if (hasLEDs) trafficLight = new TrafficLight(model, config.redLed, config.yellowLed, config.greenLed);
-  if (hasNeoPixel) neopixel = new Neopixel(model, config.neopixelData, config.neopixelNumber);
-  if (hasFeatherMatrix) featherMatrix = new FeatherMatrix(model, config.featherMatrixData, config.featherMatrixClock);
-  if (hasNeopixelMatrix) neopixelMatrix = new NeopixelMatrix(model, config.neopixelMatrixData, config.matrixColumns, config.matrixRows, config.matrixLayout);
-  if (hasHub75) hub75 = new HUB75(model);
-
+  // networking doesn't depend on the peripherals, get MQTT going while they are initialised
   mqtt::setupMqtt(
     calibrateCo2SensorCallback,
     setTemperatureOffsetCallback,
@@ -267,6 +415,14 @@ void setup() {
     &mqtt::mqttTask,    // task handle
     0);                 // CPU core
 
+  xTaskCreatePinnedToCore(mqtt::commandLoop,  // task function
+    "commandLoop",      // name of task
+    8192,               // stack size of task
+    (void*)1,           // parameter of the task
+    1,                  // priority of the task
+    &mqtt::commandTask, // task handle
+    0);                 // CPU core
+
   xTaskCreatePinnedToCore(OTA::otaLoop,  // task function
     "otaLoop",          // name of task
     8192,               // stack size of task
@@ -274,6 +430,25 @@ void setup() {
     2,                  // priority of the task
     &OTA::otaTask,      // task handle
     1);                 // CPU core
+  BootProfile::mark("mqtt");
+
+  Wire.begin((int)SDA_PIN, (int)SCL_PIN, (uint32_t)I2C_CLK);
+
+  I2C::initI2C();
+  BootProfile::mark("i2c");
+
+  if (I2C::scd30Present()) scd30 = new SCD30(&Wire, model, updateMessage);
+  if (I2C::scd40Present()) scd40 = new SCD40(&Wire, model, updateMessage);
+  if (I2C::sps30Present()) sps30 = new SPS_30(&Wire, model, updateMessage);
+  if (I2C::bme680Present()) bme680 = new BME680(&Wire, model, updateMessage);
+  BootProfile::mark("sensors");
+  createOutputs();
+  BootProfile::mark("displays");
+
+  // below the sensors task, so a slow display or a full MQTT queue never delays a reading
+  EventBus::subscribe("outputsEvt", outputsEvt, 4096, 1, 1);
+  EventBus::subscribe("pressureEvt", pressureCompensationEvt, 2048, 1, 1);
+  EventBus::subscribe("telemetryEvt", telemetryEvt, 3072, 1, 1);
 
   Sensors::setupSensorsLoop(scd30, scd40, sps30, bme680);
   sensorsTask = Sensors::start(
@@ -282,14 +457,6 @@ void setup() {
     2,                  // priority of the task
     1);                 // CPU core
 
-  if (hasNeopixelMatrix) {
-    neopixelMatrixTask = neopixelMatrix->start(
-      "neopixelMatrixLoop",  // name of task 
-      4096,                  // stack size of task
-      3,                     // priority of the task
-      1);                    // CPU core
-  }
-
   wifiManagerTask = WifiManager::start(
     "wifiManagerLoop",  // name of task
     8192,               // stack size of task
@@ -298,10 +465,24 @@ void setup() {
 
   housekeeping::cyclicTimer.attach(30, housekeeping::doHousekeeping);
 
-  OTA::setupOta(prepareOta, setPriorityMessage, clearPriorityMessage);
+  OTA::setupOta(prepareOta, restoreAfterOta, setPriorityMessage, clearPriorityMessage);
 
   attachInterrupt(BTN_1, buttonHandler, CHANGE);
 
+  // commands that came in meanwhile need the I2C map, the sensors, the outputs and the OTA callbacks
+  mqtt::enableCommands();
+
+  if (hasLEDs || hasNeoPixel || hasFeatherMatrix) {
+    xTaskCreatePinnedToCore(selfTestLoop,  // task function
+      "selfTestLoop",     // name of task
+      2048,               // stack size of task
+      (void*)1,           // parameter of the task
+      1,                  // priority of the task
+      &selfTestTask,      // task handle
+      1);                 // CPU core
+  }
+
+  BootProfile::mark("setup");
   ESP_LOGI(TAG, "Setup done.");
 #ifdef SHOW_DEBUG_MSGS
   if (lcd) {
@@ -311,6 +492,18 @@ void setup() {
 }
 
 void loop() {
+  if (reconfigureOutputsPending) {
+    reconfigureOutputsPending = false;
+    uint8_t replaced = reconfigureOutputs();
+    model->configurationChanged();
+    if (replaced > 0) {
+      // a reboot would only get as far as the outputs after the boot phase "displays"
+      char msg[96];
+      sprintf(msg, "Replaced %u outputs, new config visible after %u ms (boot: %u ms)", replaced, millis() - configChangedTime, BootProfile::get("displays"));
+      ESP_LOGI(TAG, "%s", msg);
+      mqtt::publishStatusMsg(msg);
+    }
+  }
   if (buttonState != oldConfirmedButtonState && (millis() - lastBtnDebounceTime) > debounceDelay) {
     oldConfirmedButtonState = buttonState;
     if (oldConfirmedButtonState == 1) {
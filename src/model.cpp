@@ -1,139 +1,267 @@
 #include <model.h>
 #include <configManager.h>
+#include <stddef.h>
 
 // Local logging tag
 static const char TAG[] = __FILE__;
 
+constexpr MeasurementDescriptor measurementDescriptors[MEASUREMENT_COUNT] = {
+#define X(name, field, type, key, unit, decimals, maxSpread, delta, deltaPercent, flags) \
+  { key, unit, offsetof(ModelSnapshot, field), MeasurementTypeOf<type>::value, decimals, maxSpread, delta, deltaPercent, flags },
+  MODEL_MEASUREMENTS(X)
+#undef X
+};
+
+static_assert(sizeof(ModelSnapshot) <= 255, "MeasurementDescriptor::offset is too small");
+
+const char* const sensorSourceNames[SOURCE_COUNT] = { "scd30", "scd40", "bme680", "sps30" };
+
+// weights for FUSION_MEAN, roughly the inverse of the squared datasheet accuracy for CO2 and temperature
+const uint8_t sourceWeights[SOURCE_COUNT] = { 4, 2, 1, 1 };
+
+bool MeasurementDescriptor::hasValue(const ModelSnapshot& snapshot) const {
+  float value = getValue(snapshot);
+  return !isnan(value) && !(value == 0 && (flags & MEASUREMENT_ZERO_IS_NONE));
+}
+
+float MeasurementDescriptor::getValue(const ModelSnapshot& snapshot) const {
+  const uint8_t* field = (const uint8_t*)&snapshot + offset;
+  if (type == MEASUREMENT_FLOAT) return *(const float*)field;
+  return *(const uint16_t*)field;
+}
+
+void MeasurementDescriptor::setValue(ModelSnapshot& snapshot, float value) const {
+  uint8_t* field = (uint8_t*)&snapshot + offset;
+  if (type == MEASUREMENT_FLOAT) {
+    *(float*)field = value;
+  } else {
+    *(uint16_t*)field = isnan(value) ? 0 : (uint16_t)constrain(value + 0.5f, 0.0f, 65535.0f);
+  }
+}
+
+void MeasurementDescriptor::toJson(const ModelSnapshot& snapshot, JsonObject object) const {
+  if (type == MEASUREMENT_UINT16) {
+    object[key] = *(const uint16_t*)((const uint8_t*)&snapshot + offset);
+  } else {
+    // floats are published as strings with a fixed number of decimals, as they always have been
+    char buf[16];
+    snprintf(buf, sizeof(buf), "%.*f", decimals, getValue(snapshot));
+    object[key] = buf;
+  }
+}
+
+void measurementsToJson(const ModelSnapshot& snapshot, MeasurementMask mask, JsonObject object) {
+  for (uint8_t i = 0; i < MEASUREMENT_COUNT; i++) {
+    if ((mask & (1ul << i)) && measurementDescriptors[i].hasValue(snapshot)) measurementDescriptors[i].toJson(snapshot, object);
+  }
+  if (!(snapshot.drifting & mask)) return;
+  JsonArray drifting = object.createNestedArray("drifting");
+  for (uint8_t i = 0; i < MEASUREMENT_COUNT; i++) {
+    if (snapshot.drifting & mask & (1ul << i)) drifting.add(measurementDescriptors[i].key);
+  }
+}
+
 Model::Model(modelUpdatedEvt_t _modelUpdatedEvt) {
-  this->temperature = NaN;
-  this->humidity = NaN;
-  this->co2 = 0;
-  this->pressure = 0;
-  this->iaq = 0;
-  this->pm0_5 = 0;
-  this->pm1 = 0;
-  this->pm2_5 = 0;
-  this->pm4 = 0;
-  this->pm10 = 0;
+  memset(&data, 0, sizeof(data));
+  for (const MeasurementDescriptor& measurement : measurementDescriptors) {
+    if (measurement.type == MEASUREMENT_FLOAT) *(float*)((uint8_t*)&data + measurement.offset) = NaN;
+  }
+  data.status = OFF;
+  memset(readings, 0, sizeof(readings));
+  sequence = 0;
+  writeMux = portMUX_INITIALIZER_UNLOCKED;
+  updateMutex = xSemaphoreCreateMutex();
   this->modelUpdatedEvt = _modelUpdatedEvt;
-  this->status = OFF;
 }
 
-Model::~Model() {}
+Model::~Model() {
+  vSemaphoreDelete(updateMutex);
+}
+
+// Publishes next to the readers, called with updateMutex held
+void Model::publish(ModelSnapshot& next) {
+  next.sequence = sequence / 2 + 1;
+  next.timestamp = millis();
+  portENTER_CRITICAL(&writeMux);
+  __atomic_store_n(&sequence, sequence + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  memcpy((void*)&data, &next, sizeof(data));
+  __atomic_store_n(&sequence, sequence + 1, __ATOMIC_RELEASE);
+  portEXIT_CRITICAL(&writeMux);
+}
+
+ModelSnapshot Model::getSnapshot() {
+  ModelSnapshot snapshot;
+  uint32_t before, after;
+  do {
+    before = __atomic_load_n(&sequence, __ATOMIC_ACQUIRE);
+    memcpy(&snapshot, (const void*)&data, sizeof(snapshot));
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    after = __atomic_load_n(&sequence, __ATOMIC_RELAXED);
+  } while ((before & 1) || before != after);
+  return snapshot;
+}
 
-void Model::updateStatus() {
+// Called with updateMutex held
+void Model::updateStatus(ModelSnapshot& next) {
   TrafficLightStatus co2Status = OFF;
-  if (this->co2 != 0) {
-    if (this->co2 <= config.co2GreenThreshold) {
+  if (next.co2 != 0) {
+    if (next.co2 <= config.co2GreenThreshold) {
       co2Status = OFF;
-    } else if (this->co2 <= config.co2YellowThreshold) {
+    } else if (next.co2 <= config.co2YellowThreshold) {
       co2Status = GREEN;
-    } else if (this->co2 <= config.co2RedThreshold) {
+    } else if (next.co2 <= config.co2RedThreshold) {
       co2Status = YELLOW;
-    } else if (this->co2 <= config.co2DarkRedThreshold) {
+    } else if (next.co2 <= config.co2DarkRedThreshold) {
       co2Status = RED;
     } else {
       co2Status = DARK_RED;
     }
   }
   TrafficLightStatus iaqStatus = OFF;
-  if (iaq != 0) {
-    if (iaq <= config.iaqGreenThreshold) {
+  if (next.iaq != 0) {
+    if (next.iaq <= config.iaqGreenThreshold) {
       iaqStatus = OFF;
-    } else if (iaq <= config.iaqYellowThreshold) {
+    } else if (next.iaq <= config.iaqYellowThreshold) {
       iaqStatus = GREEN;
-    } else if (iaq <= config.iaqRedThreshold) {
+    } else if (next.iaq <= config.iaqRedThreshold) {
       iaqStatus = YELLOW;
-    } else if (iaq <= config.iaqDarkRedThreshold) {
+    } else if (next.iaq <= config.iaqDarkRedThreshold) {
       iaqStatus = RED;
     } else {
       iaqStatus = DARK_RED;
     }
   }
-  this->status = max(co2Status, iaqStatus);
-  //  ESP_LOGD(TAG, "UpdateStatus CO2: %i (%u), IAQ: %i (%u) ==> %i", co2Status, this->co2, iaqStatus, this->iaq, this->status);
+  next.status = max(co2Status, iaqStatus);
+  //  ESP_LOGD(TAG, "UpdateStatus CO2: %i (%u), IAQ: %i (%u) ==> %i", co2Status, next.co2, iaqStatus, next.iaq, next.status);
 }
 
-void Model::updateModel(uint16_t _co2) {
-  this->co2 = _co2;
-  TrafficLightStatus oldStatus = this->status;
-  this->updateStatus();
-  modelUpdatedEvt((_co2 != 0 ? M_CO2 : M_NONE), oldStatus, this->status);
-}
+// Called with updateMutex held after the reading of source has been stored
+void Model::fuse(ModelSnapshot& next, MeasurementId id, SensorSource source, uint32_t now) {
+  const MeasurementDescriptor& measurement = measurementDescriptors[id];
+  MeasurementMask bit = 1ul << id;
+  float values[SOURCE_COUNT];
+  uint8_t sources[SOURCE_COUNT];
+  uint8_t count = 0;
+  for (uint8_t s = 0; s < SOURCE_COUNT; s++) {
+    const SourceReading& reading = readings[s][id];
+    if (reading.valid && now - reading.time < SENSOR_READING_TIMEOUT) {
+      values[count] = reading.value;
+      sources[count++] = s;
+    }
+  }
+  next.drifting &= ~bit;
+  if (count == 0) {
+    // no source has a reading, store the missing value as reported
+    measurement.setValue(next, readings[source][id].value);
+    return;
+  }
+  if (count == 1) {
+    measurement.setValue(next, values[0]);
+    return;
+  }
 
-void Model::updateModel(uint16_t _co2, float _temperature, float _humidity) {
-  this->co2 = _co2;
-  this->temperature = _temperature;
-  this->humidity = _humidity;
-  TrafficLightStatus oldStatus = this->status;
-  this->updateStatus();
-  modelUpdatedEvt((_co2 != 0 ? M_CO2 : M_NONE) | M_TEMPERATURE | M_HUMIDITY, oldStatus, this->status);
-}
+  SourceReading& updated = readings[source][id];
+  if (updated.valid) {
+    float others = 0;
+    for (uint8_t i = 0; i < count; i++) {
+      if (sources[i] != source) others += values[i];
+    }
+    others /= count - 1;
+    updated.drift += (updated.value - others - updated.drift) / SENSOR_DRIFT_SMOOTHING;
+  }
+  if (measurement.maxSpread > 0) {
+    for (uint8_t i = 0; i < count; i++) {
+      if (fabsf(readings[sources[i]][id].drift) > measurement.maxSpread) next.drifting |= bit;
+    }
+  }
 
-void Model::updateModel(float _temperature, float _humidity, uint16_t _pressure, uint16_t _iaq) {
-  this->temperature = _temperature;
-  this->humidity = _humidity;
-  this->pressure = _pressure;
-  this->iaq = _iaq;
-  TrafficLightStatus oldStatus = this->status;
-  this->updateStatus();
-  modelUpdatedEvt(M_TEMPERATURE | M_HUMIDITY | M_PRESSURE | (_iaq != 0 ? M_IAQ : M_NONE), oldStatus, this->status);
+  float fused = values[0];
+  switch (config.sensorFusion) {
+  case FUSION_MEAN: {
+    float sum = 0;
+    uint16_t weights = 0;
+    for (uint8_t i = 0; i < count; i++) {
+      sum += values[i] * sourceWeights[sources[i]];
+      weights += sourceWeights[sources[i]];
+    }
+    fused = sum / weights;
+    break;
+  }
+  case FUSION_MEDIAN:
+    for (uint8_t i = 1; i < count; i++) {
+      for (uint8_t j = i; j > 0 && values[j - 1] > values[j]; j--) std::swap(values[j - 1], values[j]);
+    }
+    fused = (count & 1) ? values[count / 2] : (values[count / 2 - 1] + values[count / 2]) / 2;
+    break;
+  default:
+    // sources are in the order of their default priority
+    for (uint8_t i = 0; i < count; i++) {
+      if (sources[i] == config.preferredSensor) fused = values[i];
+    }
+  }
+  measurement.setValue(next, fused);
 }
 
-void Model::updateModel(uint16_t _pm0_5, uint16_t _pm1, uint16_t _pm2_5, uint16_t _pm4, uint16_t _pm10) {
-  this->pm0_5 = _pm0_5;
-  this->pm1 = _pm1;
-  this->pm2_5 = _pm2_5;
-  this->pm4 = _pm4;
-  this->pm10 = _pm10;
-  modelUpdatedEvt(M_PM0_5 | M_PM1_0 | M_PM2_5 | M_PM4 | M_PM10, this->status, this->status);
+/**
+ * Fuses into a copy of the model while holding updateMutex, which only serializes the writers. Readers just
+ * retry if they copied the model while publish() replaced it.
+ */
+void Model::updateModel(SensorSource source, const ModelSnapshot& values, MeasurementMask mask) {
+  MeasurementMask updated = M_NONE;
+  uint32_t now = millis();
+  xSemaphoreTake(updateMutex, portMAX_DELAY);
+  // only writers change data and they hold updateMutex, so it can be copied without the seqlock
+  ModelSnapshot next = data;
+  TrafficLightStatus oldStatus = next.status;
+  MeasurementMask oldDrifting = next.drifting;
+  for (uint8_t i = 0; i < MEASUREMENT_COUNT; i++) {
+    if (!(mask & (1ul << i))) continue;
+    const MeasurementDescriptor& measurement = measurementDescriptors[i];
+    SourceReading& reading = readings[source][i];
+    reading.value = measurement.getValue(values);
+    reading.valid = measurement.hasValue(values);
+    reading.time = now;
+    fuse(next, (MeasurementId)i, source, now);
+    if (measurement.hasValue(next)) updated |= 1ul << i;
+  }
+  updateStatus(next);
+  publish(next);
+  for (uint8_t i = 0; i < MEASUREMENT_COUNT; i++) {
+    if (!((next.drifting ^ oldDrifting) & (1ul << i))) continue;
+    char msg[96];
+    int length = snprintf(msg, sizeof(msg), "%s %s:", measurementDescriptors[i].key, (next.drifting & (1ul << i)) ? "sensors drifting apart" : "sensors no longer drifting");
+    for (uint8_t s = 0; s < SOURCE_COUNT && length < (int)sizeof(msg); s++) {
+      if (readings[s][i].valid) length += snprintf(msg + length, sizeof(msg) - length, " %s %.1f (%+.1f)", sensorSourceNames[s], readings[s][i].value, readings[s][i].drift);
+    }
+    ESP_LOGW(TAG, "%s", msg);
+  }
+  xSemaphoreGive(updateMutex);
+  modelUpdatedEvt(updated, oldStatus, next.status);
 }
 
 void Model::configurationChanged() {
-  updateStatus();
-  modelUpdatedEvt(M_CONFIG_CHANGED, this->status, this->status);
+  xSemaphoreTake(updateMutex, portMAX_DELAY);
+  ModelSnapshot next = data;
+  updateStatus(next);
+  publish(next);
+  xSemaphoreGive(updateMutex);
+  modelUpdatedEvt(M_CONFIG_CHANGED, next.status, next.status);
 }
 
+// The single value getters read through a snapshot as well, use getSnapshot() to read several values.
 TrafficLightStatus Model::getStatus() {
-  return this->status;
+  return getSnapshot().status;
 }
 
 uint16_t Model::getCo2() {
-  return this->co2;
-}
-
-float Model::getTemperature() {
-  return this->temperature;
-}
-
-float Model::getHumidity() {
-  return this->humidity;
+  return getSnapshot().co2;
 }
 
 uint16_t Model::getPressure() {
-  return this->pressure;
-}
-
-uint16_t Model::getIAQ() {
-  return this->iaq;
-}
-
-uint16_t Model::getPM0_5() {
-  return this->pm0_5;
-}
-
-uint16_t Model::getPM1() {
-  return this->pm1;
-}
-
-uint16_t Model::getPM2_5() {
-  return this->pm2_5;
-}
-
-uint16_t Model::getPM4() {
-  return this->pm4;
+  return getSnapshot().pressure;
 }
 
-uint16_t Model::getPM10() {
-  return this->pm10;
+float Model::getValue(MeasurementId id) {
+  return measurementDescriptors[id].getValue(getSnapshot());
 }
@@ -2,15 +2,19 @@
 #include <Arduino.h>
 #include <config.h>
 
-#include <PubSubClient.h>
+#include <mqttClient.h>
 #include <WiFiClient.h>
 #include <WiFiClientSecure.h>
 #include <i2c.h>
 #include <configManager.h>
 #include <wifiManager.h>
 #include <ota.h>
+#include <blobUpload.h>
+#include <bootProfile.h>
+#include <telemetry.h>
 
 #include <LittleFS.h>
+#include <freertos/event_groups.h>
 
 // Local logging tag
 static const char TAG[] = __FILE__;
@@ -26,12 +30,88 @@ namespace mqtt {
   const uint8_t X_CMD_PUBLISH_SENSORS = bit(0);
   const uint8_t X_CMD_PUBLISH_CONFIGURATION = bit(1);
   const uint8_t X_CMD_PUBLISH_STATUS_MSG = bit(2);
+  const uint8_t X_CMD_PUBLISH_REPLY = bit(3);
 
   TaskHandle_t mqttTask;
-  QueueHandle_t mqttQueue;
+  TaskHandle_t commandTask;
+
+  // Downlink commands are executed on their own task so slow commands (TLS tests, file system writes,
+  // sensor cleaning) don't stall publishing and keepalives on the MQTT task.
+  // Handlers get the null terminated payload and may add details to the reply sent on .../up/reply.
+  typedef boolean(*commandHandler_t)(char* payload, size_t length, JsonDocument& reply);
+
+  struct CommandHandler {
+    const char* name;
+    commandHandler_t handler;
+  };
+
+  struct MqttCommand {
+    char name[MQTT_COMMAND_NAME_LEN + 1];
+    uint8_t slot;
+    size_t length;
+  };
+
+  // Payload buffers are allocated on first use and only ever grown, so they settle on the sizes seen.
+  struct PayloadBuffer {
+    char* data;
+    size_t capacity;
+  };
+
+  PayloadBuffer payloadPool[MQTT_COMMAND_QUEUE_LENGTH] = {};
+  QueueHandle_t commandQueue;
+  QueueHandle_t freePayloadSlots;
+  uint32_t commandsQueued = 0;
+  uint32_t commandsDropped = 0;
+  // COMMANDS_ENABLED is set by enableCommands() once setup() is done with everything the handlers use
+  EventGroupHandle_t commandEvents;
+  const EventBits_t COMMANDS_ENABLED = BIT0;
+
+  // set by the command task to have the MQTT task drop its connection while a second TLS session is tested,
+  // the MQTT task notifies pauseWaiter once it's disconnected and between publishes
+  volatile boolean pauseRequested = false;
+  volatile boolean paused = false;
+  TaskHandle_t volatile pauseWaiter = NULL;
+
+  // set by a command handler, the command task reboots once the command's reply had time to go out
+  boolean rebootRequested = false;
+
+  // Outbound messages are split into lanes so a message that keeps failing in one lane can't hold up
+  // the others. Lanes are served by a weighted round robin scheduler.
+  typedef enum {
+    LANE_CONTROL = 0,
+    LANE_STATUS,
+    LANE_TELEMETRY,
+    LANE_COUNT
+  } Lane;
+
+  struct MqttLane {
+    const char* name;
+    uint8_t capacity;
+    uint8_t weight;
+    boolean latestWins;   // drop the oldest message when full instead of the newest
+    QueueHandle_t queue;
+    uint8_t credits;
+    uint32_t sent;
+    uint32_t dropped;     // discarded to make room, or because the lane was full
+    uint32_t failed;      // taken off a latest-wins lane but not published
+  };
+
+  MqttLane lanes[LANE_COUNT] = {
+    { "control", MQTT_CONTROL_QUEUE_LENGTH, MQTT_CONTROL_WEIGHT, false, NULL, 0, 0, 0, 0 },
+    { "status", MQTT_STATUS_QUEUE_LENGTH, MQTT_STATUS_WEIGHT, false, NULL, 0, 0, 0, 0 },
+    { "telemetry", MQTT_TELEMETRY_QUEUE_LENGTH, MQTT_TELEMETRY_WEIGHT, true, NULL, 0, 0, 0, 0 }
+  };
 
   WiFiClient* wifiClient;
-  PubSubClient* mqtt_client;
+  MqttClient* mqtt_client;
+
+  // topics only depend on config, which needs a reboot to change, so they are built once
+  char sensorsTopic[MQTT_TOPIC_BUFFER_LEN];
+  char statusTopic[MQTT_TOPIC_BUFFER_LEN];
+  char configTopic[MQTT_TOPIC_BUFFER_LEN];
+  char deviceDownlinkTopic[MQTT_TOPIC_BUFFER_LEN];
+  char downlinkTopic[MQTT_TOPIC_BUFFER_LEN];
+  char replyTopic[MQTT_TOPIC_BUFFER_LEN];
 
   calibrateCo2SensorCallback_t calibrateCo2SensorCallback;
   setTemperatureOffsetCallback_t setTemperatureOffsetCallback;
@@ -45,6 +125,95 @@ namespace mqtt {
   uint32_t lastReconnectAttempt = 0;
   uint16_t connectionAttempts = 0;
 
+  // reconnect backoff and time-to-reconnect metrics
+  uint32_t reconnectDelay = 0;
+  uint8_t backoffExponent = 0;
+  uint32_t jitterState = 1;
+  volatile boolean reconnectImmediately = false;
+  boolean wasConnected = false;
+  uint32_t disconnectedSince = 0;
+  uint32_t reconnects = 0;
+  uint32_t lastTimeToReconnect = 0;
+  uint32_t maxTimeToReconnect = 0;
+
+  // duration of the last connect (TCP, TLS handshake and CONNECT/CONNACK) and the heap it held on to
+  uint32_t lastConnectDuration = 0;
+  uint32_t maxConnectDuration = 0;
+  int32_t lastConnectHeap = 0;
+
+  boolean bootProfilePublished = false;
+
+  void freeMessage(MqttMessage* msg) {
+    // send-on-delta relies on every selected value reaching the broker
+    if (msg->cmd == X_CMD_PUBLISH_SENSORS) Telemetry::invalidate();
+    if (msg->payload) delete msg->payload;
+    if (msg->cmd == X_CMD_PUBLISH_STATUS_MSG && msg->statusMessage) free(msg->statusMessage);
+  }
+
+  boolean enqueue(Lane lane, MqttMessage* msg) {
+    MqttLane* l = &lanes[lane];
+    if (!l->queue) {
+      freeMessage(msg);
+      return false;
+    }
+    boolean queued = xQueueSendToBack(l->queue, (void*)msg, l->latestWins ? 0 : pdMS_TO_TICKS(100)) == pdTRUE;
+    if (!queued && l->latestWins) {
+      // make room by discarding the oldest message - a newer reading supersedes it
+      MqttMessage oldest;
+      if (xQueueReceive(l->queue, &oldest, 0) == pdTRUE) {
+        freeMessage(&oldest);
+        l->dropped++;
+      }
+      queued = xQueueSendToBack(l->queue, (void*)msg, 0) == pdTRUE;
+    }
+    if (!queued) {
+      freeMessage(msg);
+      l->dropped++;
+      return false;
+    }
+    if (mqttTask) xTaskNotifyGive(mqttTask);
+    return true;
+  }
+
+  // xorshift32, seeded per device so monitors sharing a broker don't retry in lock-step
+  uint32_t nextRandom() {
+    jitterState ^= jitterState << 13;
+    jitterState ^= jitterState >> 17;
+    jitterState ^= jitterState << 5;
+    return jitterState;
+  }
+
+  // Exponential backoff with full jitter: a random delay between 0 and min(max, base * 2^attempt)
+  uint32_t nextReconnectDelay() {
+    uint32_t ceiling = min((uint32_t)MQTT_RECONNECT_MAX_DELAY, (uint32_t)MQTT_RECONNECT_BASE_DELAY << backoffExponent);
+    if (ceiling < MQTT_RECONNECT_MAX_DELAY) backoffExponent++;
+    return nextRandom() % (ceiling + 1);
+  }
+
+  void resetBackoff() {
+    backoffExponent = 0;
+    reconnectDelay = 0;
+  }
+
+  void eventHandler(void* event_handler_arg, esp_event_base_t event_base, int32_t event_id, void* event_data) {
+    if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP) {
+      // connectivity just came back, try the broker straight away instead of waiting out the backoff
+      reconnectImmediately = true;
+      if (mqttTask) xTaskNotifyGive(mqttTask);
+    }
+  }
+
+  void logQueueStatistics() {
+    for (uint8_t i = 0; i < LANE_COUNT; i++) {
+      ESP_LOGI(TAG, "MQTT lane %s: depth %u/%u, sent %u, dropped %u, failed %u", lanes[i].name, lanes[i].queue ? uxQueueMessagesWaiting(lanes[i].queue) : 0,
+        lanes[i].capacity, lanes[i].sent, lanes[i].dropped, lanes[i].failed);
+    }
+    if (mqtt_client) ESP_LOGI(TAG, "MQTT in flight %u, acknowledged %u, retransmitted %u, rejected %u", mqtt_client->getInFlight(), mqtt_client->getAcknowledged(), mqtt_client->getRetransmitted(), mqtt_client->getRejected());
+    ESP_LOGI(TAG, "MQTT commands queued %u, dropped %u", commandsQueued, commandsDropped);
+    ESP_LOGI(TAG, "MQTT reconnects %u, time to reconnect last %u ms, max %u ms", reconnects, lastTimeToReconnect, maxTimeToReconnect);
+    ESP_LOGI(TAG, "MQTT connect last %u ms, max %u ms, heap used %i, min free heap %u", lastConnectDuration, maxConnectDuration, lastConnectHeap, ESP.getMinFreeHeap());
+  }
+
   char* cloneStr(const char* original) {
     char* copy = (char*)malloc(strlen(original) + 1);
     strncpy(copy, original, strlen(original));
@@ -54,36 +223,38 @@ namespace mqtt {
 
   void publishSensors(DynamicJsonDocument* _payload) {
     if (!WiFi.isConnected() || !mqtt_client->connected()) {
+      Telemetry::invalidate();
       delete _payload;
       return;
     }
     MqttMessage msg;
     msg.cmd = X_CMD_PUBLISH_SENSORS;
     msg.payload = _payload;
-    if (!mqttQueue || !xQueueSendToBack(mqttQueue, (void*)&msg, pdMS_TO_TICKS(100))) {
-      delete msg.payload;
-    }
+    msg.statusMessage = nullptr;
+    enqueue(LANE_TELEMETRY, &msg);
   }
 
-  boolean publishSensorsInternal(MqttMessage queueMsg) {
-    char topic[256];
-    char msg[256];
-    sprintf(topic, "%s/%u/up/sensors", config.mqttTopic, config.deviceId);
+  // Serialises doc straight into the MQTT packet, the length is measured up front so no intermediate buffer is needed.
+  boolean publishJson(const char* topic, JsonDocument& doc, const MqttPublishProperties* properties = nullptr) {
+    size_t length = measureJson(doc);
+    if (!mqtt_client->beginPublish(topic, length, MQTT_QOS, false, properties)) return false;
+    serializeJson(doc, *mqtt_client);
+    return mqtt_client->endPublish();
+  }
 
-    // Serialize JSON to file
-    if (serializeJson(*queueMsg.payload, msg) == 0) {
-      ESP_LOGW(TAG, "Failed to serialise payload");
-      delete queueMsg.payload;
-      return true; // pretend to have been successful to prevent queue from clogging up
-    }
-    if (strncmp(msg, "null", 4) == 0) {
+  boolean publishSensorsInternal(MqttMessage queueMsg) {
+    // a reading that couldn't be delivered in time is of no use to anyone
+    MqttPublishProperties properties = { MQTT_TELEMETRY_EXPIRY, nullptr, 0 };
+    if (queueMsg.payload->isNull()) {
       ESP_LOGD(TAG, "Nothing to publish");
       delete queueMsg.payload;
       return true; // pretend to have been successful to prevent queue from clogging up
     }
-    ESP_LOGD(TAG, "Publishing sensor values: %s:%s", topic, msg);
-    if (!mqtt_client->publish(topic, msg)) {
+    ESP_LOGD(TAG, "Publishing sensor values: %s (%u bytes)", sensorsTopic, measureJson(*queueMsg.payload));
+    if (!publishJson(sensorsTopic, *queueMsg.payload, &properties)) {
       ESP_LOGI(TAG, "publish sensors failed!");
+      Telemetry::invalidate();
+      delete queueMsg.payload;
       return false;
     }
     delete queueMsg.payload;
@@ -93,39 +264,118 @@ namespace mqtt {
   void publishConfiguration() {
     MqttMessage msg;
     msg.cmd = X_CMD_PUBLISH_CONFIGURATION;
+    msg.payload = nullptr;
     msg.statusMessage = nullptr;
-    if (mqttQueue) xQueueSendToBack(mqttQueue, (void*)&msg, pdMS_TO_TICKS(100));
+    enqueue(LANE_CONTROL, &msg);
+  }
+
+  // Publishes only the given keys on the config topic, marked with "partial": true. Takes ownership of changes.
+  void publishConfigurationChanges(DynamicJsonDocument* changes) {
+    MqttMessage msg;
+    msg.cmd = X_CMD_PUBLISH_CONFIGURATION;
+    msg.payload = changes;
+    msg.statusMessage = nullptr;
+    enqueue(LANE_CONTROL, &msg);
+  }
+
+  // PEM files are read from LittleFS once and kept on the heap. WiFiClientSecure only keeps the pointer,
+  // so cached buffers must outlive every client using them.
+  struct CachedPem {
+    const char* filename;
+    char* pem;
+  };
+
+  CachedPem pemCache[MQTT_PEM_CACHE_SIZE] = {};
+
+  const char* getPem(const char* filename) {
+    for (uint8_t i = 0; i < MQTT_PEM_CACHE_SIZE; i++) {
+      if (pemCache[i].filename && strcmp(pemCache[i].filename, filename) == 0) return pemCache[i].pem;
+    }
+    File f = LittleFS.open(filename, FILE_READ);
+    if (!f) return nullptr;
+    size_t size = f.size();
+    char* pem = (char*)malloc(size + 1);
+    if (!pem) {
+      ESP_LOGE(TAG, "Not enough heap to load %s", filename);
+      f.close();
+      return nullptr;
+    }
+    if (f.read((uint8_t*)pem, size) != size) {
+      ESP_LOGW(TAG, "Failed to read %s", filename);
+      free(pem);
+      f.close();
+      return nullptr;
+    }
+    pem[size] = 0x00;
+    f.close();
+    for (uint8_t i = 0; i < MQTT_PEM_CACHE_SIZE; i++) {
+      if (!pemCache[i].filename) {
+        pemCache[i].filename = filename;
+        pemCache[i].pem = pem;
+        ESP_LOGD(TAG, "Cached %s (%u bytes)", filename, size);
+        return pem;
+      }
+    }
+    ESP_LOGE(TAG, "PEM cache full, can't cache %s", filename);
+    free(pem);
+    return nullptr;
+  }
+
+  // Only call once no client is using the PEM anymore.
+  void invalidatePem(const char* filename) {
+    for (uint8_t i = 0; i < MQTT_PEM_CACHE_SIZE; i++) {
+      if (pemCache[i].filename && strcmp(pemCache[i].filename, filename) == 0) {
+        free(pemCache[i].pem);
+        pemCache[i].filename = nullptr;
+        pemCache[i].pem = nullptr;
+      }
+    }
   }
 
   void setMqttCerts(WiFiClientSecure* wifiClient, const char* mqttRootCertFilename, const char* mqttClientKeyFilename, const char* mqttClientCertFilename) {
-    File root_ca_file = LittleFS.open(mqttRootCertFilename, FILE_READ);
-    if (root_ca_file) {
-      ESP_LOGD(TAG, "Loading MQTT root ca from FS (%s)", mqttRootCertFilename);
-      wifiClient->loadCACert(root_ca_file, root_ca_file.size());
-      root_ca_file.close();
+    const char* pem;
+    if ((pem = getPem(mqttRootCertFilename))) {
+      ESP_LOGD(TAG, "Using MQTT root ca (%s)", mqttRootCertFilename);
+      wifiClient->setCACert(pem);
     }
-    File client_key_file = LittleFS.open(mqttClientKeyFilename, FILE_READ);
-    if (client_key_file) {
-      ESP_LOGD(TAG, "Loading MQTT client key from FS (%s)", mqttClientKeyFilename);
-      wifiClient->loadPrivateKey(client_key_file, client_key_file.size());
-      client_key_file.close();
+    if ((pem = getPem(mqttClientKeyFilename))) {
+      ESP_LOGD(TAG, "Using MQTT client key (%s)", mqttClientKeyFilename);
+      wifiClient->setPrivateKey(pem);
     }
-    File client_cert_file = LittleFS.open(mqttClientCertFilename, FILE_READ);
-    if (client_cert_file) {
-      ESP_LOGD(TAG, "Loading MQTT client cert from FS (%s)", mqttClientCertFilename);
-      wifiClient->loadCertificate(client_cert_file, client_cert_file.size());
-      client_cert_file.close();
+    if ((pem = getPem(mqttClientCertFilename))) {
+      ESP_LOGD(TAG, "Using MQTT client cert (%s)", mqttClientCertFilename);
+      wifiClient->setCertificate(pem);
     }
   }
 
+  // Asks the MQTT task to disconnect and stay offline until resumeConnection(), returns false on timeout.
+  boolean pauseConnection(uint32_t timeout) {
+    if (!mqttTask) return false;
+    ulTaskNotifyTake(pdTRUE, 0);  // clear an acknowledgement that came in after an earlier timeout
+    pauseWaiter = xTaskGetCurrentTaskHandle();
+    pauseRequested = true;
+    xTaskNotifyGive(mqttTask);
+    boolean acknowledged = ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(timeout)) > 0;
+    pauseWaiter = NULL;
+    return acknowledged;
+  }
+
+  void resumeConnection() {
+    if (!pauseRequested) return;
+    pauseRequested = false;
+    reconnectImmediately = true;
+    if (mqttTask) xTaskNotifyGive(mqttTask);
+  }
+
   boolean testMqttConfig(WiFiClient* wifiClient, Config testConfig) {
     char buf[128];
     boolean mqttTestSuccess;
-    PubSubClient* testMqttClient = new PubSubClient(*wifiClient);
+    MqttClient* testMqttClient = new MqttClient(*wifiClient);
+    testMqttClient->setProtocolVersion(testConfig.mqttV5 ? MQTT_PROTOCOL_V5 : MQTT_PROTOCOL_V311);
     testMqttClient->setServer(testConfig.mqttHost, testConfig.mqttServerPort);
     sprintf(buf, "CO2Monitor-%u-%s", testConfig.deviceId, WifiManager::getMac().c_str());
     // disconnect current connection if not enough heap avalable to initiate another tls session.
-    if (testConfig.mqttUseTls && ESP.getFreeHeap() < 75000) mqtt_client->disconnect();
+    if (testConfig.mqttUseTls && ESP.getFreeHeap() < 75000) pauseConnection(5000);
     mqttTestSuccess = testMqttClient->connect(buf, testConfig.mqttUsername, testConfig.mqttPassword);
     if (mqttTestSuccess) {
       ESP_LOGD(TAG, "Test MQTT connected");
@@ -134,12 +384,12 @@ namespace mqtt {
       if (!mqttTestSuccess) ESP_LOGI(TAG, "connecting using new mqtt settings failed!");
     }
     delete testMqttClient;
+    resumeConnection();
     return mqttTestSuccess;
   }
 
   boolean publishConfigurationInternal() {
     char buf[256];
-    char msg[CONFIG_SIZE];
     DynamicJsonDocument doc(CONFIG_SIZE);
     doc["appVersion"] = APP_VERSION;
     sprintf(buf, "%s", WifiManager::getMac().c_str());
@@ -160,30 +410,42 @@ namespace mqtt {
       doc["sps30Status"] = getSPS30StatusCallback();
     }
 
-    for (ConfigParameterBase<Config>* configParameter : getConfigParameters()) {
-      if (!(strncmp(configParameter->getId(), "deviceId", strlen(buf)) == 0)
-        && !(strncmp(configParameter->getId(), "mqttPassword", strlen(buf)) == 0))
-        configParameter->toJson(config, &doc);
+    for (const ConfigParameter& configParameter : getConfigParameters()) {
+      if (!configParameter.isSecret() && strcmp(configParameter.getId(), "deviceId") != 0)
+        configParameter.toJson(config, &doc);
     }
 
+    ConfigPersistenceStats persistence = getConfigPersistenceStats();
+    doc["configWrites"] = persistence.writes;
+    doc["configMaxWriteTime"] = persistence.maxWriteTime;
+    Telemetry::TelemetryStats telemetry = Telemetry::getStats();
+    doc["sensorMessagesSent"] = telemetry.sent;
+    doc["sensorMessagesSuppressed"] = telemetry.suppressed;
+
     float tempOffset = getTemperatureOffsetCallback();
     if (tempOffset != NaN) {
       sprintf(buf, "%.1f", getTemperatureOffsetCallback());
       doc["tempOffset"] = buf;
     }
-    if (serializeJson(doc, msg) == 0) {
-      ESP_LOGW(TAG, "Failed to serialise payload");
-      return true; // pretend to have been successful to prevent queue from clogging up
-    }
-    sprintf(buf, "%s/%u/up/config", config.mqttTopic, config.deviceId);
-    ESP_LOGI(TAG, "Publishing configuration: %s:%s", buf, msg);
-    if (!mqtt_client->publish(buf, msg)) {
+    if (doc.overflowed()) ESP_LOGW(TAG, "Configuration document truncated");
+    ESP_LOGI(TAG, "Publishing configuration: %s (%u bytes)", configTopic, measureJson(doc));
+    if (!publishJson(configTopic, doc)) {
       ESP_LOGI(TAG, "publish configuration failed!");
       return false;
     }
     return true;
   }
 
+  boolean publishConfigurationChangesInternal(MqttMessage queueMsg) {
+    ESP_LOGI(TAG, "Publishing configuration changes: %s (%u bytes)", configTopic, measureJson(*queueMsg.payload));
+    if (!publishJson(configTopic, *queueMsg.payload)) {
+      ESP_LOGI(TAG, "publish configuration changes failed!");
+      return false;  // keep for a retry, freed once done with
+    }
+    delete queueMsg.payload;
+    return true;
+  }
+
   void publishStatusMsg(const char* statusMessage) {
     if (strlen(statusMessage) > 200) {
       ESP_LOGW(TAG, "msg too long - discarding");
@@ -191,10 +453,9 @@ namespace mqtt {
     }
     MqttMessage msg;
     msg.cmd = X_CMD_PUBLISH_STATUS_MSG;
+    msg.payload = nullptr;
     msg.statusMessage = cloneStr(statusMessage);
-    if (!mqttQueue || !xQueueSendToBack(mqttQueue, (void*)&msg, pdMS_TO_TICKS(100))) {
-      free(msg.statusMessage);
-    }
+    enqueue(LANE_STATUS, &msg);
   }
 
   boolean publishStatusMsgInternal(char* statusMessage, boolean keepOnFailure) {
@@ -202,17 +463,9 @@ namespace mqtt {
       free(statusMessage);
       return true;// pretend to have been successful to prevent queue from clogging up
     }
-    char topic[256];
-    sprintf(topic, "%s/%u/up/status", config.mqttTopic, config.deviceId);
-    char msg[256];
-    DynamicJsonDocument doc(CONFIG_SIZE);
-    doc["msg"] = statusMessage;
-    if (serializeJson(doc, msg) == 0) {
-      ESP_LOGW(TAG, "Failed to serialise payload");
-      free(statusMessage);
-      return true;// pretend to have been successful to prevent queue from clogging up
-    }
-    if (!mqtt_client->publish(topic, msg)) {
+    StaticJsonDocument<JSON_OBJECT_SIZE(1)> doc;
+    doc["msg"] = (const char*)statusMessage;
+    if (!publishJson(statusTopic, doc)) {
       ESP_LOGI(TAG, "publish status msg failed!");
       if (!keepOnFailure) free(statusMessage);
       // don't free heap, since message will be re-tried
@@ -237,193 +490,478 @@ namespace mqtt {
     return true;
   }
 
-  void callback(char* topic, byte* payload, unsigned int length) {
-    char buf[256];
-    char msg[length + 1];
-    strncpy(msg, (char*)payload, length);
-    msg[length] = 0x00;
-    ESP_LOGI(TAG, "Message arrived [%s] %s", topic, msg);
-
-    sprintf(buf, "%s/%u/down/", config.mqttTopic, config.deviceId);
-    int16_t cmdIdx = -1;
-    if (strncmp(topic, buf, strlen(buf)) == 0) {
-      ESP_LOGI(TAG, "Device specific downlink message arrived [%s]", topic);
-      cmdIdx = strlen(buf);
-    }
-    sprintf(buf, "%s/down/", config.mqttTopic);
-    if (strncmp(topic, buf, strlen(buf)) == 0) {
-      ESP_LOGI(TAG, "Device agnostic downlink message arrived [%s]", topic);
-      cmdIdx = strlen(buf);
+  boolean cmdCalibrate(char* payload, size_t length, JsonDocument& reply) {
+    int reference = atoi(payload);
+    if (reference < 400 || reference > 2000) return false;
+    calibrateCo2SensorCallback(reference);
+    return true;
+  }
+
+  boolean cmdSetTemperatureOffset(char* payload, size_t length, JsonDocument& reply) {
+    float tempOffset = atof(payload);
+    if (tempOffset < 0.0 || tempOffset > 10.0) return false;
+    setTemperatureOffsetCallback(tempOffset);
+    return true;
+  }
+
+  boolean cmdSetSPS30AutoCleanInterval(char* payload, size_t length, JsonDocument& reply) {
+    char* eptr;
+    long interval = std::strtoul(payload, &eptr, 10);
+    return setSPS30AutoCleanIntervalCallback(interval);
+  }
+
+  boolean cmdCleanSPS30(char* payload, size_t length, JsonDocument& reply) {
+    return cleanSPS30Callback();
+  }
+
+  boolean cmdGetConfig(char* payload, size_t length, JsonDocument& reply) {
+    publishConfiguration();
+    return true;
+  }
+
+  boolean cmdSetConfig(char* payload, size_t length, JsonDocument& reply) {
+    DynamicJsonDocument doc(CONFIG_SIZE);
+    DeserializationError error = deserializeJson(doc, payload);
+    if (error) {
+      ESP_LOGW(TAG, "Failed to parse message: %s", error.f_str());
+      return false;
     }
-    if (cmdIdx < 0) return;
-    strncpy(buf, topic + cmdIdx, strlen(topic) - cmdIdx + 1);
-    ESP_LOGI(TAG, "Received command [%s]", buf);
 
-    if (strncmp(buf, "calibrate", strlen(buf)) == 0) {
-      int reference = atoi(msg);
-      if (reference >= 400 && reference <= 2000) {
-        calibrateCo2SensorCallback(reference);
-      }
-    } else if (strncmp(buf, "setTemperatureOffset", strlen(buf)) == 0) {
-      float tempOffset = atof(msg);
-      if (0.0 <= tempOffset && tempOffset <= 10.0) {
-        setTemperatureOffsetCallback(tempOffset);
-      }
-    } else if (strncmp(buf, "setSPS30AutoCleanInterval", strlen(buf)) == 0) {
-      char* eptr;
-      long interval = std::strtoul(msg, &eptr, 10);
-      setSPS30AutoCleanIntervalCallback(interval);
-    } else if (strncmp(buf, "cleanSPS30", strlen(buf)) == 0) {
-      cleanSPS30Callback();
-    } else if (strncmp(buf, "getConfig", strlen(buf)) == 0) {
-      publishConfiguration();
-    } else if (strncmp(buf, "setConfig", strlen(buf)) == 0) {
-      DynamicJsonDocument doc(CONFIG_SIZE);
-      DeserializationError error = deserializeJson(doc, msg);
-      if (error) {
-        ESP_LOGW(TAG, "Failed to parse message: %s", error.f_str());
-        return;
-      }
+    ConfigTransaction transaction;
+    beginConfigTransaction(transaction);
+    if (!stageConfigJson(transaction, doc.as<JsonObjectConst>())) {
+      reply["rejected"] = transaction.rejected;
+      return false;
+    }
+    reply["changed"] = transaction.changeCount();
+    if (transaction.changeCount() == 0) return true;
 
-      bool rebootRequired = false;
-      Config mqttConfig = config;
-      bool mqttConfigUpdated = false;
-      for (ConfigParameterBase<Config>* configParameter : getConfigParameters()) {
-        if (strncmp(configParameter->getId(), "mqttHost", strlen(buf)) == 0
-          || strncmp(configParameter->getId(), "mqttServerPort", strlen(buf)) == 0
-          || strncmp(configParameter->getId(), "deviceId", strlen(buf)) == 0
-          || strncmp(configParameter->getId(), "mqttUsername", strlen(buf)) == 0
-          || strncmp(configParameter->getId(), "mqttPassword", strlen(buf)) == 0
-          || strncmp(configParameter->getId(), "mqttTopic", strlen(buf)) == 0
-          || strncmp(configParameter->getId(), "mqttUseTls", strlen(buf)) == 0
-          || strncmp(configParameter->getId(), "mqttInsecure", strlen(buf)) == 0) {
-          mqttConfigUpdated |= configParameter->fromJson(mqttConfig, &doc, false);
-          if (configParameter->fromJson(mqttConfig, &doc, false))
-            ESP_LOGI(TAG, "MQTT Config %s updated to %s", configParameter->getId(), configParameter->toString(mqttConfig).c_str());
-        } else {
-          rebootRequired |= (configParameter->fromJson(config, &doc, false) && configParameter->isRebootRequiredOnChange());
-          if (configParameter->fromJson(config, &doc, false))
-            ESP_LOGI(TAG, "Config %s updated to %s. Reboot needed? %s", configParameter->getId(), configParameter->toString(config).c_str(), configParameter->isRebootRequiredOnChange() ? "true" : "false");
+    // the connection settings are only taken over if the broker accepts them, otherwise nothing changes.
+    // They are the only settings that still need a reboot to take effect.
+    bool rebootRequired = transaction.mqttConnectionChanged();
+    if (transaction.mqttConnectionChanged()) {
+      const Config& mqttConfig = transaction.staged;
+      WiFiClient* testWifiClient;
+      if (mqttConfig.mqttUseTls) {
+        testWifiClient = new WiFiClientSecure();
+        if (mqttConfig.mqttInsecure) {
+          ((WiFiClientSecure*)testWifiClient)->setInsecure();
         }
+        setMqttCerts((WiFiClientSecure*)testWifiClient, MQTT_ROOT_CA_FILENAME, MQTT_CLIENT_KEY_FILENAME, MQTT_CLIENT_CERT_FILENAME);
+      } else {
+        testWifiClient = new WiFiClient();
       }
-      bool mqttTestSuccess = true;
-
-      if (mqttConfigUpdated) {
-        WiFiClient* testWifiClient;
-        if (mqttConfig.mqttUseTls) {
-          testWifiClient = new WiFiClientSecure();
-          if (mqttConfig.mqttInsecure) {
-            ((WiFiClientSecure*)testWifiClient)->setInsecure();
-          }
-          setMqttCerts((WiFiClientSecure*)testWifiClient, MQTT_ROOT_CA_FILENAME, MQTT_CLIENT_KEY_FILENAME, MQTT_CLIENT_CERT_FILENAME);
-        } else {
-          testWifiClient = new WiFiClient();
-        }
-        mqttTestSuccess = testMqttConfig(testWifiClient, mqttConfig);
-        delete testWifiClient;
-        if (mqttTestSuccess) {
-          config = mqttConfig;
-          rebootRequired = true;
-        }
+      bool mqttTestSuccess = testMqttConfig(testWifiClient, mqttConfig);
+      delete testWifiClient;
+      if (!mqttTestSuccess) {
+        reply["changed"] = 0;
+        return false;
       }
-      if (saveConfiguration(config) && rebootRequired) {
-        publishStatusMsgInternal(cloneStr("configuration updated - rebooting shortly"), false);
-        delay(2000);
-        esp_restart();
+    }
+    commitConfigTransaction(transaction);
+    DynamicJsonDocument* changes = new DynamicJsonDocument(CONFIG_SIZE);
+    (*changes)["partial"] = true;
+    configChangesToJson(transaction, changes->as<JsonObject>());
+    changes->shrinkToFit();
+    publishConfigurationChanges(changes);
+    saveConfiguration(config);
+    if (rebootRequired) {
+      if (flushConfiguration()) {
+        publishStatusMsg("configuration updated - rebooting shortly");
+        rebootRequested = true;
+        return true;
       }
+      // committed in RAM, but the new settings would be lost with the reboot they need to take effect
+      ESP_LOGE(TAG, "Failed to store the configuration, not rebooting");
+      publishStatusMsg("configuration could not be stored - not rebooting");
+      reply["persisted"] = false;
       configChangedCallback();
-    } else if (strncmp(buf, "installMqttRootCa", strlen(buf)) == 0) {
-      ESP_LOGD(TAG, "installMqttRootCa");
-      if (!writeFile(TEMP_MQTT_ROOT_CA_FILENAME, (unsigned char*)&msg[0])) {
-        ESP_LOGW(TAG, "Error writing mqtt root ca");
-        publishStatusMsgInternal(cloneStr("Error writing cert to FS"), false);
-        return;
-      }
-      bool mqttTestSuccess = config.mqttInsecure || !config.mqttUseTls; // no need to test if not using tls, or not checking certs
-      if (config.mqttUseTls && !config.mqttInsecure) {
-        ESP_LOGD(TAG, "test connection using new ca");
-        // test connection using cert
-        WiFiClientSecure* testWifiClient = new WiFiClientSecure();
-        setMqttCerts(testWifiClient, TEMP_MQTT_ROOT_CA_FILENAME, MQTT_CLIENT_KEY_FILENAME, MQTT_CLIENT_CERT_FILENAME);
-        mqttTestSuccess = testMqttConfig(testWifiClient, config);
-        delete testWifiClient;
-      }
-      ESP_LOGD(TAG, "mqttTestSuccess %u", mqttTestSuccess);
-      if (mqttTestSuccess) {
-        if (LittleFS.exists(MQTT_ROOT_CA_FILENAME) && !LittleFS.remove(MQTT_ROOT_CA_FILENAME)) {
-          ESP_LOGE(TAG, "Failed to remove original CA file");
-          publishStatusMsgInternal(cloneStr("Could not remove original CA - giving up"), false);
-          return;  // leave old file in place and give up.
-        }
-        if (!LittleFS.rename(TEMP_MQTT_ROOT_CA_FILENAME, MQTT_ROOT_CA_FILENAME)) {
-          publishStatusMsgInternal(cloneStr("Could not replace original CA with new CA - PANIC - giving up"), false);
-          ESP_LOGE(TAG, "Failed to move temporary CA file");
-          config.mqttInsecure = true;
-          saveConfiguration(config);
-          delay(2000);
-          esp_restart();
-          return;
-        }
-        ESP_LOGI(TAG, "installed and tested new CA, rebooting shortly");
-        publishStatusMsgInternal(cloneStr("installed and tested new CA - rebooting shortly"), false);
-        delay(2000);
-        esp_restart();
-      } else {
-        ESP_LOGI(TAG, "publish connect msg failed!");
-        publishStatusMsgInternal(cloneStr("Connecting using the new CA failed - reverting"), false);
-        if (!LittleFS.remove(TEMP_MQTT_ROOT_CA_FILENAME)) ESP_LOGW(TAG, "Failed to remove temporary CA file");
-      }
-    } else if (strncmp(buf, "installRootCa", strlen(buf)) == 0) {
-      ESP_LOGD(TAG, "installRootCa");
-      if (!writeFile(ROOT_CA_FILENAME, (unsigned char*)&msg[0])) {
-        ESP_LOGW(TAG, "Error writing root ca");
-        publishStatusMsgInternal(cloneStr("Error writing cert to FS"), false);
+      return false;
+    }
+    configChangedCallback();
+    return true;
+  }
+
+  // Tests the CA in TEMP_MQTT_ROOT_CA_FILENAME and installs it if a connection can be made with it.
+  boolean installMqttRootCa() {
+    bool mqttTestSuccess = config.mqttInsecure || !config.mqttUseTls; // no need to test if not using tls, or not checking certs
+    if (config.mqttUseTls && !config.mqttInsecure) {
+      ESP_LOGD(TAG, "test connection using new ca");
+      // test connection using cert
+      WiFiClientSecure* testWifiClient = new WiFiClientSecure();
+      setMqttCerts(testWifiClient, TEMP_MQTT_ROOT_CA_FILENAME, MQTT_CLIENT_KEY_FILENAME, MQTT_CLIENT_CERT_FILENAME);
+      mqttTestSuccess = testMqttConfig(testWifiClient, config);
+      delete testWifiClient;
+      invalidatePem(TEMP_MQTT_ROOT_CA_FILENAME);
+    }
+    ESP_LOGD(TAG, "mqttTestSuccess %u", mqttTestSuccess);
+    if (!mqttTestSuccess) {
+      ESP_LOGI(TAG, "publish connect msg failed!");
+      publishStatusMsg("Connecting using the new CA failed - reverting");
+      if (!LittleFS.remove(TEMP_MQTT_ROOT_CA_FILENAME)) ESP_LOGW(TAG, "Failed to remove temporary CA file");
+      return false;
+    }
+    if (LittleFS.exists(MQTT_ROOT_CA_FILENAME) && !LittleFS.remove(MQTT_ROOT_CA_FILENAME)) {
+      ESP_LOGE(TAG, "Failed to remove original CA file");
+      publishStatusMsg("Could not remove original CA - giving up");
+      return false;  // leave old file in place and give up.
+    }
+    if (!LittleFS.rename(TEMP_MQTT_ROOT_CA_FILENAME, MQTT_ROOT_CA_FILENAME)) {
+      publishStatusMsg("Could not replace original CA with new CA - PANIC - giving up");
+      ESP_LOGE(TAG, "Failed to move temporary CA file");
+      config.mqttInsecure = true;
+      saveConfiguration(config);
+      flushConfiguration();
+      delay(2000);
+      esp_restart();
+      return false;
+    }
+    ESP_LOGI(TAG, "installed and tested new CA, rebooting shortly");
+    publishStatusMsg("installed and tested new CA - rebooting shortly");
+    delay(2000);
+    esp_restart();
+    return true;
+  }
+
+  boolean cmdInstallMqttRootCa(char* payload, size_t length, JsonDocument& reply) {
+    if (!writeFile(TEMP_MQTT_ROOT_CA_FILENAME, (unsigned char*)payload)) {
+      ESP_LOGW(TAG, "Error writing mqtt root ca");
+      publishStatusMsg("Error writing cert to FS");
+      return false;
+    }
+    return installMqttRootCa();
+  }
+
+  boolean cmdInstallRootCa(char* payload, size_t length, JsonDocument& reply) {
+    if (!writeFile(ROOT_CA_FILENAME, (unsigned char*)payload)) {
+      ESP_LOGW(TAG, "Error writing root ca");
+      publishStatusMsg("Error writing cert to FS");
+      return false;
+    }
+    return true;
+  }
+
+  boolean cmdResetWifi(char* payload, size_t length, JsonDocument& reply) {
+    WifiManager::resetSettings();
+    return true;
+  }
+
+  boolean cmdOta(char* payload, size_t length, JsonDocument& reply) {
+    OTA::checkForUpdate();
+    return true;
+  }
+
+  boolean cmdForceOta(char* payload, size_t length, JsonDocument& reply) {
+    OTA::forceUpdate(payload);
+    return true;
+  }
+
+  // The new map takes effect after a reboot, the sensors in use were set up from the one found on boot.
+  boolean cmdRescanI2C(char* payload, size_t length, JsonDocument& reply) {
+    uint8_t previousMap = I2C::getDeviceMap();
+    uint8_t deviceMap = I2C::rescan();
+    reply["deviceMap"] = deviceMap;
+    reply["changed"] = deviceMap != previousMap;
+    return true;
+  }
+
+  boolean cmdReboot(char* payload, size_t length, JsonDocument& reply) {
+    flushConfiguration();
+    rebootRequested = true;
+    return true;
+  }
+
+  // Files that can be replaced using a chunked upload, install is run once the upload is verified.
+  struct UploadTarget {
+    const char* name;
+    const char* filename;
+    boolean(*install)();
+  };
+
+  const UploadTarget uploadTargets[] = {
+    { "mqttRootCa", TEMP_MQTT_ROOT_CA_FILENAME, installMqttRootCa },
+    { "mqttClientCert", MQTT_CLIENT_CERT_FILENAME, nullptr },
+    { "mqttClientKey", MQTT_CLIENT_KEY_FILENAME, nullptr },
+    { "rootCa", ROOT_CA_FILENAME, nullptr }
+  };
+
+  const UploadTarget* findUploadTarget(const char* name) {
+    for (const UploadTarget& target : uploadTargets) {
+      if (strcmp(target.name, name) == 0) return &target;
+    }
+    return nullptr;
+  }
+
+  void addUploadProgress(JsonDocument& reply) {
+    reply["offset"] = BlobUpload::getOffset();
+    reply["size"] = BlobUpload::getSize();
+  }
+
+  // {"target":"mqttRootCa","size":1234,"sha256":"..."}, replies with the offset to continue from
+  boolean cmdUploadBegin(char* payload, size_t length, JsonDocument& reply) {
+    StaticJsonDocument<JSON_OBJECT_SIZE(3)> doc;
+    DeserializationError error = deserializeJson(doc, payload);
+    if (error) {
+      ESP_LOGW(TAG, "Failed to parse message: %s", error.f_str());
+      return false;
+    }
+    const char* target = doc["target"] | "";
+    if (!findUploadTarget(target)) {
+      ESP_LOGW(TAG, "Unknown upload target %s", target);
+      return false;
+    }
+    boolean success = BlobUpload::begin(target, doc["size"] | 0, doc["sha256"] | "");
+    if (success) addUploadProgress(reply);
+    return success;
+  }
+
+  // binary: offset and CRC32 (big endian) followed by the data
+  boolean cmdUploadChunk(char* payload, size_t length, JsonDocument& reply) {
+    boolean success = BlobUpload::writeChunk((uint8_t*)payload, length);
+    addUploadProgress(reply);
+    return success;
+  }
+
+  boolean cmdUploadEnd(char* payload, size_t length, JsonDocument& reply) {
+    if (!BlobUpload::isActive()) return false;
+    const UploadTarget* target = findUploadTarget(BlobUpload::getTarget());
+    if (!target || !BlobUpload::finish(target->filename)) return false;
+    if (strcmp(target->filename, MQTT_CLIENT_CERT_FILENAME) == 0 || strcmp(target->filename, MQTT_CLIENT_KEY_FILENAME) == 0)
+      publishStatusMsg("MQTT client cert/key replaced - used after the next reboot");
+    return target->install ? target->install() : true;
+  }
+
+  boolean cmdUploadAbort(char* payload, size_t length, JsonDocument& reply) {
+    BlobUpload::abort();
+    return true;
+  }
+
+  void addOtaProgress(JsonDocument& reply) {
+    reply["offset"] = OTA::getMqttUpdateOffset();
+    reply["size"] = OTA::getMqttUpdateSize();
+  }
+
+  // {"size":1234,"sha256":"...","signature":"..."}, replies with the offset to continue from
+  boolean cmdOtaBegin(char* payload, size_t length, JsonDocument& reply) {
+    StaticJsonDocument<JSON_OBJECT_SIZE(4)> doc;
+    DeserializationError error = deserializeJson(doc, payload);
+    if (error) {
+      ESP_LOGW(TAG, "Failed to parse message: %s", error.f_str());
+      return false;
+    }
+    const char* encodingName = doc["encoding"] | "raw";
+    uint8_t encoding;
+    if (strcmp(encodingName, "raw") == 0) {
+      encoding = OTA_ENCODING_RAW;
+    } else if (strcmp(encodingName, "deflate") == 0) {
+      encoding = OTA_ENCODING_DEFLATE;
+    } else if (strcmp(encodingName, "delta") == 0) {
+      encoding = OTA_ENCODING_DELTA;
+    } else {
+      ESP_LOGW(TAG, "Unknown encoding %s", encodingName);
+      return false;
+    }
+    boolean success = OTA::beginMqttUpdate(doc["size"] | 0, doc["sha256"] | "", doc["signature"] | "", encoding);
+    if (success) addOtaProgress(reply);
+    return success;
+  }
+
+  // same chunk format as uploadChunk
+  boolean cmdOtaChunk(char* payload, size_t length, JsonDocument& reply) {
+    boolean success = OTA::writeMqttUpdate((uint8_t*)payload, length);
+    addOtaProgress(reply);
+    return success;
+  }
+
+  boolean cmdOtaEnd(char* payload, size_t length, JsonDocument& reply) {
+    return OTA::endMqttUpdate();
+  }
+
+  boolean cmdOtaAbort(char* payload, size_t length, JsonDocument& reply) {
+    OTA::abortMqttUpdate();
+    return true;
+  }
+
+  // Downlink commands, keyed on the topic suffix after .../down/
+  const CommandHandler commandHandlers[] = {
+    { "calibrate", cmdCalibrate },
+    { "setTemperatureOffset", cmdSetTemperatureOffset },
+    { "setSPS30AutoCleanInterval", cmdSetSPS30AutoCleanInterval },
+    { "cleanSPS30", cmdCleanSPS30 },
+    { "getConfig", cmdGetConfig },
+    { "setConfig", cmdSetConfig },
+    { "installMqttRootCa", cmdInstallMqttRootCa },
+    { "installRootCa", cmdInstallRootCa },
+    { "uploadBegin", cmdUploadBegin },
+    { "uploadChunk", cmdUploadChunk },
+    { "uploadEnd", cmdUploadEnd },
+    { "uploadAbort", cmdUploadAbort },
+    { "otaBegin", cmdOtaBegin },
+    { "otaChunk", cmdOtaChunk },
+    { "otaEnd", cmdOtaEnd },
+    { "otaAbort", cmdOtaAbort },
+    { "resetWifi", cmdResetWifi },
+    { "ota", cmdOta },
+    { "forceota", cmdForceOta },
+    { "rescanI2C", cmdRescanI2C },
+    { "reboot", cmdReboot }
+  };
+
+  boolean publishReplyInternal(MqttMessage queueMsg) {
+    if (!publishJson(replyTopic, *queueMsg.payload)) {
+      ESP_LOGI(TAG, "publish reply failed!");
+      return false;  // keep for a retry, freed once done with
+    }
+    delete queueMsg.payload;
+    return true;
+  }
+
+  void executeCommand(MqttCommand* command) {
+    char* payload = payloadPool[command->slot].data;
+    MqttMessage msg;
+    msg.cmd = X_CMD_PUBLISH_REPLY;
+    msg.payload = new DynamicJsonDocument(MQTT_REPLY_SIZE);
+    msg.statusMessage = nullptr;
+    (*msg.payload)["cmd"] = command->name;   // char* gets copied, the command buffer is reused
+    boolean success = false;
+    boolean found = false;
+    for (const CommandHandler& handler : commandHandlers) {
+      if (strcmp(handler.name, command->name) == 0) {
+        ESP_LOGI(TAG, "Executing command [%s]", command->name);
+        success = handler.handler(payload, command->length, *msg.payload);
+        found = true;
+        break;
       }
-    } else if (strncmp(buf, "resetWifi", strlen(buf)) == 0) {
-      WifiManager::resetSettings();
-    } else if (strncmp(buf, "ota", strlen(buf)) == 0) {
-      OTA::checkForUpdate();
-    } else if (strncmp(buf, "forceota", strlen(buf)) == 0) {
-      OTA::forceUpdate(msg);
-    } else if (strncmp(buf, "reboot", strlen(buf)) == 0) {
+    }
+    if (!found) ESP_LOGW(TAG, "Unknown command [%s]", command->name);
+    (*msg.payload)["success"] = success;
+    enqueue(LANE_CONTROL, &msg);
+    if (rebootRequested) {
+      // give the MQTT task time to publish the reply
+      delay(2000);
       esp_restart();
     }
   }
 
+  void commandLoop(void* pvParameters) {
+    _ASSERT((uint32_t)pvParameters == 1);
+    MqttCommand command;
+    // retained or persistent session downlinks may arrive before the sensors exist
+    xEventGroupWaitBits(commandEvents, COMMANDS_ENABLED, pdFALSE, pdTRUE, portMAX_DELAY);
+    while (1) {
+      if (xQueueReceive(commandQueue, &command, portMAX_DELAY) != pdTRUE) continue;
+      executeCommand(&command);
+      xQueueSendToBack(freePayloadSlots, &command.slot, 0);
+    }
+    vTaskDelete(NULL);
+  }
+
+  void enableCommands() {
+    xEventGroupSetBits(commandEvents, COMMANDS_ENABLED);
+  }
+
+  // Runs on the MQTT task: only copies the payload into a pooled buffer and hands it to the command task.
+  void callback(char* topic, byte* payload, unsigned int length) {
+    ESP_LOGI(TAG, "Message arrived [%s] (%u bytes)", topic, length);
+
+    const char* name = nullptr;
+    if (strncmp(topic, deviceDownlinkTopic, strlen(deviceDownlinkTopic)) == 0) {
+      ESP_LOGI(TAG, "Device specific downlink message arrived [%s]", topic);
+      name = topic + strlen(deviceDownlinkTopic);
+    } else if (strncmp(topic, downlinkTopic, strlen(downlinkTopic)) == 0) {
+      ESP_LOGI(TAG, "Device agnostic downlink message arrived [%s]", topic);
+      name = topic + strlen(downlinkTopic);
+    }
+    if (!name) return;
+    if (strlen(name) > MQTT_COMMAND_NAME_LEN) {
+      ESP_LOGW(TAG, "Command name too long [%s]", name);
+      return;
+    }
+
+    MqttCommand command;
+    if (!freePayloadSlots || xQueueReceive(freePayloadSlots, &command.slot, 0) != pdTRUE) {
+      ESP_LOGW(TAG, "Command queue full, dropping [%s]", name);
+      commandsDropped++;
+      return;
+    }
+    PayloadBuffer* buffer = &payloadPool[command.slot];
+    if (buffer->capacity < length + 1) {
+      char* data = (char*)realloc(buffer->data, length + 1);
+      if (!data) {
+        ESP_LOGW(TAG, "Not enough heap for command payload of %u bytes", length);
+        xQueueSendToBack(freePayloadSlots, &command.slot, 0);
+        commandsDropped++;
+        return;
+      }
+      buffer->data = data;
+      buffer->capacity = length + 1;
+    }
+    memcpy(buffer->data, payload, length);
+    buffer->data[length] = 0x00;
+    strcpy(command.name, name);
+    command.length = length;
+    xQueueSendToBack(commandQueue, &command, 0);
+    commandsQueued++;
+  }
+
   void reconnect() {
     if (!WiFi.isConnected() || mqtt_client->connected()) return;
-    if (millis() - lastReconnectAttempt < 60000) return;
+    if (reconnectImmediately) {
+      reconnectImmediately = false;
+      resetBackoff();
+    }
+    if (millis() - lastReconnectAttempt < reconnectDelay) return;
     if (strncmp(config.mqttHost, "127.0.0.1", MQTT_HOSTNAME_LEN) == 0 ||
       strncmp(config.mqttHost, "localhost", MQTT_HOSTNAME_LEN) == 0) return;
-    char topic[256];
+    char topic[MQTT_TOPIC_BUFFER_LEN];
     char id[64];
     sprintf(id, "CO2Monitor-%u-%s", config.deviceId, WifiManager::getMac().c_str());
     lastReconnectAttempt = millis();
     ESP_LOGD(TAG, "Attempting MQTT connection...");
     connectionAttempts++;
-    sprintf(topic, "%s/%u/up/status", config.mqttTopic, config.deviceId);
-    if (mqtt_client->connect(id, config.mqttUsername, config.mqttPassword, topic, 1, false, "{\"msg\":\"disconnected\"}")) {
-      ESP_LOGD(TAG, "MQTT connected");
-      sprintf(topic, "%s/%u/down/#", config.mqttTopic, config.deviceId);
-      mqtt_client->subscribe(topic);
-      sprintf(topic, "%s/down/#", config.mqttTopic);
-      mqtt_client->subscribe(topic);
-      sprintf(topic, "%s/%u/up/status", config.mqttTopic, config.deviceId);
-      char msg[256];
-      DynamicJsonDocument doc(CONFIG_SIZE);
+    uint32_t connectStart = millis();
+    uint32_t heapBefore = ESP.getFreeHeap();
+    boolean connected = mqtt_client->connect(id, config.mqttUsername, config.mqttPassword, statusTopic, 1, false, "{\"msg\":\"disconnected\"}");
+    lastConnectDuration = millis() - connectStart;
+    maxConnectDuration = max(maxConnectDuration, lastConnectDuration);
+    if (connected) {
+      lastConnectHeap = (int32_t)heapBefore - (int32_t)ESP.getFreeHeap();
+      lastTimeToReconnect = millis() - disconnectedSince;
+      maxTimeToReconnect = max(maxTimeToReconnect, lastTimeToReconnect);
+      reconnects++;
+      wasConnected = true;
+      resetBackoff();
+      ESP_LOGD(TAG, "MQTT connected after %u ms, connect took %u ms", lastTimeToReconnect, lastConnectDuration);
+      sprintf(topic, "%s#", deviceDownlinkTopic);
+      mqtt_client->subscribe(topic, MQTT_QOS);
+      sprintf(topic, "%s#", downlinkTopic);
+      mqtt_client->subscribe(topic, MQTT_QOS);
+      StaticJsonDocument<JSON_OBJECT_SIZE(4)> doc;
       doc["online"] = true;
-      doc["connectionAttempts"] = connectionAttempts;
-      if (serializeJson(doc, msg) == 0) {
-        ESP_LOGW(TAG, "Failed to serialise payload");
-        return;
+      // with MQTT 5 the connection metrics travel as user properties, leaving the payload to the state
+      char attempts[8], timeToReconnect[12], connectDuration[12];
+      sprintf(attempts, "%u", connectionAttempts);
+      sprintf(timeToReconnect, "%u", lastTimeToReconnect);
+      sprintf(connectDuration, "%u", lastConnectDuration);
+      MqttUserProperty userProperties[] = {
+        { "connectionAttempts", attempts },
+        { "timeToReconnect", timeToReconnect },
+        { "connectDuration", connectDuration }
+      };
+      MqttPublishProperties properties = { 0, userProperties, 3 };
+      if (!config.mqttV5) {
+        doc["connectionAttempts"] = connectionAttempts;
+        doc["timeToReconnect"] = lastTimeToReconnect;
+        doc["connectDuration"] = lastConnectDuration;
       }
-      if (mqtt_client->publish(topic, msg))
+      if (publishJson(statusTopic, doc, &properties))
         connectionAttempts = 0;
       else
         ESP_LOGI(TAG, "publish connect msg failed!");
+      BootProfile::mark("mqttConnected");
     } else {
-      ESP_LOGW(TAG, "MQTT connection failed, rc=%i", mqtt_client->state());
-      vTaskDelay(pdMS_TO_TICKS(1000));
+      reconnectDelay = nextReconnectDelay();
+      ESP_LOGW(TAG, "MQTT connection failed, rc=%i, reason=0x%02x, retrying in %u ms", mqtt_client->state(), mqtt_client->getReasonCode(), reconnectDelay);
     }
   }
 
@@ -441,9 +979,19 @@ namespace mqtt {
     getSPS30StatusCallback_t _getSPS30StatusCallback,
     configChangedCallback_t _configChangedCallback
   ) {
-    mqttQueue = xQueueCreate(MQTT_QUEUE_LENGTH, sizeof(struct MqttMessage));
-    if (mqttQueue == NULL) {
-      ESP_LOGE(TAG, "Queue creation failed!");
+    for (uint8_t i = 0; i < LANE_COUNT; i++) {
+      lanes[i].queue = xQueueCreate(lanes[i].capacity, sizeof(struct MqttMessage));
+      if (lanes[i].queue == NULL) {
+        ESP_LOGE(TAG, "Queue creation failed for lane %s!", lanes[i].name);
+      }
+    }
+    commandEvents = xEventGroupCreate();
+    commandQueue = xQueueCreate(MQTT_COMMAND_QUEUE_LENGTH, sizeof(struct MqttCommand));
+    freePayloadSlots = xQueueCreate(MQTT_COMMAND_QUEUE_LENGTH, sizeof(uint8_t));
+    if (commandQueue == NULL || freePayloadSlots == NULL) {
+      ESP_LOGE(TAG, "Queue creation failed for commands!");
+    } else {
+      for (uint8_t i = 0; i < MQTT_COMMAND_QUEUE_LENGTH; i++) xQueueSendToBack(freePayloadSlots, &i, 0);
     }
 
     calibrateCo2SensorCallback = _calibrateCo2SensorCallback;
@@ -465,44 +1013,133 @@ namespace mqtt {
       wifiClient = new WiFiClient();
     }
 
-    mqtt_client = new PubSubClient(*wifiClient);
+    uint64_t mac = ESP.getEfuseMac();
+    jitterState = (uint32_t)(mac ^ (mac >> 32)) ^ esp_random();
+    if (jitterState == 0) jitterState = 1;
+
+    sprintf(sensorsTopic, "%s/%u/up/sensors", config.mqttTopic, config.deviceId);
+    sprintf(statusTopic, "%s/%u/up/status", config.mqttTopic, config.deviceId);
+    sprintf(configTopic, "%s/%u/up/config", config.mqttTopic, config.deviceId);
+    sprintf(deviceDownlinkTopic, "%s/%u/down/", config.mqttTopic, config.deviceId);
+    sprintf(downlinkTopic, "%s/down/", config.mqttTopic);
+    sprintf(replyTopic, "%s/%u/up/reply", config.mqttTopic, config.deviceId);
+
+    mqtt_client = new MqttClient(*wifiClient);
     mqtt_client->setServer(config.mqttHost, config.mqttServerPort);
+    if (config.mqttV5) {
+      mqtt_client->setProtocolVersion(MQTT_PROTOCOL_V5);
+      mqtt_client->addTopicAlias(sensorsTopic);
+      mqtt_client->addTopicAlias(statusTopic);
+      mqtt_client->addTopicAlias(configTopic);
+    }
+    // keep the session on the broker so unacknowledged QoS1 messages survive a reconnect
+    mqtt_client->setCleanSession(false);
     mqtt_client->setCallback(callback);
     if (!mqtt_client->setBufferSize(MQTT_BUFFER_SIZE)) ESP_LOGE(TAG, "mqtt_client->setBufferSize failed!");
 
     //    logging::addOnLogCallback(logCallback);
   }
 
+  // Returns true once the message is done with and can be removed from its lane.
+  boolean processMessage(MqttMessage msg) {
+    if (msg.cmd == X_CMD_PUBLISH_CONFIGURATION) {
+      if (msg.payload) return publishConfigurationChangesInternal(msg);
+      return publishConfigurationInternal();
+    } else if (msg.cmd == X_CMD_PUBLISH_SENSORS) {
+      // the telemetry lane doesn't keep measurements that fail to be published
+      return publishSensorsInternal(msg);
+    } else if (msg.cmd == X_CMD_PUBLISH_STATUS_MSG) {
+      // keep status messages in the queue should they fail to be published
+      return publishStatusMsgInternal(msg.statusMessage, true);
+    } else if (msg.cmd == X_CMD_PUBLISH_REPLY) {
+      return publishReplyInternal(msg);
+    }
+    return true;
+  }
+
+  /**
+   * Weighted round robin across the lanes: each lane may send up to its weight of messages per round.
+   * A lane whose head message fails forfeits its remaining credits so the other lanes keep flowing.
+   * Returns true if a message was taken off a lane.
+   */
+  boolean serviceLanes() {
+    for (uint8_t round = 0; round < 2; round++) {
+      for (uint8_t i = 0; i < LANE_COUNT; i++) {
+        MqttLane* l = &lanes[i];
+        MqttMessage msg;
+        if (l->credits == 0 || !l->queue) continue;
+        // latest-wins lanes never retry, take the message off straight away so a producer making room can't free it under us
+        if (l->latestWins) {
+          if (xQueueReceive(l->queue, &msg, 0) != pdPASS) continue;
+        } else if (xQueuePeek(l->queue, &msg, 0) != pdPASS) continue;
+        boolean published = processMessage(msg);
+        if (published || l->latestWins) {
+          if (!l->latestWins) xQueueReceive(l->queue, &msg, 0);
+          if (published) {
+            l->sent++;
+          } else {
+            l->failed++;
+          }
+          l->credits--;
+          return true;
+        }
+        l->credits = 0;
+      }
+      // all lanes either empty or out of credits - start a new round
+      for (uint8_t i = 0; i < LANE_COUNT; i++) lanes[i].credits = lanes[i].weight;
+    }
+    return false;
+  }
+
+  // Published once, after the first reading has been marked, so the profile covers the whole boot
+  void publishBootProfile() {
+    if (bootProfilePublished || !mqtt_client->connected() || !BootProfile::get("firstReading")) return;
+    StaticJsonDocument<JSON_OBJECT_SIZE(1) + JSON_OBJECT_SIZE(BOOT_PROFILE_MAX_PHASES)> profile;
+    BootProfile::toJson(profile.createNestedObject("bootProfile"));
+    bootProfilePublished = publishJson(statusTopic, profile);
+  }
+
   void mqttLoop(void* pvParameters) {
     _ASSERT((uint32_t)pvParameters == 1);
-    lastReconnectAttempt = millis() - 60000;
-    BaseType_t notified;
-    MqttMessage msg;
+    lastReconnectAttempt = millis();
+    disconnectedSince = millis();
+    resetBackoff();
+    boolean busy;
     while (1) {
-      notified = xQueuePeek(mqttQueue, &msg, pdMS_TO_TICKS(100));
-      if (notified == pdPASS) {
-        if (mqtt_client->connected()) {
-          if (msg.cmd == X_CMD_PUBLISH_CONFIGURATION) {
-            if (publishConfigurationInternal()) {
-              xQueueReceive(mqttQueue, &msg, pdMS_TO_TICKS(100));
-            }
-          } else if (msg.cmd == X_CMD_PUBLISH_SENSORS) {
-            // don't keep measurements in the queue should they fail to be published
-            publishSensorsInternal(msg);
-            xQueueReceive(mqttQueue, &msg, pdMS_TO_TICKS(100));
-          } else if (msg.cmd == X_CMD_PUBLISH_STATUS_MSG) {
-            // keep status messages in the queue should they fail to be published
-            if (publishStatusMsgInternal(msg.statusMessage, true)) {
-              xQueueReceive(mqttQueue, &msg, pdMS_TO_TICKS(100));
-            }
-          }
+      busy = false;
+      // only take the next message off a lane while there is room in the in-flight window
+      if (mqtt_client->canPublish(MQTT_QOS)) {
+        busy = serviceLanes();
+      }
+      if (pauseRequested) {
+        if (!paused && mqtt_client->connected()) mqtt_client->disconnect();
+        paused = true;
+        TaskHandle_t waiter = pauseWaiter;
+        if (waiter) {
+          pauseWaiter = NULL;
+          xTaskNotifyGive(waiter);
         }
+      } else {
+        paused = false;
       }
       if (!mqtt_client->connected()) {
-        reconnect();
+        if (wasConnected) {
+          wasConnected = false;
+          disconnectedSince = millis();
+          // a broker restart drops every monitor at once, spread the first retry over the base delay.
+          // Only regaining an IP address retries straight away.
+          resetBackoff();
+          reconnectDelay = nextRandom() % MQTT_RECONNECT_BASE_DELAY;
+          lastReconnectAttempt = millis();
+        }
+        if (!paused) reconnect();
       }
       mqtt_client->loop();
-      vTaskDelay(pdMS_TO_TICKS(50));
+      publishBootProfile();
+      // pipeline queued messages back to back while the in-flight window has room, otherwise
+      // sleep until a new message gets queued
+      if (!busy || !mqtt_client->canPublish(MQTT_QOS))
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(50));
     }
     vTaskDelete(NULL);
   }
@@ -0,0 +1,912 @@
+#include <mqttClient.h>
+#include <Arduino.h>
+
+// Local logging tag
+static const char TAG[] = __FILE__;
+
+#define MQTT_CTRL_CONNECT      0x10
+#define MQTT_CTRL_CONNACK      0x20
+#define MQTT_CTRL_PUBLISH      0x30
+#define MQTT_CTRL_PUBACK       0x40
+#define MQTT_CTRL_SUBSCRIBE    0x82
+#define MQTT_CTRL_SUBACK       0x90
+#define MQTT_CTRL_PINGREQ      0xC0
+#define MQTT_CTRL_PINGRESP     0xD0
+#define MQTT_CTRL_DISCONNECT   0xE0
+
+#define MQTT_PUBLISH_DUP       0x08
+
+// MQTT 5 reason codes
+#define MQTT_REASON_PACKET_TOO_LARGE    0x95
+
+// MQTT 5 property identifiers
+#define MQTT_PROP_MESSAGE_EXPIRY        0x02
+#define MQTT_PROP_SESSION_EXPIRY        0x11
+#define MQTT_PROP_RECEIVE_MAXIMUM       0x21
+#define MQTT_PROP_TOPIC_ALIAS_MAXIMUM   0x22
+#define MQTT_PROP_TOPIC_ALIAS           0x23
+#define MQTT_PROP_USER_PROPERTY         0x26
+#define MQTT_PROP_MAXIMUM_PACKET_SIZE   0x27
+
+#define MQTT_RX_HEADER            0
+#define MQTT_RX_LENGTH            1
+#define MQTT_RX_BODY              2
+
+// Writes the MQTT variable length encoding of len to buf and returns the number of bytes used.
+static uint8_t encodeRemainingLength(uint8_t* buf, uint32_t len) {
+  uint8_t pos = 0;
+  do {
+    uint8_t digit = len % 128;
+    len /= 128;
+    if (len > 0) digit |= 0x80;
+    buf[pos++] = digit;
+  } while (len > 0 && pos < 4);
+  return pos;
+}
+
+// Returns the number of bytes the variable length encoding of len takes.
+static uint8_t remainingLengthSize(uint32_t len) {
+  return len < 128 ? 1 : len < 16384 ? 2 : len < 2097152 ? 3 : 4;
+}
+
+// Decodes a variable byte integer, returns the number of bytes used or 0 if it is malformed or truncated.
+static uint8_t decodeVarInt(const uint8_t* buf, uint32_t available, uint32_t* value) {
+  *value = 0;
+  for (uint8_t i = 0; i < 4 && i < available; i++) {
+    *value |= (uint32_t)(buf[i] & 0x7f) << (7 * i);
+    if (!(buf[i] & 0x80)) return i + 1;
+  }
+  return 0;
+}
+
+// Returns the size of the value of the MQTT 5 property id starting at buf, or -1 if unknown or truncated.
+static int32_t propertyValueSize(uint8_t id, const uint8_t* buf, uint32_t available) {
+  switch (id) {
+  case 0x01: case 0x17: case 0x19: case 0x24: case 0x25: case 0x28: case 0x29: case 0x2A:
+    return 1;
+  case 0x13: case 0x21: case 0x22: case 0x23:
+    return 2;
+  case 0x02: case 0x11: case 0x18: case 0x27:
+    return 4;
+  case 0x0B: {
+    uint32_t value;
+    uint8_t n = decodeVarInt(buf, available, &value);
+    return n > 0 ? n : -1;
+  }
+  case 0x03: case 0x08: case 0x09: case 0x12: case 0x15: case 0x16: case 0x1A: case 0x1C: case 0x1F:
+    return available >= 2 ? 2 + ((buf[0] << 8) | buf[1]) : -1;
+  case 0x26: {
+    if (available < 2) return -1;
+    uint32_t keyLength = 2 + ((buf[0] << 8) | buf[1]);
+    if (available < keyLength + 2) return -1;
+    return keyLength + 2 + ((buf[keyLength] << 8) | buf[keyLength + 1]);
+  }
+  }
+  return -1;
+}
+
+static size_t writeUint32(uint8_t* buf, uint32_t value) {
+  buf[0] = (uint8_t)(value >> 24);
+  buf[1] = (uint8_t)(value >> 16);
+  buf[2] = (uint8_t)(value >> 8);
+  buf[3] = (uint8_t)(value & 0xff);
+  return 4;
+}
+
+// Maps MQTT 5 CONNACK reason codes onto the 3.1.1 connection states.
+static int connectStateFromReason(uint8_t reason) {
+  switch (reason) {
+  case 0x84: return MQTT_CONNECT_BAD_PROTOCOL;
+  case 0x85: return MQTT_CONNECT_BAD_CLIENT_ID;
+  case 0x86: return MQTT_CONNECT_BAD_CREDENTIALS;
+  case 0x87: return MQTT_CONNECT_UNAUTHORIZED;
+  case 0x88:
+  case 0x89: return MQTT_CONNECT_UNAVAILABLE;
+  }
+  return MQTT_CONNECT_FAILED;
+}
+
+static size_t writeString(uint8_t* buf, const char* str) {
+  size_t len = strlen(str);
+  buf[0] = (uint8_t)(len >> 8);
+  buf[1] = (uint8_t)(len & 0xff);
+  memcpy(buf + 2, str, len);
+  return len + 2;
+}
+
+MqttClient::MqttClient(Client& _client) {
+  this->client = &_client;
+  this->host = nullptr;
+  this->port = 1883;
+  this->callback = nullptr;
+  this->keepAlive = MQTT_DEFAULT_KEEPALIVE;
+  this->cleanSession = true;
+  this->protocolVersion = MQTT_PROTOCOL_V311;
+  this->connectionState = MQTT_DISCONNECTED;
+  this->reasonCode = 0;
+  this->serverReceiveMaximum = 0xffff;
+  this->serverTopicAliasMaximum = 0;
+  this->buffer = nullptr;
+  this->bufferSize = 0;
+  this->nextPacketId = 0;
+  this->inFlightCount = 0;
+  this->acknowledged = 0;
+  this->retransmitted = 0;
+  this->rejected = 0;
+  this->lastOutActivity = 0;
+  this->lastInActivity = 0;
+  this->pingOutstanding = false;
+  this->streamActive = false;
+  this->streamFailed = false;
+  this->streamPacket = nullptr;
+  this->streamPacketId = 0;
+  this->streamHeaderLength = 0;
+  this->streamTopicAlias = 0;
+  this->streamLength = 0;
+  this->streamPosition = 0;
+  this->streamRemaining = 0;
+  for (uint8_t i = 0; i < MQTT_MAX_INFLIGHT; i++) {
+    inFlight[i].packetId = 0;
+    inFlight[i].packet = nullptr;
+    inFlight[i].length = 0;
+    inFlight[i].headerLength = 0;
+    inFlight[i].topicAlias = 0;
+  }
+  for (uint8_t i = 0; i < MQTT_MAX_TOPIC_ALIASES; i++) {
+    topicAliases[i] = nullptr;
+    topicAliasEstablished[i] = false;
+  }
+  resetParser();
+  setBufferSize(MQTT_DEFAULT_BUFFER_SIZE);
+}
+
+MqttClient::~MqttClient() {
+  clearInFlight();
+  if (this->streamPacket) free(streamPacket);
+  for (uint8_t i = 0; i < MQTT_MAX_TOPIC_ALIASES; i++) {
+    if (topicAliases[i]) free(topicAliases[i]);
+  }
+  if (this->buffer) free(buffer);
+}
+
+void MqttClient::setServer(const char* _host, uint16_t _port) {
+  this->host = _host;
+  this->port = _port;
+}
+
+void MqttClient::setCallback(callback_t _callback) {
+  this->callback = _callback;
+}
+
+boolean MqttClient::setBufferSize(uint16_t size) {
+  if (size == 0) return false;
+  // one additional byte to allow for null terminating the topic in place
+  uint8_t* newBuffer = (uint8_t*)realloc(this->buffer, size + 1);
+  if (newBuffer == nullptr) return false;
+  this->buffer = newBuffer;
+  this->bufferSize = size;
+  return true;
+}
+
+void MqttClient::setKeepAlive(uint16_t keepAliveSeconds) {
+  this->keepAlive = keepAliveSeconds;
+}
+
+void MqttClient::setCleanSession(boolean _cleanSession) {
+  this->cleanSession = _cleanSession;
+}
+
+void MqttClient::setProtocolVersion(uint8_t version) {
+  this->protocolVersion = version == MQTT_PROTOCOL_V5 ? MQTT_PROTOCOL_V5 : MQTT_PROTOCOL_V311;
+}
+
+uint8_t MqttClient::getProtocolVersion() {
+  return this->protocolVersion;
+}
+
+/**
+ * Registers a topic to be published using a topic alias (MQTT 5 only). The first publish on a new
+ * connection carries the full topic, subsequent ones only the two byte alias. Aliases beyond the
+ * maximum announced by the broker are not used.
+ */
+boolean MqttClient::addTopicAlias(const char* topic) {
+  for (uint8_t i = 0; i < MQTT_MAX_TOPIC_ALIASES; i++) {
+    if (topicAliases[i] && strcmp(topicAliases[i], topic) == 0) return true;
+  }
+  for (uint8_t i = 0; i < MQTT_MAX_TOPIC_ALIASES; i++) {
+    if (topicAliases[i] == nullptr) {
+      topicAliases[i] = (char*)malloc(strlen(topic) + 1);
+      if (topicAliases[i] == nullptr) return false;
+      strcpy(topicAliases[i], topic);
+      topicAliasEstablished[i] = false;
+      return true;
+    }
+  }
+  return false;
+}
+
+uint8_t MqttClient::findTopicAlias(const char* topic) {
+  if (protocolVersion != MQTT_PROTOCOL_V5) return 0;
+  for (uint8_t i = 0; i < MQTT_MAX_TOPIC_ALIASES && i < serverTopicAliasMaximum; i++) {
+    if (topicAliases[i] && strcmp(topicAliases[i], topic) == 0) return i + 1;
+  }
+  return 0;
+}
+
+boolean MqttClient::connect(const char* id, const char* user, const char* pass) {
+  return connect(id, user, pass, nullptr, 0, false, nullptr);
+}
+
+boolean MqttClient::connect(const char* id, const char* user, const char* pass, const char* willTopic, uint8_t willQos, boolean willRetain, const char* willMessage) {
+  if (connected()) return true;
+  if (host == nullptr || !client->connect(host, port)) {
+    connectionState = MQTT_CONNECT_FAILED;
+    return false;
+  }
+  resetParser();
+
+  boolean v5 = protocolVersion == MQTT_PROTOCOL_V5;
+  uint8_t flags = cleanSession ? 0x02 : 0x00;
+  uint32_t remaining = 10 + 2 + strlen(id);
+  // MQTT 5: persistent sessions need an expiry, otherwise the broker drops them on disconnect
+  uint8_t propertiesLength = (cleanSession ? 0 : 5) + 5;
+  if (v5) remaining += 1 + propertiesLength;
+  if (willTopic && willMessage) {
+    flags |= 0x04 | ((willQos & 0x03) << 3) | (willRetain ? 0x20 : 0x00);
+    remaining += 2 + strlen(willTopic) + 2 + strlen(willMessage) + (v5 ? 1 : 0);
+  }
+  if (user) {
+    flags |= 0x80;
+    remaining += 2 + strlen(user);
+    if (pass) {
+      flags |= 0x40;
+      remaining += 2 + strlen(pass);
+    }
+  }
+
+  uint8_t* packet = (uint8_t*)malloc(remaining + 5);
+  if (packet == nullptr) {
+    client->stop();
+    connectionState = MQTT_CONNECT_FAILED;
+    return false;
+  }
+  size_t pos = 0;
+  packet[pos++] = MQTT_CTRL_CONNECT;
+  pos += encodeRemainingLength(packet + pos, remaining);
+  pos += writeString(packet + pos, "MQTT");
+  packet[pos++] = protocolVersion;
+  packet[pos++] = flags;
+  packet[pos++] = (uint8_t)(keepAlive >> 8);
+  packet[pos++] = (uint8_t)(keepAlive & 0xff);
+  if (v5) {
+    packet[pos++] = propertiesLength;
+    if (!cleanSession) {
+      packet[pos++] = MQTT_PROP_SESSION_EXPIRY;
+      pos += writeUint32(packet + pos, MQTT_SESSION_EXPIRY);
+    }
+    packet[pos++] = MQTT_PROP_MAXIMUM_PACKET_SIZE;
+    pos += writeUint32(packet + pos, bufferSize);
+  }
+  pos += writeString(packet + pos, id);
+  if (flags & 0x04) {
+    if (v5) packet[pos++] = 0x00; // no will properties
+    pos += writeString(packet + pos, willTopic);
+    pos += writeString(packet + pos, willMessage);
+  }
+  if (flags & 0x80) pos += writeString(packet + pos, user);
+  if (flags & 0x40) pos += writeString(packet + pos, pass);
+
+  boolean written = client->write(packet, pos) == pos;
+  free(packet);
+  if (!written) {
+    client->stop();
+    connectionState = MQTT_CONNECT_FAILED;
+    return false;
+  }
+  lastOutActivity = millis();
+
+  if (!readPacket(MQTT_CONNACK_TIMEOUT)) {
+    client->stop();
+    connectionState = MQTT_CONNECTION_TIMEOUT;
+    return false;
+  }
+  if ((rxHeader & 0xf0) != MQTT_CTRL_CONNACK || rxLength < 2) {
+    client->stop();
+    connectionState = MQTT_CONNECT_FAILED;
+    return false;
+  }
+  reasonCode = buffer[1];
+  if (reasonCode != 0) {
+    ESP_LOGD(TAG, "Connection refused, reason 0x%02x", reasonCode);
+    client->stop();
+    connectionState = v5 ? connectStateFromReason(reasonCode) : reasonCode;
+    return false;
+  }
+  serverReceiveMaximum = 0xffff;
+  serverTopicAliasMaximum = 0;
+  if (v5) {
+    uint32_t length;
+    uint8_t n = decodeVarInt(buffer + 2, rxLength - 2, &length);
+    if (n == 0 || 2 + n + length > rxLength || !parseConnackProperties(buffer + 2 + n, length)) {
+      ESP_LOGW(TAG, "Malformed CONNACK properties");
+      client->stop();
+      connectionState = MQTT_CONNECT_FAILED;
+      return false;
+    }
+  }
+  // aliases only live as long as the network connection
+  for (uint8_t i = 0; i < MQTT_MAX_TOPIC_ALIASES; i++) topicAliasEstablished[i] = false;
+  resetParser();
+  connectionState = MQTT_CONNECTED;
+  lastInActivity = millis();
+  pingOutstanding = false;
+  ESP_LOGD(TAG, "Connected, session present: %u, in flight: %u", buffer[0] & 0x01, inFlightCount);
+  retransmit();
+  return connected();
+}
+
+boolean MqttClient::parseConnackProperties(const uint8_t* properties, uint32_t length) {
+  uint32_t pos = 0;
+  while (pos < length) {
+    uint8_t id = properties[pos++];
+    int32_t size = propertyValueSize(id, properties + pos, length - pos);
+    if (size < 0 || pos + size > length) return false;
+    if (id == MQTT_PROP_RECEIVE_MAXIMUM) {
+      serverReceiveMaximum = (properties[pos] << 8) | properties[pos + 1];
+    } else if (id == MQTT_PROP_TOPIC_ALIAS_MAXIMUM) {
+      serverTopicAliasMaximum = (properties[pos] << 8) | properties[pos + 1];
+    }
+    pos += size;
+  }
+  ESP_LOGD(TAG, "Broker receive maximum %u, topic alias maximum %u", serverReceiveMaximum, serverTopicAliasMaximum);
+  return true;
+}
+
+void MqttClient::disconnect() {
+  if (client->connected()) {
+    uint8_t packet[2] = { MQTT_CTRL_DISCONNECT, 0x00 };
+    client->write(packet, 2);
+    client->flush();
+  }
+  client->stop();
+  connectionState = MQTT_DISCONNECTED;
+  lastInActivity = lastOutActivity = millis();
+}
+
+boolean MqttClient::connected() {
+  if (client == nullptr) return false;
+  boolean socketConnected = client->connected();
+  if (!socketConnected && connectionState == MQTT_CONNECTED) {
+    connectionState = MQTT_CONNECTION_LOST;
+    client->stop();
+  }
+  return socketConnected && connectionState == MQTT_CONNECTED;
+}
+
+int MqttClient::state() {
+  return this->connectionState;
+}
+
+uint16_t MqttClient::getNextPacketId() {
+  boolean inUse;
+  do {
+    nextPacketId++;
+    if (nextPacketId == 0) nextPacketId = 1;
+    inUse = false;
+    for (uint8_t i = 0; i < MQTT_MAX_INFLIGHT; i++) {
+      if (inFlight[i].packet && inFlight[i].packetId == nextPacketId) inUse = true;
+    }
+  } while (inUse);
+  return nextPacketId;
+}
+
+boolean MqttClient::canPublish(uint8_t qos) {
+  return connected() && (qos == 0 || (inFlightCount < MQTT_MAX_INFLIGHT && inFlightCount < serverReceiveMaximum));
+}
+
+uint8_t MqttClient::getInFlight() {
+  return this->inFlightCount;
+}
+
+uint32_t MqttClient::getAcknowledged() {
+  return this->acknowledged;
+}
+
+uint32_t MqttClient::getRetransmitted() {
+  return this->retransmitted;
+}
+
+uint32_t MqttClient::getRejected() {
+  return this->rejected;
+}
+
+// Last reason code (MQTT 5) or return code (3.1.1) that signalled a failure.
+uint8_t MqttClient::getReasonCode() {
+  return this->reasonCode;
+}
+
+boolean MqttClient::publish(const char* topic, const char* payload, uint8_t qos, boolean retained) {
+  return publish(topic, (const uint8_t*)payload, payload ? strlen(payload) : 0, qos, retained);
+}
+
+boolean MqttClient::publish(const char* topic, const uint8_t* payload, size_t length, uint8_t qos, boolean retained) {
+  if (!beginPublish(topic, length, qos, retained)) return false;
+  if (length > 0 && write(payload, length) != length) {
+    endPublish();
+    return false;
+  }
+  return endPublish();
+}
+
+/**
+ * Starts a publish of exactly length payload bytes, which are then passed in through write().
+ * QoS0 messages are streamed straight to the socket. QoS1 messages are assembled once in a buffer
+ * of the exact packet size, kept in the in-flight window until the broker acknowledges them and
+ * retransmitted after a reconnect. Properties are only sent when connected using MQTT 5.
+ * Returns false if not connected, the in-flight window is full or the packet couldn't be started.
+ */
+boolean MqttClient::beginPublish(const char* topic, size_t length, uint8_t qos, boolean retained, const MqttPublishProperties* properties) {
+  if (!canPublish(qos)) return false;
+  if (streamActive) {
+    ESP_LOGW(TAG, "beginPublish called while another publish is in progress");
+    return false;
+  }
+  if (qos > 1) qos = 1;
+  boolean v5 = protocolVersion == MQTT_PROTOCOL_V5;
+  size_t topicLength = strlen(topic);
+  uint8_t alias = findTopicAlias(topic);
+  // QoS1 packets keep the full topic for retransmission, sendInFlight() leaves it out if possible
+  if (qos == 0 && alias && topicAliasEstablished[alias - 1]) topicLength = 0;
+  uint32_t propertiesLength = 0;
+  if (v5) {
+    if (alias) propertiesLength += 3;
+    if (properties && properties->messageExpiry) propertiesLength += 5;
+    for (uint8_t i = 0; properties && i < properties->userPropertyCount; i++) {
+      propertiesLength += 1 + 2 + strlen(properties->userProperties[i].key) + 2 + strlen(properties->userProperties[i].value);
+    }
+    // a single byte property length keeps dropTopicAlias() simple
+    if (propertiesLength > 127) {
+      ESP_LOGW(TAG, "Publish properties exceed 127 bytes");
+      return false;
+    }
+  }
+  size_t variableLength = 2 + topicLength + (qos > 0 ? 2 : 0) + (v5 ? 1 + propertiesLength : 0);
+  uint32_t remaining = variableLength + length;
+  size_t headerSize = 1 + remainingLengthSize(remaining) + variableLength;
+  uint8_t* packet = (uint8_t*)malloc(qos > 0 ? headerSize + length : headerSize);
+  if (packet == nullptr) {
+    ESP_LOGW(TAG, "Failed to allocate %u bytes for publish", qos > 0 ? headerSize + length : headerSize);
+    return false;
+  }
+  size_t pos = 0;
+  packet[pos++] = MQTT_CTRL_PUBLISH | (qos << 1) | (retained ? 0x01 : 0x00);
+  pos += encodeRemainingLength(packet + pos, remaining);
+  uint8_t fixedHeaderLength = pos;
+  packet[pos++] = (uint8_t)(topicLength >> 8);
+  packet[pos++] = (uint8_t)(topicLength & 0xff);
+  memcpy(packet + pos, topic, topicLength);
+  pos += topicLength;
+  uint16_t packetId = 0;
+  if (qos > 0) {
+    packetId = getNextPacketId();
+    packet[pos++] = (uint8_t)(packetId >> 8);
+    packet[pos++] = (uint8_t)(packetId & 0xff);
+  }
+  if (v5) {
+    packet[pos++] = (uint8_t)propertiesLength;
+    // the topic alias has to be the first property, see dropTopicAlias()
+    if (alias) {
+      packet[pos++] = MQTT_PROP_TOPIC_ALIAS;
+      packet[pos++] = 0x00;
+      packet[pos++] = alias;
+    }
+    if (properties && properties->messageExpiry) {
+      packet[pos++] = MQTT_PROP_MESSAGE_EXPIRY;
+      pos += writeUint32(packet + pos, properties->messageExpiry);
+    }
+    for (uint8_t i = 0; properties && i < properties->userPropertyCount; i++) {
+      packet[pos++] = MQTT_PROP_USER_PROPERTY;
+      pos += writeString(packet + pos, properties->userProperties[i].key);
+      pos += writeString(packet + pos, properties->userProperties[i].value);
+    }
+  }
+
+  if (qos == 0) {
+    boolean written = writePacket(packet, pos);
+    free(packet);
+    if (!written) return false;
+    if (alias) topicAliasEstablished[alias - 1] = true;
+    streamPacket = nullptr;
+  } else {
+    streamPacket = packet;
+    streamLength = headerSize + length;
+    streamPosition = pos;
+    streamPacketId = packetId;
+    streamHeaderLength = fixedHeaderLength;
+    streamTopicAlias = alias;
+  }
+  streamRemaining = length;
+  streamFailed = false;
+  streamActive = true;
+  return true;
+}
+
+size_t MqttClient::write(uint8_t b) {
+  return write(&b, 1);
+}
+
+size_t MqttClient::write(const uint8_t* data, size_t length) {
+  if (!streamActive || streamFailed) return 0;
+  if (length > streamRemaining) {
+    // writing more than announced would corrupt the stream, fail the whole message
+    ESP_LOGW(TAG, "Publish payload exceeds announced length by %u bytes", length - streamRemaining);
+    streamFailed = true;
+    return 0;
+  }
+  if (streamPacket) {
+    memcpy(streamPacket + streamPosition, data, length);
+    streamPosition += length;
+  } else if (client->write(data, length) != length) {
+    streamFailed = true;
+    return 0;
+  }
+  streamRemaining -= length;
+  return length;
+}
+
+/**
+ * Completes the publish started with beginPublish(). Returns false if fewer or more bytes than
+ * announced were written, in which case a QoS0 connection is dropped since the broker would read
+ * a truncated packet.
+ */
+boolean MqttClient::endPublish() {
+  if (!streamActive) return false;
+  streamActive = false;
+  boolean complete = !streamFailed && streamRemaining == 0;
+  if (!streamPacket) {
+    if (!complete) {
+      connectionLost();
+      return false;
+    }
+    lastOutActivity = millis();
+    return true;
+  }
+  if (!complete) {
+    free(streamPacket);
+    streamPacket = nullptr;
+    return false;
+  }
+  for (uint8_t i = 0; i < MQTT_MAX_INFLIGHT; i++) {
+    if (inFlight[i].packet == nullptr) {
+      inFlight[i].packetId = streamPacketId;
+      inFlight[i].packet = streamPacket;
+      inFlight[i].length = streamLength;
+      inFlight[i].headerLength = streamHeaderLength;
+      inFlight[i].topicAlias = streamTopicAlias;
+      inFlightCount++;
+      streamPacket = nullptr;
+      // A failed write leaves the message in flight, it'll be retransmitted after reconnecting.
+      sendInFlight(&inFlight[i]);
+      return true;
+    }
+  }
+  free(streamPacket);
+  streamPacket = nullptr;
+  return false;
+}
+
+boolean MqttClient::subscribe(const char* topic, uint8_t qos) {
+  if (!connected()) return false;
+  size_t topicLength = strlen(topic);
+  uint16_t packetId = getNextPacketId();
+  boolean v5 = protocolVersion == MQTT_PROTOCOL_V5;
+  uint8_t header[10];
+  uint8_t headerLength = 0;
+  header[headerLength++] = MQTT_CTRL_SUBSCRIBE;
+  headerLength += encodeRemainingLength(header + headerLength, 2 + (v5 ? 1 : 0) + 2 + topicLength + 1);
+  header[headerLength++] = (uint8_t)(packetId >> 8);
+  header[headerLength++] = (uint8_t)(packetId & 0xff);
+  if (v5) header[headerLength++] = 0x00; // no properties
+  header[headerLength++] = (uint8_t)(topicLength >> 8);
+  header[headerLength++] = (uint8_t)(topicLength & 0xff);
+  uint8_t requestedQos = qos > 1 ? 1 : qos;
+  boolean written = client->write(header, headerLength) == headerLength
+    && client->write((const uint8_t*)topic, topicLength) == topicLength
+    && client->write(&requestedQos, 1) == 1;
+  if (!written) {
+    connectionLost();
+    return false;
+  }
+  lastOutActivity = millis();
+  return true;
+}
+
+boolean MqttClient::writePacket(const uint8_t* packet, size_t length) {
+  if (client->write(packet, length) != length) {
+    connectionLost();
+    return false;
+  }
+  lastOutActivity = millis();
+  return true;
+}
+
+boolean MqttClient::writeControl(uint8_t header, uint16_t packetId, boolean withId) {
+  uint8_t packet[4] = { header, (uint8_t)(withId ? 0x02 : 0x00), (uint8_t)(packetId >> 8), (uint8_t)(packetId & 0xff) };
+  return writePacket(packet, withId ? 4 : 2);
+}
+
+/**
+ * Sends an in-flight QoS1 packet. Once the broker knows the packet's topic alias only the alias is
+ * sent, the stored packet always keeps the full topic so it can be retransmitted on a new connection.
+ */
+boolean MqttClient::sendInFlight(InFlightMessage* msg) {
+  if (msg->topicAlias && msg->topicAlias > serverTopicAliasMaximum && !dropTopicAlias(msg)) return false;
+  uint8_t alias = msg->topicAlias;
+  if (alias == 0 || !topicAliasEstablished[alias - 1]) {
+    if (!writePacket(msg->packet, msg->length)) return false;
+    if (alias) topicAliasEstablished[alias - 1] = true;
+    return true;
+  }
+  const uint8_t* packet = msg->packet;
+  size_t topicLength = (packet[msg->headerLength] << 8) | packet[msg->headerLength + 1];
+  size_t bodyOffset = msg->headerLength + 2 + topicLength;
+  size_t bodyLength = msg->length - bodyOffset;
+  uint8_t prefix[7];
+  uint8_t pos = 0;
+  prefix[pos++] = packet[0];
+  pos += encodeRemainingLength(prefix + pos, 2 + bodyLength);
+  prefix[pos++] = 0x00;
+  prefix[pos++] = 0x00;
+  if (client->write(prefix, pos) != pos || client->write(packet + bodyOffset, bodyLength) != bodyLength) {
+    connectionLost();
+    return false;
+  }
+  lastOutActivity = millis();
+  return true;
+}
+
+/**
+ * Rebuilds an in-flight packet without its topic alias property, needed when the broker allows fewer
+ * aliases after a reconnect than when the packet was built. Relies on the alias being the first property.
+ */
+boolean MqttClient::dropTopicAlias(InFlightMessage* msg) {
+  size_t topicLength = (msg->packet[msg->headerLength] << 8) | msg->packet[msg->headerLength + 1];
+  size_t propertiesOffset = msg->headerLength + 2 + topicLength + 2;
+  uint32_t remaining = msg->length - msg->headerLength - 3;
+  uint8_t headerLength = 1 + remainingLengthSize(remaining);
+  uint8_t* packet = (uint8_t*)malloc(headerLength + remaining);
+  if (packet == nullptr) return false;
+  packet[0] = msg->packet[0];
+  encodeRemainingLength(packet + 1, remaining);
+  size_t pos = headerLength;
+  memcpy(packet + pos, msg->packet + msg->headerLength, propertiesOffset - msg->headerLength);
+  pos += propertiesOffset - msg->headerLength;
+  packet[pos++] = msg->packet[propertiesOffset] - 3;
+  memcpy(packet + pos, msg->packet + propertiesOffset + 4, msg->length - propertiesOffset - 4);
+  free(msg->packet);
+  msg->packet = packet;
+  msg->length = headerLength + remaining;
+  msg->headerLength = headerLength;
+  msg->topicAlias = 0;
+  return true;
+}
+
+// Blocks until a complete packet has been read into the buffer, only used while connecting.
+boolean MqttClient::readPacket(uint32_t timeout) {
+  uint8_t b;
+  resetParser();
+  if (!readByte(&rxHeader, timeout)) return false;
+  do {
+    if (!readByte(&b, timeout)) return false;
+    rxLength |= (uint32_t)(b & 0x7f) << rxLengthShift;
+    rxLengthShift += 7;
+  } while ((b & 0x80) && rxLengthShift < 28);
+  if (rxLength > bufferSize) return false;
+  for (rxPosition = 0; rxPosition < rxLength; rxPosition++) {
+    if (!readByte(&buffer[rxPosition], timeout)) return false;
+  }
+  return true;
+}
+
+boolean MqttClient::readByte(uint8_t* result, uint32_t timeout) {
+  uint32_t start = millis();
+  while (!client->available()) {
+    if (millis() - start >= timeout || !client->connected()) return false;
+    vTaskDelay(pdMS_TO_TICKS(1));
+  }
+  *result = client->read();
+  return true;
+}
+
+void MqttClient::retransmit() {
+  for (uint8_t i = 0; i < MQTT_MAX_INFLIGHT; i++) {
+    if (inFlight[i].packet == nullptr) continue;
+    inFlight[i].packet[0] |= MQTT_PUBLISH_DUP;
+    if (!sendInFlight(&inFlight[i])) return;
+    retransmitted++;
+  }
+}
+
+void MqttClient::releaseInFlight(uint16_t packetId, uint8_t reason) {
+  for (uint8_t i = 0; i < MQTT_MAX_INFLIGHT; i++) {
+    if (inFlight[i].packet && inFlight[i].packetId == packetId) {
+      free(inFlight[i].packet);
+      inFlight[i].packet = nullptr;
+      inFlight[i].length = 0;
+      inFlightCount--;
+      // a rejected message won't be accepted when retransmitted either, so it's released all the same
+      if (reason >= 0x80) {
+        ESP_LOGW(TAG, "Publish %u rejected, reason 0x%02x", packetId, reason);
+        reasonCode = reason;
+        rejected++;
+      } else {
+        acknowledged++;
+      }
+      return;
+    }
+  }
+  ESP_LOGD(TAG, "PUBACK for unknown packet id %u", packetId);
+}
+
+void MqttClient::clearInFlight() {
+  for (uint8_t i = 0; i < MQTT_MAX_INFLIGHT; i++) {
+    if (inFlight[i].packet) free(inFlight[i].packet);
+    inFlight[i].packet = nullptr;
+    inFlight[i].length = 0;
+  }
+  inFlightCount = 0;
+}
+
+void MqttClient::resetParser() {
+  rxStage = MQTT_RX_HEADER;
+  rxHeader = 0;
+  rxLength = 0;
+  rxPosition = 0;
+  rxLengthShift = 0;
+  rxDiscard = false;
+}
+
+void MqttClient::connectionLost() {
+  ESP_LOGD(TAG, "Connection lost");
+  client->stop();
+  connectionState = MQTT_CONNECTION_LOST;
+  resetParser();
+}
+
+/**
+ * Consumes whatever bytes the socket has available without blocking and dispatches complete packets.
+ */
+boolean MqttClient::processIncoming() {
+  int available = client->available();
+  while (available-- > 0) {
+    int c = client->read();
+    if (c < 0) break;
+    uint8_t b = (uint8_t)c;
+    lastInActivity = millis();
+    if (rxStage == MQTT_RX_HEADER) {
+      rxHeader = b;
+      rxLength = 0;
+      rxLengthShift = 0;
+      rxStage = MQTT_RX_LENGTH;
+    } else if (rxStage == MQTT_RX_LENGTH) {
+      rxLength |= (uint32_t)(b & 0x7f) << rxLengthShift;
+      rxLengthShift += 7;
+      if (!(b & 0x80)) {
+        rxPosition = 0;
+        rxDiscard = rxLength > bufferSize;
+        if (rxDiscard) ESP_LOGW(TAG, "Discarding packet of %u bytes exceeding buffer size %u", rxLength, bufferSize);
+        if (rxLength == 0) {
+          handlePacket();
+          resetParser();
+        } else {
+          rxStage = MQTT_RX_BODY;
+        }
+      } else if (rxLengthShift > 21) {
+        ESP_LOGW(TAG, "Malformed remaining length");
+        connectionLost();
+        return false;
+      }
+    } else {
+      // a discarded packet still keeps its start, the packet id of a PUBLISH is needed to acknowledge it
+      if (rxPosition < bufferSize) buffer[rxPosition] = b;
+      rxPosition++;
+      if (rxPosition == rxLength) {
+        if (rxDiscard) {
+          discardPacket();
+        } else {
+          handlePacket();
+        }
+        resetParser();
+      }
+    }
+  }
+  return true;
+}
+
+/**
+ * Called for a packet that didn't fit into the buffer. A QoS1 PUBLISH is still acknowledged, with MQTT 5
+ * as too large, otherwise a persistent session would get it redelivered on every reconnect. If the packet
+ * id lies beyond the buffer the connection is dropped instead.
+ */
+void MqttClient::discardPacket() {
+  if ((rxHeader & 0xf0) != MQTT_CTRL_PUBLISH || ((rxHeader >> 1) & 0x03) == 0) return;
+  uint32_t topicLength = (buffer[0] << 8) | buffer[1];
+  if (4 + topicLength > bufferSize) {
+    ESP_LOGW(TAG, "Can't acknowledge discarded publish, disconnecting");
+    connectionLost();
+    return;
+  }
+  uint16_t packetId = (buffer[2 + topicLength] << 8) | buffer[3 + topicLength];
+  if (protocolVersion == MQTT_PROTOCOL_V5) {
+    uint8_t packet[5] = { MQTT_CTRL_PUBACK, 0x03, (uint8_t)(packetId >> 8), (uint8_t)(packetId & 0xff), MQTT_REASON_PACKET_TOO_LARGE };
+    writePacket(packet, sizeof(packet));
+  } else {
+    writeControl(MQTT_CTRL_PUBACK, packetId, true);
+  }
+}
+
+void MqttClient::handlePacket() {
+  uint8_t type = rxHeader & 0xf0;
+  if (type == MQTT_CTRL_PUBLISH) {
+    if (rxLength < 2) return;
+    uint8_t qos = (rxHeader >> 1) & 0x03;
+    uint16_t topicLength = (buffer[0] << 8) | buffer[1];
+    uint32_t payloadOffset = 2 + topicLength + (qos > 0 ? 2 : 0);
+    if (payloadOffset > rxLength) return;
+    if (protocolVersion == MQTT_PROTOCOL_V5) {
+      uint32_t propertiesLength;
+      uint8_t n = decodeVarInt(buffer + payloadOffset, rxLength - payloadOffset, &propertiesLength);
+      if (n == 0 || payloadOffset + n + propertiesLength > rxLength) return;
+      payloadOffset += n + propertiesLength;
+    }
+    uint16_t packetId = qos > 0 ? (buffer[2 + topicLength] << 8) | buffer[3 + topicLength] : 0;
+    // move topic one byte to the front to be able to null terminate it in place
+    memmove(buffer, buffer + 2, topicLength);
+    buffer[topicLength] = 0x00;
+    if (qos == 1) writeControl(MQTT_CTRL_PUBACK, packetId, true);
+    if (callback) callback((char*)buffer, buffer + payloadOffset, rxLength - payloadOffset);
+  } else if (type == MQTT_CTRL_PUBACK) {
+    // MQTT 5 brokers may append a reason code, it's left out on success
+    if (rxLength >= 2) releaseInFlight((buffer[0] << 8) | buffer[1], rxLength >= 3 ? buffer[2] : 0);
+  } else if (type == (MQTT_CTRL_SUBACK & 0xf0)) {
+    uint32_t offset = 2;
+    if (protocolVersion == MQTT_PROTOCOL_V5 && rxLength > 2) {
+      uint32_t propertiesLength;
+      uint8_t n = decodeVarInt(buffer + 2, rxLength - 2, &propertiesLength);
+      if (n == 0) return;
+      offset += n + propertiesLength;
+    }
+    if (rxLength > offset && buffer[offset] >= 0x80) {
+      reasonCode = buffer[offset];
+      ESP_LOGW(TAG, "Subscription %u rejected, reason 0x%02x", (buffer[0] << 8) | buffer[1], reasonCode);
+    }
+  } else if (type == MQTT_CTRL_DISCONNECT) {
+    // only sent by MQTT 5 brokers
+    reasonCode = rxLength > 0 ? buffer[0] : 0;
+    ESP_LOGW(TAG, "Disconnected by broker, reason 0x%02x", reasonCode);
+    connectionLost();
+  } else if (type == MQTT_CTRL_PINGRESP) {
+    pingOutstanding = false;
+  } else if (type == MQTT_CTRL_PINGREQ) {
+    writeControl(MQTT_CTRL_PINGRESP, 0, false);
+  }
+}
+
+boolean MqttClient::loop() {
+  if (!connected()) return false;
+  uint32_t now = millis();
+  if (keepAlive > 0 && (now - lastInActivity > keepAlive * 1000UL || now - lastOutActivity > keepAlive * 1000UL)) {
+    if (pingOutstanding) {
+      if (now - lastInActivity > keepAlive * 1000UL + MQTT_PINGRESP_TIMEOUT) {
+        ESP_LOGD(TAG, "Keep alive timeout");
+        client->stop();
+        connectionState = MQTT_CONNECTION_TIMEOUT;
+        resetParser();
+        return false;
+      }
+    } else if (writeControl(MQTT_CTRL_PINGREQ, 0, false)) {
+      pingOutstanding = true;
+    }
+  }
+  return processIncoming();
+}
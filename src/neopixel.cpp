@@ -18,23 +18,25 @@ Neopixel::Neopixel(Model* _model, uint8_t _pin, uint8_t numPixel) {
   this->colourOff = this->strip->Color(0, 0, 0);
 
   // https://stackoverflow.com/questions/60985496/arduino-esp8266-esp32-ticker-callback-class-member-function
-  ticker->attach(0.3, +[](Neopixel* instance) { instance->timer(); }, this);
+  ticker->attach(0.3, outputTimer<Neopixel, &Neopixel::timer>, this);
 
   this->strip->begin();
   this->strip->setBrightness(config.brightness);
   this->strip->show(); // Initialize all pixels to 'off'
-  fill(colourRed);
-  delay(250);
-  fill(colourYellow);
-  delay(250);
-  fill(colourGreen);
-  delay(250);
-  fill(colourOff);
 }
 
 Neopixel::~Neopixel() {
   if (this->ticker) delete ticker;
-  if (this->strip) delete strip;
+  if (this->strip) {
+    off();
+    delete strip;
+  }
+}
+
+// Shows red, yellow and green for steps 0 to 2, step SELF_TEST_STEPS turns the pixels off again.
+void Neopixel::selfTest(uint8_t step) {
+  const uint32_t colours[SELF_TEST_STEPS] = { colourRed, colourYellow, colourGreen };
+  fill(step < SELF_TEST_STEPS ? colours[step] : colourOff);
 }
 
 void Neopixel::fill(uint32_t c) {
@@ -52,7 +54,7 @@ void Neopixel::off() {
   this->strip->show();
 }
 
-void Neopixel::update(uint16_t mask, TrafficLightStatus oldStatus, TrafficLightStatus newStatus) {
+void Neopixel::update(MeasurementMask mask, TrafficLightStatus oldStatus, TrafficLightStatus newStatus) {
   if (oldStatus == newStatus && !(mask & M_CONFIG_CHANGED)) return;
   if (mask & M_CONFIG_CHANGED) this->strip->setBrightness(config.brightness);
   if (newStatus == OFF) {
@@ -17,6 +17,12 @@ NeopixelMatrix::NeopixelMatrix(Model* _model, uint8_t _pin, uint8_t _columns, ui
 
   pin = _pin;
   layout = _layout;
+  matrix = nullptr;
+  cyclicTimer = nullptr;
+  snakeTicker = nullptr;
+  updateQueue = NULL;
+  displayTask = NULL;
+  stopRequested = false;
   MATRIX_WIDTH = _columns;
   MATRIX_HEIGHT = _rows;
   NUMBER_OF_DOTS = MATRIX_WIDTH * MATRIX_HEIGHT;
@@ -30,10 +36,22 @@ NeopixelMatrix::NeopixelMatrix(Model* _model, uint8_t _pin, uint8_t _columns, ui
   PPM_PER_DOT = (float)RANGE / (NUMBER_OF_DOTS);
 }
 
+// Ends the display task before releasing what it uses. A task suspended by stop() is deleted right away.
 NeopixelMatrix::~NeopixelMatrix() {
-  if (this->matrix) delete matrix;
+  if (displayTask) {
+    stopRequested = true;
+    // the task may still be in its start-up animation
+    for (uint8_t i = 0; i < 200 && displayTask && eTaskGetState(displayTask) != eSuspended; i++) vTaskDelay(pdMS_TO_TICKS(10));
+    if (displayTask) vTaskDelete(displayTask);
+  }
   if (this->cyclicTimer) delete cyclicTimer;
   if (this->snakeTicker) delete snakeTicker;
+  if (updateQueue) vQueueDelete(updateQueue);
+  if (this->matrix) {
+    matrix->fillScreen(0);
+    matrix->show();
+    delete matrix;
+  }
 }
 
 TaskHandle_t NeopixelMatrix::start(const char* name, uint32_t stackSize, UBaseType_t priority, BaseType_t core) {
@@ -51,10 +69,10 @@ TaskHandle_t NeopixelMatrix::start(const char* name, uint32_t stackSize, UBaseTy
 }
 
 void NeopixelMatrix::stop() {
-  vTaskSuspend(displayTask);
+  if (displayTask) vTaskSuspend(displayTask);
   updateQueue = NULL;
-  if (snakeTicker->active()) snakeTicker->detach();
-  if (cyclicTimer->active()) cyclicTimer->detach();
+  if (snakeTicker && snakeTicker->active()) snakeTicker->detach();
+  if (cyclicTimer && cyclicTimer->active()) cyclicTimer->detach();
   cyclicTimerMode = TIMER_OFF;
   if (matrix) {
     matrix->setBrightness(0);
@@ -160,7 +178,8 @@ void NeopixelMatrix::showTank(uint16_t ppm, bool showDrip) {
   //  ESP_LOGI(TAG, "show() took %u us", end - start);
 }
 
-void NeopixelMatrix::update(uint16_t mask, TrafficLightStatus oldStatus, TrafficLightStatus newStatus) {
+void NeopixelMatrix::update(MeasurementMask mask, TrafficLightStatus oldStatus, TrafficLightStatus newStatus) {
+  if (!updateQueue) return;  // display task not up yet, or stopped
   if (mask & M_CONFIG_CHANGED) {
     UPPER_LIMIT = config.co2DarkRedThreshold;
     MID_POINT = config.co2YellowThreshold;
@@ -204,7 +223,7 @@ void NeopixelMatrix::update(uint16_t ppm) {
     if (scrollWidth > 0) {
       if (!cyclicTimer->active()) {
         cyclicTimerMode = TIMER_SCROLL;
-        cyclicTimer->attach_ms(TEXT_TIMER_INTERVAL, +[](NeopixelMatrix* instance) { instance->textTimer(); }, this);
+        cyclicTimer->attach_ms(TEXT_TIMER_INTERVAL, outputTimer<NeopixelMatrix, &NeopixelMatrix::textTimer>, this);
       }
     } else {
       if (cyclicTimer->active()) cyclicTimer->detach();
@@ -236,13 +255,13 @@ void NeopixelMatrix::update(uint16_t ppm) {
       }
       if (cyclicTimer->active()) cyclicTimer->detach();
       cyclicTimerMode = TIMER_DRIP;
-      cyclicTimer->attach_ms(DRIP_TIMER_INTERVAL, +[](NeopixelMatrix* instance) { instance->dripTimer(); }, this);
+      cyclicTimer->attach_ms(DRIP_TIMER_INTERVAL, outputTimer<NeopixelMatrix, &NeopixelMatrix::dripTimer>, this);
     } else if (ppm <= UPPER_LIMIT && delta >= 2 * PPM_PER_DOT) {
       amplitude = 1;
       lastPpmUpdate = millis();
       if (cyclicTimer->active()) cyclicTimer->detach(); // cyclicTimer could be active on DRIP, hence detach
       cyclicTimerMode = TIMER_WAVE;
-      cyclicTimer->attach_ms(WAVE_TIMER_INTERVAL, +[](NeopixelMatrix* instance) { instance->waveTimer(); }, this);
+      cyclicTimer->attach_ms(WAVE_TIMER_INTERVAL, outputTimer<NeopixelMatrix, &NeopixelMatrix::waveTimer>, this);
     } else {
       QueueMessage msg;
       msg.cmd = X_CMD_SHOW_PPM;
@@ -251,7 +270,7 @@ void NeopixelMatrix::update(uint16_t ppm) {
     }
     // turn on snake(s) if only 1 row or less is visible
     if (currentPpm > UPPER_LIMIT - (TANK_WIDTH * PPM_PER_DOT)) {
-      if (!snakeTicker->active()) snakeTicker->attach_ms(SNAKE_TICKER_INTERVAL, +[](NeopixelMatrix* instance) { instance->snakeTimer(); }, this);
+      if (!snakeTicker->active()) snakeTicker->attach_ms(SNAKE_TICKER_INTERVAL, outputTimer<NeopixelMatrix, &NeopixelMatrix::snakeTimer>, this);
     } else {
       if (snakeTicker->active()) snakeTicker->detach();
     }
@@ -264,7 +283,7 @@ void NeopixelMatrix::waveTimer() {
     cyclicTimerMode = TIMER_OFF;
     if (currentPpm > UPPER_LIMIT - (TANK_WIDTH * PPM_PER_DOT)) {
       // turn on snake(s) if only 1 row or less is visible
-      if (!snakeTicker->active()) snakeTicker->attach_ms(SNAKE_TICKER_INTERVAL, +[](NeopixelMatrix* instance) { instance->snakeTimer(); }, this);
+      if (!snakeTicker->active()) snakeTicker->attach_ms(SNAKE_TICKER_INTERVAL, outputTimer<NeopixelMatrix, &NeopixelMatrix::snakeTimer>, this);
       return;
     }
   }
@@ -349,7 +368,7 @@ void NeopixelMatrix::neopixelMatrixLoop(void* pvParameters) {
 
 
   uint32_t lastModeChange = millis();
-  while (1) {
+  while (!instance->stopRequested) {
     if (ENABLE_TEXT) {
       if (instance->displayMode == SHOW_TANK) {
         if (millis() - lastModeChange > TANK_INTERVAL) {
@@ -377,5 +396,6 @@ void NeopixelMatrix::neopixelMatrixLoop(void* pvParameters) {
     }
     vTaskDelay(pdMS_TO_TICKS(1));
   }
+  instance->displayTask = NULL;
   vTaskDelete(NULL);
 }
@@ -7,7 +7,14 @@
 #include <Ticker.h>
 
 #include <HTTPClient.h>
+#include <WiFiClientSecure.h>
 #include <Update.h>
+#include <blobUpload.h>
+#include <otaDecoder.h>
+#include <mbedtls/sha256.h>
+#include <mbedtls/pk.h>
+#include <rom/crc.h>
+#include <esp_system.h>
 
 // Local logging tag
 static const char TAG[] = __FILE__;
@@ -15,13 +22,16 @@ static const char TAG[] = __FILE__;
 namespace OTA {
 
   Ticker cyclicTimer;
+  Ticker startTimer;
   preUpdateCallback_t preUpdateCallback;
+  updateFailedCallback_t updateFailedCallback;
   setPriorityMessageCallback_t setPriorityMessageCallback;
   clearPriorityMessageCallback_t clearPriorityMessageCallback;
   String forceUpdateURL;
 
-  void setupOta(preUpdateCallback_t _preUpdateCallback, setPriorityMessageCallback_t _setPriorityMessageCallback, clearPriorityMessageCallback_t _clearPriorityMessageCallback) {
+  void setupOta(preUpdateCallback_t _preUpdateCallback, updateFailedCallback_t _updateFailedCallback, setPriorityMessageCallback_t _setPriorityMessageCallback, clearPriorityMessageCallback_t _clearPriorityMessageCallback) {
     preUpdateCallback = _preUpdateCallback;
+    updateFailedCallback = _updateFailedCallback;
     setPriorityMessageCallback = _setPriorityMessageCallback;
     clearPriorityMessageCallback = _clearPriorityMessageCallback;
 #ifdef OTA_POLL
@@ -33,21 +43,122 @@ namespace OTA {
   const uint32_t X_CMD_FORCE_UPDATE = bit(2);
   TaskHandle_t otaTask;
 
-  void checkForUpdate() {
+  // validators of the last manifest that didn't lead to an update, sent to let the host answer 304
+  String manifestETag;
+  String manifestLastModified;
+
+  void notifyCheckForUpdate() {
     xTaskNotify(otaTask, X_CMD_CHECK_FOR_UPDATE, eSetBits);
   }
 
+  // Waits a random time before contacting the OTA host so nodes told to update at the same time don't hit it at once.
+  void checkForUpdate() {
+    uint32_t startDelay = esp_random() % (OTA_MAX_START_DELAY + 1);
+    ESP_LOGI(TAG, "Checking for update in %u s", startDelay);
+    startTimer.once(startDelay, notifyCheckForUpdate);
+  }
+
+  // Stable per node, a release with rollout n goes to the nodes in buckets 0..n-1.
+  uint8_t getRolloutBucket() {
+    uint8_t mac[6];
+    esp_efuse_mac_get_default(mac);
+    return crc32_le(0, mac, sizeof(mac)) % 100;
+  }
+
+  boolean isNewerVersion(const char* version) {
+    unsigned int available[3] = {}, running[3] = {};
+    if (*version == 'v') version++;
+    const char* appVersion = APP_VERSION;
+    if (*appVersion == 'v') appVersion++;
+    if (sscanf(version, "%u.%u.%u", &available[0], &available[1], &available[2]) < 1) return false;
+    sscanf(appVersion, "%u.%u.%u", &running[0], &running[1], &running[2]);
+    for (uint8_t i = 0; i < 3; i++) {
+      if (available[i] != running[i]) return available[i] > running[i];
+    }
+    return false;
+  }
+
+  /**
+   * Fetches the manifest unless it hasn't changed since the last check and returns the firmware URL
+   * if there's a newer version that has been rolled out to this node's bucket.
+   */
+  boolean fetchManifest(String& firmwareUrl) {
+    WiFiClientSecure secureClient;
+    WiFiClient plainClient;
+    boolean useTls = strncmp(OTA_URL, "https", 5) == 0;
+    String rootCa;
+    if (useTls) {
+      File f = LittleFS.open(ROOT_CA_FILENAME, FILE_READ);
+      if (!f) {
+        ESP_LOGW(TAG, "No root CA for OTA host");
+        return false;
+      }
+      rootCa = f.readString();
+      f.close();
+      secureClient.setCACert(rootCa.c_str());
+    }
+    HTTPClient http;
+    const char* headers[] = { "ETag", "Last-Modified" };
+    http.setTimeout(OTA_HTTP_TIMEOUT);
+    // the manifest is parsed straight from the socket, HTTP/1.0 keeps the server from sending it chunked
+    http.useHTTP10(true);
+    if (!http.begin(useTls ? (WiFiClient&)secureClient : plainClient, OTA_URL)) return false;
+    http.collectHeaders(headers, 2);
+    if (manifestETag.length() > 0) http.addHeader("If-None-Match", manifestETag);
+    if (manifestLastModified.length() > 0) http.addHeader("If-Modified-Since", manifestLastModified);
+    int status = http.GET();
+    if (status == HTTP_CODE_NOT_MODIFIED) {
+      ESP_LOGI(TAG, "Manifest not modified");
+      http.end();
+      return false;
+    }
+    if (status != HTTP_CODE_OK) {
+      ESP_LOGW(TAG, "Manifest request failed: %d", status);
+      http.end();
+      return false;
+    }
+    String eTag = http.header("ETag");
+    String lastModified = http.header("Last-Modified");
+    StaticJsonDocument<512> doc;
+    DeserializationError error = deserializeJson(doc, http.getStream());
+    http.end();
+    if (error) {
+      ESP_LOGW(TAG, "Failed to parse manifest: %s", error.c_str());
+      return false;
+    }
+    boolean updateAvailable = false;
+    const char* version = doc["version"] | "";
+    uint8_t rollout = doc["rollout"] | 100;
+    uint8_t bucket = getRolloutBucket();
+    if (strcmp(doc["type"] | "", OTA_APP) != 0) {
+      ESP_LOGW(TAG, "Manifest is for %s", doc["type"] | "");
+    } else if (!isNewerVersion(version)) {
+      ESP_LOGI(TAG, "No newer firmware than %s", APP_VERSION);
+    } else if (bucket >= rollout) {
+      ESP_LOGI(TAG, "Firmware %s rolled out to %u%%, this node is in bucket %u", version, rollout, bucket);
+    } else if (doc.containsKey("url")) {
+      firmwareUrl = doc["url"].as<String>();
+      updateAvailable = true;
+    } else {
+      firmwareUrl = String(useTls ? "https://" : "http://") + (doc["host"] | "") + ":" + (doc["port"] | (useTls ? 443 : 80)) + (doc["bin"] | "");
+      updateAvailable = true;
+    }
+    // keep fetching a manifest that triggered an update, in case the update fails
+    manifestETag = updateAvailable ? "" : eTag;
+    manifestLastModified = updateAvailable ? "" : lastModified;
+    return updateAvailable;
+  }
+
   void checkForUpdateInternal() {
-    esp32FOTA esp32FOTA(OTA_APP, APP_VERSION, false, false);
-    esp32FOTA.setCertFileSystem(&LittleFS);
-    esp32FOTA.setManifestURL(OTA_URL);
-    bool shouldExecuteFirmwareUpdate = esp32FOTA.execHTTPcheck();
-    if (shouldExecuteFirmwareUpdate) {
+    String firmwareUrl;
+    if (fetchManifest(firmwareUrl)) {
       ESP_LOGD(TAG, "Firmware update available");
+      esp32FOTA esp32FOTA(OTA_APP, APP_VERSION, false, false);
+      esp32FOTA.setCertFileSystem(&LittleFS);
       if (preUpdateCallback) preUpdateCallback();
       setPriorityMessageCallback("Starting OTA update");
       mqtt::publishStatusMsg("Starting OTA update");
-      esp32FOTA.execOTA();
+      esp32FOTA.forceUpdate(firmwareUrl.c_str(), false);
       setPriorityMessageCallback("Rebooting");
       delay(1000);
       clearPriorityMessageCallback();
@@ -79,6 +190,210 @@ namespace OTA {
     esp_restart();
   }
 
+  // Firmware pushed over MQTT in chunks and written to the OTA partition as they arrive. An interrupted
+  // transfer resumes at the last acknowledged offset as long as the device hasn't rebooted.
+  // size, offset and hash refer to the transferred stream, which may be compressed or a delta.
+  struct MqttUpdate {
+    boolean active;
+    uint8_t encoding;
+    uint32_t size;
+    uint32_t offset;
+    uint8_t sha256[32];
+    uint8_t* signature;
+    size_t signatureLength;
+    mbedtls_sha256_context ctx;
+    OtaDecoder* decoder;
+  };
+
+  MqttUpdate mqttUpdate = {};
+
+  boolean parseHex(const char* hex, uint8_t* out, size_t length) {
+    if (strlen(hex) != 2 * length) return false;
+    for (size_t i = 0; i < length; i++) {
+      char byte[3] = { hex[2 * i], hex[2 * i + 1], 0x00 };
+      if (!isxdigit(byte[0]) || !isxdigit(byte[1])) return false;
+      out[i] = strtoul(byte, nullptr, 16);
+    }
+    return true;
+  }
+
+  boolean writeFirmware(const uint8_t* data, size_t length) {
+    if (Update.write((uint8_t*)data, length) == length) return true;
+    ESP_LOGW(TAG, "Update.write failed: %s", Update.errorString());
+    return false;
+  }
+
+  void releaseMqttUpdate() {
+    delete mqttUpdate.decoder;
+    mqttUpdate.decoder = nullptr;
+    free(mqttUpdate.signature);
+    mqttUpdate.signature = nullptr;
+  }
+
+  boolean beginMqttUpdate(uint32_t size, const char* sha256, const char* signature, uint8_t encoding) {
+    uint8_t hash[32];
+    if (!parseHex(sha256, hash, sizeof(hash))) {
+      ESP_LOGW(TAG, "Invalid SHA-256");
+      return false;
+    }
+    if (mqttUpdate.active && mqttUpdate.size == size && mqttUpdate.encoding == encoding && memcmp(mqttUpdate.sha256, hash, sizeof(hash)) == 0) {
+      ESP_LOGI(TAG, "Resuming OTA update at %u/%u", mqttUpdate.offset, size);
+      return true;
+    }
+    if (mqttUpdate.active) abortMqttUpdate();
+    if (Update.isRunning()) {
+      ESP_LOGW(TAG, "Another update is in progress");
+      return false;
+    }
+    size_t signatureLength = strlen(signature) / 2;
+    boolean signatureRequired = LittleFS.exists(OTA_PUBLIC_KEY_FILENAME);
+    if (signatureRequired && (signatureLength == 0 || signatureLength > OTA_MAX_SIGNATURE_LEN)) {
+      ESP_LOGW(TAG, "Valid signature required");
+      return false;
+    }
+    if (signatureRequired) {
+      mqttUpdate.signature = (uint8_t*)malloc(signatureLength);
+      if (!mqttUpdate.signature || !parseHex(signature, mqttUpdate.signature, signatureLength)) {
+        ESP_LOGW(TAG, "Invalid signature");
+        free(mqttUpdate.signature);
+        mqttUpdate.signature = nullptr;
+        return false;
+      }
+      mqttUpdate.signatureLength = signatureLength;
+    }
+    // the size of a decoded image isn't known up front, Update.end() validates it instead
+    mqttUpdate.decoder = new OtaDecoder(encoding, writeFirmware);
+    if (!mqttUpdate.decoder->begin()) {
+      releaseMqttUpdate();
+      return false;
+    }
+    if (!Update.begin(encoding == OTA_ENCODING_RAW ? size : UPDATE_SIZE_UNKNOWN, U_FLASH)) {
+      ESP_LOGW(TAG, "Update.begin failed: %s", Update.errorString());
+      releaseMqttUpdate();
+      return false;
+    }
+    mbedtls_sha256_init(&mqttUpdate.ctx);
+    mbedtls_sha256_starts_ret(&mqttUpdate.ctx, 0);
+    memcpy(mqttUpdate.sha256, hash, sizeof(hash));
+    mqttUpdate.encoding = encoding;
+    mqttUpdate.size = size;
+    mqttUpdate.offset = 0;
+    mqttUpdate.active = true;
+    ESP_LOGI(TAG, "OTA update over MQTT started (%u bytes, encoding %u)", size, encoding);
+    if (preUpdateCallback) preUpdateCallback();
+    setPriorityMessageCallback("Starting OTA update");
+    mqtt::publishStatusMsg("Starting OTA update over MQTT");
+    return true;
+  }
+
+  boolean writeMqttUpdate(const uint8_t* chunk, size_t length) {
+    uint32_t chunkOffset;
+    const uint8_t* data;
+    size_t dataLength;
+    if (!mqttUpdate.active || !BlobUpload::parseChunk(chunk, length, &chunkOffset, &data, &dataLength)) return false;
+    // already written, e.g. redelivered after a reconnect
+    if (chunkOffset + dataLength <= mqttUpdate.offset) return true;
+    if (chunkOffset > mqttUpdate.offset) {
+      ESP_LOGW(TAG, "Chunk at %u, expected %u", chunkOffset, mqttUpdate.offset);
+      return false;
+    }
+    data += mqttUpdate.offset - chunkOffset;
+    dataLength -= mqttUpdate.offset - chunkOffset;
+    if (mqttUpdate.offset + dataLength > mqttUpdate.size) {
+      ESP_LOGW(TAG, "Chunk exceeds firmware size");
+      return false;
+    }
+    mbedtls_sha256_update_ret(&mqttUpdate.ctx, data, dataLength);
+    if (!mqttUpdate.decoder->write(data, dataLength)) {
+      abortMqttUpdate();
+      return false;
+    }
+    mqttUpdate.offset += dataLength;
+    return true;
+  }
+
+  boolean verifySignature(const uint8_t* hash) {
+    File f = LittleFS.open(OTA_PUBLIC_KEY_FILENAME, FILE_READ);
+    if (!f) return false;
+    size_t keyLength = f.size();
+    uint8_t* key = (uint8_t*)malloc(keyLength + 1);
+    if (!key) {
+      f.close();
+      return false;
+    }
+    f.read(key, keyLength);
+    f.close();
+    key[keyLength] = 0x00;  // mbedtls expects PEM to be null terminated and counted
+    mbedtls_pk_context pk;
+    mbedtls_pk_init(&pk);
+    int ret = mbedtls_pk_parse_public_key(&pk, key, keyLength + 1);
+    free(key);
+    if (ret == 0) ret = mbedtls_pk_verify(&pk, MBEDTLS_MD_SHA256, hash, 32, mqttUpdate.signature, mqttUpdate.signatureLength);
+    mbedtls_pk_free(&pk);
+    if (ret != 0) ESP_LOGW(TAG, "Signature verification failed: -0x%04x", -ret);
+    return ret == 0;
+  }
+
+  // Verifies hash and signature of the received firmware and only then switches the boot partition.
+  boolean endMqttUpdate() {
+    if (!mqttUpdate.active || mqttUpdate.offset != mqttUpdate.size) {
+      ESP_LOGW(TAG, "OTA update incomplete (%u/%u)", mqttUpdate.offset, mqttUpdate.size);
+      return false;
+    }
+    uint8_t hash[32];
+    mbedtls_sha256_finish_ret(&mqttUpdate.ctx, hash);
+    boolean verified = memcmp(hash, mqttUpdate.sha256, sizeof(hash)) == 0;
+    if (!verified) ESP_LOGW(TAG, "Firmware SHA-256 mismatch");
+    if (verified && mqttUpdate.signature) verified = verifySignature(hash);
+    if (!verified) {
+      mqtt::publishStatusMsg("OTA update verification failed");
+      abortMqttUpdate();
+      return false;
+    }
+    if (!mqttUpdate.decoder->end()) {
+      mqtt::publishStatusMsg("OTA update decoding failed");
+      abortMqttUpdate();
+      return false;
+    }
+    ESP_LOGI(TAG, "Firmware image %u bytes", mqttUpdate.decoder->getOutputSize());
+    if (!Update.end(mqttUpdate.encoding != OTA_ENCODING_RAW)) {
+      ESP_LOGW(TAG, "Update.end failed: %s", Update.errorString());
+      abortMqttUpdate();
+      return false;
+    }
+    mbedtls_sha256_free(&mqttUpdate.ctx);
+    releaseMqttUpdate();
+    mqttUpdate.active = false;
+    ESP_LOGI(TAG, "OTA update over MQTT done");
+    mqtt::publishStatusMsg("OTA update done - rebooting shortly");
+    setPriorityMessageCallback("Rebooting");
+    delay(2000);
+    clearPriorityMessageCallback();
+    esp_restart();
+    return true;
+  }
+
+  void abortMqttUpdate() {
+    if (!mqttUpdate.active) return;
+    Update.abort();
+    mbedtls_sha256_free(&mqttUpdate.ctx);
+    releaseMqttUpdate();
+    mqttUpdate.active = false;
+    mqttUpdate.offset = 0;
+    clearPriorityMessageCallback();
+    // an active update always went through preUpdateCallback
+    if (updateFailedCallback) updateFailedCallback();
+    ESP_LOGI(TAG, "OTA update over MQTT aborted");
+  }
+
+  uint32_t getMqttUpdateOffset() {
+    return mqttUpdate.offset;
+  }
+
+  uint32_t getMqttUpdateSize() {
+    return mqttUpdate.size;
+  }
+
   void otaLoop(void* pvParameters) {
     _ASSERT((uint32_t)pvParameters == 1);
     uint32_t taskNotification;
@@ -0,0 +1,223 @@
+#include <otaDecoder.h>
+#include <esp_ota_ops.h>
+#include <mbedtls/sha256.h>
+#include "rom/miniz.h"
+
+// Local logging tag
+static const char TAG[] = __FILE__;
+
+#define DELTA_HEADER  0
+#define DELTA_OP      1
+#define DELTA_ARGS    2
+#define DELTA_INSERT  3
+#define DELTA_DONE    4
+
+#define DELTA_OP_COPY    'C'
+#define DELTA_OP_INSERT  'I'
+#define DELTA_OP_END     'E'
+
+static uint32_t readUint32(const uint8_t* buf) {
+  return ((uint32_t)buf[0] << 24) | ((uint32_t)buf[1] << 16) | ((uint32_t)buf[2] << 8) | buf[3];
+}
+
+OtaDecoder::OtaDecoder(uint8_t _encoding, otaWriteCallback_t _writeCallback) {
+  this->encoding = _encoding;
+  this->writeCallback = _writeCallback;
+  this->outputSize = 0;
+  this->inflator = nullptr;
+  this->dictionary = nullptr;
+  this->dictionaryOffset = 0;
+  this->inflateDone = false;
+  this->source = nullptr;
+  this->sourceSize = 0;
+  this->copyBuffer = nullptr;
+  this->deltaStage = DELTA_HEADER;
+  this->headerLength = 0;
+  this->op = 0;
+  this->argsLength = 0;
+  this->insertRemaining = 0;
+}
+
+OtaDecoder::~OtaDecoder() {
+  if (this->inflator) free(inflator);
+  if (this->dictionary) free(dictionary);
+  if (this->copyBuffer) free(copyBuffer);
+}
+
+boolean OtaDecoder::begin() {
+  if (encoding == OTA_ENCODING_RAW) return true;
+  inflator = (tinfl_decompressor*)malloc(sizeof(tinfl_decompressor));
+  dictionary = (uint8_t*)malloc(TINFL_LZ_DICT_SIZE);
+  if (!inflator || !dictionary) {
+    ESP_LOGW(TAG, "Not enough heap to inflate");
+    return false;
+  }
+  tinfl_init(inflator);
+  if (encoding == OTA_ENCODING_DELTA) {
+    source = esp_ota_get_running_partition();
+    copyBuffer = (uint8_t*)malloc(OTA_COPY_BUFFER_SIZE);
+    if (!source || !copyBuffer) {
+      ESP_LOGW(TAG, "Can't read running partition");
+      return false;
+    }
+  }
+  return true;
+}
+
+boolean OtaDecoder::write(const uint8_t* data, size_t length) {
+  if (encoding == OTA_ENCODING_RAW) return output(data, length);
+  return inflate(data, length);
+}
+
+// Returns true if the whole stream has been decoded.
+boolean OtaDecoder::end() {
+  if (encoding == OTA_ENCODING_RAW) return true;
+  if (!inflateDone) ESP_LOGW(TAG, "Compressed stream incomplete");
+  if (encoding == OTA_ENCODING_DELTA && deltaStage != DELTA_DONE) ESP_LOGW(TAG, "Delta incomplete");
+  return inflateDone && (encoding != OTA_ENCODING_DELTA || deltaStage == DELTA_DONE);
+}
+
+uint32_t OtaDecoder::getOutputSize() {
+  return this->outputSize;
+}
+
+/**
+ * Inflates into the 32KB dictionary, which doubles as the output window: whatever tinfl produced is
+ * passed on before the window wraps around and gets overwritten.
+ */
+boolean OtaDecoder::inflate(const uint8_t* data, size_t length) {
+  tinfl_status status;
+  do {
+    if (inflateDone) {
+      if (length > 0) ESP_LOGW(TAG, "Trailing data after compressed stream");
+      return length == 0;
+    }
+    size_t inBytes = length;
+    size_t outBytes = TINFL_LZ_DICT_SIZE - dictionaryOffset;
+    status = tinfl_decompress(inflator, data, &inBytes, dictionary, dictionary + dictionaryOffset, &outBytes,
+      TINFL_FLAG_PARSE_ZLIB_HEADER | TINFL_FLAG_HAS_MORE_INPUT);
+    data += inBytes;
+    length -= inBytes;
+    if (outBytes > 0) {
+      const uint8_t* out = dictionary + dictionaryOffset;
+      if (!(encoding == OTA_ENCODING_DELTA ? applyDelta(out, outBytes) : output(out, outBytes))) return false;
+      dictionaryOffset = (dictionaryOffset + outBytes) & (TINFL_LZ_DICT_SIZE - 1);
+    }
+    if (status < TINFL_STATUS_DONE) {
+      ESP_LOGW(TAG, "Inflate failed: %d", status);
+      return false;
+    }
+    if (status == TINFL_STATUS_DONE) inflateDone = true;
+  } while (length > 0 || status == TINFL_STATUS_HAS_MORE_OUTPUT);
+  return true;
+}
+
+boolean OtaDecoder::applyDelta(const uint8_t* data, size_t length) {
+  while (length > 0) {
+    size_t n;
+    switch (deltaStage) {
+    case DELTA_HEADER:
+      n = min(length, (size_t)(OTA_DELTA_HEADER_SIZE - headerLength));
+      memcpy(header + headerLength, data, n);
+      headerLength += n;
+      data += n;
+      length -= n;
+      if (headerLength == OTA_DELTA_HEADER_SIZE) {
+        if (!verifySource()) return false;
+        deltaStage = DELTA_OP;
+      }
+      break;
+    case DELTA_OP:
+      op = *data++;
+      length--;
+      argsLength = 0;
+      if (op == DELTA_OP_COPY || op == DELTA_OP_INSERT) {
+        deltaStage = DELTA_ARGS;
+      } else if (op == DELTA_OP_END) {
+        deltaStage = DELTA_DONE;
+      } else {
+        ESP_LOGW(TAG, "Unknown delta operation 0x%02x", op);
+        return false;
+      }
+      break;
+    case DELTA_ARGS:
+      n = min(length, (size_t)((op == DELTA_OP_COPY ? 8 : 4) - argsLength));
+      memcpy(args + argsLength, data, n);
+      argsLength += n;
+      data += n;
+      length -= n;
+      if (op == DELTA_OP_COPY && argsLength == 8) {
+        if (!copyFromSource(readUint32(args), readUint32(args + 4))) return false;
+        deltaStage = DELTA_OP;
+      } else if (op == DELTA_OP_INSERT && argsLength == 4) {
+        insertRemaining = readUint32(args);
+        deltaStage = insertRemaining > 0 ? DELTA_INSERT : DELTA_OP;
+      }
+      break;
+    case DELTA_INSERT:
+      n = min(length, (size_t)insertRemaining);
+      if (!output(data, n)) return false;
+      insertRemaining -= n;
+      data += n;
+      length -= n;
+      if (insertRemaining == 0) deltaStage = DELTA_OP;
+      break;
+    default:
+      ESP_LOGW(TAG, "Trailing data after delta");
+      return false;
+    }
+  }
+  return true;
+}
+
+// Makes sure the delta was made against the firmware we're running.
+boolean OtaDecoder::verifySource() {
+  if (memcmp(header, OTA_DELTA_MAGIC, 4) != 0 || header[4] != OTA_DELTA_VERSION) {
+    ESP_LOGW(TAG, "Not a delta of a supported version");
+    return false;
+  }
+  sourceSize = readUint32(header + 5);
+  if (sourceSize > source->size) {
+    ESP_LOGW(TAG, "Delta source larger than running partition");
+    return false;
+  }
+  uint8_t hash[32];
+  mbedtls_sha256_context ctx;
+  mbedtls_sha256_init(&ctx);
+  mbedtls_sha256_starts_ret(&ctx, 0);
+  for (uint32_t offset = 0; offset < sourceSize; offset += OTA_COPY_BUFFER_SIZE) {
+    size_t n = min((uint32_t)OTA_COPY_BUFFER_SIZE, sourceSize - offset);
+    if (esp_partition_read(source, offset, copyBuffer, n) != ESP_OK) {
+      mbedtls_sha256_free(&ctx);
+      return false;
+    }
+    mbedtls_sha256_update_ret(&ctx, copyBuffer, n);
+  }
+  mbedtls_sha256_finish_ret(&ctx, hash);
+  mbedtls_sha256_free(&ctx);
+  if (memcmp(hash, header + 9, sizeof(hash)) != 0) {
+    ESP_LOGW(TAG, "Delta was made against a different firmware");
+    return false;
+  }
+  return true;
+}
+
+boolean OtaDecoder::copyFromSource(uint32_t offset, uint32_t length) {
+  if (offset > sourceSize || length > sourceSize - offset) {
+    ESP_LOGW(TAG, "Delta copy beyond source firmware");
+    return false;
+  }
+  while (length > 0) {
+    size_t n = min((uint32_t)OTA_COPY_BUFFER_SIZE, length);
+    if (esp_partition_read(source, offset, copyBuffer, n) != ESP_OK || !output(copyBuffer, n)) return false;
+    offset += n;
+    length -= n;
+  }
+  return true;
+}
+
+boolean OtaDecoder::output(const uint8_t* data, size_t length) {
+  if (!writeCallback(data, length)) return false;
+  outputSize += length;
+  return true;
+}
@@ -96,7 +96,13 @@ boolean SCD30::readScd30() {
 #ifdef SHOW_DEBUG_MSGS
     updateMessageCallback("");
 #endif
-    model->updateModel(scd30->CO2, scd30->temperature, scd30->relative_humidity);
+    if (scd30->CO2 >= 1) Cadence::addReading(SOURCE_SCD30, MEASUREMENT_CO2, scd30->CO2);
+    ModelSnapshot values;
+    // 0 means no reading, it mustn't end up in the filter state
+    values.co2 = scd30->CO2 >= 1 ? (uint16_t)(co2Filter.apply(scd30->CO2) + 0.5f) : 0;
+    values.temperature = temperatureFilter.apply(scd30->temperature);
+    values.humidity = humidityFilter.apply(scd30->relative_humidity);
+    model->updateModel(SOURCE_SCD30, values, M_CO2 | M_TEMPERATURE | M_HUMIDITY);
     return true;
   } else {
 #ifdef SHOW_DEBUG_MSGS
@@ -27,6 +27,7 @@ boolean SCD40::checkError(uint16_t error, char const* msg) {
 SCD40::SCD40(TwoWire* wire, Model* _model, updateMessageCallback_t _updateMessageCallback) {
   this->model = _model;
   this->updateMessageCallback = _updateMessageCallback;
+  this->wire = wire;
   this->scd40 = new SensirionI2CScd4x();
   ESP_LOGD(TAG, "Initialising SCD40");
 
@@ -78,7 +79,7 @@ SCD40::SCD40(TwoWire* wire, Model* _model, updateMessageCallback_t _updateMessag
   }
 
   // Start Measurement
-  checkError(scd40->startPeriodicMeasurement(), "startPeriodicMeasurement");
+  checkError(startMeasurement(), "startMeasurement");
   I2C::giveMutex();
   ESP_LOGD(TAG, "SCD40 initialised");
 }
@@ -88,7 +89,60 @@ SCD40::~SCD40() {
 }
 
 uint32_t SCD40::getInterval() {
-  return 5;
+  switch (mode) {
+    case SCD4X_LOW_POWER: return 30;
+    case SCD4X_SINGLE_SHOT: return singleShotPending ? 5 : SCD4X_SINGLE_SHOT_INTERVAL;
+    default: return 5;
+  }
+}
+
+// Starts the periodic measurement of the current mode, or nothing for single shots. Call with the I2C mutex taken.
+uint16_t SCD40::startMeasurement() {
+  singleShotPending = false;
+  switch (mode) {
+    case SCD4X_LOW_POWER: return scd40->startLowPowerPeriodicMeasurement();
+    case SCD4X_SINGLE_SHOT: return 0;
+    default: return scd40->startPeriodicMeasurement();
+  }
+}
+
+// Switches to the mode of the current cadence level, only called by readScd40() so getInterval() changes with a reading
+void SCD40::applyCadence() {
+  Scd4xMode wanted;
+  switch (Cadence::getLevel()) {
+    case Cadence::CADENCE_FAST: wanted = SCD4X_PERIODIC; break;
+    case Cadence::CADENCE_NORMAL: wanted = SCD4X_LOW_POWER; break;
+    default: wanted = singleShotSupported ? SCD4X_SINGLE_SHOT : SCD4X_LOW_POWER; break;
+  }
+  if (wanted == mode) return;
+  if (!I2C::takeMutex(I2C_MUTEX_DEF_WAIT)) return;
+  if (checkError(scd40->stopPeriodicMeasurement(), "stopPeriodicMeasurement")) {
+    vTaskDelay(pdMS_TO_TICKS(500));
+    ESP_LOGI(TAG, "Measurement mode %u -> %u", mode, wanted);
+    mode = wanted;
+    checkError(startMeasurement(), "startMeasurement");
+  }
+  I2C::giveMutex();
+}
+
+// measureSingleShot() of the library blocks for the 5 s the measurement takes, so only the command is sent
+// here and readScd40() picks up the result once it's ready. The SCD40 doesn't acknowledge the command.
+boolean SCD40::triggerSingleShot() {
+  if (!I2C::takeMutex(I2C_MUTEX_DEF_WAIT)) return false;
+  uint8_t buffer[2];
+  SensirionI2CTxFrame txFrame(buffer, 2);
+  uint16_t error = txFrame.addCommand(0x219D);
+  if (!error) error = SensirionI2CCommunication::sendFrame(SCD4X_I2C_ADDRESS, txFrame, *wire);
+  if (error) {
+    ESP_LOGI(TAG, "No single shot measurement, staying in low power mode");
+    singleShotSupported = false;
+    mode = SCD4X_LOW_POWER;
+    checkError(startMeasurement(), "startMeasurement");
+  } else {
+    singleShotPending = true;
+  }
+  I2C::giveMutex();
+  return singleShotPending;
 }
 
 boolean SCD40::readScd40() {
@@ -96,6 +150,12 @@ boolean SCD40::readScd40() {
   this->updateMessageCallback("readScd40");
 #endif
 
+  applyCadence();
+  if (mode == SCD4X_SINGLE_SHOT && !singleShotPending) {
+    triggerSingleShot();
+    return false;
+  }
+
   // check if data is ready
   uint16_t dataReady;
   if (!I2C::takeMutex(I2C_MUTEX_DEF_WAIT)) return false;
@@ -117,6 +177,7 @@ boolean SCD40::readScd40() {
   success = checkError(scd40->readMeasurement(co2, temperature, humidity), "readMeasurement");
   I2C::giveMutex();
   if (!success) return false;
+  singleShotPending = false;
   ESP_LOGD(TAG, "Temp: %.1fC, rH: %.1f%%, CO2:  %uppm", temperature, humidity, co2);
 #ifdef SHOW_DEBUG_MSGS
   this->updateMessageCallback("");
@@ -127,7 +188,12 @@ boolean SCD40::readScd40() {
     this->updateMessageCallback("Invalid sample");
 #endif
   } else {
-    model->updateModel(co2, temperature, humidity);
+    Cadence::addReading(SOURCE_SCD40, MEASUREMENT_CO2, co2);
+    ModelSnapshot values;
+    values.co2 = (uint16_t)(co2Filter.apply(co2) + 0.5f);
+    values.temperature = temperatureFilter.apply(temperature);
+    values.humidity = humidityFilter.apply(humidity);
+    model->updateModel(SOURCE_SCD40, values, M_CO2 | M_TEMPERATURE | M_HUMIDITY);
     return true;
   }
   return false;
@@ -150,7 +216,7 @@ boolean SCD40::calibrateScd40ToReference(uint16_t co2Reference) {
     return false;
   }
   ESP_LOGD(TAG, "co2Reference: %u, frcCorrection %u", co2Reference, frcCorrection);
-  success = checkError(scd40->startPeriodicMeasurement(), "startPeriodicMeasurement");
+  success = checkError(startMeasurement(), "startMeasurement");
   I2C::giveMutex();
   return success;
 }
@@ -172,7 +238,7 @@ float SCD40::getTemperatureOffset() {
     return false;
   }
   ESP_LOGD(TAG, "getTemperatureOffset: %.1f", temperatureOffset);
-  success = checkError(scd40->startPeriodicMeasurement(), "startPeriodicMeasurement");
+  success = checkError(startMeasurement(), "startMeasurement");
   I2C::giveMutex();
   return temperatureOffset;
 }
@@ -200,7 +266,7 @@ boolean SCD40::setTemperatureOffset(float temperatureOffset) {
     }
   }
   ESP_LOGD(TAG, "setTemperatureOffset: %.1f", temperatureOffset);
-  success = checkError(scd40->startPeriodicMeasurement(), "startPeriodicMeasurement");
+  success = checkError(startMeasurement(), "startMeasurement");
   I2C::giveMutex();
   return success;
 }
@@ -71,7 +71,7 @@ SPS_30::~SPS_30() {
 }
 
 uint32_t SPS_30::getInterval() {
-  return 60;
+  return interval;
 }
 
 boolean SPS_30::readSps30() {
@@ -79,6 +79,12 @@ boolean SPS_30::readSps30() {
 #ifdef SHOW_DEBUG_MSGS
   this->updateMessageCallback("readSps30");
 #endif
+  // the fan and laser only run for the reading, so stable air saves most of their wear
+  switch (Cadence::getLevel()) {
+    case Cadence::CADENCE_FAST: interval = SPS30_INTERVAL_FAST; break;
+    case Cadence::CADENCE_NORMAL: interval = SPS30_INTERVAL_NORMAL; break;
+    default: interval = SPS30_INTERVAL_SLOW; break;
+  }
   struct sps_values values;
 
   if (!I2C::takeMutex(I2C_MUTEX_DEF_WAIT)) return false;
@@ -116,7 +122,20 @@ boolean SPS_30::readSps30() {
   if (result == SPS30_ERR_OK) {
     ESP_LOGD(TAG, "SPS30 MassPM1:%.1f, MassPM2:%.1f, MassPM4:%.1f, MassPM10:%.1f, NumPM0:%.1f, NumPM1:%.1f, NumPM2:%.1f, NumPM4:%.1f, NumPM10:%.1f, PartSize:%.1f",
       values.MassPM1, values.MassPM2, values.MassPM4, values.MassPM10, values.NumPM0, values.NumPM1, values.NumPM2, values.NumPM4, values.NumPM10, values.PartSize);
-    model->updateModel((uint16_t)(values.NumPM0 + 0.5f), (uint16_t)(values.NumPM1 + 0.5f), (uint16_t)(values.NumPM2 + 0.5f), (uint16_t)(values.NumPM4 + 0.5f), (uint16_t)(values.NumPM10 + 0.5f));
+    Cadence::addReading(SOURCE_SPS30, MEASUREMENT_MASS_PM2_5, values.MassPM2);
+    ModelSnapshot modelValues;
+    modelValues.pm0_5 = (uint16_t)(countFilters[0].apply(values.NumPM0) + 0.5f);
+    modelValues.pm1 = (uint16_t)(countFilters[1].apply(values.NumPM1) + 0.5f);
+    modelValues.pm2_5 = (uint16_t)(countFilters[2].apply(values.NumPM2) + 0.5f);
+    modelValues.pm4 = (uint16_t)(countFilters[3].apply(values.NumPM4) + 0.5f);
+    modelValues.pm10 = (uint16_t)(countFilters[4].apply(values.NumPM10) + 0.5f);
+    modelValues.massPm1 = massFilters[0].apply(values.MassPM1);
+    modelValues.massPm2_5 = massFilters[1].apply(values.MassPM2);
+    modelValues.massPm4 = massFilters[2].apply(values.MassPM4);
+    modelValues.massPm10 = massFilters[3].apply(values.MassPM10);
+    modelValues.particleSize = sizeFilter.apply(values.PartSize);
+    model->updateModel(SOURCE_SPS30, modelValues, M_PM0_5 | M_PM1_0 | M_PM2_5 | M_PM4 | M_PM10
+      | M_MASS_PM1_0 | M_MASS_PM2_5 | M_MASS_PM4 | M_MASS_PM10 | M_PARTICLE_SIZE);
   }
   //  ESP_LOGD(TAG, "Sps30 done");
   return (result == SPS30_ERR_OK);
@@ -0,0 +1,72 @@
+#include <telemetry.h>
+#include <config.h>
+
+// Local logging tag
+static const char TAG[] = __FILE__;
+
+namespace Telemetry {
+  // value and time of the last publish of every measurement, NaN if it hasn't been published yet
+  float lastValues[MEASUREMENT_COUNT] = {};
+  uint32_t lastTimes[MEASUREMENT_COUNT] = {};
+  MeasurementMask lastDrifting = M_NONE;
+  volatile boolean initialised = false;
+
+  TelemetryStats stats = {};
+  portMUX_TYPE statsMux = portMUX_INITIALIZER_UNLOCKED;
+
+  MeasurementMask select(const ModelSnapshot& snapshot, MeasurementMask mask) {
+    if (!initialised) {
+      initialised = true;
+      for (uint8_t i = 0; i < MEASUREMENT_COUNT; i++) lastValues[i] = NaN;
+      lastDrifting = M_NONE;
+    }
+    uint32_t now = millis();
+    MeasurementMask selected = M_NONE;
+    uint8_t candidates = 0;
+    for (uint8_t i = 0; i < MEASUREMENT_COUNT; i++) {
+      MeasurementMask bit = 1ul << i;
+      const MeasurementDescriptor& measurement = measurementDescriptors[i];
+      if (!(mask & bit) || !measurement.hasValue(snapshot)) continue;
+      candidates++;
+      float value = measurement.getValue(snapshot);
+      float deadband = max(measurement.delta, fabsf(lastValues[i]) * measurement.deltaPercent / 100);
+      if (isnan(lastValues[i]) || fabsf(value - lastValues[i]) >= deadband
+        || now - lastTimes[i] >= TELEMETRY_HEARTBEAT || ((snapshot.drifting ^ lastDrifting) & bit)) {
+        selected |= bit;
+        lastValues[i] = value;
+        lastTimes[i] = now;
+      }
+    }
+    lastDrifting = (lastDrifting & ~selected) | (snapshot.drifting & selected);
+
+    uint8_t count = __builtin_popcount(selected);
+    portENTER_CRITICAL(&statsMux);
+    if (selected != M_NONE) {
+      stats.sent++;
+    } else {
+      stats.suppressed++;
+    }
+    stats.valuesSent += count;
+    stats.valuesSuppressed += candidates - count;
+    portEXIT_CRITICAL(&statsMux);
+    return selected;
+  }
+
+  // Called from the MQTT task, the state itself is only touched by select()
+  void invalidate() {
+    initialised = false;
+  }
+
+  TelemetryStats getStats() {
+    portENTER_CRITICAL(&statsMux);
+    TelemetryStats copy = stats;
+    portEXIT_CRITICAL(&statsMux);
+    return copy;
+  }
+
+  void logStats() {
+    TelemetryStats copy = getStats();
+    ESP_LOGI(TAG, "Sensor messages sent %u, suppressed %u | values sent %u, suppressed %u",
+      copy.sent, copy.suppressed, copy.valuesSent, copy.valuesSuppressed);
+  }
+}
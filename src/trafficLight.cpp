@@ -12,7 +12,7 @@ TrafficLight::TrafficLight(Model* _model, uint8_t _pinRed, uint8_t _pinYellow, u
   //  this);
 
   // https://stackoverflow.com/questions/60985496/arduino-esp8266-esp32-ticker-callback-class-member-function
-  cyclicTimer->attach(0.3, +[](TrafficLight* instance) { instance->timer(); }, this);
+  cyclicTimer->attach(0.3, outputTimer<TrafficLight, &TrafficLight::timer>, this);
 
 
   /*
@@ -33,27 +33,35 @@ TrafficLight::TrafficLight(Model* _model, uint8_t _pinRed, uint8_t _pinYellow, u
   pinMode(pinGreen, OUTPUT);
   ledcSetup(PWM_CHANNEL_LEDS, PWM_FREQ_LEDS, PWM_RESOLUTION_LEDS);
   ledcWrite(PWM_CHANNEL_LEDS, 0);
+}
 
-  ledcAttachPin(pinRed, PWM_CHANNEL_LEDS);
-  ledcWrite(PWM_CHANNEL_LEDS, config.brightness);
-  delay(500);
-  ledcDetachPin(pinRed);
-  ledcAttachPin(pinYellow, PWM_CHANNEL_LEDS);
-  ledcWrite(PWM_CHANNEL_LEDS, config.brightness);
-  delay(500);
-  ledcDetachPin(pinYellow);
-  ledcAttachPin(pinGreen, PWM_CHANNEL_LEDS);
-  ledcWrite(PWM_CHANNEL_LEDS, config.brightness);
-  delay(500);
+// Stops blinking and releases the pins, so they can be reused by another output.
+TrafficLight::~TrafficLight() {
+  if (this->cyclicTimer) delete cyclicTimer;
   ledcDetachPin(pinGreen);
+  ledcDetachPin(pinYellow);
+  ledcDetachPin(pinRed);
   ledcWrite(PWM_CHANNEL_LEDS, 0);
+  digitalWrite(pinGreen, LOW);
+  digitalWrite(pinYellow, LOW);
+  digitalWrite(pinRed, LOW);
 }
 
-TrafficLight::~TrafficLight() {
-  if (this->cyclicTimer) delete cyclicTimer;
+// Lights the red, yellow and green LED for steps 0 to 2, step SELF_TEST_STEPS turns them off again.
+void TrafficLight::selfTest(uint8_t step) {
+  const uint8_t pins[SELF_TEST_STEPS] = { pinRed, pinYellow, pinGreen };
+  ledcDetachPin(pinGreen);
+  ledcDetachPin(pinYellow);
+  ledcDetachPin(pinRed);
+  if (step < SELF_TEST_STEPS) {
+    ledcAttachPin(pins[step], PWM_CHANNEL_LEDS);
+    ledcWrite(PWM_CHANNEL_LEDS, config.brightness);
+  } else {
+    ledcWrite(PWM_CHANNEL_LEDS, 0);
+  }
 }
 
-void TrafficLight::update(uint16_t mask, TrafficLightStatus oldStatus, TrafficLightStatus newStatus) {
+void TrafficLight::update(MeasurementMask mask, TrafficLightStatus oldStatus, TrafficLightStatus newStatus) {
   if (oldStatus == newStatus && !(mask & M_CONFIG_CHANGED)) return;
   if (newStatus == OFF) {
     ledcDetachPin(pinGreen);
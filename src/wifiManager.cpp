@@ -40,7 +40,6 @@ namespace WifiManager {
 
   const uint8_t X_CMD_CONNECT = bit(0);
   const uint8_t X_CMD_SAVE_CONFIG = bit(1);
-  const uint8_t X_CMD_SAVE_CONFIG_AND_REBOOT = bit(2);
   const uint8_t X_CMD_WIFI_SCAN_DONE = bit(3);
 
   bool keepCaptivePortalActive;
@@ -118,7 +117,7 @@ namespace WifiManager {
     return (String(appName) + "-" + getMac());
   }
 
-  std::vector<ConfigParameterBase<Config>*> configParameterVector;
+  ConfigParameterTable configParameters;
 
   updateMessageCallback_t updateMessageCallback;
   setPriorityMessageCallback_t setPriorityMessageCallback;
@@ -159,11 +158,11 @@ namespace WifiManager {
     };
   */
 
-  void setupWifiManager(const char* _appName, std::vector<ConfigParameterBase<Config>*> _configParameterVector, bool _keepCaptivePortalActive, bool _captivePortalActiveWhenNotConnected,
+  void setupWifiManager(const char* _appName, ConfigParameterTable _configParameters, bool _keepCaptivePortalActive, bool _captivePortalActiveWhenNotConnected,
     updateMessageCallback_t _updateMessageCallback, setPriorityMessageCallback_t _setPriorityMessageCallback, clearPriorityMessageCallback_t _clearPriorityMessageCallback,
     configChangedCallback_t _configChangedCallback) {
     appName = _appName;
-    configParameterVector = _configParameterVector;
+    configParameters = _configParameters;
     keepCaptivePortalActive = _keepCaptivePortalActive;
     captivePortalActiveWhenNotConnected = _captivePortalActiveWhenNotConnected;
     updateMessageCallback = _updateMessageCallback;
@@ -265,33 +264,33 @@ namespace WifiManager {
     if (!authenticate(request)) return;
     String page = FPSTR(html::config_header);
     char buf[8];
-    for (ConfigParameterBase<Config>* configParameter : configParameterVector) {
+    for (const ConfigParameter& configParameter : configParameters) {
       String parameterHtml;
-      if (configParameter->isNumber()) {
+      if (configParameter.isNumber()) {
         parameterHtml = FPSTR(html::config_parameter_number);
-        configParameter->getMinimum(buf);
+        configParameter.getMinimum(buf);
         parameterHtml.replace("{mi}", buf);
-        configParameter->getMaximum(buf);
+        configParameter.getMaximum(buf);
         parameterHtml.replace("{ma}", buf);
-        char defaultValue[configParameter->getMaxStrLen()];
-        configParameter->print(config, defaultValue);
+        char defaultValue[configParameter.getMaxStrLen()];
+        configParameter.print(config, defaultValue);
         parameterHtml.replace("{v}", defaultValue);
-      } else if (configParameter->isBoolean()) {
+      } else if (configParameter.isBoolean()) {
         parameterHtml = FPSTR(html::config_parameter_checkbox);
-        configParameter->print(config, buf);
+        configParameter.print(config, buf);
         snprintf(buf, 8, "%s", strncmp(buf, "true", strlen(buf)) == 0 ? "checked" : "");
         parameterHtml.replace("{v}", buf);
-      } else if (configParameter->isEnum()) {
+      } else if (configParameter.isEnum()) {
         parameterHtml = FPSTR(html::config_parameter_select_start);
-        configParameter->getMinimum(buf);
+        configParameter.getMinimum(buf);
         uint16_t min = atoi(buf);
-        configParameter->getMaximum(buf);
+        configParameter.getMaximum(buf);
         uint16_t max = atoi(buf);
         for (uint16_t i = min; i <= max; i++) {
           parameterHtml += FPSTR(html::config_parameter_select_option);
           parameterHtml.replace("{v}", String(i).c_str());
-          parameterHtml.replace("{lbl}", configParameter->getEnumLabels()[i]);
-          if (i == configParameter->getValueOrdinal(config)) {
+          parameterHtml.replace("{lbl}", configParameter.getEnumLabels()[i]);
+          if (i == configParameter.getValueOrdinal(config)) {
             parameterHtml.replace("{s}", "selected");
           } else {
             parameterHtml.replace("{s}", "");
@@ -300,14 +299,14 @@ namespace WifiManager {
         parameterHtml += FPSTR(html::config_parameter_select_end);
       } else {
         parameterHtml = FPSTR(html::config_parameter);
-        char defaultValue[configParameter->getMaxStrLen()];
-        configParameter->print(config, defaultValue);
+        char defaultValue[configParameter.getMaxStrLen()];
+        configParameter.print(config, defaultValue);
         parameterHtml.replace("{v}", defaultValue);
       }
-      parameterHtml.replace("{i}", configParameter->getId());
-      parameterHtml.replace("{n}", configParameter->getId());
-      parameterHtml.replace("{p}", configParameter->getLabel());
-      snprintf(buf, 5, "%d", configParameter->getMaxStrLen());
+      parameterHtml.replace("{i}", configParameter.getId());
+      parameterHtml.replace("{n}", configParameter.getId());
+      parameterHtml.replace("{p}", configParameter.getLabel());
+      snprintf(buf, 5, "%d", configParameter.getMaxStrLen());
       parameterHtml.replace("{l}", buf);
       page += parameterHtml;
     }
@@ -320,21 +319,17 @@ namespace WifiManager {
   void handleSafeConfig(AsyncWebServerRequest* request) {
     ESP_LOGI(TAG, "handleSafeConfig");
     if (!authenticate(request)) return;
-    bool rebootRequired = false;
-    for (ConfigParameterBase<Config>* configParameter : configParameterVector) {
-      rebootRequired |= configParameter->save(config, request->arg(configParameter->getId()).c_str()) && configParameter->isRebootRequiredOnChange();
+    ConfigTransaction transaction;
+    beginConfigTransaction(transaction);
+    for (const ConfigParameter& configParameter : configParameters) {
+      stageConfigValue(transaction, configParameter, request->arg(configParameter.getId()).c_str());
     }
-    logConfiguration(config);
+    commitConfigTransaction(transaction);
     AsyncWebServerResponse* response = request->beginResponse(200, FPSTR(html::content_type_html), FPSTR(html::config_saved));
     response->addHeader(FPSTR(html::header_cache_control), FPSTR(html::cache_control_no_cache));
     request->send(response);
 
-    if (wifiManagerTask) {
-      if (rebootRequired)
-        xTaskNotify(wifiManagerTask, X_CMD_SAVE_CONFIG_AND_REBOOT, eSetBits);
-      else
-        xTaskNotify(wifiManagerTask, X_CMD_SAVE_CONFIG, eSetBits);
-    }
+    if (wifiManagerTask) xTaskNotify(wifiManagerTask, X_CMD_SAVE_CONFIG, eSetBits);
   }
 
   void handleWifi(AsyncWebServerRequest* request) {
@@ -751,6 +746,7 @@ namespace WifiManager {
     if (!authenticate(request)) return;
     AsyncWebServerResponse* response = request->beginResponse(200, FPSTR(html::content_type_html), FPSTR(html::reboot));
     request->send(response);
+    flushConfiguration();
     delay(1000);
     esp_restart();
   }
@@ -779,12 +775,6 @@ namespace WifiManager {
           saveConfiguration(config);
           configChangedCallback();
         }
-        if (taskNotification & X_CMD_SAVE_CONFIG_AND_REBOOT) {
-          if (saveConfiguration(config)) {
-            delay(1000);
-            esp_restart();
-          }
-        }
         if (taskNotification & X_CMD_WIFI_SCAN_DONE) {
           scanWifiDone();
         }
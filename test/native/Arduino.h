@@ -0,0 +1,122 @@
+#ifndef _NATIVE_ARDUINO_H
+#define _NATIVE_ARDUINO_H
+
+/**
+ * Just enough of the Arduino core and FreeRTOS to build the hardware independent modules on the host,
+ * see [env:native] in platformio.ini. millis() only moves when a test advances nativeMillis.
+ */
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <mutex>
+#include <string>
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+using std::min;
+using std::max;
+using std::isnan;
+
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+#define bit(b) (1UL << (b))
+
+extern uint32_t nativeMillis;
+
+inline uint32_t millis() {
+  return nativeMillis;
+}
+
+inline void delay(uint32_t ms) {
+  nativeMillis += ms;
+}
+
+inline void esp_restart() {
+  abort();
+}
+
+typedef enum {
+  ESP_LOG_NONE,
+  ESP_LOG_ERROR,
+  ESP_LOG_WARN,
+  ESP_LOG_INFO,
+  ESP_LOG_DEBUG,
+  ESP_LOG_VERBOSE
+} esp_log_level_t;
+
+const char* pathToFileName(const char* path);
+
+class String {
+public:
+  String(const char* str = "") : value(str) {}
+  const char* c_str() const {
+    return value.c_str();
+  }
+  unsigned int length() const {
+    return value.length();
+  }
+  bool operator==(const String& other) const {
+    return value == other.value;
+  }
+
+private:
+  std::string value;
+};
+
+// FreeRTOS, a tick is a millisecond
+typedef uint32_t TickType_t;
+typedef void* TaskHandle_t;
+#define portMAX_DELAY 0xffffffffUL
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+#define pdTRUE 1
+#define pdFALSE 0
+
+inline void vTaskDelay(TickType_t ticks) {
+  delay(ticks);
+}
+
+inline const char* pcTaskGetTaskName(TaskHandle_t task) {
+  return "native";
+}
+
+// Spinlock, critical sections don't disable interrupts on the host
+struct portMUX_TYPE {
+  int locked;
+};
+#define portMUX_INITIALIZER_UNLOCKED { 0 }
+
+inline void portENTER_CRITICAL(portMUX_TYPE* mux) {
+  while (__atomic_exchange_n(&mux->locked, 1, __ATOMIC_ACQUIRE)) {}
+}
+
+inline void portEXIT_CRITICAL(portMUX_TYPE* mux) {
+  __atomic_store_n(&mux->locked, 0, __ATOMIC_RELEASE);
+}
+
+// Mutexes only, the timeout is ignored
+typedef std::mutex* SemaphoreHandle_t;
+
+inline SemaphoreHandle_t xSemaphoreCreateMutex() {
+  return new std::mutex();
+}
+
+inline void vSemaphoreDelete(SemaphoreHandle_t semaphore) {
+  delete semaphore;
+}
+
+inline int xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t blockTime) {
+  semaphore->lock();
+  return pdTRUE;
+}
+
+inline int xSemaphoreGive(SemaphoreHandle_t semaphore) {
+  semaphore->unlock();
+  return pdTRUE;
+}
+
+#endif
@@ -0,0 +1,33 @@
+#ifndef _NATIVE_PREFERENCES_H
+#define _NATIVE_PREFERENCES_H
+
+#include <Arduino.h>
+#include <map>
+#include <string>
+
+// NVS content by "namespace/key", tests clear it to simulate a first boot
+extern std::map<std::string, uint8_t> nativePreferences;
+
+class Preferences {
+public:
+  bool begin(const char* name, bool readOnly = false) {
+    prefix = std::string(name) + "/";
+    return true;
+  }
+  void end() {}
+  bool isKey(const char* key) {
+    return nativePreferences.count(prefix + key) > 0;
+  }
+  uint8_t getUChar(const char* key, uint8_t defaultValue = 0) {
+    return isKey(key) ? nativePreferences[prefix + key] : defaultValue;
+  }
+  size_t putUChar(const char* key, uint8_t value) {
+    nativePreferences[prefix + key] = value;
+    return 1;
+  }
+
+private:
+  std::string prefix;
+};
+
+#endif
@@ -0,0 +1,20 @@
+#ifndef _NATIVE_PRINT_H
+#define _NATIVE_PRINT_H
+
+#include <Arduino.h>
+
+class Print {
+public:
+  virtual ~Print() {}
+  virtual size_t write(uint8_t b) = 0;
+  virtual size_t write(const uint8_t* buffer, size_t size) {
+    size_t n = 0;
+    while (n < size && write(buffer[n])) n++;
+    return n;
+  }
+  size_t write(const char* str) {
+    return str ? write((const uint8_t*)str, strlen(str)) : 0;
+  }
+};
+
+#endif
@@ -0,0 +1,30 @@
+#ifndef _NATIVE_WIRE_H
+#define _NATIVE_WIRE_H
+
+#include <Arduino.h>
+
+// I2C bus on which the devices a test puts into present answer, every transmission is counted
+class TwoWire {
+public:
+  bool present[128] = {};
+  uint32_t transmissions = 0;
+  uint32_t clock = 100000;
+
+  void beginTransmission(uint8_t _address) {
+    address = _address;
+  }
+  uint8_t endTransmission(bool sendStop = true) {
+    transmissions++;
+    return address < 128 && present[address] ? 0 : 2;   // 2: NACK on address
+  }
+  void setClock(uint32_t frequency) {
+    clock = frequency;
+  }
+
+private:
+  uint8_t address = 0;
+};
+
+extern TwoWire Wire;
+
+#endif
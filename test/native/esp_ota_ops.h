@@ -0,0 +1,13 @@
+#ifndef _NATIVE_ESP_OTA_OPS_H
+#define _NATIVE_ESP_OTA_OPS_H
+
+#include <esp_partition.h>
+
+// the firmware the tests pretend to be running
+extern esp_partition_t nativeRunningPartition;
+
+inline const esp_partition_t* esp_ota_get_running_partition() {
+  return &nativeRunningPartition;
+}
+
+#endif
@@ -0,0 +1,22 @@
+#ifndef _NATIVE_ESP_PARTITION_H
+#define _NATIVE_ESP_PARTITION_H
+
+#include <Arduino.h>
+
+typedef int esp_err_t;
+#define ESP_OK                 0
+#define ESP_ERR_INVALID_SIZE   0x104
+
+// A partition in memory, tests point data at the content they want to read back
+typedef struct {
+  uint32_t size;
+  const uint8_t* data;
+} esp_partition_t;
+
+inline esp_err_t esp_partition_read(const esp_partition_t* partition, size_t offset, void* dst, size_t size) {
+  if (offset > partition->size || size > partition->size - offset) return ESP_ERR_INVALID_SIZE;
+  memcpy(dst, partition->data + offset, size);
+  return ESP_OK;
+}
+
+#endif
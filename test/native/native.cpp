@@ -0,0 +1,59 @@
+#include <Arduino.h>
+#include <logging.h>
+#include <Wire.h>
+#include <Preferences.h>
+#include <nativeHeap.h>
+#include <esp_ota_ops.h>
+
+uint32_t nativeMillis = 0;
+TwoWire Wire;
+std::map<std::string, uint8_t> nativePreferences;
+esp_partition_t nativeRunningPartition = { 0, nullptr };
+std::atomic<size_t> nativeAllocations(0);
+std::atomic<size_t> nativeAllocatedBytes(0);
+
+#ifdef __GLIBC__
+const bool nativeHeapCounted = true;
+
+extern "C" {
+  void* __libc_malloc(size_t size);
+  void* __libc_calloc(size_t count, size_t size);
+  void* __libc_realloc(void* pointer, size_t size);
+
+  void* malloc(size_t size) __THROW {
+    nativeAllocations++;
+    nativeAllocatedBytes += size;
+    return __libc_malloc(size);
+  }
+
+  void* calloc(size_t count, size_t size) __THROW {
+    nativeAllocations++;
+    nativeAllocatedBytes += count * size;
+    return __libc_calloc(count, size);
+  }
+
+  void* realloc(void* pointer, size_t size) __THROW {
+    nativeAllocations++;
+    nativeAllocatedBytes += size;
+    return __libc_realloc(pointer, size);
+  }
+}
+#else
+const bool nativeHeapCounted = false;
+#endif
+
+const char* pathToFileName(const char* path) {
+  const char* name = strrchr(path, '/');
+  return name ? name + 1 : path;
+}
+
+namespace logging {
+  void decorateLog(esp_log_level_t level, const char* file, int line, const char* function, const char* tag, const char* format, ...) {
+    printf("[%s][%s:%i] %s(): ", LOG_LEVEL_LETTERS[level], file, line, function);
+    va_list args;
+    va_start(args, format);
+    vprintf(format, args);
+    va_end(args);
+    printf("\n");
+  }
+}
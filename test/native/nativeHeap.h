@@ -0,0 +1,15 @@
+#ifndef _NATIVE_HEAP_H
+#define _NATIVE_HEAP_H
+
+#include <atomic>
+#include <stddef.h>
+
+/**
+ * Heap allocations counted by the malloc hooks in native.cpp, operator new goes through malloc as well.
+ * The hooks need glibc, elsewhere nativeHeapCounted is false and the counters stay 0.
+ */
+extern const bool nativeHeapCounted;
+extern std::atomic<size_t> nativeAllocations;
+extern std::atomic<size_t> nativeAllocatedBytes;
+
+#endif
@@ -0,0 +1,72 @@
+#ifndef _NATIVE_ROM_MINIZ_H
+#define _NATIVE_ROM_MINIZ_H
+
+#include <zlib.h>
+#include <string.h>
+
+/**
+ * The part of the ROM's tinfl the OTA decoder uses, on top of the host's zlib. zlib keeps its own window,
+ * so the output can go anywhere in the caller's circular dictionary. Its state lives in an arena inside the
+ * decompressor, so freeing the decompressor frees everything, like it does with tinfl.
+ */
+#define TINFL_LZ_DICT_SIZE            32768
+#define TINFL_FLAG_PARSE_ZLIB_HEADER  1
+#define TINFL_FLAG_HAS_MORE_INPUT     2
+
+typedef enum {
+  TINFL_STATUS_BAD_PARAM = -3,
+  TINFL_STATUS_ADLER32_MISMATCH = -2,
+  TINFL_STATUS_FAILED = -1,
+  TINFL_STATUS_DONE = 0,
+  TINFL_STATUS_NEEDS_MORE_INPUT = 1,
+  TINFL_STATUS_HAS_MORE_OUTPUT = 2
+} tinfl_status;
+
+struct tinfl_decompressor_tag {
+  z_stream stream;
+  bool started;
+  size_t arenaUsed;
+  // inflate state and its 32KB window
+  uint8_t arena[48 * 1024];
+};
+typedef tinfl_decompressor_tag tinfl_decompressor;
+
+inline voidpf tinflArenaAlloc(voidpf opaque, uInt items, uInt size) {
+  tinfl_decompressor* r = (tinfl_decompressor*)opaque;
+  size_t bytes = ((size_t)items * size + 15) & ~(size_t)15;
+  if (r->arenaUsed + bytes > sizeof(r->arena)) return Z_NULL;
+  voidpf block = r->arena + r->arenaUsed;
+  r->arenaUsed += bytes;
+  return block;
+}
+
+inline void tinflArenaFree(voidpf opaque, voidpf address) {}
+
+inline void tinfl_init(tinfl_decompressor* r) {
+  memset(&r->stream, 0, sizeof(r->stream));
+  r->started = false;
+  r->arenaUsed = 0;
+}
+
+inline tinfl_status tinfl_decompress(tinfl_decompressor* r, const uint8_t* in, size_t* inSize, uint8_t* outStart,
+  uint8_t* outNext, size_t* outSize, uint32_t flags) {
+  if (!r->started) {
+    r->stream.zalloc = tinflArenaAlloc;
+    r->stream.zfree = tinflArenaFree;
+    r->stream.opaque = r;
+    if (inflateInit2(&r->stream, (flags & TINFL_FLAG_PARSE_ZLIB_HEADER) ? 15 : -15) != Z_OK) return TINFL_STATUS_FAILED;
+    r->started = true;
+  }
+  r->stream.next_in = (Bytef*)in;
+  r->stream.avail_in = *inSize;
+  r->stream.next_out = outNext;
+  r->stream.avail_out = *outSize;
+  int result = inflate(&r->stream, Z_NO_FLUSH);
+  *inSize -= r->stream.avail_in;
+  *outSize -= r->stream.avail_out;
+  if (result == Z_STREAM_END) return TINFL_STATUS_DONE;
+  if (result != Z_OK && result != Z_BUF_ERROR) return TINFL_STATUS_FAILED;
+  return r->stream.avail_out == 0 ? TINFL_STATUS_HAS_MORE_OUTPUT : TINFL_STATUS_NEEDS_MORE_INPUT;
+}
+
+#endif
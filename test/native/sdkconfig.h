@@ -0,0 +1,6 @@
+#ifndef _NATIVE_SDKCONFIG_H
+#define _NATIVE_SDKCONFIG_H
+
+// no CONFIG_IDF_TARGET_*, config.h leaves out the board pins on the host
+
+#endif
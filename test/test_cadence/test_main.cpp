@@ -0,0 +1,86 @@
+#include <unity.h>
+#include <cadence.h>
+#include <config.h>
+
+using namespace Cadence;
+
+// The cadence keeps its state between the tests, they run in order and continue where the previous one stopped
+
+// adds a reading of every sensor every interval seconds for duration seconds, CO2 changing by rate ppm per minute
+void addReadings(uint16_t interval, uint32_t duration, float co2, float rate) {
+  for (uint32_t t = 0; t < duration; t += interval) {
+    nativeMillis += interval * 1000;
+    co2 += rate * interval / 60;
+    addReading(SOURCE_SCD40, MEASUREMENT_CO2, co2);
+    // a second sensor reading 60 ppm higher isn't a change
+    addReading(SOURCE_SCD30, MEASUREMENT_CO2, co2 + 60);
+    addReading(SOURCE_SPS30, MEASUREMENT_MASS_PM2_5, 3.0f);
+    addReading(SOURCE_BME680, MEASUREMENT_IAQ, 40.0f);
+  }
+}
+
+void setUp() {}
+
+void tearDown() {}
+
+void test_stable_readings_step_down() {
+  TEST_ASSERT_EQUAL(CADENCE_FAST, getLevel());
+  addReadings(5, CADENCE_STABLE_TIME / 1000 - 5, 600, 0);
+  TEST_ASSERT_EQUAL(CADENCE_FAST, getLevel());
+  addReadings(5, 5, 600, 0);
+  TEST_ASSERT_EQUAL(CADENCE_NORMAL, getLevel());
+  addReadings(30, CADENCE_STABLE_TIME / 1000, 600, 0);
+  TEST_ASSERT_EQUAL(CADENCE_SLOW, getLevel());
+}
+
+void test_slow_drift_keeps_slow_cadence() {
+  addReadings(300, 3600, 600, 2);
+  TEST_ASSERT_EQUAL(CADENCE_SLOW, getLevel());
+}
+
+// At the slow cadence a reading only comes every 5 minutes, the first one of a ramp switches to fast
+void test_ramp_switches_to_fast_with_the_next_reading() {
+  addReadings(300, 300, 720, 25);
+  TEST_ASSERT_EQUAL(CADENCE_FAST, getLevel());
+}
+
+void test_single_outlier_is_ignored() {
+  // the rate of the ramp counts until the rate window is over
+  addReadings(5, (CADENCE_RATE_WINDOW + CADENCE_STABLE_TIME) / 1000, 845, 0);
+  addReadings(30, CADENCE_STABLE_TIME / 1000, 845, 0);
+  TEST_ASSERT_EQUAL(CADENCE_SLOW, getLevel());
+  nativeMillis += 5000;
+  addReading(SOURCE_SPS30, MEASUREMENT_MASS_PM2_5, 9.0f);
+  nativeMillis += 5000;
+  addReading(SOURCE_SPS30, MEASUREMENT_MASS_PM2_5, 3.0f);
+  TEST_ASSERT_EQUAL(CADENCE_SLOW, getLevel());
+}
+
+void test_jump_switches_to_fast_within_the_rate_window() {
+  nativeMillis += 5000;
+  addReading(SOURCE_SPS30, MEASUREMENT_MASS_PM2_5, 9.0f);
+  TEST_ASSERT_EQUAL(CADENCE_SLOW, getLevel());
+  nativeMillis += 5000;
+  addReading(SOURCE_SPS30, MEASUREMENT_MASS_PM2_5, 9.5f);
+  TEST_ASSERT_EQUAL(CADENCE_FAST, getLevel());
+}
+
+// the SPS30 stops reporting, its last rate must not keep the cadence fast
+void test_rate_of_silent_sensor_expires() {
+  for (uint32_t t = 0; t < (CADENCE_RATE_EXPIRY + CADENCE_STABLE_TIME) / 1000; t += 5) {
+    nativeMillis += 5000;
+    addReading(SOURCE_SCD40, MEASUREMENT_CO2, 845);
+  }
+  TEST_ASSERT_EQUAL(CADENCE_NORMAL, getLevel());
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_stable_readings_step_down);
+  RUN_TEST(test_slow_drift_keeps_slow_cadence);
+  RUN_TEST(test_ramp_switches_to_fast_with_the_next_reading);
+  RUN_TEST(test_single_outlier_is_ignored);
+  RUN_TEST(test_jump_switches_to_fast_within_the_rate_window);
+  RUN_TEST(test_rate_of_silent_sensor_expires);
+  return UNITY_END();
+}
@@ -0,0 +1,112 @@
+#include <unity.h>
+#include <configManager.h>
+#include <chrono>
+
+// repetitions of each benchmark
+const uint32_t BENCHMARK_RUNS = 2000;
+
+volatile uintptr_t sink;
+
+void setUp() {}
+
+void tearDown() {}
+
+void test_every_id_has_its_own_slot() {
+  bool taken[CONFIG_HASH_SLOTS] = {};
+  for (const ConfigParameter& configParameter : getConfigParameters()) {
+    uint8_t slot = configIdSlot(configParameter.getId(), CONFIG_HASH_SEED, CONFIG_HASH_BITS);
+    TEST_ASSERT_TRUE_MESSAGE(slot < CONFIG_HASH_SLOTS, configParameter.getId());
+    TEST_ASSERT_FALSE_MESSAGE(taken[slot], configParameter.getId());
+    taken[slot] = true;
+  }
+}
+
+void test_every_id_is_found() {
+  ConfigParameterTable table = getConfigParameters();
+  TEST_ASSERT_TRUE(table.count > 0);
+  for (const ConfigParameter& configParameter : table) {
+    TEST_ASSERT_EQUAL_PTR(&configParameter, findConfigParameter(configParameter.getId()));
+  }
+}
+
+// Ids that aren't in the table may hash to a used slot, the lookup has to tell them apart
+void test_unknown_ids_are_not_found() {
+  const char* unknown[] = { "", "mqtttopic", "mqttTopic ", "deviceID", "co2", "hub75", "brightnes", "co2monitor" };
+  for (const char* id : unknown) {
+    TEST_ASSERT_NULL(findConfigParameter(id));
+  }
+  for (const ConfigParameter& configParameter : getConfigParameters()) {
+    char truncated[32];
+    strncpy(truncated, configParameter.getId(), sizeof(truncated));
+    truncated[strlen(truncated) - 1] = 0x00;
+    TEST_ASSERT_NULL(findConfigParameter(truncated));
+  }
+}
+
+void test_defaults_are_applied() {
+  Config defaults;
+  memset(&defaults, 0, sizeof(defaults));
+  getDefaultConfiguration(defaults);
+  for (const ConfigParameter& configParameter : getConfigParameters()) {
+    if (configParameter.isNumber() || configParameter.isEnum()) {
+      TEST_ASSERT_EQUAL_MESSAGE(configParameter.defaultValue, configParameter.getValueOrdinal(defaults) + configParameter.minValue, configParameter.getId());
+    } else if (!configParameter.isBoolean()) {
+      TEST_ASSERT_EQUAL_STRING_MESSAGE(configParameter.defaultString, configParameter.toString(defaults).c_str(), configParameter.getId());
+    }
+  }
+}
+
+// The lookup before the perfect hash
+const ConfigParameter* findByScan(const char* id) {
+  for (const ConfigParameter& configParameter : getConfigParameters()) {
+    if (strcmp(configParameter.getId(), id) == 0) return &configParameter;
+  }
+  return nullptr;
+}
+
+template <typename Function>
+void benchmark(const char* name, uint32_t operations, Function function) {
+  auto start = std::chrono::steady_clock::now();
+  for (uint32_t run = 0; run < BENCHMARK_RUNS; run++) function();
+  double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+  char message[100];
+  snprintf(message, sizeof(message), "%s: %.1f ns/%s", name, ns / BENCHMARK_RUNS / operations, operations > 1 ? "lookup" : "config");
+  TEST_MESSAGE(message);
+}
+
+// Cost of looking up every id and of a JSON round trip of the whole configuration, for comparing them with
+// each other. No assertion, timings vary by machine and ArduinoJson build.
+void test_benchmark() {
+  ConfigParameterTable table = getConfigParameters();
+  benchmark("findConfigParameter()", table.count, [&table]() {
+    for (const ConfigParameter& configParameter : table) sink = (uintptr_t)findConfigParameter(configParameter.getId());
+  });
+  benchmark("strcmp scan", table.count, [&table]() {
+    for (const ConfigParameter& configParameter : table) sink = (uintptr_t)findByScan(configParameter.getId());
+  });
+
+  Config values;
+  memset(&values, 0, sizeof(values));
+  getDefaultConfiguration(values);
+  DynamicJsonDocument doc(CONFIG_SIZE);
+  benchmark("toJson() of every parameter", 1, [&]() {
+    doc.clear();
+    for (const ConfigParameter& configParameter : table) configParameter.toJson(values, &doc);
+  });
+  Config parsed;
+  memset(&parsed, 0, sizeof(parsed));
+  benchmark("fromJson() of every parameter", 1, [&]() {
+    for (const ConfigParameter& configParameter : table) sink = configParameter.fromJson(parsed, &doc, true);
+  });
+  TEST_ASSERT_EQUAL_MEMORY(&values, &parsed, sizeof(Config));
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_every_id_has_its_own_slot);
+  RUN_TEST(test_every_id_is_found);
+  RUN_TEST(test_unknown_ids_are_not_found);
+  RUN_TEST(test_defaults_are_applied);
+  RUN_TEST(test_benchmark);
+  return UNITY_END();
+}
@@ -0,0 +1,160 @@
+#include <unity.h>
+#include <configManager.h>
+#include <model.h>
+#include <string>
+#include <chrono>
+
+// repetitions of each benchmark
+const uint32_t BENCHMARK_RUNS = 2000;
+
+volatile bool sink;
+
+StaticJsonDocument<512> doc;
+ConfigTransaction transaction;
+
+JsonObjectConst parse(const char* json) {
+  TEST_ASSERT_FALSE(deserializeJson(doc, json));
+  return doc.as<JsonObjectConst>();
+}
+
+void setUp() {
+  getDefaultConfiguration(config);
+  beginConfigTransaction(transaction);
+}
+
+void tearDown() {}
+
+void test_changes_are_staged_until_commit() {
+  TEST_ASSERT_TRUE(stageConfigJson(transaction, parse("{\"co2YellowThreshold\":750,\"mqttV5\":true,\"mqttTopic\":\"office\"}")));
+  TEST_ASSERT_EQUAL(3, transaction.changeCount());
+  TEST_ASSERT_EQUAL(700, config.co2YellowThreshold);
+  TEST_ASSERT_FALSE(config.mqttV5);
+  TEST_ASSERT_EQUAL_STRING("co2monitor", config.mqttTopic);
+
+  commitConfigTransaction(transaction);
+  TEST_ASSERT_EQUAL(750, config.co2YellowThreshold);
+  TEST_ASSERT_TRUE(config.mqttV5);
+  TEST_ASSERT_EQUAL_STRING("office", config.mqttTopic);
+}
+
+void test_unknown_keys_are_ignored() {
+  TEST_ASSERT_TRUE(stageConfigJson(transaction, parse("{\"noSuchParameter\":1,\"brightness\":128}")));
+  TEST_ASSERT_EQUAL(1, transaction.changeCount());
+  TEST_ASSERT_NOT_NULL(findConfigParameter("brightness"));
+}
+
+// One invalid value rejects the whole set, the values staged before it never reach the configuration
+void test_invalid_value_rejects_the_transaction() {
+  Config before = config;
+  TEST_ASSERT_FALSE(stageConfigJson(transaction, parse("{\"co2YellowThreshold\":750,\"ssd1306Rows\":128}")));
+  TEST_ASSERT_EQUAL_STRING("ssd1306Rows", transaction.rejected);
+  TEST_ASSERT_EQUAL_MEMORY(&before, &config, sizeof(Config));
+
+  beginConfigTransaction(transaction);
+  TEST_ASSERT_FALSE(stageConfigJson(transaction, parse("{\"mqttUseTls\":\"yes\"}")));
+  TEST_ASSERT_EQUAL_STRING("mqttUseTls", transaction.rejected);
+
+  beginConfigTransaction(transaction);
+  TEST_ASSERT_FALSE(stageConfigJson(transaction, parse("{\"brightness\":256}")));
+  TEST_ASSERT_EQUAL_STRING("brightness", transaction.rejected);
+}
+
+void test_unchanged_values_are_not_changes() {
+  TEST_ASSERT_TRUE(stageConfigJson(transaction, parse("{\"co2YellowThreshold\":700,\"mqttHost\":\"127.0.0.1\"}")));
+  TEST_ASSERT_EQUAL(0, transaction.changeCount());
+
+  // changed and set back within the same transaction
+  TEST_ASSERT_TRUE(stageConfigJson(transaction, parse("{\"brightness\":10}")));
+  TEST_ASSERT_EQUAL(1, transaction.changeCount());
+  TEST_ASSERT_TRUE(stageConfigJson(transaction, parse("{\"brightness\":255}")));
+  TEST_ASSERT_EQUAL(0, transaction.changeCount());
+}
+
+void test_flags_of_changed_parameters() {
+  TEST_ASSERT_TRUE(stageConfigJson(transaction, parse("{\"co2RedThreshold\":950}")));
+  TEST_ASSERT_FALSE(transaction.mqttConnectionChanged());
+  TEST_ASSERT_TRUE(stageConfigJson(transaction, parse("{\"mqttServerPort\":8883}")));
+  TEST_ASSERT_TRUE(transaction.mqttConnectionChanged());
+}
+
+void test_changes_to_json_hides_secrets() {
+  TEST_ASSERT_TRUE(stageConfigJson(transaction, parse("{\"mqttPassword\":\"hunter2\",\"altitude\":120}")));
+  StaticJsonDocument<256> changes;
+  configChangesToJson(transaction, changes.to<JsonObject>());
+  std::string json;
+  serializeJson(changes, json);
+  TEST_ASSERT_EQUAL_STRING("{\"mqttPassword\":true,\"altitude\":120}", json.c_str());
+}
+
+void test_portal_values_are_staged() {
+  TEST_ASSERT_TRUE(stageConfigValue(transaction, *findConfigParameter("sensorFusion"), "median"));
+  TEST_ASSERT_TRUE(stageConfigValue(transaction, *findConfigParameter("mqttUseTls"), "on"));
+  TEST_ASSERT_FALSE(stageConfigValue(transaction, *findConfigParameter("ssd1306Rows"), "16"));
+  TEST_ASSERT_EQUAL(2, transaction.changeCount());
+  commitConfigTransaction(transaction);
+  TEST_ASSERT_EQUAL(FUSION_MEDIAN, config.sensorFusion);
+  TEST_ASSERT_TRUE(config.mqttUseTls);
+  TEST_ASSERT_EQUAL(64, config.ssd1306Rows);
+}
+
+// How setConfig applied a document before transactions: every parameter of the table looked up in the
+// document, and parsed a second time to log the change
+void applyByScan(Config& live, JsonDocument& values) {
+  static const char* const mqttIds[] = { "mqttHost", "mqttServerPort", "deviceId", "mqttUsername", "mqttPassword",
+    "mqttTopic", "mqttUseTls", "mqttInsecure", "mqttV5" };
+  Config mqttConfig = live;
+  bool configUpdated = false;
+  bool mqttConfigUpdated = false;
+  for (const ConfigParameter& configParameter : getConfigParameters()) {
+    bool mqttParameter = false;
+    for (const char* id : mqttIds) mqttParameter |= strcmp(configParameter.getId(), id) == 0;
+    if (mqttParameter) {
+      mqttConfigUpdated |= configParameter.fromJson(mqttConfig, &values, false);
+      sink = configParameter.fromJson(mqttConfig, &values, false);
+    } else {
+      configUpdated |= configParameter.fromJson(live, &values, false);
+      sink = configParameter.fromJson(live, &values, false);
+    }
+  }
+  sink = configUpdated || mqttConfigUpdated;
+}
+
+template <typename Function>
+void benchmark(const char* name, Function function) {
+  auto start = std::chrono::steady_clock::now();
+  for (uint32_t run = 0; run < BENCHMARK_RUNS; run++) function();
+  double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+  char message[100];
+  snprintf(message, sizeof(message), "%s: %.1f ns/document", name, ns / BENCHMARK_RUNS);
+  TEST_MESSAGE(message);
+}
+
+// Cost of applying a typical setConfig document both ways, leaving out the logging of the changes. No
+// assertion, timings vary by machine and ArduinoJson build.
+void test_benchmark() {
+  parse("{\"co2YellowThreshold\":750,\"brightness\":128,\"mqttTopic\":\"office\"}");
+  Config scanned = config;
+  benchmark("transaction", []() {
+    beginConfigTransaction(transaction);
+    sink = stageConfigJson(transaction, doc.as<JsonObjectConst>());
+  });
+  benchmark("scan with fromJson() twice", [&scanned]() {
+    scanned = config;
+    applyByScan(scanned, doc);
+  });
+  TEST_ASSERT_EQUAL(3, transaction.changeCount());
+  TEST_ASSERT_EQUAL(750, scanned.co2YellowThreshold);
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_changes_are_staged_until_commit);
+  RUN_TEST(test_unknown_keys_are_ignored);
+  RUN_TEST(test_invalid_value_rejects_the_transaction);
+  RUN_TEST(test_unchanged_values_are_not_changes);
+  RUN_TEST(test_flags_of_changed_parameters);
+  RUN_TEST(test_changes_to_json_hides_secrets);
+  RUN_TEST(test_portal_values_are_staged);
+  RUN_TEST(test_benchmark);
+  return UNITY_END();
+}
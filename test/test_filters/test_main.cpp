@@ -0,0 +1,114 @@
+#include <unity.h>
+#include <filters.h>
+#include <chrono>
+
+using namespace Filters;
+
+// samples per stage in the benchmark
+const uint32_t BENCHMARK_SAMPLES = 1000000;
+
+void setUp() {}
+
+void tearDown() {}
+
+void test_spike_is_rejected() {
+  Hampel<5, 30, 300, 90> hampel;
+  uint32_t now = 0;
+  for (uint8_t i = 0; i < 4; i++, now += 5000) hampel.apply(800, now);
+  TEST_ASSERT_EQUAL_FLOAT(800, hampel.apply(2000, now));
+  TEST_ASSERT_EQUAL_FLOAT(810, hampel.apply(810, now + 5000));
+}
+
+// A step within the span is held until it makes up the median, that is for (N - 1) / 2 samples
+void test_step_passes_after_half_the_window() {
+  Hampel<5, 30, 300, 90> hampel;
+  uint32_t now = 0;
+  for (uint8_t i = 0; i < 5; i++, now += 5000) hampel.apply(800, now);
+  TEST_ASSERT_EQUAL_FLOAT(800, hampel.apply(1200, now));
+  TEST_ASSERT_EQUAL_FLOAT(800, hampel.apply(1200, now + 5000));
+  TEST_ASSERT_EQUAL_FLOAT(1200, hampel.apply(1200, now + 10000));
+}
+
+void test_step_passes_immediately_at_slow_cadence() {
+  Hampel<5, 30, 300, 90> hampel;
+  Median<3, 60> median;
+  uint32_t now = 0;
+  for (uint8_t i = 0; i < 5; i++, now += 300000) {
+    hampel.apply(800, now);
+    median.apply(800, now);
+  }
+  TEST_ASSERT_EQUAL_FLOAT(1200, hampel.apply(1200, now));
+  TEST_ASSERT_EQUAL_FLOAT(1200, median.apply(1200, now));
+}
+
+// A flat window has a MAD of 0, changes below the floor pass, larger ones count as outliers
+void test_floor_is_respected() {
+  Hampel<5, 30, 300, 90> hampel;
+  uint32_t now = 0;
+  for (uint8_t i = 0; i < 5; i++, now += 5000) hampel.apply(800, now);
+  TEST_ASSERT_EQUAL_FLOAT(830, hampel.apply(830, now));
+  TEST_ASSERT_EQUAL_FLOAT(800, hampel.apply(831, now + 5000));
+}
+
+void test_ewma_weight_depends_on_interval() {
+  Ewma<60> ewma;
+  ewma.apply(0, 0);
+  TEST_ASSERT_FLOAT_WITHIN(0.01f, 100 * (1 - expf(-5.0f / 60)), ewma.apply(100, 5000));
+  ewma.reset();
+  ewma.apply(0, 0);
+  TEST_ASSERT_FLOAT_WITHIN(0.01f, 100 * (1 - expf(-300.0f / 60)), ewma.apply(100, 300000));
+}
+
+void test_slew_rate_is_per_minute() {
+  SlewRate<60> slewRate;
+  slewRate.apply(20, 0);
+  TEST_ASSERT_FLOAT_WITHIN(0.001f, 20.5f, slewRate.apply(30, 5000));
+  TEST_ASSERT_FLOAT_WITHIN(0.001f, 26.5f, slewRate.apply(30, 65000));
+  TEST_ASSERT_FLOAT_WITHIN(0.001f, 30.0f, slewRate.apply(30, 365000));
+}
+
+void test_nan_passes_through() {
+  Co2Filter filter;
+  filter.apply(800, 0);
+  TEST_ASSERT_TRUE(isnan(filter.apply(NAN, 5000)));
+  TEST_ASSERT_EQUAL_FLOAT(800, filter.apply(800, 10000));
+}
+
+volatile float sink;
+
+template <typename Filter>
+void benchmark(const char* name) {
+  Filter filter;
+  auto start = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < BENCHMARK_SAMPLES; i++) {
+    // noise of a few ppm around 800 with a spike every 100 samples
+    sink = filter.apply(i % 100 ? 800 + (i * 7) % 13 : 3000, i * 5000);
+  }
+  double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+  char message[80];
+  snprintf(message, sizeof(message), "%s: %.1f ns/sample", name, ns / BENCHMARK_SAMPLES);
+  TEST_MESSAGE(message);
+}
+
+// Cost per sample on the host, for comparing stages with each other. No assertion, timings vary by machine.
+void test_benchmark() {
+  benchmark<Pipeline<Median<3, 60>>>("Median<3>");
+  benchmark<Pipeline<Hampel<5, 30, 300, 90>>>("Hampel<5>");
+  benchmark<Pipeline<Ewma<7>>>("Ewma");
+  benchmark<Pipeline<SlewRate<60>>>("SlewRate");
+  benchmark<Pipeline<Deadband<50>>>("Deadband");
+  benchmark<Co2Filter>("Co2Filter");
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_spike_is_rejected);
+  RUN_TEST(test_step_passes_after_half_the_window);
+  RUN_TEST(test_step_passes_immediately_at_slow_cadence);
+  RUN_TEST(test_floor_is_respected);
+  RUN_TEST(test_ewma_weight_depends_on_interval);
+  RUN_TEST(test_slew_rate_is_per_minute);
+  RUN_TEST(test_nan_passes_through);
+  RUN_TEST(test_benchmark);
+  return UNITY_END();
+}
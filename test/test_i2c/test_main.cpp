@@ -0,0 +1,83 @@
+#include <unity.h>
+#include <i2c.h>
+#include <config.h>
+#include <Wire.h>
+#include <Preferences.h>
+
+const uint8_t knownAddresses[] = { SSD1306_I2C_ADR, SCD30_I2C_ADR, SCD40_I2C_ADR, SPS30_I2C_ADR, BME680_I2C_ADR };
+const uint8_t KNOWN_COUNT = sizeof(knownAddresses) / sizeof(knownAddresses[0]);
+// full scan of addresses 1 to 126
+const uint32_t SCAN_TRANSMISSIONS = 126;
+
+// puts the known devices whose bit is set in map on the bus, plus a device the firmware doesn't know
+void attachDevices(uint8_t map) {
+  memset(Wire.present, 0, sizeof(Wire.present));
+  for (uint8_t i = 0; i < KNOWN_COUNT; i++) {
+    Wire.present[knownAddresses[i]] = (map & bit(i)) != 0;
+  }
+  Wire.present[0x20] = true;
+}
+
+uint8_t detectedMap() {
+  boolean detected[] = { I2C::lcdPresent(), I2C::scd30Present(), I2C::scd40Present(), I2C::sps30Present(), I2C::bme680Present() };
+  uint8_t map = 0;
+  for (uint8_t i = 0; i < KNOWN_COUNT; i++) {
+    if (detected[i]) map |= bit(i);
+  }
+  return map;
+}
+
+void setUp() {
+  nativePreferences.clear();
+  Wire.transmissions = 0;
+}
+
+void tearDown() {}
+
+void test_first_boot_scans_the_bus() {
+  attachDevices(0b10100);
+  I2C::initI2C();
+  TEST_ASSERT_EQUAL(KNOWN_COUNT + SCAN_TRANSMISSIONS, Wire.transmissions);
+  TEST_ASSERT_EQUAL_HEX8(0b10100, I2C::getDeviceMap());
+  TEST_ASSERT_EQUAL_HEX8(0b10100, detectedMap());
+  TEST_ASSERT_EQUAL_HEX8(0b10100, nativePreferences[I2C_PREFERENCES_NAMESPACE "/" I2C_DEVICE_MAP_KEY]);
+  TEST_ASSERT_EQUAL(I2C_CLK, Wire.clock);
+}
+
+// For every combination of the known devices a boot with the cached map finds what the full scan found
+void test_cached_map_matches_full_scan() {
+  for (uint8_t map = 0; map < bit(KNOWN_COUNT); map++) {
+    attachDevices(map);
+    uint8_t scanned = I2C::rescan();
+    TEST_ASSERT_EQUAL_HEX8(map, scanned);
+
+    Wire.transmissions = 0;
+    I2C::initI2C();
+    TEST_ASSERT_EQUAL(KNOWN_COUNT, Wire.transmissions);
+    TEST_ASSERT_EQUAL_HEX8(scanned, I2C::getDeviceMap());
+    TEST_ASSERT_EQUAL_HEX8(scanned, detectedMap());
+  }
+}
+
+void test_changed_devices_are_scanned() {
+  attachDevices(0b00110);
+  I2C::initI2C();
+  attachDevices(0b00010);
+  Wire.transmissions = 0;
+  I2C::initI2C();
+  TEST_ASSERT_EQUAL(KNOWN_COUNT + SCAN_TRANSMISSIONS, Wire.transmissions);
+  TEST_ASSERT_EQUAL_HEX8(0b00010, detectedMap());
+
+  Wire.transmissions = 0;
+  I2C::initI2C();
+  TEST_ASSERT_EQUAL(KNOWN_COUNT, Wire.transmissions);
+  TEST_ASSERT_EQUAL_HEX8(0b00010, detectedMap());
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_first_boot_scans_the_bus);
+  RUN_TEST(test_cached_map_matches_full_scan);
+  RUN_TEST(test_changed_devices_are_scanned);
+  return UNITY_END();
+}
@@ -0,0 +1,131 @@
+#include <unity.h>
+#include <model.h>
+#include <configManager.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+// updates per writer in the stress test
+const uint32_t STRESS_UPDATES = 200000;
+
+std::atomic<uint32_t> events(0);
+
+void modelUpdated(MeasurementMask mask, TrafficLightStatus oldStatus, TrafficLightStatus newStatus) {
+  events++;
+}
+
+ModelSnapshot emptyValues() {
+  ModelSnapshot values;
+  memset(&values, 0, sizeof(values));
+  return values;
+}
+
+void setUp() {
+  getDefaultConfiguration(config);
+  events = 0;
+}
+
+void tearDown() {}
+
+void test_readings_of_several_sensors_are_fused() {
+  Model model(modelUpdated);
+  config.sensorFusion = FUSION_MEAN;
+  ModelSnapshot values = emptyValues();
+  values.co2 = 800;
+  values.temperature = 21.0f;
+  values.humidity = 40.0f;
+  model.updateModel(SOURCE_SCD30, values, M_CO2 | M_TEMPERATURE | M_HUMIDITY);
+  values.co2 = 900;
+  model.updateModel(SOURCE_SCD40, values, M_CO2 | M_TEMPERATURE | M_HUMIDITY);
+
+  ModelSnapshot snapshot = model.getSnapshot();
+  // weighted 4:2
+  TEST_ASSERT_EQUAL(833, snapshot.co2);
+  TEST_ASSERT_EQUAL_FLOAT(21.0f, snapshot.temperature);
+  TEST_ASSERT_EQUAL(YELLOW, snapshot.status);
+  TEST_ASSERT_EQUAL(2, snapshot.sequence);
+  TEST_ASSERT_EQUAL(2, events.load());
+
+  config.co2RedThreshold = 800;
+  model.configurationChanged();
+  snapshot = model.getSnapshot();
+  TEST_ASSERT_EQUAL(RED, snapshot.status);
+  TEST_ASSERT_EQUAL(3, snapshot.sequence);
+}
+
+/**
+ * Two writers update disjoint measurements, every update writes the same number into all of its fields.
+ * Readers check that no snapshot mixes fields of different updates and that snapshots never go back.
+ */
+void test_concurrent_readers_never_see_torn_snapshots() {
+  Model model(modelUpdated);
+  std::atomic<bool> writing(true);
+  std::atomic<uint32_t> torn(0);
+  std::atomic<uint32_t> reads(0);
+
+  std::thread co2Writer([&model]() {
+    ModelSnapshot values = emptyValues();
+    for (uint32_t i = 0; i < STRESS_UPDATES; i++) {
+      uint16_t value = 1 + i % 60000;
+      values.co2 = value;
+      values.temperature = value;
+      values.humidity = value;
+      model.updateModel(SOURCE_SCD30, values, M_CO2 | M_TEMPERATURE | M_HUMIDITY);
+    }
+  });
+  std::thread particleWriter([&model]() {
+    ModelSnapshot values = emptyValues();
+    for (uint32_t i = 0; i < STRESS_UPDATES; i++) {
+      uint16_t value = 1 + i % 60000;
+      values.pm0_5 = value;
+      values.pm1 = value;
+      values.pm2_5 = value;
+      values.pm4 = value;
+      values.pm10 = value;
+      values.massPm1 = value;
+      values.massPm2_5 = value;
+      values.massPm4 = value;
+      values.massPm10 = value;
+      values.particleSize = value;
+      model.updateModel(SOURCE_SPS30, values, M_PM0_5 | M_PM1_0 | M_PM2_5 | M_PM4 | M_PM10
+        | M_MASS_PM1_0 | M_MASS_PM2_5 | M_MASS_PM4 | M_MASS_PM10 | M_PARTICLE_SIZE);
+    }
+  });
+
+  std::vector<std::thread> readers;
+  for (uint8_t r = 0; r < 2; r++) {
+    readers.push_back(std::thread([&model, &writing, &torn, &reads]() {
+      uint32_t lastSequence = 0;
+      while (writing) {
+        ModelSnapshot s = model.getSnapshot();
+        bool co2Consistent = s.co2 == 0 ? isnan(s.temperature) : (s.temperature == s.co2 && s.humidity == s.co2);
+        bool pmConsistent = s.pm0_5 == 0 ? isnan(s.massPm1) : (s.pm1 == s.pm0_5 && s.pm2_5 == s.pm0_5 && s.pm4 == s.pm0_5
+          && s.pm10 == s.pm0_5 && s.massPm1 == s.pm0_5 && s.massPm2_5 == s.pm0_5 && s.massPm4 == s.pm0_5
+          && s.massPm10 == s.pm0_5 && s.particleSize == s.pm0_5);
+        if (!co2Consistent || !pmConsistent || s.sequence < lastSequence) torn++;
+        lastSequence = s.sequence;
+        reads++;
+      }
+    }));
+  }
+
+  co2Writer.join();
+  particleWriter.join();
+  writing = false;
+  for (std::thread& reader : readers) reader.join();
+
+  ModelSnapshot last = model.getSnapshot();
+  TEST_ASSERT_EQUAL(0, torn.load());
+  TEST_ASSERT_GREATER_THAN(0, reads.load());
+  TEST_ASSERT_EQUAL(2 * STRESS_UPDATES, last.sequence);
+  TEST_ASSERT_EQUAL(2 * STRESS_UPDATES, events.load());
+  TEST_ASSERT_EQUAL(1 + (STRESS_UPDATES - 1) % 60000, last.co2);
+  TEST_ASSERT_EQUAL(1 + (STRESS_UPDATES - 1) % 60000, last.pm10);
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_readings_of_several_sensors_are_fused);
+  RUN_TEST(test_concurrent_readers_never_see_torn_snapshots);
+  return UNITY_END();
+}
@@ -0,0 +1,231 @@
+#include <unity.h>
+#include <mqttClient.h>
+#include <ArduinoJson.h>
+#include <nativeHeap.h>
+#include <pthread.h>
+#include <string>
+#include <vector>
+
+// stack of the thread the stack depth is measured on, painted with STACK_PAINT before the run
+const size_t PROBE_STACK_SIZE = 64 * 1024;
+const uint8_t STACK_PAINT = 0xa5;
+
+// Socket on top of two buffers: the broker's packets are queued in input, everything sent ends up in output
+class BufferClient : public Client {
+public:
+  std::vector<uint8_t> input;
+  std::vector<uint8_t> output;
+  size_t readPosition = 0;
+  bool open = false;
+
+  int connect(const char* host, uint16_t port) override {
+    open = true;
+    return 1;
+  }
+  size_t write(uint8_t b) override {
+    return write(&b, 1);
+  }
+  size_t write(const uint8_t* buffer, size_t size) override {
+    if (!open) return 0;
+    output.insert(output.end(), buffer, buffer + size);
+    return size;
+  }
+  int available() override {
+    return input.size() - readPosition;
+  }
+  int read() override {
+    return readPosition < input.size() ? input[readPosition++] : -1;
+  }
+  int read(uint8_t* buffer, size_t size) override {
+    size_t n = 0;
+    while (n < size && readPosition < input.size()) buffer[n++] = input[readPosition++];
+    return n;
+  }
+  int peek() override {
+    return readPosition < input.size() ? input[readPosition] : -1;
+  }
+  void flush() override {}
+  void stop() override {
+    open = false;
+  }
+  uint8_t connected() override {
+    return open;
+  }
+  operator bool() override {
+    return open;
+  }
+};
+
+static const char TOPIC[] = "co2monitor/0/up/sensors";
+
+BufferClient* socket;
+MqttClient* mqtt;
+StaticJsonDocument<256> doc;
+
+void setUp() {
+  nativeMillis = 0;
+  socket = new BufferClient();
+  mqtt = new MqttClient(*socket);
+  mqtt->setServer("broker", 1883);
+  socket->input = { 0x20, 0x02, 0x00, 0x00 };   // CONNACK, accepted
+  TEST_ASSERT_TRUE(mqtt->connect("test", nullptr, nullptr));
+  socket->output.clear();
+  doc.clear();
+  doc["co2"] = 812;
+  doc["temperature"] = "21.5";
+  doc["humidity"] = "48.0";
+}
+
+void tearDown() {
+  delete mqtt;
+  delete socket;
+}
+
+// The payload of the PUBLISH packet at the start of output, which has to be complete
+std::string publishedPayload(uint8_t qos) {
+  const std::vector<uint8_t>& out = socket->output;
+  TEST_ASSERT_TRUE(out.size() > 2);
+  TEST_ASSERT_EQUAL_HEX8(0x30 | (qos << 1), out[0]);
+  TEST_ASSERT_TRUE(out[1] < 128);
+  TEST_ASSERT_EQUAL(2 + out[1], out.size());
+  size_t topicLength = (out[2] << 8) | out[3];
+  TEST_ASSERT_EQUAL(strlen(TOPIC), topicLength);
+  TEST_ASSERT_EQUAL_MEMORY(TOPIC, &out[4], topicLength);
+  size_t payloadStart = 4 + topicLength + (qos > 0 ? 2 : 0);
+  return std::string(out.begin() + payloadStart, out.end());
+}
+
+void test_streamed_json_is_the_serialized_document() {
+  std::string expected;
+  serializeJson(doc, expected);
+  size_t length = measureJson(doc);
+  TEST_ASSERT_EQUAL(expected.size(), length);
+
+  TEST_ASSERT_TRUE(mqtt->beginPublish(TOPIC, length));
+  TEST_ASSERT_EQUAL(length, serializeJson(doc, *mqtt));
+  TEST_ASSERT_TRUE(mqtt->endPublish());
+  TEST_ASSERT_EQUAL_STRING(expected.c_str(), publishedPayload(0).c_str());
+  TEST_ASSERT_TRUE(mqtt->connected());
+}
+
+void test_qos1_streamed_json_stays_in_flight() {
+  std::string expected;
+  serializeJson(doc, expected);
+
+  TEST_ASSERT_TRUE(mqtt->beginPublish(TOPIC, measureJson(doc), 1));
+  serializeJson(doc, *mqtt);
+  TEST_ASSERT_TRUE(mqtt->endPublish());
+  TEST_ASSERT_EQUAL(1, mqtt->getInFlight());
+  TEST_ASSERT_EQUAL_STRING(expected.c_str(), publishedPayload(1).c_str());
+}
+
+// The header announced one byte more than was sent, the broker would wait for it or read the next packet into it
+void test_short_qos0_payload_drops_the_connection() {
+  TEST_ASSERT_TRUE(mqtt->beginPublish(TOPIC, measureJson(doc) + 1));
+  serializeJson(doc, *mqtt);
+  TEST_ASSERT_FALSE(mqtt->endPublish());
+  TEST_ASSERT_FALSE(mqtt->connected());
+}
+
+void test_long_payload_is_not_sent() {
+  size_t length = measureJson(doc);
+  TEST_ASSERT_TRUE(mqtt->beginPublish(TOPIC, length - 1, 1));
+  TEST_ASSERT_TRUE(serializeJson(doc, *mqtt) < length);
+  TEST_ASSERT_FALSE(mqtt->endPublish());
+  TEST_ASSERT_EQUAL(0, mqtt->getInFlight());
+  TEST_ASSERT_EQUAL(0, socket->output.size());
+  TEST_ASSERT_TRUE(mqtt->connected());
+}
+
+void test_short_qos1_payload_is_not_sent() {
+  TEST_ASSERT_TRUE(mqtt->beginPublish(TOPIC, measureJson(doc) + 1, 1));
+  serializeJson(doc, *mqtt);
+  TEST_ASSERT_FALSE(mqtt->endPublish());
+  TEST_ASSERT_EQUAL(0, mqtt->getInFlight());
+  TEST_ASSERT_EQUAL(0, socket->output.size());
+  TEST_ASSERT_TRUE(mqtt->connected());
+}
+
+// The way publishJson() sends a document
+bool publishStreamed(uint8_t qos) {
+  if (!mqtt->beginPublish(TOPIC, measureJson(doc), qos)) return false;
+  serializeJson(doc, *mqtt);
+  return mqtt->endPublish();
+}
+
+// The way documents were sent before, serialised into a buffer on the stack first
+bool publishBuffered(uint8_t qos) {
+  char msg[256];
+  if (serializeJson(doc, msg, sizeof(msg)) == 0) return false;
+  return mqtt->publish(TOPIC, msg, qos);
+}
+
+struct PublishCall {
+  bool (*publish)(uint8_t qos);
+  uint8_t qos;
+  bool result;
+};
+
+void* runPublish(void* argument) {
+  PublishCall* call = (PublishCall*)argument;
+  call->result = call->publish(call->qos);
+  return nullptr;
+}
+
+// Runs the publish on a thread with a painted stack and returns how deep into it the run went. This includes
+// the thread's own bookkeeping, which is the same for every call.
+size_t stackDepth(PublishCall& call) {
+  void* stack;
+  TEST_ASSERT_EQUAL(0, posix_memalign(&stack, 64, PROBE_STACK_SIZE));
+  memset(stack, STACK_PAINT, PROBE_STACK_SIZE);
+  pthread_attr_t attributes;
+  pthread_attr_init(&attributes);
+  TEST_ASSERT_EQUAL(0, pthread_attr_setstack(&attributes, stack, PROBE_STACK_SIZE));
+  pthread_t thread;
+  TEST_ASSERT_EQUAL(0, pthread_create(&thread, &attributes, runPublish, &call));
+  pthread_join(thread, nullptr);
+  pthread_attr_destroy(&attributes);
+  size_t untouched = 0;
+  while (untouched < PROBE_STACK_SIZE && ((uint8_t*)stack)[untouched] == STACK_PAINT) untouched++;
+  free(stack);
+  return PROBE_STACK_SIZE - untouched;
+}
+
+void reportMemory(const char* name, bool (*publish)(uint8_t qos), uint8_t qos) {
+  socket->output.clear();
+  size_t allocations = nativeAllocations;
+  size_t allocatedBytes = nativeAllocatedBytes;
+  TEST_ASSERT_TRUE(publish(qos));
+  allocations = nativeAllocations - allocations;
+  allocatedBytes = nativeAllocatedBytes - allocatedBytes;
+
+  PublishCall call = { publish, qos, false };
+  size_t depth = stackDepth(call);
+  TEST_ASSERT_TRUE(call.result);
+
+  char message[120];
+  snprintf(message, sizeof(message), "%s QoS%u: %u allocations, %u bytes heap, %u bytes stack", name, qos,
+    (unsigned)allocations, (unsigned)allocatedBytes, (unsigned)depth);
+  TEST_MESSAGE(message);
+}
+
+// Heap allocations and stack depth of both paths, for comparing them with each other. Nothing is asserted,
+// the numbers depend on the compiler and the ArduinoJson build.
+void test_memory_of_publish_paths() {
+  if (!nativeHeapCounted) TEST_MESSAGE("Heap allocations aren't counted on this platform");
+  for (uint8_t qos = 0; qos <= 1; qos++) {
+    reportMemory("publishJson()", publishStreamed, qos);
+    reportMemory("serialise to buffer", publishBuffered, qos);
+  }
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_streamed_json_is_the_serialized_document);
+  RUN_TEST(test_qos1_streamed_json_stays_in_flight);
+  RUN_TEST(test_short_qos0_payload_drops_the_connection);
+  RUN_TEST(test_long_payload_is_not_sent);
+  RUN_TEST(test_short_qos1_payload_is_not_sent);
+  RUN_TEST(test_memory_of_publish_paths);
+  return UNITY_END();
+}
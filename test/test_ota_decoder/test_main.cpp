@@ -0,0 +1,258 @@
+#include <unity.h>
+#include <otaDecoder.h>
+#include <esp_ota_ops.h>
+#include <mbedtls/sha256.h>
+#include <zlib.h>
+#include <chrono>
+#include <vector>
+
+typedef std::vector<uint8_t> Bytes;
+
+// firmware images span many 32KB inflate windows
+const uint32_t FIRMWARE_SIZE = 300 * 1024;
+// chunk sizes written into the decoder, from single bytes to more than the inflate window
+const size_t CHUNK_SIZES[] = { 1, 7, 1000, 4096, 32 * 1024 + 1000, 1024 * 1024 };
+// chunk size and repetitions of the throughput measurement, 4KB is a typical OTA message
+const size_t BENCHMARK_CHUNK = 4096;
+const uint8_t BENCHMARK_RUNS = 10;
+
+Bytes source;
+Bytes target;
+Bytes written;
+
+boolean writeOutput(const uint8_t* data, size_t length) {
+  written.insert(written.end(), data, data + length);
+  return true;
+}
+
+// Compressible stand-in for a firmware image: runs of pseudo random words from a small vocabulary
+Bytes makeFirmware(uint32_t seed) {
+  Bytes image;
+  image.reserve(FIRMWARE_SIZE);
+  while (image.size() < FIRMWARE_SIZE) {
+    seed = seed * 1103515245 + 12345;
+    uint8_t word[8];
+    for (uint8_t i = 0; i < sizeof(word); i++) word[i] = "\x00\x01\x20\x40\xff\xa5\x37\x80"[(seed >> (i * 3 + 8)) & 7];
+    image.insert(image.end(), word, word + sizeof(word));
+  }
+  image.resize(FIRMWARE_SIZE);
+  return image;
+}
+
+void appendUint32(Bytes& bytes, uint32_t value) {
+  for (int8_t shift = 24; shift >= 0; shift -= 8) bytes.push_back(value >> shift);
+}
+
+// Delta operations in the format of ota_image.py, before compression
+class Delta {
+public:
+  Bytes ops;
+
+  explicit Delta(const Bytes& against) {
+    uint8_t hash[32];
+    sha256(against, hash);
+    ops.insert(ops.end(), OTA_DELTA_MAGIC, OTA_DELTA_MAGIC + 4);
+    ops.push_back(OTA_DELTA_VERSION);
+    appendUint32(ops, against.size());
+    ops.insert(ops.end(), hash, hash + sizeof(hash));
+  }
+  Delta& copy(uint32_t offset, uint32_t length) {
+    ops.push_back('C');
+    appendUint32(ops, offset);
+    appendUint32(ops, length);
+    return *this;
+  }
+  Delta& insert(const Bytes& literal) {
+    ops.push_back('I');
+    appendUint32(ops, literal.size());
+    ops.insert(ops.end(), literal.begin(), literal.end());
+    return *this;
+  }
+  Delta& end() {
+    ops.push_back('E');
+    return *this;
+  }
+
+  static void sha256(const Bytes& data, uint8_t hash[32]) {
+    mbedtls_sha256_context ctx;
+    mbedtls_sha256_init(&ctx);
+    mbedtls_sha256_starts_ret(&ctx, 0);
+    mbedtls_sha256_update_ret(&ctx, data.data(), data.size());
+    mbedtls_sha256_finish_ret(&ctx, hash);
+    mbedtls_sha256_free(&ctx);
+  }
+};
+
+// zlib format at level 9, like zlib.compress(data, 9) in ota_image.py
+Bytes deflate(const Bytes& data) {
+  uLongf length = compressBound(data.size());
+  Bytes compressed(length);
+  TEST_ASSERT_EQUAL(Z_OK, compress2(compressed.data(), &length, data.data(), data.size(), 9));
+  compressed.resize(length);
+  return compressed;
+}
+
+// The new firmware: the old one with a changed block, an inserted block and a removed block
+Delta targetDelta() {
+  Bytes changed(source.begin() + 1000, source.begin() + 1600);
+  for (uint8_t& b : changed) b ^= 0x5a;
+  Bytes added = makeFirmware(99);
+  added.resize(20000);
+  return Delta(source)
+    .copy(0, 1000)
+    .insert(changed)
+    .copy(1600, 100000)
+    .insert(added)
+    .copy(150000, FIRMWARE_SIZE - 150000)
+    .end();
+}
+
+// Writes stream in chunks of chunkSize and returns whether every write succeeded, end() is left to the caller
+bool decode(OtaDecoder& decoder, const Bytes& stream, size_t chunkSize) {
+  for (size_t offset = 0; offset < stream.size(); offset += chunkSize) {
+    if (!decoder.write(stream.data() + offset, min(chunkSize, stream.size() - offset))) return false;
+  }
+  return true;
+}
+
+// Whether the whole stream is accepted
+bool accepted(uint8_t encoding, const Bytes& stream, size_t chunkSize = 4096) {
+  OtaDecoder decoder(encoding, writeOutput);
+  TEST_ASSERT_TRUE(decoder.begin());
+  return decode(decoder, stream, chunkSize) && decoder.end();
+}
+
+void setUp() {
+  if (source.empty()) {
+    source = makeFirmware(1);
+    // applying targetDelta() by hand gives the new firmware
+    target.clear();
+    target.insert(target.end(), source.begin(), source.begin() + 1000);
+    for (size_t i = 1000; i < 1600; i++) target.push_back(source[i] ^ 0x5a);
+    target.insert(target.end(), source.begin() + 1600, source.begin() + 101600);
+    Bytes added = makeFirmware(99);
+    target.insert(target.end(), added.begin(), added.begin() + 20000);
+    target.insert(target.end(), source.begin() + 150000, source.end());
+  }
+  nativeRunningPartition = { (uint32_t)source.size(), source.data() };
+  written.clear();
+}
+
+void tearDown() {}
+
+void test_sha256_of_known_input() {
+  uint8_t hash[32];
+  Delta::sha256(Bytes{ 'a', 'b', 'c' }, hash);
+  const uint8_t expected[] = {
+    0xba, 0x78, 0x16, 0xbf, 0x8f, 0x01, 0xcf, 0xea, 0x41, 0x41, 0x40, 0xde, 0x5d, 0xae, 0x22, 0x23,
+    0xb0, 0x03, 0x61, 0xa3, 0x96, 0x17, 0x7a, 0x9c, 0xb4, 0x10, 0xff, 0x61, 0xf2, 0x00, 0x15, 0xad
+  };
+  TEST_ASSERT_EQUAL_MEMORY(expected, hash, sizeof(expected));
+}
+
+void test_deflate_stream_is_decoded_in_any_chunk_size() {
+  Bytes stream = deflate(target);
+  for (size_t chunkSize : CHUNK_SIZES) {
+    written.clear();
+    OtaDecoder decoder(OTA_ENCODING_DEFLATE, writeOutput);
+    TEST_ASSERT_TRUE(decoder.begin());
+    TEST_ASSERT_TRUE(decode(decoder, stream, chunkSize));
+    TEST_ASSERT_TRUE(decoder.end());
+    TEST_ASSERT_EQUAL(target.size(), decoder.getOutputSize());
+    TEST_ASSERT_TRUE(written == target);
+  }
+}
+
+void test_delta_stream_is_decoded_in_any_chunk_size() {
+  Bytes stream = deflate(targetDelta().ops);
+  for (size_t chunkSize : CHUNK_SIZES) {
+    written.clear();
+    OtaDecoder decoder(OTA_ENCODING_DELTA, writeOutput);
+    TEST_ASSERT_TRUE(decoder.begin());
+    TEST_ASSERT_TRUE(decode(decoder, stream, chunkSize));
+    TEST_ASSERT_TRUE(decoder.end());
+    TEST_ASSERT_EQUAL(target.size(), decoder.getOutputSize());
+    TEST_ASSERT_TRUE(written == target);
+  }
+}
+
+void test_truncated_streams_are_incomplete() {
+  Bytes stream = deflate(target);
+  stream.resize(stream.size() - 10);
+  TEST_ASSERT_FALSE(accepted(OTA_ENCODING_DEFLATE, stream));
+
+  // a complete deflate stream of a delta without the end operation
+  Delta delta(source);
+  delta.copy(0, 1000);
+  TEST_ASSERT_FALSE(accepted(OTA_ENCODING_DELTA, deflate(delta.ops)));
+}
+
+void test_trailing_data_is_rejected() {
+  Bytes stream = deflate(target);
+  stream.push_back(0x00);
+  TEST_ASSERT_FALSE(accepted(OTA_ENCODING_DEFLATE, stream, 1));
+  TEST_ASSERT_FALSE(accepted(OTA_ENCODING_DEFLATE, stream));
+
+  Bytes ops = targetDelta().ops;
+  ops.push_back('E');
+  TEST_ASSERT_FALSE(accepted(OTA_ENCODING_DELTA, deflate(ops)));
+}
+
+void test_unknown_operation_is_rejected() {
+  Delta delta(source);
+  delta.copy(0, 1000);
+  delta.ops.push_back('X');
+  delta.end();
+  TEST_ASSERT_FALSE(accepted(OTA_ENCODING_DELTA, deflate(delta.ops)));
+}
+
+void test_copy_past_the_source_is_rejected() {
+  TEST_ASSERT_FALSE(accepted(OTA_ENCODING_DELTA, deflate(Delta(source).copy(FIRMWARE_SIZE - 10, 11).end().ops)));
+  TEST_ASSERT_FALSE(accepted(OTA_ENCODING_DELTA, deflate(Delta(source).copy(FIRMWARE_SIZE + 1, 0).end().ops)));
+  // offset + length overflowing 32 bits
+  TEST_ASSERT_FALSE(accepted(OTA_ENCODING_DELTA, deflate(Delta(source).copy(16, 0xfffffff8).end().ops)));
+  TEST_ASSERT_TRUE(accepted(OTA_ENCODING_DELTA, deflate(Delta(source).copy(FIRMWARE_SIZE - 10, 10).end().ops)));
+}
+
+void test_delta_against_other_firmware_is_rejected() {
+  Bytes ops = targetDelta().ops;
+  ops[9] ^= 0x01;
+  TEST_ASSERT_FALSE(accepted(OTA_ENCODING_DELTA, deflate(ops)));
+  TEST_ASSERT_EQUAL(0, written.size());
+
+  // the running firmware is one byte shorter than the one the delta was made against
+  nativeRunningPartition.size--;
+  TEST_ASSERT_FALSE(accepted(OTA_ENCODING_DELTA, deflate(targetDelta().ops)));
+}
+
+void benchmark(const char* name, uint8_t encoding, const Bytes& stream) {
+  auto start = std::chrono::steady_clock::now();
+  for (uint8_t run = 0; run < BENCHMARK_RUNS; run++) {
+    written.clear();
+    TEST_ASSERT_TRUE(accepted(encoding, stream, BENCHMARK_CHUNK));
+  }
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  char message[80];
+  snprintf(message, sizeof(message), "%s: %.1f MB/s of firmware", name, target.size() * BENCHMARK_RUNS / seconds / 1e6);
+  TEST_MESSAGE(message);
+}
+
+// Decoding speed on the host, for comparing the encodings with each other. No assertion, timings vary by machine.
+void test_benchmark() {
+  benchmark("deflate", OTA_ENCODING_DEFLATE, deflate(target));
+  benchmark("delta", OTA_ENCODING_DELTA, deflate(targetDelta().ops));
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_sha256_of_known_input);
+  RUN_TEST(test_deflate_stream_is_decoded_in_any_chunk_size);
+  RUN_TEST(test_delta_stream_is_decoded_in_any_chunk_size);
+  RUN_TEST(test_truncated_streams_are_incomplete);
+  RUN_TEST(test_trailing_data_is_rejected);
+  RUN_TEST(test_unknown_operation_is_rejected);
+  RUN_TEST(test_copy_past_the_source_is_rejected);
+  RUN_TEST(test_delta_against_other_firmware_is_rejected);
+  RUN_TEST(test_benchmark);
+  return UNITY_END();
+}
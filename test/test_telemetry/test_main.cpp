@@ -0,0 +1,41 @@
+#include <unity.h>
+#include <telemetry.h>
+#include <config.h>
+
+ModelSnapshot reading(uint16_t co2) {
+  ModelSnapshot snapshot;
+  memset(&snapshot, 0, sizeof(snapshot));
+  for (const MeasurementDescriptor& measurement : measurementDescriptors) measurement.setValue(snapshot, NaN);
+  snapshot.co2 = co2;
+  return snapshot;
+}
+
+void setUp() {
+  Telemetry::invalidate();
+  nativeMillis = 1000;
+}
+
+void tearDown() {}
+
+void test_changes_within_the_deadband_are_suppressed() {
+  TEST_ASSERT_EQUAL(M_CO2, Telemetry::select(reading(800), M_CO2));
+  TEST_ASSERT_EQUAL(M_NONE, Telemetry::select(reading(805), M_CO2));
+  TEST_ASSERT_EQUAL(M_CO2, Telemetry::select(reading(820), M_CO2));
+  nativeMillis += TELEMETRY_HEARTBEAT;
+  TEST_ASSERT_EQUAL(M_CO2, Telemetry::select(reading(820), M_CO2));
+}
+
+void test_dropped_message_is_sent_again() {
+  TEST_ASSERT_EQUAL(M_CO2, Telemetry::select(reading(800), M_CO2));
+  // the message carrying 800 never reached the broker
+  Telemetry::invalidate();
+  TEST_ASSERT_EQUAL(M_CO2, Telemetry::select(reading(805), M_CO2));
+  TEST_ASSERT_EQUAL(M_NONE, Telemetry::select(reading(805), M_CO2));
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_changes_within_the_deadband_are_suppressed);
+  RUN_TEST(test_dropped_message_is_sent_again);
+  return UNITY_END();
+}